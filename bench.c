@@ -0,0 +1,190 @@
+/* Benchmark driver for the pickle interpreter, run with "make bench". Each
+ * benchmark is run a fixed number of times so results can be compared between
+ * versions, the fastest of several repeats is reported as JSON. */
+#define _POSIX_C_SOURCE 200809L
+#include "pickle.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define REPEATS (5)
+
+typedef struct { long allocs, frees, reallocs, total; } heap_t; /* as in 'main.c' */
+
+typedef struct {
+	const char *name;  /* name reported in output, and used to select it */
+	const char *setup; /* evaluated once, before timing */
+	const char *body;  /* evaluated 'runs' times per repeat, timed */
+	long runs, ops;    /* evaluations per repeat, and operations per evaluation */
+	int unique;        /* if true, every evaluation of 'body' is different text so no parse is cached */
+} bench_t;
+
+typedef struct {
+	double ns;         /* time for one repeat */
+	long commands;     /* commands executed in one repeat */
+	heap_t heap;       /* allocations made in one repeat */
+} result_t;
+
+static void *allocator(void *arena, void *ptr, const size_t oldsz, const size_t newsz) {
+	heap_t *h = arena;
+	if (newsz == 0) { if (ptr) h->frees++; free(ptr); return NULL; }
+	if (newsz > oldsz) { h->reallocs += !!ptr; h->allocs++; h->total += newsz; return realloc(ptr, newsz); }
+	return ptr;
+}
+
+static double now(void) { /* nanoseconds */
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts = { 0, 0 };
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+		return ((double)ts.tv_sec * 1e9) + (double)ts.tv_nsec;
+#endif
+	return ((double)clock() / (double)CLOCKS_PER_SEC) * 1e9;
+}
+
+static long commands(pickle_t *i) {
+	const char *r = NULL;
+	if (pickle_eval(i, "info cmdcount") != PICKLE_OK || pickle_result_get(i, &r) != PICKLE_OK)
+		return 0;
+	return atol(r);
+}
+
+static int failed(pickle_t *i, const char *name) {
+	const char *r = NULL;
+	(void)pickle_result_get(i, &r);
+	(void)fprintf(stderr, "benchmark %s failed: %s\n", name, r ? r : "?");
+	return -1;
+}
+
+static int runCreate(const bench_t *b, result_t *res) {
+	heap_t h = { 0, 0, 0, 0 };
+	const double start = now();
+	for (long j = 0; j < b->runs; j++) {
+		pickle_t *i = NULL;
+		if (pickle_new(&i, allocator, &h) != PICKLE_OK || pickle_delete(i) != PICKLE_OK)
+			return -1;
+	}
+	res->ns = now() - start;
+	res->commands = 0;
+	res->heap = h;
+	return 0;
+}
+
+static int runScript(const bench_t *b, result_t *res) {
+	heap_t h = { 0, 0, 0, 0 };
+	pickle_t *i = NULL;
+	char *text = NULL;
+	int r = -1;
+	const size_t length = strlen(b->body) + 64;
+	if (pickle_new(&i, allocator, &h) != PICKLE_OK)
+		return -1;
+	if (b->unique && !(text = malloc(length)))
+		goto done;
+	if (b->setup && pickle_eval(i, b->setup) != PICKLE_OK) {
+		r = failed(i, b->name);
+		goto done;
+	}
+	const long c = commands(i);
+	const heap_t before = h;
+	const double start = now();
+	for (long j = 0; j < b->runs; j++) {
+		const char *s = b->body;
+		if (text) {
+			(void)snprintf(text, length, "set nonce %ld\n%s", j, b->body);
+			s = text;
+		}
+		if (pickle_eval(i, s) != PICKLE_OK) {
+			r = failed(i, b->name);
+			goto done;
+		}
+	}
+	res->ns = now() - start;
+	res->heap.allocs   = h.allocs - before.allocs;
+	res->heap.frees    = h.frees - before.frees;
+	res->heap.reallocs = h.reallocs - before.reallocs;
+	res->heap.total    = h.total - before.total;
+	res->commands = commands(i) - c - 1; /* the 'info cmdcount' itself */
+	r = 0;
+done:
+	free(text);
+	if (pickle_delete(i) != PICKLE_OK)
+		r = -1;
+	return r;
+}
+
+static const bench_t benchmarks[] = {
+	{ .name = "parse", .runs = 2000, .ops = 1, .unique = 1,
+	  .body = "proc p {a b} {\n"
+	          "\tset x \"$a [+ $b 1] {braced text} \\x41\\n\"\n"
+	          "\tif {< $a $b} { set y [list $a $b \"$x\"] } else { set y {} }\n"
+	          "\twhile {== $a 0} { break }\n"
+	          "\treturn \"$x$y\"\n"
+	          "}\n"
+	          "set r [p 1 2]; set s {a {b {c d}} \"e f\" g}; set t [string length $s]; # comment\n" },
+	{ .name = "proc", .runs = 200, .ops = 1000,
+	  .setup = "proc f {a b} { return $a }",
+	  .body  = "for {set j 0} {< $j 1000} {incr j} { f $j 2 }" },
+	{ .name = "vars", .runs = 200, .ops = 1000,
+	  .body  = "for {set j 0} {< $j 1000} {incr j} { set x $j; set y $x }" },
+	{ .name = "lindex", .runs = 200, .ops = 500,
+	  .setup = "set l {}; for {set j 0} {< $j 500} {incr j} { lappend l item$j }",
+	  .body  = "for {set j 0} {< $j 500} {incr j} { lindex $l $j }" },
+	{ .name = "lsort", .runs = 200, .ops = 1,
+	  .setup = "set l {}; set x 1; for {set j 0} {< $j 500} {incr j} { set x [mod [+ [* $x 1103515245] 12345] 2147483648]; lappend l [mod $x 10000] }",
+	  .body  = "lsort -integer $l" },
+	{ .name = "lappend", .runs = 200, .ops = 1000,
+	  .body  = "set l {}; for {set j 0} {< $j 1000} {incr j} { lappend l $j }" },
+	{ .name = "string", .runs = 200, .ops = 500,
+	  .setup = "set s {The quick brown fox jumps over the lazy dog}",
+	  .body  = "for {set j 0} {< $j 500} {incr j} { string first lazy $s; string toupper $s; string match *fox* $s }" },
+	{ .name = "regex", .runs = 200, .ops = 500,
+	  .setup = "set s {The quick brown fox jumps over the lazy dog}",
+	  .body  = "for {set j 0} {< $j 500} {incr j} { reg {l[a-z]+y} $s }" },
+	{ .name = "create", .runs = 2000, .ops = 1, },
+};
+
+static int selected(const char *name, int argc, char **argv) {
+	if (argc <= 1)
+		return 1;
+	for (int j = 1; j < argc; j++)
+		if (!strcmp(name, argv[j]))
+			return 1;
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	const char *version = NULL;
+	heap_t h = { 0, 0, 0, 0 };
+	pickle_t *i = NULL;
+	if (pickle_new(&i, allocator, &h) != PICKLE_OK || pickle_eval(i, "join [info version] .") != PICKLE_OK)
+		return 1;
+	if (pickle_result_get(i, &version) != PICKLE_OK)
+		return 1;
+	if (printf("{\n\t\"version\": \"%s\",\n\t\"repeats\": %d,\n\t\"benchmarks\": [", version, REPEATS) < 0)
+		return 1;
+	if (pickle_delete(i) != PICKLE_OK)
+		return 1;
+	const char *sep = "";
+	for (size_t j = 0; j < (sizeof (benchmarks) / sizeof (benchmarks[0])); j++) {
+		const bench_t *b = &benchmarks[j];
+		if (!selected(b->name, argc, argv))
+			continue;
+		result_t best = { .ns = -1 };
+		for (int k = 0; k < REPEATS; k++) {
+			result_t res = { .ns = 0 };
+			if ((b->body ? runScript : runCreate)(b, &res) < 0)
+				return 1;
+			if (best.ns < 0 || res.ns < best.ns)
+				best = res;
+		}
+		const double ops = (double)b->runs * (double)b->ops;
+		const double ns = best.ns > 0 ? best.ns : 1;
+		if (printf("%s\n\t\t{ \"name\": \"%s\", \"ops\": %.0f, \"ns_per_op\": %.1f, \"commands\": %ld, \"commands_per_sec\": %.0f, "
+			"\"allocs\": %ld, \"frees\": %ld, \"reallocs\": %ld, \"bytes\": %ld, \"allocs_per_op\": %.2f }",
+			sep, b->name, ops, best.ns / ops, best.commands, (double)best.commands * 1e9 / ns,
+			best.heap.allocs, best.heap.frees, best.heap.reallocs, best.heap.total, (double)best.heap.allocs / ops) < 0)
+			return 1;
+		sep = ",";
+	}
+	return printf("\n\t]\n}\n") < 0;
+}
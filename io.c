@@ -0,0 +1,550 @@
+/**@file io.c
+ * @brief Buffered channels for pickle interpreters, see 'io.h'.
+ * BSD license: See <https://github.com/howerj/pickle/blob/master/LICENSE>
+ * Copyright (c) 2018-2020, Richard James Howe <howe.r.j.89@gmail.com>
+ *
+ * Each channel wraps a stdio 'FILE' with buffers of its own. Input is read
+ * in large blocks and split into lines with 'memchr', on Unix with 'read',
+ * so that a pipe or terminal gives back what it has instead of waiting for
+ * a whole block. Output is gathered and written when the buffer fills, at
+ * the end of each line, or straight away, as chosen with 'fconfigure'. As
+ * with stdio, reading flushes the channels that are buffered by line first,
+ * so a prompt written without a newline is seen before waiting for input.
+ * The commands are shared by clones of the interpreter, which may be run in
+ * other threads, so a single lock is held whilst any of them runs. */
+#ifndef USE_THREADS
+#define USE_THREADS (1) /* Guard the channels with a lock, needs POSIX threads */
+#endif
+
+#ifndef USE_READ
+#ifdef __unix__
+#define USE_READ (1) /* Fill buffers with 'read', which returns what is available, instead of 'fread' */
+#else
+#define USE_READ (0)
+#endif
+#endif
+
+#if USE_THREADS || USE_READ
+#define _POSIX_C_SOURCE 200809L
+#endif
+#include "io.h"
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if USE_THREADS
+#include <pthread.h>
+#endif
+#if USE_READ
+#include <unistd.h>
+#endif
+
+#ifndef IO_BUFFER
+#define IO_BUFFER (64 * 1024) /* size of the buffers of a channel, an input buffer grows to hold longer lines */
+#endif
+
+#define UNUSED(X) ((void)(X))
+#define ok(i, ...)    pickle_result_set(i, PICKLE_OK,    __VA_ARGS__)
+#define error(i, ...) pickle_result_set(i, PICKLE_ERROR, __VA_ARGS__)
+
+enum { IO_NONE, IO_LINE, IO_FULL, };
+static const char *buffering[] = { "none", "line", "full", };
+static const char *standard[]  = { "stdin", "stdout", "stderr", };
+#define IO_STANDARD ((sizeof (standard) / sizeof (standard[0])))
+
+typedef struct {
+	FILE *file;              /* NULL if this slot is free */
+	char *in, *out;          /* buffers, allocated when first needed */
+	size_t size;             /* size of 'in', which has one more byte for a NUL terminator */
+	size_t start, end;       /* input not yet read is from 'in[start]' up to 'in[end]' */
+	size_t used;             /* bytes in 'out' not yet written */
+	int buffering;           /* IO_NONE, IO_LINE or IO_FULL */
+	unsigned eof   :1;       /* the end of the file has been reached */
+	unsigned lines :1;       /* read a line at a time with 'fgets', as something else reads the 'FILE' too */
+} channel_t;
+
+typedef int (*io_command_t)(pickle_t *i, pickle_io_t *io, int argc, char **argv);
+
+typedef struct {
+	pickle_io_t *io;
+	io_command_t command;
+} io_entry_t; /* private data of each command */
+
+static int ioCommandOpen(pickle_t *i, pickle_io_t *io, int argc, char **argv);
+static int ioCommandClose(pickle_t *i, pickle_io_t *io, int argc, char **argv);
+static int ioCommandGets(pickle_t *i, pickle_io_t *io, int argc, char **argv);
+static int ioCommandRead(pickle_t *i, pickle_io_t *io, int argc, char **argv);
+static int ioCommandPuts(pickle_t *i, pickle_io_t *io, int argc, char **argv);
+static int ioCommandFlush(pickle_t *i, pickle_io_t *io, int argc, char **argv);
+static int ioCommandEof(pickle_t *i, pickle_io_t *io, int argc, char **argv);
+static int ioCommandConfigure(pickle_t *i, pickle_io_t *io, int argc, char **argv);
+
+static const struct { const char *name; io_command_t command; } commands[] = {
+	{ "open",       ioCommandOpen      },
+	{ "close",      ioCommandClose     },
+	{ "gets",       ioCommandGets      },
+	{ "read",       ioCommandRead      },
+	{ "puts",       ioCommandPuts      },
+	{ "flush",      ioCommandFlush     },
+	{ "eof",        ioCommandEof       },
+	{ "fconfigure", ioCommandConfigure },
+};
+#define IO_COMMANDS ((sizeof (commands) / sizeof (commands[0])))
+
+struct pickle_io {
+#if USE_THREADS
+	pthread_mutex_t lock;
+#endif
+	allocator_fn allocator;
+	void *arena;
+	channel_t *channels;     /* 'count' of them, starting with stdin, stdout and stderr */
+	size_t count;
+	io_entry_t entries[IO_COMMANDS];
+};
+
+static void *ioRealloc(pickle_io_t *io, void *ptr, size_t size) {
+	assert(io);
+	return io->allocator(io->arena, ptr, 0, size);
+}
+
+static void ioFree(pickle_io_t *io, void *ptr) {
+	assert(io);
+	(void)io->allocator(io->arena, ptr, 0, 0);
+}
+
+static void ioLock(pickle_io_t *io) {
+	assert(io);
+#if USE_THREADS
+	if (pthread_mutex_lock(&io->lock) != 0)
+		abort();
+#endif
+	UNUSED(io);
+}
+
+static void ioUnlock(pickle_io_t *io) {
+	assert(io);
+#if USE_THREADS
+	if (pthread_mutex_unlock(&io->lock) != 0)
+		abort();
+#endif
+	UNUSED(io);
+}
+
+static int ioCommand(pickle_t *i, int argc, char **argv, void *pd) {
+	io_entry_t *e = pd;
+	assert(e);
+	ioLock(e->io);
+	const int r = e->command(i, e->io, argc, argv);
+	ioUnlock(e->io);
+	return r;
+}
+
+static channel_t *ioChannel(pickle_io_t *io, const char *name) {
+	assert(io);
+	assert(name);
+	for (size_t j = 0; j < IO_STANDARD; j++)
+		if (!strcmp(name, standard[j]))
+			return &io->channels[j];
+	if (strncmp(name, "file", 4) || !name[4])
+		return NULL;
+	char *end = NULL;
+	const unsigned long n = strtoul(name + 4, &end, 10);
+	if (*end || n < IO_STANDARD || n >= io->count || !(io->channels[n].file))
+		return NULL;
+	return &io->channels[n];
+}
+
+static int ioFlush(channel_t *c) {
+	assert(c);
+	if (!(c->used))
+		return PICKLE_OK;
+	const size_t used = c->used;
+	c->used = 0;
+	if (fwrite(c->out, 1, used, c->file) != used)
+		return PICKLE_ERROR;
+	return fflush(c->file) ? PICKLE_ERROR : PICKLE_OK;
+}
+
+static int ioFlushAll(pickle_io_t *io, const int lines) { /* only those buffered by line if 'lines' */
+	assert(io);
+	int r = PICKLE_OK;
+	for (size_t j = 0; j < io->count; j++)
+		if (io->channels[j].file && (!lines || io->channels[j].buffering == IO_LINE))
+			if (ioFlush(&io->channels[j]) != PICKLE_OK)
+				r = PICKLE_ERROR;
+	return r;
+}
+
+static int ioWrite(pickle_io_t *io, channel_t *c, const char *s, const size_t length) {
+	assert(io);
+	assert(c);
+	assert(s);
+	if (c->buffering == IO_NONE || length > IO_BUFFER) {
+		if (ioFlush(c) != PICKLE_OK || fwrite(s, 1, length, c->file) != length)
+			return PICKLE_ERROR;
+		return c->buffering == IO_NONE && fflush(c->file) ? PICKLE_ERROR : PICKLE_OK;
+	}
+	if (!(c->out) && !(c->out = ioRealloc(io, NULL, IO_BUFFER)))
+		return PICKLE_ERROR;
+	if (c->used + length > IO_BUFFER && ioFlush(c) != PICKLE_OK)
+		return PICKLE_ERROR;
+	memcpy(c->out + c->used, s, length);
+	c->used += length;
+	return PICKLE_OK;
+}
+
+/* Read more input onto the end of what is already in the buffer, which is
+ * moved to the start of it first, growing it if it is full. */
+static int ioFill(pickle_io_t *io, channel_t *c) {
+	assert(io);
+	assert(c);
+	if (ioFlushAll(io, 1) != PICKLE_OK)
+		return PICKLE_ERROR;
+	if (c->start) {
+		memmove(c->in, c->in + c->start, c->end - c->start);
+		c->end -= c->start;
+		c->start = 0;
+	}
+	if (c->end == c->size) {
+		const size_t size = c->size ? c->size * 2 : IO_BUFFER;
+		char *in = ioRealloc(io, c->in, size + 1);
+		if (!in)
+			return PICKLE_ERROR;
+		c->in = in;
+		c->size = size;
+	}
+	const size_t room = c->size - c->end;
+	size_t n = 0;
+	if (c->lines) {
+		if (fgets(c->in + c->end, room + 1, c->file))
+			n = strlen(c->in + c->end);
+	} else {
+#if USE_READ
+		ssize_t r = 0;
+		do
+			r = read(fileno(c->file), c->in + c->end, room);
+		while (r < 0 && errno == EINTR);
+		if (r < 0)
+			return PICKLE_ERROR;
+		n = r;
+#else
+		n = fread(c->in + c->end, 1, room, c->file);
+#endif
+	}
+	if (!n) {
+		if (ferror(c->file))
+			return PICKLE_ERROR;
+		c->eof = 1;
+	}
+	c->end += n;
+	return PICKLE_OK;
+}
+
+/* Find the next line, returning PICKLE_BREAK at the end of the file. The
+ * line is left in the buffer, 'newline' is set if it ended with one. */
+static int ioLine(pickle_io_t *io, channel_t *c, char **line, size_t *length, int *newline) {
+	assert(io);
+	assert(c);
+	assert(line);
+	assert(length);
+	assert(newline);
+	for (size_t scanned = 0;;) { /* 'scanned' bytes from 'start' have no newline */
+		char *s = c->in + c->start, *nl = NULL;
+		const size_t have = c->end - c->start;
+		if (have > scanned && (nl = memchr(s + scanned, '\n', have - scanned))) {
+			*line = s;
+			*length = nl - s;
+			*newline = 1;
+			c->start += *length + 1;
+			return PICKLE_OK;
+		}
+		scanned = have;
+		if (c->eof) {
+			if (!have)
+				return PICKLE_BREAK;
+			*line = s;
+			*length = have;
+			*newline = 0;
+			c->start = c->end;
+			return PICKLE_OK;
+		}
+		if (ioFill(io, c) != PICKLE_OK)
+			return PICKLE_ERROR;
+	}
+}
+
+/* 's' is in a buffer with a byte to spare after 'length', it is briefly
+ * terminated so it can be given to the interpreter without copying it. */
+static int ioResult(pickle_t *i, const char *var, char *s, const size_t length) {
+	assert(i);
+	assert(s);
+	const char c = s[length];
+	s[length] = '\0';
+	const int r = var ? pickle_var_set(i, var, s) : ok(i, "%s", s);
+	s[length] = c;
+	return r;
+}
+
+static int ioCommandOpen(pickle_t *i, pickle_io_t *io, int argc, char **argv) {
+	static const char *modes[] = { "r", "w", "a", "r+", "w+", "a+", };
+	if (argc != 2 && argc != 3)
+		return error(i, "Invalid command %s", argv[0]);
+	const char *mode = argc == 3 ? argv[2] : "r";
+	size_t m = 0;
+	for (; m < (sizeof (modes) / sizeof (modes[0])); m++)
+		if (!strcmp(mode, modes[m]))
+			break;
+	if (m == (sizeof (modes) / sizeof (modes[0])))
+		return error(i, "Invalid option %s", mode);
+	size_t n = IO_STANDARD;
+	for (; n < io->count; n++)
+		if (!(io->channels[n].file))
+			break;
+	if (n == io->count) {
+		const size_t count = io->count * 2;
+		channel_t *channels = ioRealloc(io, io->channels, count * sizeof *channels);
+		if (!channels)
+			return error(i, "Out Of Memory");
+		memset(&channels[io->count], 0, (count - io->count) * sizeof *channels);
+		io->channels = channels;
+		io->count = count;
+	}
+	char fmode[4] = { 0 };
+	memcpy(fmode, modes[m], strlen(modes[m]));
+	fmode[strlen(fmode)] = 'b';
+	errno = 0;
+	FILE *file = fopen(argv[1], fmode);
+	if (!file)
+		return error(i, "Could not open file '%s': %s", argv[1], strerror(errno));
+	io->channels[n] = (channel_t) { .file = file, .buffering = IO_FULL, };
+	return ok(i, "file%lu", (unsigned long)n);
+}
+
+static int ioClose(pickle_io_t *io, channel_t *c) {
+	assert(io);
+	assert(c);
+	int r = ioFlush(c);
+	if (fclose(c->file))
+		r = PICKLE_ERROR;
+	ioFree(io, c->in);
+	ioFree(io, c->out);
+	memset(c, 0, sizeof *c);
+	return r;
+}
+
+static int ioCommandClose(pickle_t *i, pickle_io_t *io, int argc, char **argv) {
+	if (argc != 2)
+		return error(i, "Invalid command %s", argv[0]);
+	channel_t *c = ioChannel(io, argv[1]);
+	if (!c || c < &io->channels[IO_STANDARD]) /* the standard channels stay open */
+		return error(i, "Invalid channel %s", argv[1]);
+	if (ioClose(io, c) != PICKLE_OK)
+		return error(i, "Invalid close: %s", strerror(errno));
+	return PICKLE_OK;
+}
+
+/* 'gets' on its own reads a line from stdin, including its newline, and
+ * returns 'EOF' with a code of 'break' at the end of the file. Given a
+ * channel the newline is removed, and with a variable the line is put in it
+ * and its length returned, or -1 at the end of the file, as in TCL. */
+static int ioCommandGets(pickle_t *i, pickle_io_t *io, int argc, char **argv) {
+	if (argc > 3)
+		return error(i, "Invalid command %s", argv[0]);
+	channel_t *c = argc == 1 ? &io->channels[0] : ioChannel(io, argv[1]);
+	if (!c)
+		return error(i, "Invalid channel %s", argv[1]);
+	char *line = NULL;
+	size_t length = 0;
+	int newline = 0;
+	const int r = ioLine(io, c, &line, &length, &newline);
+	if (r == PICKLE_ERROR)
+		return error(i, "Invalid read: %s", strerror(errno));
+	if (argc == 1) {
+		if (r == PICKLE_BREAK)
+			return ok(i, "EOF") != PICKLE_OK ? PICKLE_ERROR : PICKLE_BREAK;
+		return ioResult(i, NULL, line, length + newline);
+	}
+	if (r == PICKLE_BREAK)
+		return argc == 3 ? (pickle_var_set(i, argv[2], "") != PICKLE_OK ? PICKLE_ERROR : ok(i, "-1")) : ok(i, "");
+	if (argc == 2)
+		return ioResult(i, NULL, line, length);
+	if (ioResult(i, argv[2], line, length) != PICKLE_OK)
+		return PICKLE_ERROR;
+	return ok(i, "%lu", (unsigned long)length);
+}
+
+/* 'read ?-nonewline? channel' reads everything left, 'read channel size'
+ * reads up to 'size' bytes. */
+static int ioCommandRead(pickle_t *i, pickle_io_t *io, int argc, char **argv) {
+	const int nonewline = argc > 1 && !strcmp(argv[1], "-nonewline");
+	if (argc != 2 + nonewline && (nonewline || argc != 3))
+		return error(i, "Invalid command %s", argv[0]);
+	channel_t *c = ioChannel(io, argv[1 + nonewline]);
+	if (!c)
+		return error(i, "Invalid channel %s", argv[1 + nonewline]);
+	size_t want = (size_t)-1;
+	if (argc == 3 && !nonewline) {
+		char *end = NULL;
+		errno = 0;
+		want = strtoul(argv[2], &end, 10);
+		if (!argv[2][0] || *end || errno)
+			return error(i, "Invalid number %s", argv[2]);
+	}
+	while (!(c->eof) && c->end - c->start < want)
+		if (ioFill(io, c) != PICKLE_OK)
+			return error(i, "Invalid read: %s", strerror(errno));
+	const size_t have = c->end - c->start;
+	size_t length = have < want ? have : want;
+	char *s = NULL;
+	if (c->in && !(c->start) && length == have) { /* all of the buffer, give it away */
+		s = c->in;
+		c->in = NULL;
+		c->size = 0;
+		c->end = 0;
+	} else {
+		if (!(s = ioRealloc(io, NULL, length + 1)))
+			return error(i, "Out Of Memory");
+		if (length)
+			memcpy(s, c->in + c->start, length);
+		c->start += length;
+	}
+	if (nonewline && length && s[length - 1] == '\n')
+		length--;
+	s[length] = '\0';
+	return pickle_result_set_owned(i, PICKLE_OK, s);
+}
+
+/* 'puts ?-nonewline? ?channel? string', or 'puts' for just a newline */
+static int ioCommandPuts(pickle_t *i, pickle_io_t *io, int argc, char **argv) {
+	if (argc > 4)
+		return error(i, "Invalid command %s", argv[0]);
+	const int nonewline = argc > 2 && !strcmp(argv[1], "-nonewline");
+	if (argc == 4 && !nonewline)
+		return error(i, "Invalid option %s", argv[1]);
+	const char *name = argc - nonewline == 3 ? argv[1 + nonewline] : "stdout";
+	const char *s = argc > 1 ? argv[argc - 1] : "";
+	channel_t *c = ioChannel(io, name);
+	if (!c)
+		return error(i, "Invalid channel %s", name);
+	const size_t length = strlen(s);
+	int r = ioWrite(io, c, s, length);
+	if (r == PICKLE_OK && !nonewline)
+		r = ioWrite(io, c, "\n", 1);
+	if (r == PICKLE_OK && c->buffering == IO_LINE && (!nonewline || memchr(s, '\n', length)))
+		r = ioFlush(c);
+	return r == PICKLE_OK ? PICKLE_OK : error(i, "Invalid write: %s", strerror(errno));
+}
+
+static int ioCommandFlush(pickle_t *i, pickle_io_t *io, int argc, char **argv) {
+	if (argc != 1 && argc != 2)
+		return error(i, "Invalid command %s", argv[0]);
+	channel_t *c = argc == 2 ? ioChannel(io, argv[1]) : NULL;
+	if (argc == 2 && !c)
+		return error(i, "Invalid channel %s", argv[1]);
+	const int r = c ? ioFlush(c) : ioFlushAll(io, 0);
+	return r == PICKLE_OK ? PICKLE_OK : error(i, "Invalid write: %s", strerror(errno));
+}
+
+static int ioCommandEof(pickle_t *i, pickle_io_t *io, int argc, char **argv) {
+	if (argc != 2)
+		return error(i, "Invalid command %s", argv[0]);
+	channel_t *c = ioChannel(io, argv[1]);
+	if (!c)
+		return error(i, "Invalid channel %s", argv[1]);
+	return ok(i, "%d", c->eof && c->start == c->end);
+}
+
+/* 'fconfigure channel' or 'fconfigure channel -buffering none|line|full' */
+static int ioCommandConfigure(pickle_t *i, pickle_io_t *io, int argc, char **argv) {
+	if (argc != 2 && argc != 4)
+		return error(i, "Invalid command %s", argv[0]);
+	channel_t *c = ioChannel(io, argv[1]);
+	if (!c)
+		return error(i, "Invalid channel %s", argv[1]);
+	if (argc == 2)
+		return ok(i, "-buffering %s", buffering[c->buffering]);
+	if (strcmp(argv[2], "-buffering"))
+		return error(i, "Invalid option %s", argv[2]);
+	for (int j = IO_NONE; j <= IO_FULL; j++)
+		if (!strcmp(argv[3], buffering[j])) {
+			c->buffering = j;
+			if (j != IO_FULL && ioFlush(c) != PICKLE_OK)
+				return error(i, "Invalid write: %s", strerror(errno));
+			return PICKLE_OK;
+		}
+	return error(i, "Invalid option %s", argv[3]);
+}
+
+int pickle_io_flush(pickle_io_t *io) {
+	if (!io)
+		return PICKLE_ERROR;
+	ioLock(io);
+	const int r = ioFlushAll(io, 0);
+	ioUnlock(io);
+	return r;
+}
+
+int pickle_io_delete(pickle_io_t *io) {
+	if (!io)
+		return PICKLE_OK;
+	int r = ioFlushAll(io, 0);
+	for (size_t j = 0; j < io->count; j++) {
+		channel_t *c = &io->channels[j];
+		if (j >= IO_STANDARD && c->file && ioClose(io, c) != PICKLE_OK)
+			r = PICKLE_ERROR;
+		ioFree(io, c->in);
+		ioFree(io, c->out);
+	}
+	ioFree(io, io->channels);
+#if USE_THREADS
+	(void)pthread_mutex_destroy(&io->lock);
+#endif
+	ioFree(io, io);
+	return r;
+}
+
+/* The commands are registered in 'i', and are copied to any clone made of
+ * it, so 'io' must outlive those interpreters. */
+int pickle_io_new(pickle_io_t **io, pickle_t *i, int shared) {
+	if (!io)
+		return PICKLE_ERROR;
+	*io = NULL;
+	allocator_fn allocator = NULL;
+	void *arena = NULL;
+	if (!i || pickle_allocator_get(i, &allocator, &arena) != PICKLE_OK)
+		return PICKLE_ERROR;
+	pickle_io_t *n = allocator(arena, NULL, 0, sizeof *n);
+	if (!n)
+		return PICKLE_ERROR;
+	memset(n, 0, sizeof *n);
+	n->allocator = allocator;
+	n->arena     = arena;
+#if USE_THREADS
+	if (pthread_mutex_init(&n->lock, NULL) != 0) {
+		ioFree(n, n);
+		return PICKLE_ERROR;
+	}
+#endif
+	if (!(n->channels = ioRealloc(n, NULL, 2 * IO_STANDARD * sizeof (*n->channels))))
+		goto fail;
+	n->count = 2 * IO_STANDARD;
+	memset(n->channels, 0, n->count * sizeof (*n->channels));
+	n->channels[0] = (channel_t) { .file = stdin,  .buffering = IO_FULL, .lines = !!shared, };
+	n->channels[1] = (channel_t) { .file = stdout, .buffering = IO_LINE, };
+	n->channels[2] = (channel_t) { .file = stderr, .buffering = IO_NONE, };
+#if USE_READ
+	if (!isatty(fileno(stdout))) /* the same as stdio does */
+		n->channels[1].buffering = IO_FULL;
+#endif
+	for (size_t j = 0; j < IO_COMMANDS; j++) {
+		n->entries[j] = (io_entry_t) { .io = n, .command = commands[j].command };
+		if (pickle_command_register(i, commands[j].name, ioCommand, &n->entries[j]) != PICKLE_OK)
+			goto fail;
+	}
+	*io = n;
+	return PICKLE_OK;
+fail:
+	(void)pickle_io_delete(n);
+	return PICKLE_ERROR;
+}
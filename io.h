@@ -0,0 +1,26 @@
+/**@file io.h
+ * @brief Buffered channels for a pickle interpreter, with the commands
+ * 'open', 'close', 'gets', 'read', 'puts', 'flush', 'eof' and 'fconfigure'.
+ * Optional, it is not part of the library.
+ * BSD license: See <https://github.com/howerj/pickle/blob/master/LICENSE>
+ * Copyright (c) 2018-2020, Richard James Howe <howe.r.j.89@gmail.com> */
+
+#ifndef IO_H
+#define IO_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "pickle.h"
+
+struct pickle_io;
+typedef struct pickle_io pickle_io_t;
+
+PICKLE_API int pickle_io_new(pickle_io_t **io, pickle_t *i, int shared); /* 'shared' if stdin is also read through stdio, a line at a time */
+PICKLE_API int pickle_io_flush(pickle_io_t *io);
+PICKLE_API int pickle_io_delete(pickle_io_t *io);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
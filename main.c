@@ -1,4 +1,28 @@
+#ifndef USE_POOL
+#define USE_POOL (1) /* Allow scripts to be run in parallel with "-j", needs POSIX threads */
+#endif
+
+#ifndef USE_MMAP
+#ifdef __unix__
+#define USE_MMAP (1) /* Map regular files into memory for 'source' rather than reading them */
+#else
+#define USE_MMAP (0)
+#endif
+#endif
+
+#if USE_POOL || USE_MMAP
+#define _POSIX_C_SOURCE 200809L
+#endif
+#if USE_POOL
+#include "pool.h"
+#include <pthread.h>
+#endif
+#if USE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 #include "pickle.h"
+#include "io.h"
 #include <errno.h>
 #include <stdarg.h>
 #include <stdio.h>
@@ -10,13 +34,34 @@
 #define ok(i, ...)    pickle_result_set(i, PICKLE_OK,    __VA_ARGS__)
 #define error(i, ...) pickle_result_set(i, PICKLE_ERROR, __VA_ARGS__)
 
-typedef struct { long allocs, frees, reallocs, total; } heap_t;
+typedef struct {
+	long allocs, frees, reallocs, total;
+#if USE_POOL
+	pthread_mutex_t *lock; /* set if interpreters using this run in different threads */
+#endif
+} heap_t;
+
+static void lock(heap_t *h) {
+#if USE_POOL
+	if (h->lock && pthread_mutex_lock(h->lock) != 0)
+		abort();
+#endif
+	UNUSED(h);
+}
+
+static void unlock(heap_t *h) {
+#if USE_POOL
+	if (h->lock && pthread_mutex_unlock(h->lock) != 0)
+		abort();
+#endif
+	UNUSED(h);
+}
 
 static void *allocator(void *arena, void *ptr, const size_t oldsz, const size_t newsz) {
 	/* assert(h && (h->frees <= h->allocs)); */
 	heap_t *h = arena;
-	if (newsz == 0) { if (ptr) h->frees++; free(ptr); return NULL; }
-	if (newsz > oldsz) { h->reallocs += !!ptr; h->allocs++; h->total += newsz; return realloc(ptr, newsz); }
+	if (newsz == 0) { lock(h); if (ptr) h->frees++; unlock(h); free(ptr); return NULL; }
+	if (newsz > oldsz) { lock(h); h->reallocs += !!ptr; h->allocs++; h->total += newsz; unlock(h); return realloc(ptr, newsz); }
 	return ptr;
 }
 
@@ -42,72 +87,6 @@ static void *reallocator(pickle_t *i, void *ptr, size_t sz) {
 	return r;
 }
 
-static char *slurp(pickle_t *i, FILE *input, size_t *length, char *class) {
-	char *m = NULL;
-	const size_t bsz = class ? 80 : 4096;
-	size_t sz = 0;
-	if (length)
-		*length = 0;
-	for (;;) {
-		if ((m = reallocator(i, m, sz + bsz + 1)) == NULL)
-			return NULL;
-		if (class) {
-			size_t j = 0;
-			int ch = 0, done = 0;
-			for (; ((ch = fgetc(input)) != EOF) && j < bsz; ) {
-				m[sz + j++] = ch;
-				if (strchr(class, ch)) {
-					done = 1;
-					break;
-				}
-			}
-			sz += j;
-			if (done || ch == EOF)
-				break;
-		} else {
-			size_t inc = fread(&m[sz], 1, bsz, input);
-			sz += inc;
-			if (inc != bsz)
-				break;
-		}
-	}
-	m[sz] = '\0'; /* ensure NUL termination */
-	if (length)
-		*length = sz;
-	return m;
-}
-
-static int commandGets(pickle_t *i, int argc, char **argv, void *pd) {
-	if (argc != 1)
-		return error(i, "Invalid command %s", argv[0]);
-	size_t length = 0;
-	char *line = slurp(i, (FILE*)pd, &length, "\n");
-	if (!line)
-		return error(i, "Out Of Memory");
-	if (!length) {
-		if (release(i, line) != PICKLE_OK)
-			return PICKLE_ERROR;
-		if (ok(i, "EOF") != PICKLE_OK)
-			return PICKLE_ERROR;
-		return PICKLE_BREAK;
-	}
-	const int r = ok(i, "%s", line);
-	return release(i, line) == PICKLE_OK ? r : PICKLE_ERROR;
-}
-
-static int commandPuts(pickle_t *i, int argc, char **argv, void *pd) {
-	FILE *out = pd;
-	if (argc != 1 && argc != 2 && argc != 3)
-		return error(i, "Invalid command %s", argv[0]);
-	if (argc == 1)
-		return fputc('\n', out) < 0 ? PICKLE_ERROR : PICKLE_OK;
-	if (argc == 2)
-		return fprintf(out, "%s\n", argv[1]) < 0 ? PICKLE_ERROR : PICKLE_OK;
-	if (!strcmp(argv[1], "-nonewline"))
-		return fputs(argv[2], out) < 0 ? PICKLE_ERROR : PICKLE_OK;
-	return error(i, "Invalid option %s", argv[1]);
-}
-
 static int commandGetEnv(pickle_t *i, int argc, char **argv, void *pd) {
 	UNUSED(pd);
 	if (argc != 2)
@@ -117,14 +96,19 @@ static int commandGetEnv(pickle_t *i, int argc, char **argv, void *pd) {
 }
 
 static int commandExit(pickle_t *i, int argc, char **argv, void *pd) {
-	UNUSED(pd);
 	if (argc != 2 && argc != 1)
 		return error(i, "Invalid command %s", argv[0]);
 	const char *code = argc == 2 ? argv[1] : "0";
+	(void)pickle_io_flush(pd);
 	exit(atoi(code));
 	return PICKLE_ERROR; /* unreachable */
 }
 
+static unsigned long profileClock(void *clockdata) { /* microseconds of processor time */
+	UNUSED(clockdata);
+	return ((double)(clock()) / (double)CLOCKS_PER_SEC) * 1000000.0;
+}
+
 static int commandClock(pickle_t *i, const int argc, char **argv, void *pd) {
 	UNUSED(pd);
 	time_t ts = 0;
@@ -153,6 +137,67 @@ static int commandClock(pickle_t *i, const int argc, char **argv, void *pd) {
 	return error(i, "Invalid command %s", argv[0]);
 }
 
+/* An image, made by "pickle -c", starts with a NUL which no script can,
+ * that has already been read from 'file'. */
+static int image(pickle_t *i, FILE *file) {
+	size_t length = 1, size = 4096;
+	char *m = reallocator(i, NULL, size);
+	if (!m)
+		return PICKLE_ERROR;
+	m[0] = 0;
+	for (;;) {
+		if (length == size) {
+			if (!(m = reallocator(i, m, size *= 2)))
+				return PICKLE_ERROR;
+		}
+		const size_t got = fread(m + length, 1, size - length, file);
+		length += got;
+		if (!got)
+			break;
+	}
+	const int r = ferror(file) ?
+		error(i, "Invalid read: %s", strerror(errno)) :
+		pickle_image_load(i, m, length);
+	(void)release(i, m);
+	return r;
+}
+
+/* Commands are evaluated as soon as they have been read, so a script does
+ * not need to fit in memory and starts running before it has been read. */
+static int feed(pickle_t *i, FILE *file) {
+	int r = PICKLE_OK;
+#if USE_MMAP
+	struct stat st;
+	if (fstat(fileno(file), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		const size_t length = st.st_size, chunk = 64 * 1024;
+		char *m = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+		if (m != MAP_FAILED) {
+			if (!m[0]) {
+				r = pickle_image_load(i, m, length);
+				(void)munmap(m, length);
+				return r;
+			}
+			(void)posix_madvise(m, length, POSIX_MADV_SEQUENTIAL);
+			for (size_t j = 0; r == PICKLE_OK && j < length; j += chunk)
+				r = pickle_eval_feed(i, m + j, length - j < chunk ? length - j : chunk);
+			(void)munmap(m, length);
+			return r == PICKLE_OK ? pickle_eval_feed(i, NULL, 0) : r;
+		}
+	}
+#endif
+	const int c = getc(file);
+	if (c == 0)
+		return image(i, file);
+	if (c != EOF)
+		(void)ungetc(c, file);
+	char line[4096];
+	while (r == PICKLE_OK && fgets(line, sizeof line, file))
+		r = pickle_eval_feed(i, line, strlen(line));
+	if (r == PICKLE_OK && ferror(file))
+		return error(i, "Invalid read: %s", strerror(errno));
+	return r == PICKLE_OK ? pickle_eval_feed(i, NULL, 0) : r;
+}
+
 static int commandSource(pickle_t *i, int argc, char **argv, void *pd) {
 	if (argc != 1 && argc != 2)
 		return error(i, "Invalid command %s", argv[0]);
@@ -160,27 +205,27 @@ static int commandSource(pickle_t *i, int argc, char **argv, void *pd) {
 	FILE *file = argc == 1 ? pd : fopen(argv[1], "rb");
 	if (!file)
 		return error(i, "Could not open file '%s' for reading: %s", argv[1], strerror(errno));
-	char *program = slurp(i, file, NULL, NULL);
+	const int r = feed(i, file);
 	if (file != pd)
 		fclose(file);
-	if (!program)
-		return error(i, "Out Of Memory");
-	const int r = pickle_eval(i, program);
-	return release(i, program) == PICKLE_OK ? r : PICKLE_ERROR;
+	return r;
 }
 
 static int commandHeap(pickle_t *i, int argc, char **argv, void *pd) {
 	heap_t *h = pd;
 	if (argc != 2)
 		return error(i, "Invalid command %s", argv[0]);
-	if (!strcmp(argv[1], "frees"))         return ok(i, "%ld", h->frees);
-	if (!strcmp(argv[1], "allocations"))   return ok(i, "%ld", h->allocs);
-	if (!strcmp(argv[1], "total"))         return ok(i, "%ld", h->total);
-	if (!strcmp(argv[1], "reallocations")) return ok(i, "%ld", h->reallocs);
+	lock(h);
+	const heap_t c = *h;
+	unlock(h);
+	if (!strcmp(argv[1], "frees"))         return ok(i, "%ld", c.frees);
+	if (!strcmp(argv[1], "allocations"))   return ok(i, "%ld", c.allocs);
+	if (!strcmp(argv[1], "total"))         return ok(i, "%ld", c.total);
+	if (!strcmp(argv[1], "reallocations")) return ok(i, "%ld", c.reallocs);
 	return error(i, "Invalid command %s", argv[0]);
 }
 
-static int evalFile(pickle_t *i, char *file) {
+static int evalFile(pickle_t *i, pickle_io_t *io, char *file) {
 	const int r = file ?
 		commandSource(i, 2, (char*[2]){ "source", file }, NULL):
 		commandSource(i, 1, (char*[1]){ "source",      }, stdin);
@@ -188,12 +233,42 @@ static int evalFile(pickle_t *i, char *file) {
 		const char *f = NULL;
 		if (pickle_result_get(i, &f) != PICKLE_OK)
 			return r;
+		(void)pickle_io_flush(io); /* keep the order of anything written with 'puts' */
 		if (fprintf(stdout, "%s\n", f) < 0)
 			return PICKLE_ERROR;
 	}
 	return r;
 }
 
+/* Evaluate 'in' and save what it leaves behind to 'out', the arguments are
+ * not saved as whatever loads the image has its own. */
+static int compile(pickle_t *i, pickle_io_t *io, char *in, const char *out) {
+	char *m = NULL;
+	size_t length = 0;
+	int r = evalFile(i, io, in);
+	if (r != PICKLE_OK)
+		return r;
+	if (pickle_eval_args(i, 2, (char*[2]){ "unset", "argv" }) != PICKLE_OK)
+		return PICKLE_ERROR;
+	if (pickle_image_save(i, &m, &length) != PICKLE_OK)
+		return PICKLE_ERROR;
+	errno = 0;
+	FILE *file = fopen(out, "wb");
+	if (!file) {
+		r = error(i, "Could not open file '%s' for writing: %s", out, strerror(errno));
+	} else {
+		if (fwrite(m, 1, length, file) != length)
+			r = error(i, "Invalid write: %s", strerror(errno));
+		if (fclose(file) != 0)
+			r = error(i, "Invalid write: %s", strerror(errno));
+	}
+	const char *f = NULL;
+	if (r != PICKLE_OK && pickle_result_get(i, &f) == PICKLE_OK)
+		(void)fprintf(stdout, "%s\n", f);
+	(void)release(i, m);
+	return r;
+}
+
 static int setArgv(pickle_t *i, int argc, char **argv) {
 	const char *r = NULL;
 	char **l = reallocator(i, NULL, (argc + 1) * sizeof (char*));
@@ -213,32 +288,109 @@ fail:
 	return PICKLE_ERROR;
 }
 
+#if USE_POOL
+static void parallelDone(void *data, int retcode, const char *result) { /* called from a worker thread */
+	int *r = data;
+	*r = retcode;
+	if (retcode != PICKLE_OK)
+		(void)fprintf(stdout, "%s\n", result);
+}
+
+/* Each file is sourced in a new clone of 'i', by up to 'jobs' threads at a
+ * time, so the files cannot affect each other and their output interleaves. */
+static int parallel(pickle_t *i, heap_t *h, int jobs, int files, char **file) {
+	pthread_mutex_t m;
+	pickle_pool_t *p = NULL;
+	int r = PICKLE_ERROR, made = 0;
+	if (pthread_mutex_init(&m, NULL) != 0)
+		return PICKLE_ERROR;
+	char **scripts = reallocator(i, NULL, (files + 1) * sizeof *scripts);
+	int *codes = reallocator(i, NULL, (files + 1) * sizeof *codes);
+	if (!scripts || !codes)
+		goto done;
+	for (; made < files; made++) {
+		const char *s = NULL;
+		if (pickle_eval_args(i, 3, (char*[3]){ "list", "source", file[made] }) != PICKLE_OK)
+			goto done;
+		if (pickle_result_get(i, &s) != PICKLE_OK)
+			goto done;
+		const size_t l = strlen(s) + 1;
+		if (!(scripts[made] = reallocator(i, NULL, l)))
+			goto done;
+		memcpy(scripts[made], s, l);
+		codes[made] = PICKLE_ERROR;
+	}
+	h->lock = &m; /* the interpreters share 'h' from here on */
+	if (pickle_pool_new(&p, i, jobs, 1) != PICKLE_OK)
+		goto done;
+	r = PICKLE_OK;
+	for (int j = 0; j < files; j++)
+		if (pickle_pool_submit(p, scripts[j], parallelDone, &codes[j]) != PICKLE_OK) {
+			r = PICKLE_ERROR;
+			break;
+		}
+	if (pickle_pool_wait(p) != PICKLE_OK)
+		r = PICKLE_ERROR;
+	for (int j = 0; j < files; j++)
+		if (codes[j] < 0)
+			r = PICKLE_ERROR;
+done:
+	if (pickle_pool_delete(p) != PICKLE_OK)
+		r = PICKLE_ERROR;
+	h->lock = NULL;
+	for (int j = 0; j < made; j++)
+		(void)release(i, scripts[j]);
+	(void)release(i, scripts);
+	(void)release(i, codes);
+	(void)pthread_mutex_destroy(&m);
+	return r;
+}
+#endif
+
 int main(int argc, char **argv) {
-	heap_t h = { 0, 0, 0, 0 };
+	heap_t h = { .allocs = 0 };
 	pickle_t *i = NULL;
+	pickle_io_t *io = NULL;
 	if (pickle_tests(allocator, &h)   != PICKLE_OK) goto fail;
 	if (pickle_new(&i, allocator, &h) != PICKLE_OK) goto fail;
 	if (setArgv(i, argc, argv)  != PICKLE_OK) goto fail;
-	if (pickle_command_register(i, "gets",   commandGets,   stdin)  != PICKLE_OK) goto fail;
-	if (pickle_command_register(i, "puts",   commandPuts,   stdout) != PICKLE_OK) goto fail;
+	if (pickle_io_new(&io, i, argc == 1) != PICKLE_OK) goto fail; /* the script is read from stdin a line at a time */
 	if (pickle_command_register(i, "getenv", commandGetEnv, NULL)   != PICKLE_OK) goto fail;
-	if (pickle_command_register(i, "exit",   commandExit,   NULL)   != PICKLE_OK) goto fail;
+	if (pickle_command_register(i, "exit",   commandExit,   io)     != PICKLE_OK) goto fail;
 	if (pickle_command_register(i, "source", commandSource, NULL)   != PICKLE_OK) goto fail;
 	if (pickle_command_register(i, "clock",  commandClock,  NULL)   != PICKLE_OK) goto fail;
 	if (pickle_command_register(i, "heap",   commandHeap,   &h)     != PICKLE_OK) goto fail;
+	(void)pickle_profile_set(i, profileClock, NULL, 0); /* fails if not built in, "info profile on" starts it */
 	int r = 0;
+#if USE_POOL
+	if (argc > 2 && !strcmp(argv[1], "-j")) { /* pickle -j jobs file... */
+		const int jobs = atoi(argv[2]);
+		if (jobs <= 0 || argc < 4)
+			goto fail;
+		r = parallel(i, &h, jobs, argc - 3, &argv[3]);
+		const int d = pickle_delete(i);
+		return !!(pickle_io_delete(io) | d) || r < 0;
+	}
+#endif
+	if (argc == 5 && !strcmp(argv[1], "-c") && !strcmp(argv[3], "-o")) { /* pickle -c script -o image */
+		r = compile(i, io, argv[2], argv[4]);
+		const int d = pickle_delete(i);
+		return !!(pickle_io_delete(io) | d) || r != PICKLE_OK;
+	}
 	for (int j = 1; j < argc; j++) {
-		r = evalFile(i, argv[j]);
+		r = evalFile(i, io, argv[j]);
 		if (r < 0)
 			goto fail;
 		if (r == PICKLE_BREAK)
 			break;
 	}
 	if (argc == 1)
-		r = evalFile(i, NULL);
-	return !!pickle_delete(i) || r < 0;
+		r = evalFile(i, io, NULL);
+	const int d = pickle_delete(i);
+	return !!(pickle_io_delete(io) | d) || r < 0;
 fail:
 	(void)pickle_delete(i);
+	(void)pickle_io_delete(io);
 	return 1;
 }
 
@@ -24,6 +24,7 @@
 #define member_size(TYPE, MEMBER) (sizeof(((TYPE *)0)->MEMBER)) /* apparently fine */
 #define MIN(X, Y)                 ((X) > (Y) ? (Y) : (X))
 #define MAX(X, Y)                 ((X) > (Y) ? (X) : (Y))
+#define BUILTIN_MAX               (128) /* Maximum number of built in commands, see 'builtins' */
 
 #ifndef PREPACK
 #define PREPACK
@@ -63,6 +64,26 @@
 #define DEFINE_HELP       (0)
 #endif
 
+#ifndef DEFINE_COMPILER
+#define DEFINE_COMPILER   (1)
+#endif
+
+#ifndef DEFINE_PROFILE
+#define DEFINE_PROFILE    (1)
+#endif
+
+#ifndef DEFINE_MEMORY
+#define DEFINE_MEMORY     (1) /* 'info memory', counting what is done with the allocator when it is turned on */
+#endif
+
+#ifndef DEFINE_NATIVE
+#define DEFINE_NATIVE     (1) /* 'foreach', 'switch', 'format' and 'append' are built in, rather than left to scripts */
+#endif
+
+#ifndef DEFINE_COROUTINE
+#define DEFINE_COROUTINE  (1) /* 'coroutine' and 'yield', host commands can suspend an evaluation either way */
+#endif
+
 #ifndef PICKLE_MAX_RECURSION
 #define PICKLE_MAX_RECURSION      (128) /* Recursion limit */
 #endif
@@ -79,10 +100,60 @@
 #define STRICT_NUMERIC_CONVERSION (1)
 #endif
 
+#ifndef PICKLE_CACHE_SIZE
+#define PICKLE_CACHE_SIZE (64) /* Number of entries in parsed script cache, 0 disables it */
+#endif
+
+#ifndef PICKLE_CACHE_STRING
+#define PICKLE_CACHE_STRING (4096) /* Scripts longer than this are compiled for a single use only */
+#endif
+
+#ifndef PICKLE_EXPR_CACHE
+#define PICKLE_EXPR_CACHE (32) /* Number of entries in compiled expression cache, 0 disables it */
+#endif
+
+#ifndef PICKLE_EXPR_STACK
+#define PICKLE_EXPR_STACK (32) /* Most operands evaluating an expression can need at once */
+#endif
+
+#ifndef PICKLE_REGEX_CACHE
+#define PICKLE_REGEX_CACHE (8) /* Number of compiled regular expressions kept for reuse, 0 disables it */
+#endif
+
+#ifndef PICKLE_FRAME_HASH
+#define PICKLE_FRAME_HASH (8) /* Initial number of slots in the variable hash of each call frame, must be a power of two */
+#endif
+
+#ifndef PICKLE_BUDGET_INTERVAL
+#define PICKLE_BUDGET_INTERVAL (1024) /* Default number of commands between reading the clock of a budget */
+#endif
+
+#ifndef PICKLE_VAR_POOL
+#define PICKLE_VAR_POOL (64) /* Number of freed variables, and of dropped call frames, kept for reuse, 0 disables it */
+#endif
+
+#ifndef PICKLE_SCRATCH_SIZE
+#define PICKLE_SCRATCH_SIZE (512) /* Size of each block of scratch memory used to build argument lists */
+#endif
+
+#ifndef PICKLE_MAX_INLINE
+#define PICKLE_MAX_INLINE (16) /* Maximum nesting of control structures compiled in line */
+#endif
+
+#ifndef PICKLE_ATOMIC
+#ifdef __GNUC__
+#define PICKLE_ATOMIC (1) /* Count references to procedure text shared by clones atomically, so clones can run in different threads */
+#else
+#define PICKLE_ATOMIC (0)
+#endif
+#endif
+
 #if DEFINE_HELP == 1
 #define ARITY(COMP, MSG) if ((COMP)) { return picolSetResultArgError(i, __LINE__, #COMP, (MSG), argc, argv); }
+#define ARITY_SLICE(COMP, MSG) if ((COMP)) { return picolSetResultSliceArgError(i, __LINE__, #COMP, (MSG), argc, argv); }
 #else
 #define ARITY(COMP, MSG) if ((COMP)) { return picolSetResultArgError(i, __LINE__, "", "", argc, argv); }
+#define ARITY_SLICE(COMP, MSG) if ((COMP)) { return picolSetResultSliceArgError(i, __LINE__, "", "", argc, argv); }
 #endif
 
 #ifndef PICKLE_VERSION
@@ -92,7 +163,8 @@
 #define ok(i, ...)    pickle_result_set(i, PICKLE_OK,    __VA_ARGS__)
 #define error(i, ...) pickle_result_set(i, PICKLE_ERROR, __VA_ARGS__)
 
-enum { PT_ESC, PT_STR, PT_CMD, PT_VAR, PT_SEP, PT_EOL, PT_EOF };
+enum { PT_ESC, PT_STR, PT_CMD, PT_VAR, PT_SEP, PT_EOL, PT_EOF, PT_ERROR };
+enum { OP_JUMP = PT_ERROR + 1, OP_JUMP_FALSE, OP_EMPTY, OP_GUARD, OP_LOOP, OP_UNLOOP, OP_MATH, OP_LIST, OP_APPEND, OP_EXPR, OP_DICT };
 
 typedef struct {
 	unsigned nocommands :1, /*< turn off commands */
@@ -110,6 +182,7 @@ typedef PREPACK struct {
 	int type;                  /**< token type, PT_... */
 	pickle_parser_opts_t o;    /**< parser options */
 	unsigned inside_quote: 1;  /**< true if inside " " */
+	unsigned escaped: 1;       /**< true if the last PT_ESC token has a backslash in it, so needs 'picolUnEscape' */
 } POSTPACK pickle_parser_t;        /**< Parsing structure */
 
 typedef PREPACK struct {
@@ -118,46 +191,233 @@ typedef PREPACK struct {
 	size_t length;                 /**< length of 'p' */
 } POSTPACK pickle_stack_or_heap_t;     /**< allocate on stack, or move to heap, depending on needs */
 
-enum { PV_STRING, PV_SMALL_STRING, PV_LINK };
+typedef long number_t;
+typedef unsigned long unumber_t;
+#define NUMBER_MIN (LONG_MIN)
+#define NUMBER_MAX (LONG_MAX)
+
+enum { PV_STRING, PV_SMALL_STRING, PV_LINK, PV_NUMBER, PV_LIST };
 
 typedef union {
 	char *ptr,  /**< pointer to string that has spilled over 'small' in size */
 	     small[sizeof(char*)]; /**< string small enough to be stored in a pointer (including NUL terminator)*/
 } compact_string_t; /**< either a pointer to a string, or a string stored in a pointer */
 
+typedef PREPACK struct {
+	size_t start, length;         /**< where an item is in the string form of a list */
+} POSTPACK pickle_span_t;
+
+PREPACK struct pickle_list {          /**< A list held in a variable, with the position of each of its items */
+	char *string;                 /**< string form of the list, always kept up to date */
+	pickle_span_t *items;         /**< items of the list, as they would be parsed from 'string' */
+	size_t length, size;          /**< length of 'string', and bytes allocated for it */
+	int *index;                   /**< keys as item numbers plus one in an open addressing table, zero if empty, see 'picolDictIndex' */
+	long refs;                    /**< held by the variable, and possibly the result */
+	int count, max;               /**< number of items, and room for them in 'items' */
+	int slots, indexed;           /**< size of 'index', a power of two once it is used as a dictionary, and items added to it */
+} POSTPACK;
+
+typedef PREPACK struct {             /**< In front of a string value with room to grow, see 'picolVarReserve' */
+	size_t length, size;          /**< length of the string that follows, and bytes allocated for it */
+} POSTPACK pickle_capacity_t;
+
+PREPACK struct pickle_atom {          /**< A name interned in an interpreter, see 'picolAtom' */
+	struct pickle_atom *next;     /**< next atom in the same bucket of 'atoms' */
+	unsigned long hash;           /**< hash of 'name', found once when it is interned */
+	long refs;                    /**< variables, instructions and procedures holding it */
+	char name[];                  /**< the name, NUL terminated */
+} POSTPACK;
+
 PREPACK struct pickle_var { /* strings are stored as either pointers, or as 'small' strings */
-	compact_string_t name; /**< name of variable */
+	struct pickle_atom *name; /**< name of variable, interned */
 	union {
 		compact_string_t val;    /**< value */
 		struct pickle_var *link; /**< link to another variable */
+		number_t number;         /**< value, as a number, string is produced on demand */
+		struct pickle_list *list; /**< value, as a list with its items found */
 	} data;
 	struct pickle_var *next; /**< next variable in list of variables */
 
-	unsigned type      : 2; /* type of data; string (pointer/small), or link (NB. Could add number type) */
-	unsigned smallname : 1; /* if true, name is stored as small string */
+	unsigned type      : 3; /* type of data; string (pointer/small), number, list, or link */
+	unsigned spare     : 1; /* if true, a PV_STRING value has room to grow and a 'pickle_capacity_t' before it */
 } POSTPACK;
 
 PREPACK struct pickle_command {
 	char *name;                  /**< name of function, it would be nice if this was a 'compact_string_t' */
-	pickle_func_t func;          /**< pointer to function that implements this command */
+	pickle_func_t func;          /**< pointer to function that implements this command, NULL if 'ex' is used */
+	pickle_func_ex_t ex;         /**< function that implements this command, given the length of each argument */
 	struct pickle_command *next; /**< next command in list (chained hash table) */
 	void *privdata;              /**< (optional) private data for function */
+#if DEFINE_PROFILE
+	pickle_profile_t profile;    /**< call count and time spent in this command, gathered only when profiling */
+#endif
+} POSTPACK;
+
+struct pickle_script;
+struct pickle_expr;
+
+typedef PREPACK struct {
+	char *text;                   /**< token text, already unescaped, NUL terminated, or command name for OP_GUARD */
+	struct pickle_script *child;  /**< pre-parsed command for PT_CMD, if NULL 'text' is parsed on use */
+	struct pickle_atom *atom;     /**< 'text' interned, for PT_VAR and the name operand of OP_APPEND */
+	struct pickle_expr *expr;     /**< expression of OP_EXPR, compiled when first used */
+	int length;                   /**< length of 'text', or where 'continue' goes for OP_LOOP */
+	int target;                   /**< where to jump to for OP_JUMP, OP_JUMP_FALSE, OP_GUARD, OP_MATH, OP_LIST, OP_APPEND, OP_EXPR, OP_DICT, and 'break' for OP_LOOP */
+	number_t number;              /**< literal operand of OP_MATH, already converted */
+	const struct pickle_command *command; /**< command looked up for PT_EOL, OP_GUARD, OP_MATH, OP_LIST, OP_APPEND, OP_EXPR and OP_DICT, valid if 'epoch' is current */
+	unsigned long epoch;          /**< value of the interpreters 'epoch' when 'command' was looked up */
+	unsigned op      :5,          /**< PT_STR, PT_ESC, PT_VAR, PT_CMD, PT_EOL, PT_ERROR or one of OP_... */
+		 newword :1,          /**< if true, token starts a new argument, else it is appended to the last one */
+		 cached  :1,          /**< if true, the command name for PT_EOL is a literal and 'command' can be used */
+		 inl     :8;          /**< built in command OP_GUARD, OP_MATH, OP_LIST, OP_APPEND, OP_EXPR and OP_DICT were compiled for */
+} POSTPACK pickle_op_t;               /**< An instruction in a compiled script */
+
+PREPACK struct pickle_script {        /**< A compiled script, instructions mostly mirror tokens in the original text */
+	pickle_op_t *ops;             /**< instructions, separators are removed */
+	char *source;                 /**< copy of the original script, key for the cache */
+	char *pool;                   /**< storage for token text */
+	unsigned long hash;           /**< hash of 'source' */
+	size_t length;                /**< length of 'source' */
+	long refs;                    /**< reference count, script is freed when this reaches zero */
+	int count;                    /**< number of instructions */
+} POSTPACK;
+
+typedef PREPACK struct {
+	union {
+		number_t number;      /**< literal, for EX_NUMBER */
+		struct pickle_atom *atom; /**< variable, for EX_VAR */
+		char *text;           /**< script, for EX_CMD */
+	} data;
+	int target;                   /**< where EX_AND, EX_OR, EX_JUMP and EX_JUMP_FALSE go */
+	unsigned char code;           /**< EX_... */
+	unsigned char op;             /**< operator for EX_UNARY (U...) and EX_BINARY (B...) */
+} POSTPACK pickle_expr_op_t;          /**< An instruction in a compiled expression, operating on a stack of numbers */
+
+PREPACK struct pickle_expr {          /**< An infix expression compiled for 'expr' */
+	pickle_expr_op_t *ops;        /**< instructions, in reverse Polish order */
+	char *source;                 /**< copy of the expression, key for the cache */
+	unsigned long hash;           /**< hash of 'source' */
+	size_t length;                /**< length of 'source' */
+	long refs;                    /**< reference count, freed when this reaches zero */
+	int count;                    /**< number of instructions */
 } POSTPACK;
 
+typedef PREPACK struct {
+	char *args;                   /**< argument list, stored after 'params' */
+	char *body;                   /**< procedure body, stored after 'args' */
+	char **params;                /**< names in 'args', stored after this structure, the names after 'body' */
+	long refs;                    /**< number of procedures sharing this, in this interpreter or its clones */
+	int count;                    /**< number of 'params' */
+	unsigned variadic :1;         /**< true if the last of 'params' is "args" */
+	unsigned unique   :1;         /**< true if no name appears twice in 'params' */
+} POSTPACK pickle_proc_text_t;        /**< read only source of a procedure, shared but never modified */
+
+typedef PREPACK struct {
+	pickle_proc_text_t *text;     /**< argument list and body */
+	struct pickle_script *script; /**< parsed body, NULL until procedure is first called, never shared between interpreters */
+	struct pickle_atom **params;  /**< 'params' of 'text' interned, NULL until procedure is first called */
+} POSTPACK pickle_proc_t;             /**< private data for a defined procedure */
+
 PREPACK struct pickle_call_frame {        /**< A call frame, organized as a linked list */
 	struct pickle_var *vars;          /**< first variable in linked list of variables */
 	struct pickle_call_frame *parent; /**< parent is NULL at top level */
+	struct pickle_var **index;        /**< open addressing hash table of 'vars', is 'small' until it grows */
+	struct pickle_var *small[PICKLE_FRAME_HASH]; /**< initial storage for 'index' */
+	int count, size;                  /**< number of 'vars', and number of slots in 'index', zero if 'vars' is searched instead */
+} POSTPACK;
+
+PREPACK struct pickle_block {         /**< A block of scratch memory, see 'picolScratch' */
+	struct pickle_block *next;    /**< block in use before this one, or next spare block */
+	size_t used;                  /**< bytes of 'data' in use */
+	void *data[PICKLE_SCRATCH_SIZE / sizeof (void*)]; /**< storage, declared as pointers so it is aligned for them */
+} POSTPACK;
+
+PREPACK struct pickle_large {         /**< A scratch allocation too large for a block, freed on release */
+	struct pickle_large *next;    /**< previous large allocation */
+	void *p;                      /**< allocation made with the interpreters allocator */
+} POSTPACK;
+
+typedef PREPACK struct {
+	void *p;                      /**< block allocated whilst memory is tracked, NULL if the slot is free */
+	size_t size;                  /**< bytes asked for */
+} POSTPACK pickle_size_t;             /**< slot in the table of block sizes, see 'picolMemoryNote' */
+
+typedef PREPACK struct {
+	pickle_memory_t counts;       /**< as returned by 'pickle_memory_get' */
+	pickle_size_t *sizes;         /**< hash table of blocks allocated while tracked, indexed by address */
+	long length, count;           /**< slots in 'sizes', and number of blocks in it */
+} POSTPACK pickle_tracker_t;          /**< memory tracking, see 'picolMemoryNote' */
+
+typedef PREPACK struct {
+	struct pickle_block *block;   /**< block in use when the mark was made */
+	struct pickle_large *large;   /**< last large allocation when the mark was made */
+	size_t used;                  /**< bytes of 'block' in use when the mark was made */
+} POSTPACK pickle_mark_t;             /**< position in scratch memory to release back to */
+
+PREPACK struct pickle_resume {        /**< A suspended evaluation of a compiled script, see 'picolSuspend' */
+	struct pickle_resume *next;       /**< evaluation that this one was called from, resumed after it */
+	struct pickle_script *script;     /**< script being evaluated, a reference to it is held */
+	struct pickle_call_frame *frame;  /**< call frame it was evaluated in */
+	pickle_slice_t *words;            /**< copies of the arguments of the command being built, if suspended in a substitution */
+	int pc;                           /**< instruction that suspended it, a PT_EOL or a PT_CMD */
+	int argc;                         /**< number of 'words' */
+	int level;                        /**< value of 'level' in the interpreter */
+	int code;                         /**< return code of the command or substitution at 'pc', once resumed */
+	int loops;                        /**< number of in lined loops it is in the body of */
+	int loop[PICKLE_MAX_INLINE];      /**< OP_LOOP instructions of those loops */
+	unsigned proc :1;                 /**< true if 'script' is the body of a procedure, returning drops 'frame' */
 } POSTPACK;
 
+typedef PREPACK struct {
+	struct pickle_resume *resume; /**< evaluations to resume, innermost first, NULL if it has finished */
+	unsigned running :1;          /**< true whilst it is being resumed */
+	unsigned deleted :1;          /**< true if its command was deleted whilst it was running */
+} POSTPACK pickle_coroutine_t;        /**< private data for a command made by 'coroutine' */
+
 PREPACK struct pickle_interpreter { /**< The Pickle Interpreter! */
 	char result_buf[SMALL_RESULT_BUF_SZ];/**< store small results here without allocating */
 	allocator_fn allocator;              /**< custom allocator, if desired */
 	void *arena;                         /**< arena for custom allocator, if needed */
 	const char *result;                  /**< result of an evaluation */
 	struct pickle_call_frame *callframe; /**< call stack */
-	struct pickle_command **table;       /**< hash table */
+	struct pickle_command **table;       /**< hash table of commands that are not built in, NULL until one is added */
+	struct pickle_atom **atoms;          /**< hash table of interned names, NULL until one is made */
+	struct pickle_script **cache;        /**< cache of parsed scripts, indexed by hash */
+	struct pickle_expr **exprs;          /**< cache of compiled expressions, indexed by hash */
+	struct pickle_regex **regexes;       /**< cache of compiled regular expressions, most recently used first */
+	struct pickle_block *scratch;        /**< scratch memory in use, most recent block first */
+	struct pickle_block *spare;          /**< scratch blocks released, kept for reuse */
+	struct pickle_large *large;          /**< scratch allocations too large for a block */
+	struct pickle_call_frame *frames;    /**< call frames dropped, kept for reuse, linked by 'parent' */
+	struct pickle_var *vars;             /**< variables freed, kept for reuse, linked by 'next' */
+	struct pickle_resume *yielded;       /**< evaluations suspended by a yield, innermost first, being built as they return */
+	struct pickle_resume *yield_last;    /**< outermost of 'yielded' so far */
+	struct pickle_resume *suspended;     /**< evaluations suspended under 'pickle_eval_start' */
+	char **callsite;                     /**< arguments of the command being called from where evaluation can be suspended */
+	long spare_vars, spare_frames;       /**< number of 'vars' and of 'frames', each at most PICKLE_VAR_POOL */
+	char *feed;                          /**< text given to 'pickle_eval_feed' not yet evaluated, NUL terminated */
+	size_t fed, feed_size;               /**< length of 'feed', and size of its allocation */
 	long length;                         /**< buckets in hash table */
+	long commands;                       /**< number of commands in hash table */
+	long atom_length, atom_count;        /**< buckets in 'atoms', and number of names in it */
+	unsigned long epoch;                 /**< incremented whenever a command is added or removed */
 	long cmdcount;                       /**< total number of commands invoked in this interpreter */
+	pickle_clock_t clock;                /**< clock used by the profiler, NULL if only calls are counted */
+	void *clockdata;                     /**< passed to 'clock' */
+	unsigned long child;                 /**< time spent in commands called by the command being profiled */
+	unsigned long child_allocations;     /**< allocations made by commands called by the command being profiled */
+	unsigned long made;                  /**< allocations made while memory is tracked, never cleared */
+	size_t child_bytes, made_bytes;      /**< bytes asked for by those in 'child_allocations' and 'made' */
+	pickle_tracker_t *tracker;           /**< counts kept while 'track' is set, allocated when it is first set */
+	pickle_budget_t budget;              /**< limits set with 'pickle_budget_set', only used if 'budgeted' is set */
+	long budget_end;                     /**< value of 'cmdcount' after which the command budget is spent */
+	unsigned long budget_start;          /**< value of the budget clock when the budget was set */
+	size_t allocated;                    /**< bytes allocated since the budget was set */
+	long ticks;                          /**< commands left before the budget clock is read again */
+	const char *spent;                   /**< which part of the budget has run out, NULL if none has */
+	unsigned char removed[BUILTIN_MAX / CHAR_BIT]; /**< bit set for each entry in 'builtins' renamed or deleted */
+	number_t number;                     /**< result as a number, only valid if 'number_result' is set */
+	struct pickle_list *list;            /**< list 'result' belongs to, only valid if 'list_result' is set */
 	int level, evals;                    /**< level of functional call and evaluation nesting */
 	unsigned initialized    :1;          /**< if true, interpreter is initialized and ready to use */
 	unsigned static_result  :1;          /**< internal use only: if true, result should not be freed */
@@ -166,12 +426,19 @@ PREPACK struct pickle_interpreter { /**< The Pickle Interpreter! */
 	unsigned fatal          :1;          /**< true if a fatal error has occurred */
 	unsigned inside_trace   :1;          /**< true if we are inside the trace function */
 	unsigned trace          :1;          /**< true if tracing is on */
+	unsigned profile        :1;          /**< true if profiling is on */
+	unsigned track          :1;          /**< true if memory is being tracked */
+	unsigned number_result  :1;          /**< true if result is held in 'number', formatted into 'result_buf' on use */
+	unsigned list_result    :1;          /**< true if result is the string of 'list', which it holds a reference to */
+	unsigned budgeted       :1;          /**< true if there is a budget to check, see 'picolBudgetCheck' */
+	unsigned started        :1;          /**< true from 'pickle_eval_start' until the evaluation it starts finishes */
+	pickle_profile_t *profiles;          /**< profile of each entry in 'builtins', allocated when profiling starts */
+	struct pickle_call_frame top;        /**< top level call frame, the bottom of the call stack */
 } POSTPACK;
 
 typedef PREPACK struct {
 	const char *start,  /**< start of match, NULL if no match */
 	      *end;         /**< end of match, NULL if no match */
-	int max;            /**< maximum recursion depth (0 = unlimited) */
 	unsigned type   :2, /**< select regex type; lazy, greedy or possessive */
 		 nocase :1; /**< ignore case when matching */
 } POSTPACK pickle_regex_t;  /**< used to specify a regex and return start/end of match */
@@ -179,20 +446,58 @@ typedef PREPACK struct {
 typedef struct PREPACK { int argc; char **argv; } POSTPACK args_t;
 
 typedef struct pickle_var pickle_var_t;
+typedef struct pickle_atom pickle_atom_t;
 typedef struct pickle_call_frame pickle_call_frame_t;
 typedef struct pickle_command pickle_command_t;
-
-typedef long number_t;
-typedef unsigned long unumber_t;
-#define NUMBER_MIN (LONG_MIN)
-#define NUMBER_MAX (LONG_MAX)
+typedef struct pickle_script pickle_script_t;
+typedef struct pickle_expr pickle_expr_t;
+typedef struct pickle_regex pickle_regex_program_t;
+typedef struct pickle_block pickle_block_t;
+typedef struct pickle_list pickle_list_t;
+typedef struct pickle_resume pickle_resume_t;
 
 static const char  string_empty[]     = "";              /* Space saving measure */
 static const char  string_oom[]       = "Out Of Memory"; /* Cannot allocate this, obviously */
 static const char *string_white_space = " \t\n\r\v";
 static const char *string_digits      = "0123456789abcdefghijklmnopqrstuvwxyz";
 
+enum { /* classes in 'string_class', NUL is in all that end a run so that scans stop at the end of a string */
+	SC_BRACE   = 1 << 0, /* ends a run of characters in a braced word */
+	SC_STRING  = 1 << 1, /* ends a run of characters in a word that is not braced */
+	SC_ESCAPE  = 1 << 2, /* means a list element needs quoting */
+	SC_COMMAND = 1 << 3, /* ends a run of characters in a command substitution */
+	SC_COMMENT = 1 << 4, /* ends a run of characters in a comment */
+	SC_SEP     = 1 << 5, /* makes up a run separating words */
+	SC_EOL     = 1 << 6, /* makes up a run ending a command */
+	SC_VAR     = 1 << 7, /* makes up a variable name that is not braced */
+	SC_UPPER   = 1 << 8, /* an upper case letter, changed by 'string tolower' */
+	SC_LOWER   = 1 << 9, /* a lower case letter, changed by 'string toupper' */
+};
+
+static const unsigned short string_class[256] = {
+	['\0'] = SC_BRACE | SC_STRING | SC_ESCAPE | SC_COMMAND | SC_COMMENT,
+	['\\'] = SC_BRACE | SC_STRING | SC_ESCAPE | SC_COMMAND | SC_COMMENT,
+	['{']  = SC_BRACE | SC_ESCAPE | SC_COMMAND, ['}']  = SC_BRACE | SC_ESCAPE | SC_COMMAND,
+	['$']  = SC_STRING | SC_ESCAPE, ['[']  = SC_STRING | SC_ESCAPE | SC_COMMAND, [']'] = SC_ESCAPE | SC_COMMAND,
+	[' ']  = SC_STRING | SC_ESCAPE | SC_SEP | SC_EOL, ['\t'] = SC_STRING | SC_ESCAPE | SC_SEP | SC_EOL,
+	['\n'] = SC_STRING | SC_ESCAPE | SC_EOL | SC_COMMENT, ['\r'] = SC_STRING | SC_ESCAPE | SC_EOL,
+	['\v'] = SC_ESCAPE, [';']  = SC_STRING | SC_EOL, ['"']  = SC_STRING,
+	['0'] = SC_VAR, ['1'] = SC_VAR, ['2'] = SC_VAR, ['3'] = SC_VAR, ['4'] = SC_VAR, ['5'] = SC_VAR,
+	['6'] = SC_VAR, ['7'] = SC_VAR, ['8'] = SC_VAR, ['9'] = SC_VAR, ['_'] = SC_VAR,
+	['A'] = SC_VAR | SC_UPPER, ['B'] = SC_VAR | SC_UPPER, ['C'] = SC_VAR | SC_UPPER, ['D'] = SC_VAR | SC_UPPER, ['E'] = SC_VAR | SC_UPPER, ['F'] = SC_VAR | SC_UPPER,
+	['G'] = SC_VAR | SC_UPPER, ['H'] = SC_VAR | SC_UPPER, ['I'] = SC_VAR | SC_UPPER, ['J'] = SC_VAR | SC_UPPER, ['K'] = SC_VAR | SC_UPPER, ['L'] = SC_VAR | SC_UPPER,
+	['M'] = SC_VAR | SC_UPPER, ['N'] = SC_VAR | SC_UPPER, ['O'] = SC_VAR | SC_UPPER, ['P'] = SC_VAR | SC_UPPER, ['Q'] = SC_VAR | SC_UPPER, ['R'] = SC_VAR | SC_UPPER,
+	['S'] = SC_VAR | SC_UPPER, ['T'] = SC_VAR | SC_UPPER, ['U'] = SC_VAR | SC_UPPER, ['V'] = SC_VAR | SC_UPPER, ['W'] = SC_VAR | SC_UPPER, ['X'] = SC_VAR | SC_UPPER,
+	['Y'] = SC_VAR | SC_UPPER, ['Z'] = SC_VAR | SC_UPPER,
+	['a'] = SC_VAR | SC_LOWER, ['b'] = SC_VAR | SC_LOWER, ['c'] = SC_VAR | SC_LOWER, ['d'] = SC_VAR | SC_LOWER, ['e'] = SC_VAR | SC_LOWER, ['f'] = SC_VAR | SC_LOWER,
+	['g'] = SC_VAR | SC_LOWER, ['h'] = SC_VAR | SC_LOWER, ['i'] = SC_VAR | SC_LOWER, ['j'] = SC_VAR | SC_LOWER, ['k'] = SC_VAR | SC_LOWER, ['l'] = SC_VAR | SC_LOWER,
+	['m'] = SC_VAR | SC_LOWER, ['n'] = SC_VAR | SC_LOWER, ['o'] = SC_VAR | SC_LOWER, ['p'] = SC_VAR | SC_LOWER, ['q'] = SC_VAR | SC_LOWER, ['r'] = SC_VAR | SC_LOWER,
+	['s'] = SC_VAR | SC_LOWER, ['t'] = SC_VAR | SC_LOWER, ['u'] = SC_VAR | SC_LOWER, ['v'] = SC_VAR | SC_LOWER, ['w'] = SC_VAR | SC_LOWER, ['x'] = SC_VAR | SC_LOWER,
+	['y'] = SC_VAR | SC_LOWER, ['z'] = SC_VAR | SC_LOWER,
+};
+
 static int picolForceResult(pickle_t *i, const char *result, const int is_static);
+static int picolNumberToString(char buf[/*static*/ 64/*base 2*/ + 1/*'+'/'-'*/ + 1/*NUL*/], number_t in, int base);
 static int picolSetResultString(pickle_t *i, const char *s);
 
 static inline void static_assertions(void) { /* A neat place to put these */
@@ -200,6 +505,9 @@ static inline void static_assertions(void) { /* A neat place to put these */
 	BUILD_BUG_ON(sizeof (struct pickle_interpreter) > PICKLE_MAX_STRING);
 	BUILD_BUG_ON(sizeof (string_oom) > SMALL_RESULT_BUF_SZ);
 	BUILD_BUG_ON(PICKLE_MAX_RECURSION < 8);
+	BUILD_BUG_ON(PICKLE_FRAME_HASH < 2 || (PICKLE_FRAME_HASH & (PICKLE_FRAME_HASH - 1)));
+	BUILD_BUG_ON(PICKLE_SCRATCH_SIZE < 64 || sizeof (struct pickle_block) > PICKLE_MAX_STRING);
+	BUILD_BUG_ON(BUILTIN_MAX % CHAR_BIT);
 	BUILD_BUG_ON(PICKLE_OK    !=  0);
 	BUILD_BUG_ON(PICKLE_ERROR != -1);
 }
@@ -214,17 +522,23 @@ static inline void pre(pickle_t *i) { /* assert API pre-conditions */
 	assert(i);
 	assert(i->initialized);
 	assert(i->result);
-	assert(i->length > 0);
+	mutual(i->table, i->length > 0);
 	assert(!!locateByte(i->result_buf, 0, sizeof i->result_buf));
 	assert(i->level >= 0);
 }
 
 static inline int post(pickle_t *i, const int r) { /* assert API post-conditions */
 	pre(i);
-	assert(r >= PICKLE_ERROR && r <= PICKLE_CONTINUE);
+	assert(r >= PICKLE_YIELD && r <= PICKLE_CONTINUE);
 	return i->fatal ? PICKLE_ERROR : r;
 }
 
+static inline int compareBytes(const void *a, const void *b, const size_t length) {
+	assert(a);
+	assert(b);
+	return memcmp(a, b, length);
+}
+
 static inline int compare(const char *a, const char *b) {
 	assert(a);
 	assert(b);
@@ -276,14 +590,178 @@ static inline char *locateChar(const char *s, const int c) {
 	return strchr(s, c);
 }
 
+/* Returns the number of characters at the start of 's' (up to 'length') that
+ * are not in any of the classes 'cls', which must include a NUL unless
+ * 'length' is known, a single table look up per character means hot loops
+ * can skip over ordinary text without examining each character in turn. */
+static inline size_t picolSpan(const char *s, const size_t length, const unsigned cls) {
+	assert(s);
+	size_t j = 0;
+	while (j < length && !(string_class[(unsigned char)s[j]] & cls))
+		j++;
+	return j;
+}
+
+static inline size_t picolRun(const char *s, const size_t length, const unsigned cls) { /* the opposite of 'picolSpan' */
+	assert(s);
+	size_t j = 0;
+	while (j < length && (string_class[(unsigned char)s[j]] & cls))
+		j++;
+	return j;
+}
+
+/* Running out of the memory in a budget is not fatal, unlike running out of
+ * memory, but everything allocated afterwards fails until a new budget is
+ * set, so an evaluation cannot catch the error and carry on. */
+static int picolBudgetBytes(pickle_t *i, const size_t size) {
+	assert(i);
+	assert(i->budgeted);
+	if (!(i->spent) && (!(i->budget.bytes) || (i->allocated += size) <= i->budget.bytes))
+		return PICKLE_OK;
+	i->spent = i->spent ? i->spent : "Invalid budget: memory";
+	(void)picolForceResult(i, i->spent, 1);
+	return PICKLE_ERROR;
+}
+
+#if DEFINE_MEMORY
+/* Sizes are kept in a table on the side, rather than in a header in front of
+ * each block, so that blocks still pass to and from the host as they are (see
+ * 'pickle_result_set_owned' and 'pickle_image_save') and so that nothing is
+ * spent when memory is not tracked. The table is open addressed, at most half
+ * full, and is allocated directly so that it does not count itself. Blocks
+ * allocated before tracking started are not in it, so freeing them does not
+ * change the live count. */
+static inline unsigned long picolMemoryHash(const void *p) {
+	return (unsigned long)((uintptr_t)p >> 4) * 2654435761ul;
+}
+
+static long picolMemoryFind(const pickle_tracker_t *t, const void *p) { /* slot holding 'p', or the empty one it would go in */
+	assert(t);
+	assert(p);
+	assert(t->count < t->length);
+	const unsigned long mask = t->length - 1;
+	unsigned long j = picolMemoryHash(p) & mask;
+	while (t->sizes[j].p && t->sizes[j].p != p)
+		j = (j + 1) & mask;
+	return j;
+}
+
+static int picolMemoryGrow(pickle_t *i, pickle_tracker_t *t) {
+	assert(i);
+	assert(t);
+	const long length = t->length ? t->length * 2 : 64, old = t->length;
+	pickle_size_t *sizes = t->sizes, *n = i->allocator(i->arena, NULL, 0, length * sizeof (*n));
+	if (!n)
+		return PICKLE_ERROR;
+	zero(n, length * sizeof (*n));
+	t->sizes  = n;
+	t->length = length;
+	for (long j = 0; j < old; j++)
+		if (sizes[j].p)
+			t->sizes[picolMemoryFind(t, sizes[j].p)] = sizes[j];
+	if (sizes)
+		(void)i->allocator(i->arena, sizes, 0, 0);
+	return PICKLE_OK;
+}
+
+static void picolMemoryForget(pickle_tracker_t *t, const void *p) {
+	assert(t);
+	assert(p);
+	if (!(t->count))
+		return;
+	const unsigned long mask = t->length - 1;
+	unsigned long j = picolMemoryFind(t, p);
+	if (!(t->sizes[j].p))
+		return;
+	t->counts.live -= t->sizes[j].size;
+	t->sizes[j].p = NULL;
+	t->count--;
+	for (unsigned long k = (j + 1) & mask; t->sizes[k].p; k = (k + 1) & mask) { /* close the gap, no tombstones */
+		const unsigned long h = picolMemoryHash(t->sizes[k].p) & mask;
+		if (((k - h) & mask) >= ((k - j) & mask)) {
+			t->sizes[j] = t->sizes[k];
+			t->sizes[k].p = NULL;
+			j = k;
+		}
+	}
+}
+
+/* 'p' has been freed or reallocated, 'r' is its replacement or a new block,
+ * NULL if 'p' was freed. */
+static void picolMemoryNote(pickle_t *i, const void *p, void *r, const size_t size) {
+	assert(i);
+	assert(i->track);
+	pickle_tracker_t *t = i->tracker;
+	pickle_memory_t *m = &t->counts;
+	if (p)
+		picolMemoryForget(t, p);
+	if (!r) {
+		m->frees++;
+		return;
+	}
+	*(p ? &m->reallocations : &m->allocations) += 1;
+	m->bytes += size;
+	i->made++;
+	i->made_bytes += size;
+	int k = 0;
+	while (k < PICKLE_MEMORY_CLASSES - 1 && size > ((size_t)16 << k))
+		k++;
+	m->classes[k]++;
+	if (t->count * 2 >= t->length && picolMemoryGrow(i, t) != PICKLE_OK)
+		return; /* not counted as live, as it cannot be taken away again */
+	pickle_size_t *slot = &t->sizes[picolMemoryFind(t, r)];
+	if (slot->p) /* handed to the host and freed there, the address has been reused */
+		m->live -= slot->size;
+	else
+		t->count++;
+	*slot = (pickle_size_t) { .p = r, .size = size };
+	m->live += size;
+	m->peak  = MAX(m->peak, m->live);
+}
+
+static void picolMemoryStop(pickle_t *i) { /* the counts are kept */
+	assert(i);
+	pickle_tracker_t *t = i->tracker;
+	i->track = 0;
+	if (!t)
+		return;
+	if (t->sizes)
+		(void)i->allocator(i->arena, t->sizes, 0, 0);
+	t->sizes  = NULL;
+	t->length = 0;
+	t->count  = 0;
+}
+
+static int picolMemoryStart(pickle_t *i) {
+	assert(i);
+	picolMemoryStop(i);
+	if (!(i->tracker)) { /* allocated directly, like 'profiles' */
+		if (i->fatal || !(i->tracker = i->allocator(i->arena, NULL, 0, sizeof (*i->tracker)))) {
+			i->fatal = 1;
+			(void)picolForceResult(i, string_oom, 1);
+			return PICKLE_ERROR;
+		}
+	}
+	zero(i->tracker, sizeof (*i->tracker));
+	i->track = 1;
+	return PICKLE_OK;
+}
+#endif
+
 static void *picolMalloc(pickle_t *i, size_t size) {
 	assert(i);
 	assert(size > 0); /* we should not allocate any zero length objects here */
+	if (i->budgeted && picolBudgetBytes(i, size) != PICKLE_OK)
+		return NULL;
 	if (i->fatal || (USE_MAX_STRING && size > PICKLE_MAX_STRING))
 		goto fail;
 	void *r = i->allocator(i->arena, NULL, 0, size);
 	if (!r && size)
 		goto fail;
+#if DEFINE_MEMORY
+	if (i->track)
+		picolMemoryNote(i, NULL, r, size);
+#endif
 	return r;
 fail:
 	i->fatal = 1;
@@ -293,11 +771,17 @@ fail:
 
 static void *picolRealloc(pickle_t *i, void *p, size_t size) {
 	assert(i);
+	if (i->budgeted && size && picolBudgetBytes(i, size) != PICKLE_OK)
+		return NULL;
 	if (i->fatal || (USE_MAX_STRING && size > PICKLE_MAX_STRING))
 		goto fail;
 	void *r = i->allocator(i->arena, p, 0, size);
 	if (!r && size)
 		goto fail;
+#if DEFINE_MEMORY
+	if (i->track && (p || r))
+		picolMemoryNote(i, p, r, size);
+#endif
 	return r;
 fail:
 	i->fatal = 1;
@@ -308,6 +792,10 @@ fail:
 static int picolFree(pickle_t *i, void *p) {
 	assert(i);
 	assert(i->allocator);
+#if DEFINE_MEMORY
+	if (i->track && p)
+		picolMemoryNote(i, p, NULL, 0);
+#endif
 	const void *r = i->allocator(i->arena, p, 0, 0);
 	assert(r == NULL); /* should just return it, but we do not check it throughout program */
 	if (r != NULL) {
@@ -320,6 +808,215 @@ static int picolFree(pickle_t *i, void *p) {
 	return PICKLE_OK;
 }
 
+/* Argument lists, and the tokens they are made from, are allocated from a
+ * stack of scratch blocks owned by the interpreter instead of one allocation
+ * per token. The evaluator marks the stack when it starts and releases back
+ * to the mark once each command has finished. Blocks do not move, so the
+ * arguments stay valid while a command runs even if it evaluates more code,
+ * and allocations too large for a block go to the allocator as before. */
+static inline size_t picolScratchRound(const size_t size) {
+	return (size + sizeof (void*) - 1) & ~(sizeof (void*) - 1);
+}
+
+static void *picolScratch(pickle_t *i, size_t size) {
+	assert(i);
+	assert(size > 0);
+	size = picolScratchRound(size);
+	pickle_block_t *b = i->scratch;
+	if (size > (sizeof b->data / 2)) {
+		struct pickle_large *l = picolScratch(i, sizeof *l);
+		if (!l || !(l->p = picolMalloc(i, size)))
+			return NULL;
+		l->next  = i->large;
+		i->large = l;
+		return l->p;
+	}
+	if (!b || (b->used + size) > sizeof b->data) {
+		if ((b = i->spare))
+			i->spare = b->next;
+		else if (!(b = picolMalloc(i, sizeof *b)))
+			return NULL;
+		b->next    = i->scratch;
+		b->used    = 0;
+		i->scratch = b;
+	}
+	void *r = (char*)b->data + b->used;
+	b->used += size;
+	return r;
+}
+
+static inline pickle_mark_t picolScratchMark(pickle_t *i) {
+	assert(i);
+	return (pickle_mark_t){ .block = i->scratch, .large = i->large, .used = i->scratch ? i->scratch->used : 0 };
+}
+
+static int picolScratchRelease(pickle_t *i, const pickle_mark_t *m) {
+	assert(i);
+	assert(m);
+	int r = PICKLE_OK;
+	while (i->large != m->large) {
+		struct pickle_large *l = i->large;
+		assert(l);
+		i->large = l->next;
+		if (picolFree(i, l->p) != PICKLE_OK)
+			r = PICKLE_ERROR;
+	}
+	while (i->scratch != m->block) {
+		pickle_block_t *b = i->scratch;
+		assert(b);
+		i->scratch = b->next;
+		b->next    = i->spare;
+		i->spare   = b;
+	}
+	if (i->scratch)
+		i->scratch->used = m->used;
+	return r;
+}
+
+static char *picolScratchAdopt(pickle_t *i, char *p) { /* 'p', from the allocator, is freed on release */
+	assert(i);
+	assert(p);
+	struct pickle_large *l = picolScratch(i, sizeof *l);
+	if (!l) {
+		(void)picolFree(i, p);
+		return NULL;
+	}
+	l->p     = p;
+	l->next  = i->large;
+	i->large = l;
+	return p;
+}
+
+/* If 'p' is a large scratch allocation it is no longer freed on release and
+ * is returned for the caller to keep, otherwise NULL is returned. */
+static char *picolScratchTake(pickle_t *i, const char *p) {
+	assert(i);
+	assert(p);
+	for (struct pickle_large *l = i->large; l; l = l->next)
+		if (l->p == p) {
+			l->p = NULL;
+			return (char*)p;
+		}
+	return NULL;
+}
+
+static char *picolScratchDup(pickle_t *i, const char *s, const size_t length) {
+	assert(i);
+	assert(s);
+	char *r = picolScratch(i, length + 1);
+	if (!r)
+		return NULL;
+	move(r, s, length);
+	r[length] = '\0';
+	return r;
+}
+
+/* Append 's' to the 'al' bytes at 'from', 'arg' is 'from' if that was
+ * allocated with 'picolScratch', or NULL if it must not be written to. */
+static char *picolScratchAppend(pickle_t *i, char *arg, const char *from, const size_t al, const char *s, const size_t sl) {
+	assert(i);
+	assert(from);
+	assert(s);
+	implies(arg, arg == from);
+	pickle_block_t *b = i->scratch;
+	const size_t osz = picolScratchRound(al + 1), nsz = picolScratchRound(al + sl + 1);
+	if (arg && b && arg + osz == (char*)b->data + b->used && (b->used - osz + nsz) <= sizeof b->data) {
+		b->used += nsz - osz; /* last thing allocated, grow it in place */
+	} else {
+		char *n = picolScratch(i, al + sl + 1);
+		if (!n)
+			return NULL;
+		move(n, from, al);
+		arg = n;
+	}
+	move(arg + al, s, sl);
+	arg[al + sl] = '\0';
+	return arg;
+}
+
+static char **picolScratchArgs(pickle_t *i, char **argv, const int argc, int *max) { /* make room for one more argument */
+	assert(i);
+	assert(max);
+	assert(argc <= *max);
+	if (argc < *max)
+		return argv;
+	const int n = MAX(*max * 2, 8);
+	char **r = picolScratch(i, n * sizeof *r);
+	if (!r)
+		return NULL;
+	if (argc)
+		move(r, argv, argc * sizeof *r);
+	*max = n;
+	return r;
+}
+
+static int picolScratchWords(pickle_t *i, char ***argv, pickle_slice_t **argl, const int argc, int *max) { /* room for one more word */
+	assert(i);
+	assert(argv);
+	assert(argl);
+	assert(max);
+	if (argc < *max)
+		return PICKLE_OK;
+	int m = *max;
+	char **v = picolScratchArgs(i, *argv, argc, &m);
+	pickle_slice_t *l = v ? picolScratch(i, m * sizeof *l) : NULL;
+	if (!l)
+		return PICKLE_ERROR;
+	if (argc)
+		move(l, *argl, argc * sizeof *l);
+	*argv = v;
+	*argl = l;
+	*max  = m;
+	return PICKLE_OK;
+}
+
+static int picolSliceOwn(pickle_t *i, const int argc, char **argv, pickle_slice_t *argl) { /* copy any word 'argv' does not have yet */
+	assert(i);
+	for (int j = 0; j < argc; j++)
+		if (!argv[j] && !(argv[j] = picolScratchDup(i, argl[j].ptr, argl[j].len)))
+			return PICKLE_ERROR;
+	return PICKLE_OK;
+}
+
+static char **picolSliceArgs(pickle_t *i, const int argc, pickle_slice_t *argv) { /* NUL terminated copies, in scratch memory */
+	assert(i);
+	assert(argc >= 0);
+	implies(argc > 0, argv);
+	char **r = picolScratch(i, (argc + 1) * sizeof *r);
+	if (!r)
+		return NULL;
+	for (int j = 0; j < argc; j++)
+		if (!(r[j] = picolScratchDup(i, argv[j].ptr, argv[j].len)))
+			return NULL;
+	r[argc] = NULL;
+	return r;
+}
+
+static pickle_slice_t *picolArgsSlice(pickle_t *i, const int argc, char **argv) { /* views of 'argv', in scratch memory */
+	assert(i);
+	assert(argc >= 0);
+	implies(argc > 0, argv);
+	pickle_slice_t *r = picolScratch(i, (argc + 1) * sizeof *r);
+	if (!r)
+		return NULL;
+	for (int j = 0; j < argc; j++)
+		r[j] = (pickle_slice_t){ .ptr = argv[j], .len = picolStrlen(argv[j]) };
+	return r;
+}
+
+static int picolScratchDeinitialize(pickle_t *i) {
+	assert(i);
+	const pickle_mark_t empty = { .block = NULL };
+	int r = picolScratchRelease(i, &empty);
+	for (pickle_block_t *b = i->spare, *n = NULL; b; b = n) {
+		n = b->next;
+		if (picolFree(i, b) != PICKLE_OK)
+			r = PICKLE_ERROR;
+	}
+	i->spare = NULL;
+	return r;
+}
+
 static inline int picolIsBaseValid(const int base) {
 	return base >= 2 && base <= 36; /* Base '0' is not a special case */
 }
@@ -471,54 +1168,78 @@ static char *picolStrdup(pickle_t *i, const char *s) {
 	return r ? move(r, s, l + 1) : r;
 }
 
-static inline unsigned long picolHashString(const char *s) { /* DJB2 Hash, <http://www.cse.yorku.ca/~oz/hash.html> */
+static inline unsigned long picolHashString(const char *s) { /* FNV-1a Hash, <http://www.isthe.com/chongo/tech/comp/fnv/> */
 	assert(s);
-	unsigned long h = 5381, ch = 0; /* NB. strictly speaking 'uint32_t' should be used here */
-	for (size_t i = 0; (ch = s[i]); i++) {
+	unsigned long h = 2166136261ul, ch = 0; /* 32-bit variant, so results are the same whatever the size of 'long' */
+	for (size_t i = 0; (ch = (unsigned char)s[i]); i++) {
 		implies(USE_MAX_STRING, i < PICKLE_MAX_STRING);
-		h = ((h << 5) + h) + ch;
+		h = ((h ^ ch) * 16777619ul) & 0xFFFFFFFFul;
 	}
 	return h;
 }
 
-static inline pickle_command_t *picolGetCommand(pickle_t *i, const char *s) {
-	assert(s);
+static long picolBuiltin(const pickle_t *i, const char *name);
+static inline const pickle_command_t *picolGetCommand(pickle_t *i, const char *s);
+static const pickle_command_t *picolNextCommand(pickle_t *i, long *j, const pickle_command_t *c);
+#if DEFINE_PROFILE
+static pickle_profile_t *picolProfileOf(pickle_t *i, const pickle_command_t *c);
+static int picolProfileStart(pickle_t *i);
+#endif
+
+static int picolListRelease(pickle_t *i, pickle_list_t *l) {
 	assert(i);
-	pickle_command_t *np = NULL;
-	for (np = i->table[picolHashString(s) % i->length]; np != NULL; np = np->next)
-		if (!compare(s, np->name))
-			return np; /* found */
-	return NULL; /* not found */
+	if (!l)
+		return PICKLE_OK;
+	assert(l->refs > 0);
+	if (--l->refs)
+		return PICKLE_OK;
+	const int r1 = picolFree(i, l->string);
+	const int r2 = picolFree(i, l->items);
+	const int r3 = picolFree(i, l->index);
+	const int r4 = picolFree(i, l);
+	return r1 == PICKLE_OK && r2 == PICKLE_OK && r3 == PICKLE_OK && r4 == PICKLE_OK ? PICKLE_OK : PICKLE_ERROR;
 }
 
 static int picolFreeResult(pickle_t *i) {
 	assert(i);
+	if (i->list_result) {
+		i->list_result = 0;
+		return picolListRelease(i, i->list);
+	}
 	return i->static_result ? PICKLE_OK : picolFree(i, (char*)i->result);
 }
 
-static int picolSetResultString(pickle_t *i, const char *s) {
+static int picolSetResultBuffer(pickle_t *i, const char *s, const size_t length) {
+	assert(i);
 	assert(s);
 	int is_static = 1;
 	char *r = i->result_buf;
-	const size_t sl = picolStrlen(s) + 1;
-	if (sizeof(i->result_buf) < sl) {
+	if (sizeof(i->result_buf) < (length + 1)) {
 		is_static = 0;
-		r = picolMalloc(i, sl);
+		r = picolMalloc(i, length + 1);
 		if (!r)
 			return PICKLE_ERROR;
 	}
-	move(r, s, sl);
+	move(r, s, length);
+	r[length] = '\0';
 	const int fr = picolFreeResult(i);
 	i->static_result = is_static;
+	i->number_result = 0;
 	i->result = r;
 	return fr;
 }
 
+static int picolSetResultString(pickle_t *i, const char *s) {
+	assert(s);
+	return picolSetResultBuffer(i, s, picolStrlen(s));
+}
+
 static int picolForceResult(pickle_t *i, const char *result, const int is_static) {
 	assert(i);
 	assert(result);
 	int r = picolFreeResult(i);
 	i->static_result = is_static;
+	i->number_result = 0;
 	i->result = result;
 	return r;
 }
@@ -528,38 +1249,83 @@ static int picolSetResultEmpty(pickle_t *i) {
 	return picolForceResult(i, string_empty, 1);
 }
 
+/* Hands over the result to the caller if it was allocated, otherwise NULL
+ * is returned and the result is left alone. The result becomes empty. */
+static char *picolResultTake(pickle_t *i) {
+	assert(i);
+	if (i->static_result || i->list_result)
+		return NULL;
+	char *r = (char*)i->result;
+	i->static_result = 1;
+	i->result = string_empty;
+	return r;
+}
+
 static int picolSetResultArgError(pickle_t *i, const unsigned line, const char *comp, const char *help, const int argc, char **argv);
+static int picolSetResultSliceArgError(pickle_t *i, const unsigned line, const char *comp, const char *help, const int argc, pickle_slice_t *argv);
 static int picolCommandCallProc(pickle_t *i, const int argc, char **argv, void *pd);
 
+static int picolProcFree(pickle_t *i, pickle_proc_t *proc);
+static int picolProcParamsFree(pickle_t *i, pickle_proc_t *proc);
+
 static int picolIsDefinedProc(pickle_func_t func) {
 	return func == picolCommandCallProc;
 }
 
 /* <https://stackoverflow.com/questions/4384359/> */
-static int picolRegisterCommand(pickle_t *i, const char *name, pickle_func_t func, void *privdata) {
+static int picolCommandTableGrow(pickle_t *i) { /* keep the load factor of the command table at or below one */
 	assert(i);
-	assert(name);
-	assert(func);
-	pickle_command_t *np = picolGetCommand(i, name);
-	if (np) {
-		if (picolIsDefinedProc(func)) {
-			char **procdata = privdata;
-			(void)picolFree(i, procdata[0]);
-			(void)picolFree(i, procdata[1]);
-			(void)picolFree(i, procdata);
+	const long length = i->length ? i->length * 2 : 8;
+	const size_t bytes = length * sizeof (*i->table);
+	if (i->table && (i->commands < i->length || (USE_MAX_STRING && bytes > PICKLE_MAX_STRING)))
+		return PICKLE_OK;
+	pickle_command_t **n = picolMalloc(i, bytes);
+	if (!n)
+		return PICKLE_ERROR;
+	zero(n, bytes);
+	for (long j = 0; j < i->length; j++)
+		for (pickle_command_t *c = i->table[j], *next = NULL; c; c = next) {
+			const unsigned long hashval = picolHashString(c->name) % length;
+			next = c->next;
+			c->next = n[hashval];
+			n[hashval] = c;
 		}
-		return error(i, "Invalid operation %s", name);
-	}
-	np = picolMalloc(i, sizeof(*np));
+	const int r = picolFree(i, i->table);
+	i->table  = n;
+	i->length = length;
+	return r;
+}
+
+static int picolRegisterCommand(pickle_t *i, const char *name, pickle_func_t func, pickle_func_ex_t ex, void *privdata) {
+	assert(i);
+	assert(name);
+	assert(!func != !ex);
+	if (picolGetCommand(i, name)) {
+		if (picolIsDefinedProc(func))
+			(void)picolProcFree(i, privdata);
+		return error(i, "Invalid operation %s", name);
+	}
+	pickle_command_t *np = picolMalloc(i, sizeof(*np));
 	if (np == NULL || (np->name = picolStrdup(i, name)) == NULL) {
 		(void)picolFree(i, np);
 		return PICKLE_ERROR;
 	}
+	if (picolCommandTableGrow(i) != PICKLE_OK) {
+		(void)picolFree(i, np->name);
+		(void)picolFree(i, np);
+		return PICKLE_ERROR;
+	}
 	const unsigned long hashval = picolHashString(name) % i->length;
 	np->next = i->table[hashval];
 	i->table[hashval] = np;
 	np->func = func;
+	np->ex = ex;
 	np->privdata = privdata;
+#if DEFINE_PROFILE
+	zero(&np->profile, sizeof (np->profile));
+#endif
+	i->commands++;
+	i->epoch++;
 	return PICKLE_OK;
 }
 
@@ -568,11 +1334,21 @@ static int picolFreeCmd(pickle_t *i, pickle_command_t *p);
 static int picolUnsetCommand(pickle_t *i, const char *name) {
 	assert(i);
 	assert(name);
+	const long b = picolBuiltin(i, name);
+	if (b >= 0) { /* built ins are read only, they are marked as removed instead */
+		i->removed[b / CHAR_BIT] |= 1u << (b % CHAR_BIT);
+		i->epoch++;
+		return PICKLE_OK;
+	}
+	if (!i->table)
+		return error(i, "Invalid variable %s", name);
 	pickle_command_t **p = &i->table[picolHashString(name) % i->length];
 	pickle_command_t *c = *p;
 	for (; c; c = c->next) {
 		if (!compare(c->name, name)) {
 			*p = c->next;
+			i->commands--;
+			i->epoch++;
 			return picolFreeCmd(i, c);
 		}
 		p = &c->next;
@@ -605,16 +1381,21 @@ static inline void picolParserInitialize(pickle_parser_t *p, pickle_parser_opts_
 	p->o    = o ? *o : p->o;
 }
 
-static inline int picolIsSpaceChar(const int ch) {
-	return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r';
+/* Moves over 'run' characters at once, failing as 'advance' would if that
+ * leaves it on a NUL before the end of the text. */
+static inline int picolSkip(pickle_parser_t *p, const size_t run) {
+	assert(p);
+	assert(run <= (size_t)p->len);
+	p->p   += run;
+	p->len -= run;
+	return run && p->len && !(*p->p) ? PICKLE_ERROR : PICKLE_OK;
 }
 
 static inline int picolParseSep(pickle_parser_t *p) {
 	assert(p);
 	p->start = p->p;
-	while (*p->p == ' ' || *p->p == '\t')
-		if (advance(p) != PICKLE_OK)
-			return PICKLE_ERROR;
+	if (picolSkip(p, picolRun(p->p, p->len, SC_SEP)) != PICKLE_OK)
+		return PICKLE_ERROR;
 	p->end  = p->p - 1;
 	p->type = PT_SEP;
 	return PICKLE_OK;
@@ -623,9 +1404,8 @@ static inline int picolParseSep(pickle_parser_t *p) {
 static inline int picolParseEol(pickle_parser_t *p) {
 	assert(p);
 	p->start = p->p;
-	while (picolIsSpaceChar(*p->p) || *p->p == ';')
-		if (advance(p) != PICKLE_OK)
-			return PICKLE_ERROR;
+	if (picolSkip(p, picolRun(p->p, p->len, SC_EOL)) != PICKLE_OK)
+		return PICKLE_ERROR;
 	p->end  = p->p - 1;
 	p->type = PT_EOL;
 	return PICKLE_OK;
@@ -636,7 +1416,11 @@ static inline int picolParseCommand(pickle_parser_t *p) {
 	if (advance(p) != PICKLE_OK)
 		return PICKLE_ERROR;
 	p->start = p->p;
-	for (int level = 1, blevel = 0; p->len;) {
+	for (int level = 1, blevel = 0;;) {
+		if (picolSkip(p, picolSpan(p->p, p->len, SC_COMMAND)) != PICKLE_OK)
+			return PICKLE_ERROR;
+		if (!(p->len))
+			break;
 		if (*p->p == '[' && blevel == 0) {
 			level++;
 		} else if (*p->p == ']' && blevel == 0) {
@@ -663,10 +1447,6 @@ static inline int picolParseCommand(pickle_parser_t *p) {
 	return PICKLE_OK;
 }
 
-static inline int picolIsVarChar(const int ch) {
-	return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9') || ch == '_';
-}
-
 static inline int picolParseVar(pickle_parser_t *p) {
 	assert(p);
 	int br = 0;
@@ -678,9 +1458,8 @@ static inline int picolParseVar(pickle_parser_t *p) {
 		br = 1;
 	}
 	p->start = p->p;
-	for (;picolIsVarChar(*p->p);)
-	       	if (advance(p) != PICKLE_OK)
-			return PICKLE_ERROR;
+	if (picolSkip(p, picolRun(p->p, p->len, SC_VAR)) != PICKLE_OK)
+		return PICKLE_ERROR;
 	p->end = p->p - 1;
 	if (br) {
 		if (*p->p != '}')
@@ -703,6 +1482,9 @@ static inline int picolParseBrace(pickle_parser_t *p) {
 		return PICKLE_ERROR;
 	p->start = p->p;
 	for (int level = 1;;) {
+		const size_t run = picolSpan(p->p, p->len, SC_BRACE);
+		p->p   += run;
+		p->len -= run;
 		if (p->len >= 2 && *p->p == '\\') {
 			if (advance(p) != PICKLE_OK)
 				return PICKLE_ERROR;
@@ -736,12 +1518,19 @@ static int picolParseString(pickle_parser_t *p) {
 		if (advance(p) != PICKLE_OK)
 			return PICKLE_ERROR;
 	}
-	p->start = p->p;
+	p->start   = p->p;
+	p->escaped = 0;
 	for (;p->len;) {
+		const size_t run = picolSpan(p->p, p->len, SC_STRING);
+		p->p   += run;
+		p->len -= run;
+		if (!p->len)
+			break;
 		switch (*p->p) {
 		case '\\':
 			if (p->o.noescape)
 				break;
+			p->escaped = 1;
 			if (p->len >= 2)
 				if (advance(p) != PICKLE_OK)
 					return PICKLE_ERROR;
@@ -786,7 +1575,11 @@ static int picolParseString(pickle_parser_t *p) {
 
 static inline int picolParseComment(pickle_parser_t *p) {
 	assert(p);
-	while (p->len && *p->p != '\n') {
+	while (p->len) {
+		if (picolSkip(p, picolSpan(p->p, p->len, SC_COMMENT)) != PICKLE_OK)
+			return PICKLE_ERROR;
+		if (!(p->len) || *p->p == '\n')
+			break;
 		if (*p->p == '\\' && p->p[1] == '\n') /* Unix line endings only */
 			if (advance(p) != PICKLE_OK)
 				return PICKLE_ERROR;
@@ -837,41 +1630,222 @@ static int picolGetToken(pickle_parser_t *p) {
 	return PICKLE_OK;
 }
 
-static pickle_var_t *picolGetVar(pickle_t *i, const char *name, int link) {
+/* Variable names are interned, each distinct name is kept once in 'atoms'
+ * along with its hash, so a variable can be found by comparing pointers.
+ * The name of a variable reference in a compiled script, or a parameter of
+ * a procedure, is interned once and kept, so looking it up never hashes or
+ * compares a string. */
+static pickle_atom_t *picolAtomFind(pickle_t *i, const char *name, const unsigned long hash) {
 	assert(i);
 	assert(name);
-	pickle_var_t *v = i->callframe->vars;
-	while (v) {
-		const char *n = v->smallname ? &v->name.small[0] : v->name.ptr;
-		assert(n);
-		if (!compare(n, name)) {
-			if (link)
-				while (v->type == PV_LINK) { /* NB. Could resolve link at creation? */
-					assert(v != v->data.link); /* Cycle? */
-					v = v->data.link;
-				}
-			implies(v->type == PV_STRING, v->data.val.ptr);
-			return v;
+	if (!(i->atoms))
+		return NULL;
+	for (pickle_atom_t *a = i->atoms[hash % i->atom_length]; a; a = a->next)
+		if (a->hash == hash && !compare(a->name, name))
+			return a;
+	return NULL;
+}
+
+static int picolAtomTableGrow(pickle_t *i) { /* keep the load factor at or below one, as for commands */
+	assert(i);
+	const long length = i->atom_length ? i->atom_length * 2 : 16;
+	const size_t bytes = length * sizeof (*i->atoms);
+	if (i->atoms && (i->atom_count < i->atom_length || (USE_MAX_STRING && bytes > PICKLE_MAX_STRING)))
+		return PICKLE_OK;
+	pickle_atom_t **n = picolMalloc(i, bytes);
+	if (!n)
+		return PICKLE_ERROR;
+	zero(n, bytes);
+	for (long j = 0; j < i->atom_length; j++)
+		for (pickle_atom_t *a = i->atoms[j], *next = NULL; a; a = next) {
+			next = a->next;
+			a->next = n[a->hash % length];
+			n[a->hash % length] = a;
 		}
-		/* See <https://en.wikipedia.org/wiki/Cycle_detection>,
-		 * <https://stackoverflow.com/questions/2663115>, or "Floyd's
-		 * cycle-finding algorithm" for proper loop detection */
-		assert(v != v->next); /* Cycle? */
-		v = v->next;
+	const int r = picolFree(i, i->atoms);
+	i->atoms       = n;
+	i->atom_length = length;
+	return r;
+}
+
+static pickle_atom_t *picolAtom(pickle_t *i, const char *name) { /* intern 'name', the caller must release it */
+	assert(i);
+	assert(name);
+	const unsigned long hash = picolHashString(name);
+	pickle_atom_t *a = picolAtomFind(i, name, hash);
+	if (a) {
+		a->refs++;
+		return a;
 	}
-	return NULL;
+	const size_t length = picolStrlen(name);
+	if (picolAtomTableGrow(i) != PICKLE_OK || !(a = picolMalloc(i, sizeof (*a) + length + 1)))
+		return NULL;
+	move(a->name, name, length + 1);
+	a->hash = hash;
+	a->refs = 1;
+	a->next = i->atoms[hash % i->atom_length];
+	i->atoms[hash % i->atom_length] = a;
+	i->atom_count++;
+	return a;
+}
+
+static int picolAtomRelease(pickle_t *i, pickle_atom_t *a) {
+	assert(i);
+	if (!a)
+		return PICKLE_OK;
+	assert(a->refs > 0);
+	if (--(a->refs))
+		return PICKLE_OK;
+	pickle_atom_t **p = &i->atoms[a->hash % i->atom_length];
+	while (*p != a)
+		p = &(*p)->next;
+	*p = a->next;
+	i->atom_count--;
+	return picolFree(i, a);
+}
+
+static inline const char *picolGetVarName(const pickle_var_t *v) {
+	assert(v);
+	assert(v->name);
+	return v->name->name;
+}
+
+static inline void picolFrameInitialize(pickle_call_frame_t *cf, pickle_call_frame_t *parent) {
+	assert(cf);
+	zero(cf, sizeof *cf);
+	cf->parent = parent;
+	cf->index  = cf->small;
+	cf->size   = PICKLE_FRAME_HASH;
+}
+
+/* Variables are hashed into 'index' with linear probing, which is never more
+ * than half full, so there is always an empty slot to end a search on. The
+ * linked list 'vars' is kept so the order variables are listed in is the
+ * same as it was, and is searched instead if the index could not grow. */
+static inline size_t picolFrameSlot(const pickle_call_frame_t *cf, const pickle_atom_t *name) { /* slot 'name' is in, or would go in */
+	assert(cf);
+	assert(name);
+	const size_t mask = cf->size - 1;
+	size_t j = name->hash & mask;
+	for (pickle_var_t *v = NULL; (v = cf->index[j]); j = (j + 1) & mask)
+		if (v->name == name)
+			break;
+	return j;
+}
+
+static int picolFrameAdd(pickle_t *i, pickle_call_frame_t *cf, pickle_var_t *v) {
+	assert(i);
+	assert(cf);
+	assert(v);
+	if (!(cf->size))
+		return PICKLE_OK;
+	if (((cf->count + 1) * 2) > cf->size) {
+		const int osize = cf->size;
+		pickle_var_t **old = cf->index, **n = NULL;
+		if (USE_MAX_STRING && (osize * 2 * sizeof *n) > PICKLE_MAX_STRING) {
+			cf->index = cf->small;
+			cf->size  = 0;
+			return old != cf->small ? picolFree(i, old) : PICKLE_OK;
+		}
+		n = picolMalloc(i, osize * 2 * sizeof *n);
+		if (!n)
+			return PICKLE_ERROR;
+		zero(n, osize * 2 * sizeof *n);
+		cf->index = n;
+		cf->size  = osize * 2;
+		for (int j = 0; j < osize; j++)
+			if (old[j])
+				cf->index[picolFrameSlot(cf, old[j]->name)] = old[j];
+		if (old != cf->small)
+			if (picolFree(i, old) != PICKLE_OK)
+				return PICKLE_ERROR;
+	}
+	const size_t slot = picolFrameSlot(cf, v->name);
+	assert(!(cf->index[slot]));
+	cf->index[slot] = v;
+	cf->count++;
+	return PICKLE_OK;
+}
+
+static void picolFrameRemove(pickle_call_frame_t *cf, pickle_var_t *v) {
+	assert(cf);
+	assert(v);
+	if (!(cf->size))
+		return;
+	const size_t mask = cf->size - 1;
+	size_t j = picolFrameSlot(cf, v->name);
+	assert(cf->index[j] == v);
+	cf->index[j] = NULL;
+	for (size_t k = (j + 1) & mask; cf->index[k]; k = (k + 1) & mask) { /* move back entries the removed one displaced */
+		const size_t home = cf->index[k]->name->hash & mask;
+		const int stays = j <= k ? (j < home && home <= k) : (j < home || home <= k);
+		if (stays)
+			continue;
+		cf->index[j] = cf->index[k];
+		cf->index[k] = NULL;
+		j = k;
+	}
+	cf->count--;
+}
+
+static pickle_var_t *picolGetVarAtom(pickle_t *i, const pickle_atom_t *name, int link) {
+	assert(i);
+	assert(name);
+	pickle_call_frame_t *cf = i->callframe;
+	pickle_var_t *v = NULL;
+	if (cf->size)
+		v = cf->index[picolFrameSlot(cf, name)];
+	else
+		for (v = cf->vars; v && v->name != name; v = v->next)
+			;
+	if (v && link)
+		while (v->type == PV_LINK) { /* links are resolved when they are made, so this is normally one step */
+			assert(v != v->data.link); /* Cycle? */
+			v = v->data.link;
+		}
+	implies(v && v->type == PV_STRING, v->data.val.ptr);
+	return v;
+}
+
+static pickle_var_t *picolGetVar(pickle_t *i, const char *name, int link) { /* a name never interned is not a variable */
+	assert(i);
+	assert(name);
+	const pickle_atom_t *a = picolAtomFind(i, name, picolHashString(name));
+	return a ? picolGetVarAtom(i, a, link) : NULL;
 }
 
 static int picolFreeVarName(pickle_t *i, pickle_var_t *v) {
 	assert(i);
 	assert(v);
-	return v->smallname ? PICKLE_OK : picolFree(i, v->name.ptr);
+	const int r = picolAtomRelease(i, v->name);
+	v->name = NULL;
+	return r;
+}
+
+/* The result can be the value of a variable, see 'append', in which case it
+ * is copied before that value is freed or moved elsewhere. */
+static inline int picolResultDetach(pickle_t *i, const char *value) {
+	assert(i);
+	if (i->static_result && !(i->list_result) && i->result == value)
+		return picolSetResultString(i, value);
+	return PICKLE_OK;
+}
+
+static inline pickle_capacity_t *picolVarCapacity(pickle_var_t *v) {
+	assert(v);
+	assert(v->type == PV_STRING && v->spare);
+	return ((pickle_capacity_t*)v->data.val.ptr) - 1;
 }
 
 static int picolFreeVarVal(pickle_t *i, pickle_var_t *v) {
 	assert(i);
 	assert(v);
-	return v->type == PV_STRING ? picolFree(i, v->data.val.ptr) : PICKLE_OK;
+	if (v->type == PV_LIST)
+		return picolListRelease(i, v->data.list);
+	if (v->type != PV_STRING)
+		return PICKLE_OK;
+	const int r = picolResultDetach(i, v->data.val.ptr);
+	return picolFree(i, v->spare ? (void*)picolVarCapacity(v) : v->data.val.ptr) == PICKLE_OK ? r : PICKLE_ERROR;
 }
 
 /* return: non-zero if and only if val fits in a small string */
@@ -890,6 +1864,7 @@ static int picolSetVarString(pickle_t *i, pickle_var_t *v, const char *val) {
 		return PICKLE_OK;
 	}
 	v->type = PV_STRING;
+	v->spare = 0;
 	return (v->data.val.ptr = picolStrdup(i, val)) ? PICKLE_OK : PICKLE_ERROR;
 }
 
@@ -897,25 +1872,355 @@ static inline int picolSetVarName(pickle_t *i, pickle_var_t *v, const char *name
 	assert(i);
 	assert(v);
 	assert(name);
-	if (picolIsSmallString(name)) {
-		v->smallname = 1;
-		copy(v->name.small, name);
-		return PICKLE_OK;
+	return (v->name = picolAtom(i, name)) ? PICKLE_OK : PICKLE_ERROR;
+}
+
+static int picolSetVarOwned(pickle_t *i, pickle_var_t *v, char *val) { /* 'v' keeps 'val', or frees it */
+	assert(i);
+	assert(v);
+	assert(val);
+	if (picolIsSmallString(val)) {
+		v->type = PV_SMALL_STRING;
+		copy(v->data.val.small, val);
+		return picolFree(i, val);
+	}
+	v->type = PV_STRING;
+	v->spare = 0;
+	v->data.val.ptr = val;
+	return PICKLE_OK;
+}
+
+static pickle_var_t *picolVarNew(pickle_t *i) { /* an empty variable, reused if one has been freed */
+	assert(i);
+	pickle_var_t *v = i->vars;
+	if (v) {
+		i->vars = v->next;
+		i->spare_vars--;
+	} else if (!(v = picolMalloc(i, sizeof(*v)))) {
+		return NULL;
+	}
+	zero(v, sizeof *v);
+	v->type = PV_SMALL_STRING;
+	return v;
+}
+
+/* Create variable 'name' in the current frame, which must not already have
+ * it, taking 'owned' if it is not NULL as 'picolSetVar' does. The variable
+ * holds its own reference to 'name'. */
+static int picolNewVarAtom(pickle_t *i, pickle_atom_t *name, const char *val, char *owned, pickle_var_t **set) {
+	assert(i);
+	assert(name);
+	assert(val);
+	implies(owned, owned == val);
+	pickle_var_t *v = picolVarNew(i);
+	if (!v) {
+		(void)picolFree(i, owned);
+		return PICKLE_ERROR;
+	}
+	v->name = name;
+	name->refs++;
+	const int r2 = owned ? picolSetVarOwned(i, v, owned) : picolSetVarString(i, v, val);
+	if (r2 != PICKLE_OK || picolFrameAdd(i, i->callframe, v) != PICKLE_OK) {
+		(void)picolFreeVarName(i, v);
+		(void)picolFreeVarVal(i, v);
+		(void)picolFree(i, v);
+		return PICKLE_ERROR;
 	}
-	v->smallname = 0;
-	return (v->name.ptr = picolStrdup(i, name)) ? PICKLE_OK : PICKLE_ERROR;
+	v->next = i->callframe->vars;
+	i->callframe->vars = v;
+	if (set)
+		*set = v;
+	return PICKLE_OK;
+}
+
+static int picolNewVar(pickle_t *i, const char *name, const char *val, char *owned, pickle_var_t **set) {
+	assert(i);
+	assert(name);
+	pickle_atom_t *a = picolAtom(i, name);
+	if (!a) {
+		(void)picolFree(i, owned);
+		return PICKLE_ERROR;
+	}
+	const int r = picolNewVarAtom(i, a, val, owned, set);
+	return picolAtomRelease(i, a) == PICKLE_OK ? r : PICKLE_ERROR;
+}
+
+static int picolSetVarValue(pickle_t *i, pickle_var_t *v, const char *val, char *owned, pickle_var_t **set) {
+	assert(i);
+	assert(v);
+	assert(val);
+	implies(owned, owned == val);
+	if (!owned && v->type == PV_STRING && v->spare) { /* reuse the room a value has, unless it is far too big */
+		pickle_capacity_t *c = picolVarCapacity(v);
+		const size_t length = picolStrlen(val);
+		if (length < c->size && length >= c->size / 4) {
+			if (picolResultDetach(i, v->data.val.ptr) != PICKLE_OK)
+				return PICKLE_ERROR;
+			move(v->data.val.ptr, val, length + 1);
+			c->length = length;
+			if (set)
+				*set = v;
+			return PICKLE_OK;
+		}
+	}
+	pickle_var_t old = *v; /* freed once the new value is set, as 'val' may be part of it */
+	if ((owned ? picolSetVarOwned(i, v, owned) : picolSetVarString(i, v, val)) != PICKLE_OK) {
+		*v = old;
+		return PICKLE_ERROR;
+	}
+	if (set)
+		*set = v;
+	return picolFreeVarVal(i, &old);
+}
+
+/* Set or create variable 'name' in the current frame, if 'owned' is not NULL
+ * it is 'val' and was allocated, the variable takes it instead of copying
+ * it, and it is freed if that fails. The variable is returned in 'set'. */
+static int picolSetVar(pickle_t *i, const char *name, const char *val, char *owned, pickle_var_t **set) {
+	assert(i);
+	assert(name);
+	pickle_var_t *v = picolGetVar(i, name, 1);
+	if (!v)
+		return picolNewVar(i, name, val, owned, set);
+	return picolSetVarValue(i, v, val, owned, set);
 }
 
-static const char *picolGetVarVal(pickle_var_t *v) {
+static int picolSetVarAtom(pickle_t *i, pickle_atom_t *name, const char *val, char *owned, pickle_var_t **set) {
+	assert(i);
+	assert(name);
+	pickle_var_t *v = picolGetVarAtom(i, name, 1);
+	if (!v)
+		return picolNewVarAtom(i, name, val, owned, set);
+	return picolSetVarValue(i, v, val, owned, set);
+}
+
+static const char *picolGetVarVal(pickle_var_t *v, char buf[/*static*/ PRINT_NUMBER_BUF_SZ]) { /* 'buf' is used if 'v' is a number */
 	assert(v);
-	assert((v->type == PV_SMALL_STRING) || (v->type == PV_STRING));
+	assert(buf);
+	assert((v->type == PV_SMALL_STRING) || (v->type == PV_STRING) || (v->type == PV_NUMBER) || (v->type == PV_LIST));
 	switch (v->type) {
 	case PV_SMALL_STRING: return v->data.val.small;
 	case PV_STRING:       return v->data.val.ptr;
+	case PV_LIST:         return v->data.list->string;
+	case PV_NUMBER:       return picolNumberToString(buf, v->data.number, 10) == PICKLE_OK ? buf : NULL;
 	}
 	return NULL;
 }
 
+static int picolGetVarNumber(pickle_t *i, pickle_var_t *v, number_t *n) {
+	assert(i);
+	assert(v);
+	assert(n);
+	if (v->type == PV_NUMBER) {
+		*n = v->data.number;
+		return PICKLE_OK;
+	}
+	char buffy[PRINT_NUMBER_BUF_SZ];
+	return picolStringToNumber(i, picolGetVarVal(v, buffy), n);
+}
+
+static int picolSetVarNumber(pickle_t *i, pickle_var_t *v, const number_t n) {
+	assert(i);
+	assert(v);
+	assert(v->type != PV_LINK);
+	const int r = picolFreeVarVal(i, v);
+	v->type = PV_NUMBER;
+	v->data.number = n;
+	return r;
+}
+
+/* Without a maximum string length a variable appended to is given room to
+ * grow, a power of two at least the size of its value, so appending to it
+ * repeatedly takes time in proportion to what is appended. */
+static inline size_t picolCapacity(const size_t size) {
+	if (USE_MAX_STRING)
+		return size;
+	size_t c = 16;
+	while (c < size)
+		c *= 2;
+	return c;
+}
+
+/* Make room for 'more' bytes on the end of the value of 'v', which becomes
+ * a string with its length and size kept in front of it. It is returned and
+ * its length put in 'length', the caller appends to it and updates the
+ * length. The result is cleared first, as it may be the value. */
+static char *picolVarReserve(pickle_t *i, pickle_var_t *v, const size_t more, size_t *length) {
+	assert(i);
+	assert(v);
+	assert(v->type != PV_LINK);
+	assert(length);
+	const size_t header = sizeof (pickle_capacity_t);
+	if (picolSetResultEmpty(i) != PICKLE_OK)
+		return NULL;
+	if (v->type == PV_STRING && v->spare) {
+		pickle_capacity_t *c = picolVarCapacity(v);
+		*length = c->length;
+		if (c->length + more + 1 > c->size) {
+			const size_t size = picolCapacity(header + c->length + more + 1);
+			if (!(c = picolRealloc(i, c, size)))
+				return NULL;
+			c->size = size - header;
+			v->data.val.ptr = (char*)(c + 1);
+		}
+		return v->data.val.ptr;
+	}
+	char buffy[PRINT_NUMBER_BUF_SZ];
+	const char *old = picolGetVarVal(v, buffy);
+	if (!old)
+		return NULL;
+	const size_t l = picolStrlen(old), size = picolCapacity(header + l + more + 1);
+	pickle_capacity_t *c = picolMalloc(i, size);
+	if (!c)
+		return NULL;
+	char *s = (char*)(c + 1);
+	move(s, old, l + 1);
+	if (picolFreeVarVal(i, v) != PICKLE_OK) {
+		(void)picolFree(i, c);
+		return NULL;
+	}
+	c->length = l;
+	c->size = size - header;
+	v->type = PV_STRING;
+	v->spare = 1;
+	v->data.val.ptr = s;
+	*length = l;
+	return s;
+}
+
+/* A variable used as a list keeps where each of its items are, so they can
+ * be found without parsing the list again, and appended to in place. The
+ * string form is always kept, and any other change to the variable turns it
+ * back into a string. Functions that want room they cannot have return
+ * PICKLE_BREAK, as does 'picolVarList' for a value that is not a valid list,
+ * and the caller should then deal with the string instead. */
+static int picolListParse(pickle_t *i, pickle_list_t *l, const size_t from) { /* find items from 'from' onwards */
+	assert(i);
+	assert(l);
+	assert(from <= l->length);
+	pickle_parser_t p = { .p = NULL };
+	picolParserInitialize(&p, &(pickle_parser_opts_t){ 1, 1, 1, 1 }, l->string + from);
+	for (;;) {
+		if (picolGetToken(&p) != PICKLE_OK)
+			return PICKLE_BREAK;
+		if (p.type == PT_EOF)
+			break;
+		if (p.type != PT_STR && p.type != PT_VAR && p.type != PT_CMD && p.type != PT_ESC)
+			continue;
+		if (l->count == l->max) {
+			const int max = MAX(l->max * 2, 8);
+			if (USE_MAX_STRING && (max * sizeof *l->items) > PICKLE_MAX_STRING)
+				return PICKLE_BREAK;
+			pickle_span_t *n = picolRealloc(i, l->items, max * sizeof *n);
+			if (!n)
+				return PICKLE_ERROR;
+			l->items = n;
+			l->max = max;
+		}
+		l->items[l->count++] = (pickle_span_t){ .start = p.start - l->string, .length = (p.end - p.start) + 1 };
+	}
+	return PICKLE_OK;
+}
+
+static int picolVarList(pickle_t *i, pickle_var_t *v, pickle_list_t **list) {
+	assert(i);
+	assert(v);
+	assert(list);
+	*list = NULL;
+	if (v->type == PV_LIST) {
+		*list = v->data.list;
+		return PICKLE_OK;
+	}
+	if (v->type != PV_STRING && v->type != PV_SMALL_STRING)
+		return PICKLE_BREAK;
+	pickle_list_t *l = picolMalloc(i, sizeof *l);
+	if (!l)
+		return PICKLE_ERROR;
+	zero(l, sizeof *l);
+	char buffy[PRINT_NUMBER_BUF_SZ];
+	const char *s = picolGetVarVal(v, buffy);
+	l->length = picolStrlen(s);
+	l->size   = l->length + 1;
+	l->refs   = 1;
+	const int take = v->type == PV_STRING && !(v->spare);
+	if (take && picolResultDetach(i, s) != PICKLE_OK) {
+		(void)picolFree(i, l);
+		return PICKLE_ERROR;
+	}
+	l->string = take ? v->data.val.ptr : picolStrdup(i, s); /* taken from 'v' if it works */
+	int r = l->string ? picolListParse(i, l, 0) : PICKLE_ERROR;
+	if (r != PICKLE_OK) {
+		if (take)
+			l->string = NULL;
+		return picolListRelease(i, l) == PICKLE_OK ? r : PICKLE_ERROR;
+	}
+	if (!take && picolFreeVarVal(i, v) != PICKLE_OK) {
+		(void)picolListRelease(i, l);
+		return PICKLE_ERROR;
+	}
+	v->type = PV_LIST;
+	v->data.list = l;
+	*list = l;
+	return PICKLE_OK;
+}
+
+static int picolListReserve(pickle_t *i, pickle_list_t *l, const size_t need) { /* room for a string of 'need' bytes */
+	assert(i);
+	assert(l);
+	if (need <= l->size)
+		return PICKLE_OK;
+	const size_t size = MAX(l->size * 2, need);
+	if (USE_MAX_STRING && size > PICKLE_MAX_STRING)
+		return PICKLE_BREAK;
+	char *n = picolRealloc(i, l->string, size);
+	if (!n)
+		return PICKLE_ERROR;
+	l->string = n;
+	l->size = size;
+	return PICKLE_OK;
+}
+
+static int picolListAppend(pickle_t *i, pickle_list_t *l, const char *s) { /* appends ' ' and 's', a list */
+	assert(i);
+	assert(l);
+	assert(s);
+	assert(l->refs == 1);
+	const size_t sl = picolStrlen(s), from = l->length + 1;
+	const int r = picolListReserve(i, l, from + sl + 1);
+	if (r != PICKLE_OK)
+		return r;
+	l->string[l->length] = ' ';
+	move(&l->string[from], s, sl + 1);
+	l->length += sl + 1;
+	return picolListParse(i, l, from);
+}
+
+static int picolVarString(pickle_t *i, pickle_var_t *v) { /* stop treating a list in 'v' as a list */
+	assert(i);
+	assert(v);
+	if (v->type != PV_LIST)
+		return PICKLE_OK;
+	pickle_list_t *l = v->data.list;
+	char *s = l->refs == 1 ? l->string : picolStrdup(i, l->string);
+	if (!s)
+		return PICKLE_ERROR;
+	if (l->refs == 1)
+		l->string = NULL;
+	const int r = picolListRelease(i, l);
+	v->type = PV_STRING;
+	v->spare = 0;
+	v->data.val.ptr = s;
+	return r;
+}
+
+static int picolListIndex(pickle_t *i, pickle_list_t *l, const number_t index) {
+	assert(i);
+	assert(l);
+	if (index < 0 || index >= l->count)
+		return picolSetResultEmpty(i);
+	return picolSetResultBuffer(i, l->string + l->items[index].start, l->items[index].length);
+}
+
 static inline void picolSwapString(char **a, char **b) {
 	assert(a);
 	assert(b);
@@ -994,21 +2299,62 @@ fail:
 	return NULL;
 }
 
-static int picolSetResultNumber(pickle_t *i, const number_t result) {
-	assert(i);
-	char buffy/*<3*/[PRINT_NUMBER_BUF_SZ] = { 0 };
-	if (picolNumberToString(buffy, result, 10) != PICKLE_OK)
-		return error(i, "Invalid conversion");
-	return picolSetResultString(i, buffy);
+static inline int isFalse(const char *s) {
+	assert(s);
+	static const char *negatory[] = { "0", "false", "off", "no", };
+	for (size_t i = 0; i < (sizeof(negatory) / sizeof(negatory[0])); i++)
+		if (!picolCompareCaseInsensitive(negatory[i], s))
+			return 1;
+	return 0;
 }
 
-static int picolSetVarInteger(pickle_t *i, const char *name, const number_t r) {
-	assert(i);
-	assert(name);
-	char buffy[PRINT_NUMBER_BUF_SZ] = { 0 };
-	if (picolNumberToString(buffy, r, 10) != PICKLE_OK)
-		return error(i, "Invalid conversion");
-	return pickle_var_set(i, name, buffy);
+static inline int isTrue(const char *s) {
+	assert(s);
+	static const char *affirmative[] = { "1", "true", "on", "yes", };
+	for (size_t i = 0; i < (sizeof(affirmative) / sizeof(affirmative[0])); i++)
+		if (!picolCompareCaseInsensitive(affirmative[i], s))
+			return 1;
+	return 0;
+}
+
+static int picolSetResultList(pickle_t *i, pickle_list_t *l) { /* the result shares the string of 'l' */
+	assert(i);
+	assert(l);
+	l->refs++;
+	const int r = picolFreeResult(i);
+	i->static_result = 1;
+	i->number_result = 0;
+	i->list_result   = 1;
+	i->list   = l;
+	i->result = l->string;
+	return r;
+}
+
+static int picolSetResultNumber(pickle_t *i, const number_t result) {
+	assert(i);
+	BUILD_BUG_ON(SMALL_RESULT_BUF_SZ < PRINT_NUMBER_BUF_SZ);
+	const int r = picolFreeResult(i);
+	i->static_result = 1;
+	i->number_result = 1;
+	i->number = result;
+	i->result = i->result_buf; /* formatted by 'picolGetResult' if it is needed */
+	return r;
+}
+
+static const char *picolGetResult(pickle_t *i) {
+	assert(i);
+	if (i->number_result) {
+		const int r = picolNumberToString(i->result_buf, i->number, 10);
+		assert(r == PICKLE_OK);
+		UNUSED(r);
+		i->number_result = 0;
+	}
+	return i->result;
+}
+
+static inline int picolResultIsFalse(pickle_t *i) {
+	assert(i);
+	return i->number_result ? i->number == 0 : isFalse(i->result);
 }
 
 static inline void picolAssertCommandPreConditions(pickle_t *i, const int argc, char **argv, void *pd) {
@@ -1120,24 +2466,31 @@ static char *picolEscape(pickle_t *i, const char *s, size_t length) {
 static int picolStringNeedsEscaping(const char *s) {
 	assert(s);
 	long braces = 0;
-	char start = s[0], end = 0, ch = 0, sp = 0;
-	for (size_t i = 0; (ch = s[i]); s++) {
+	char start = s[0], end = 0, sp = 0, early = 0;
+	for (size_t j = 0;;) {
+		const size_t run = picolSpan(&s[j], SIZE_MAX, SC_ESCAPE);
+		if (run)
+			end = s[j + run - 1];
+		j += run;
+		const char ch = s[j];
+		if (!ch)
+			break;
 		end = ch;
-		if (locateChar(string_white_space, ch))
-			sp = 1;
-		if (locateChar("[]$", ch))
-			sp = 1;
-		if (ch == '{') braces++;
-		if (ch == '}') braces--;
+		if (ch == '{')
+			braces++;
+		else if (ch == '}')
+			early |= !--braces && s[j + 1]; /* "{a} {b}" is not one braced word */
+		else
+			sp = 1; /* white space, "[]$" or an escape */
 		if (ch == '\\') {
-			ch = s[++i];
-			sp = 1;
-			if (!ch)
+			if (!s[j + 1])
 				return 1;
+			j++; /* the escaped character counts for nothing */
 		}
+		j++;
 	}
 	if (!start || sp)
-		return braces || !(start == '{' && end == '}');
+		return braces || early || !(start == '{' && end == '}');
 	return 0;
 }
 
@@ -1187,8 +2540,9 @@ static char *concatenate(pickle_t *i, const char *join, const int argc, char **a
 		return picolStrdup(i, "");
 	const size_t jl = picolStrlen(join);
 	size_t l = 0, lo = 0;
-	char   *esc = picolMalloc(i, argc * sizeof *esc); /* NB. we could allocate this in pickle_t and grow as needed */
-	size_t  *ls = picolMalloc(i, argc * sizeof *ls);
+	const pickle_mark_t mark = picolScratchMark(i);
+	size_t  *ls = picolScratch(i, argc * sizeof *ls);
+	char   *esc = ls ? picolScratch(i, argc * sizeof *esc) : NULL;
 	char *str = NULL;
 	int args = 0;
 	if (!esc || !ls)
@@ -1226,33 +2580,204 @@ static char *concatenate(pickle_t *i, const char *join, const int argc, char **a
 		}
 
 		const int escape = esc[j];
-		char *f = escape ? picolEscape(i, arg, ls[j]) : NULL;
-		char *p = escape ? f : arg;
-		if (!p)
-			goto end;
 		implies(USE_MAX_STRING, l < PICKLE_MAX_STRING);
 		assert(escape == 0 || escape == 1);
 		assert((l + ls[j] + (2 * escape)) <= lo);
 		(void)lo;
-		move(h.p + l, p, ls[j] + (2 * escape));
-		l += ls[j] + (2 * escape);
+		if (escape) /* braced in place, rather than in a copy */
+			h.p[l++] = '{';
+		move(h.p + l, arg, ls[j]);
+		l += ls[j];
+		if (escape)
+			h.p[l++] = '}';
 		if (jl && k < args) {
 			implies(USE_MAX_STRING, l < PICKLE_MAX_STRING);
 			move(h.p + l, join, jl);
 			l += jl;
 		}
-		if (picolFree(i, f) != PICKLE_OK)
-			goto end;
 	}
 	h.p[l] = '\0';
 	str = picolOnHeap(i, &h) ? h.p : picolStrdup(i, h.p);
 end:
-	(void)picolFree(i, ls);
-	(void)picolFree(i, esc);
+	(void)picolScratchRelease(i, &mark);
 	/* NB. Do not call 'picolStackOrHeapFree(i, &h)' */
 	return str;
 }
 
+/* A list with an even number of items can be used as a dictionary, its keys
+ * are added to an open addressing table of item numbers the first time it
+ * is, and those appended to it since then each time after that, so a key is
+ * found without comparing it to every other. The last of any keys given more
+ * than once is the one found. Values are replaced in the string form in
+ * place, moving what follows them only if their length changes, and new keys
+ * are appended to it. */
+static inline unsigned long picolHashSpan(const char *s, const size_t length) { /* as 'picolHashString' */
+	assert(s);
+	unsigned long h = 2166136261ul;
+	for (size_t i = 0; i < length; i++)
+		h = ((h ^ (unsigned char)s[i]) * 16777619ul) & 0xFFFFFFFFul;
+	return h;
+}
+
+static int picolDictSlot(const pickle_list_t *l, const char *key, const size_t length, const unsigned long hash) {
+	assert(l);
+	assert(key);
+	assert(l->slots > (l->count / 2));
+	const int mask = l->slots - 1;
+	for (int j = hash & mask;; j = (j + 1) & mask) {
+		const int e = l->index[j];
+		if (!e)
+			return j;
+		const pickle_span_t *k = &l->items[e - 1];
+		if (k->length == length && !memcmp(l->string + k->start, key, length))
+			return j;
+	}
+}
+
+static int picolDictIndex(pickle_t *i, pickle_list_t *l) { /* PICKLE_BREAK if 'l' is not a dictionary */
+	assert(i);
+	assert(l);
+	if (l->count % 2)
+		return PICKLE_BREAK;
+	if (!(l->slots) || l->count >= l->slots) { /* keep it at most half full */
+		int slots = MAX(l->slots, 8);
+		while (l->count >= slots)
+			slots *= 2;
+		if (USE_MAX_STRING && (slots * sizeof *l->index) > PICKLE_MAX_STRING)
+			return PICKLE_BREAK;
+		int *n = picolMalloc(i, slots * sizeof *n);
+		if (!n)
+			return PICKLE_ERROR;
+		if (picolFree(i, l->index) != PICKLE_OK) {
+			(void)picolFree(i, n);
+			return PICKLE_ERROR;
+		}
+		zero(n, slots * sizeof *n);
+		l->index   = n;
+		l->slots   = slots;
+		l->indexed = 0;
+	}
+	for (; l->indexed < l->count; l->indexed += 2) {
+		const pickle_span_t *k = &l->items[l->indexed];
+		const char *key = l->string + k->start;
+		l->index[picolDictSlot(l, key, k->length, picolHashSpan(key, k->length))] = l->indexed + 1;
+	}
+	return PICKLE_OK;
+}
+
+static int picolDictFind(const pickle_list_t *l, const char *key) { /* item number of 'key' in an indexed 'l', or -1 */
+	assert(l);
+	assert(key);
+	assert(l->indexed == l->count);
+	const size_t length = picolStrlen(key);
+	return l->index[picolDictSlot(l, key, length, picolHashSpan(key, length))] - 1;
+}
+
+static void picolListExtent(const pickle_list_t *l, const int item, size_t *from, size_t *to) { /* item with its braces or quotes */
+	assert(l);
+	assert(item >= 0 && item < l->count);
+	const pickle_span_t *s = &l->items[item];
+	const int delimited = s->start && (l->string[s->start - 1] == '{' || l->string[s->start - 1] == '"');
+	*from = s->start - delimited;
+	*to   = s->start + s->length + delimited;
+}
+
+static inline int picolListReplace(pickle_t *i, pickle_list_t *l, const int item, const char *s) {
+	assert(i);
+	assert(l);
+	assert(s);
+	assert(l->refs == 1);
+	size_t from = 0, to = 0;
+	picolListExtent(l, item, &from, &to);
+	const int escape = picolStringNeedsEscaping(s);
+	const size_t sl = picolStrlen(s), nl = sl + (2 * escape), length = (l->length - (to - from)) + nl;
+	const int r = picolListReserve(i, l, length + 1);
+	if (r != PICKLE_OK)
+		return r;
+	move(&l->string[from + nl], &l->string[to], (l->length - to) + 1);
+	move(&l->string[from + escape], s, sl);
+	if (escape) {
+		l->string[from] = '{';
+		l->string[from + nl - 1] = '}';
+	}
+	l->length = length;
+	l->items[item] = (pickle_span_t){ .start = from + escape, .length = sl };
+	if (nl != to - from) /* what follows has moved */
+		for (int j = item + 1; j < l->count; j++)
+			l->items[j].start = (l->items[j].start - (to - from)) + nl;
+	return PICKLE_OK;
+}
+
+static inline int picolListRemove(pickle_t *i, pickle_list_t *l, const int item, const int items) {
+	assert(i);
+	assert(l);
+	assert(item >= 0 && items > 0 && (item + items) <= l->count);
+	assert(l->refs == 1);
+	size_t from = 0, to = 0, unused = 0;
+	picolListExtent(l, item, &from, &unused);
+	if (item + items < l->count) /* up to the next item, or from the end of the last one */
+		picolListExtent(l, item + items, &to, &unused);
+	else if (to = l->length, item)
+		picolListExtent(l, item - 1, &unused, &from);
+	move(&l->string[from], &l->string[to], (l->length - to) + 1);
+	l->length -= to - from;
+	for (int j = item + items; j < l->count; j++)
+		l->items[j - items] = (pickle_span_t){ .start = l->items[j].start - (to - from), .length = l->items[j].length };
+	l->count -= items;
+	l->indexed = 0; /* item numbers have changed */
+	if (l->index)
+		zero(l->index, l->slots * sizeof *l->index);
+	return picolDictIndex(i, l);
+}
+
+static inline int picolDictPut(pickle_t *i, pickle_list_t *l, const char *key, const char *value) {
+	assert(i);
+	assert(l);
+	assert(key);
+	assert(value);
+	const int item = picolDictFind(l, key);
+	if (item >= 0)
+		return picolListReplace(i, l, item + 1, value);
+	char *pair = concatenate(i, " ", 2, (char*[2]) { (char*)key, (char*)value }, 1, -1, 0);
+	if (!pair)
+		return PICKLE_ERROR;
+	const size_t length = picolStrlen(pair);
+	int r = PICKLE_OK;
+	if (l->length) {
+		r = picolListAppend(i, l, pair);
+	} else if ((r = picolListReserve(i, l, length + 1)) == PICKLE_OK) { /* no space in front of it */
+		move(l->string, pair, length + 1);
+		l->length = length;
+		r = picolListParse(i, l, 0);
+	}
+	if (picolFree(i, pair) != PICKLE_OK)
+		return PICKLE_ERROR;
+	return r == PICKLE_OK ? picolDictIndex(i, l) : r;
+}
+
+static inline int picolDictRemove(pickle_t *i, pickle_list_t *l, const char *key) { /* and any earlier values for it */
+	assert(i);
+	assert(l);
+	assert(key);
+	for (int item = 0; (item = picolDictFind(l, key)) >= 0;)
+		if (picolListRemove(i, l, item, 2) != PICKLE_OK)
+			return PICKLE_ERROR;
+	return PICKLE_OK;
+}
+
+static char *picolListCopy(pickle_t *i, const pickle_list_t *l, const int item) { /* 'item' as a string, or "" if it is -1 */
+	assert(i);
+	assert(l);
+	assert(item >= -1 && item < l->count);
+	const pickle_span_t s = item >= 0 ? l->items[item] : (pickle_span_t){ .start = 0, .length = 0 };
+	char *r = picolMalloc(i, s.length + 1);
+	if (!r)
+		return NULL;
+	move(r, l->string + s.start, s.length);
+	r[s.length] = '\0';
+	return r;
+}
+
 static args_t picolArgs(pickle_t *i, pickle_parser_opts_t *o, const char *s) {
 	assert(i);
 	assert(s);
@@ -1314,7 +2839,113 @@ static char **picolArgsCopy(pickle_t *i, int argc, char **argv, unsigned grow) {
 	return as;
 }
 
-static inline int picolDoSpecialCommand(pickle_t *i, pickle_command_t *cmd, const char *name, int argc, char **argv) {
+/* Call 'c' with whichever of 'argv' or 'argl' it takes, 'argl' is made from
+ * 'argv' if it is NULL, 'argv' must be valid unless 'c' takes 'argl'. */
+static inline int picolInvokeCommand(pickle_t *i, const pickle_command_t *c, const int argc, char **argv, pickle_slice_t *argl) {
+	assert(i);
+	assert(c);
+	assert(argc >= 1);
+	if (c->func) {
+		picolAssertCommandPreConditions(i, argc, argv, c->privdata);
+		const int r = c->func(i, argc, argv, c->privdata);
+		picolAssertCommandPostConditions(i, r);
+		return r;
+	}
+	assert(c->ex);
+	const pickle_mark_t mark = picolScratchMark(i);
+	if (!argl && !(argl = picolArgsSlice(i, argc, argv)))
+		return PICKLE_ERROR;
+	const int r = c->ex(i, argc, argl, c->privdata);
+	picolAssertCommandPostConditions(i, r);
+	return picolScratchRelease(i, &mark) == PICKLE_OK ? r : PICKLE_ERROR;
+}
+
+#if DEFINE_PROFILE
+/* Time spent in commands called by 'c' is accumulated in 'i->child' so that
+ * it can be taken away from the total to get the time spent in 'c' itself,
+ * allocations are attributed to the command that made them the same way.
+ * 'c' may be removed while it runs, in which case it is looked up again. */
+static int picolProfileCommand(pickle_t *i, const pickle_command_t *c, const int argc, char **argv, pickle_slice_t *argl) {
+	assert(i);
+	assert(c);
+	const char *name = argl ? argl[0].ptr : argv[0];
+	const pickle_clock_t clock = i->clock;
+	void *clockdata = i->clockdata;
+	const unsigned long epoch = i->epoch, outer = i->child, outer_allocations = i->child_allocations, made = i->made;
+	const size_t outer_bytes = i->child_bytes, made_bytes = i->made_bytes;
+	const unsigned long start = clock ? clock(clockdata) : 0;
+	i->child = 0;
+	i->child_allocations = 0;
+	i->child_bytes = 0;
+	const int r = picolInvokeCommand(i, c, argc, argv, argl);
+	const unsigned long total = clock ? clock(clockdata) - start : 0;
+	const unsigned long self = total - MIN(total, i->child);
+	const unsigned long allocations = i->made - made;
+	const size_t bytes = i->made_bytes - made_bytes;
+	const unsigned long own = allocations - MIN(allocations, i->child_allocations);
+	const size_t own_bytes = bytes - MIN(bytes, i->child_bytes);
+	i->child = outer + total;
+	i->child_allocations = outer_allocations + allocations;
+	i->child_bytes = outer_bytes + bytes;
+	if (epoch != i->epoch)
+		c = picolGetCommand(i, name);
+	pickle_profile_t *p = c ? picolProfileOf(i, c) : NULL;
+	if (p) {
+		p->calls++;
+		p->total += total;
+		p->self  += self;
+		p->allocations += own;
+		p->bytes += own_bytes;
+	}
+	return r;
+}
+#endif
+
+/* Called before each command is run, and whenever a compiled loop goes back
+ * to its start, so any loop is checked. Counting commands is cheap enough to
+ * check every time, the clock is only read every so often. Once spent the
+ * budget stays spent, even if the error is caught. */
+static int picolBudgetCheck(pickle_t *i) {
+	assert(i);
+	assert(i->budgeted);
+	if (!(i->spent) && i->budget.commands && i->cmdcount > i->budget_end)
+		i->spent = "Invalid budget: commands";
+	if (!(i->spent) && i->budget.clock && --i->ticks <= 0) {
+		i->ticks = i->budget.interval ? i->budget.interval : PICKLE_BUDGET_INTERVAL;
+		if ((i->budget.clock(i->budget.clockdata) - i->budget_start) >= (i->budget.deadline - i->budget_start))
+			i->spent = "Invalid budget: time";
+	}
+	if (!(i->spent))
+		return PICKLE_OK;
+	(void)picolForceResult(i, i->spent, 1);
+	return PICKLE_ERROR;
+}
+
+static inline int picolCounted(pickle_t *i) { /* for commands done in line, without calling them */
+	assert(i);
+	i->cmdcount++;
+	return i->budgeted ? picolBudgetCheck(i) : PICKLE_OK;
+}
+
+static inline int picolBudgetCode(pickle_t *i, const int r) { /* the error from a spent budget gets its own code */
+	assert(i);
+	if (r != PICKLE_ERROR || !(i->spent))
+		return r;
+	(void)picolForceResult(i, i->spent, 1);
+	return PICKLE_LIMIT;
+}
+
+static inline int picolCallCommand(pickle_t *i, const pickle_command_t *c, const int argc, char **argv, pickle_slice_t *argl) {
+	if (i->budgeted && picolBudgetCheck(i) != PICKLE_OK)
+		return PICKLE_ERROR;
+#if DEFINE_PROFILE
+	if (i->profile)
+		return picolProfileCommand(i, c, argc, argv, argl);
+#endif
+	return picolInvokeCommand(i, c, argc, argv, argl);
+}
+
+static inline int picolDoSpecialCommand(pickle_t *i, const pickle_command_t *cmd, const char *name, int argc, char **argv) {
 	assert(i);
 	assert(argv);
 	assert(cmd);
@@ -1323,21 +2954,19 @@ static inline int picolDoSpecialCommand(pickle_t *i, pickle_command_t *cmd, cons
 		return PICKLE_ERROR;
 	move(&as[1], &as[0], argc * sizeof (char*));
 	as[0] = (char*)name;
-	picolAssertCommandPreConditions(i, argc + 1, as, cmd->privdata);
-	const int r = cmd->func(i, argc + 1, as, cmd->privdata);
-	picolAssertCommandPostConditions(i, r);
+	const int r = picolCallCommand(i, cmd, argc + 1, as, NULL);
 	if (picolFree(i, as) != PICKLE_OK)
 		return PICKLE_ERROR;
 	return r;
 }
 
-static inline int picolDoCommand(pickle_t *i, int argc, char *argv[]) {
+static inline int picolDoCommand(pickle_t *i, int argc, char *argv[], pickle_slice_t *argl) {
 	assert(i);
 	assert(argc >= 1);
 	assert(argv);
 	i->cmdcount++;
 	if (i->trace && !(i->inside_trace)) {
-		pickle_command_t *t = picolGetCommand(i, "tracer");
+		const pickle_command_t *t = picolGetCommand(i, "tracer");
 		if (t) {
 			i->inside_trace = 1;
 			const int r = picolDoSpecialCommand(i, t, "tracer", argc, argv);
@@ -1350,7 +2979,7 @@ static inline int picolDoCommand(pickle_t *i, int argc, char *argv[]) {
 	}
 	if (picolSetResultEmpty(i) != PICKLE_OK)
 		return PICKLE_ERROR;
-	pickle_command_t *c = picolGetCommand(i, argv[0]);
+	const pickle_command_t *c = picolGetCommand(i, argv[0]);
 	if (c == NULL) {
 		if (i->inside_unknown || ((c = picolGetCommand(i, "unknown")) == NULL))
 			return error(i, "Invalid unknown command %s", argv[0]);
@@ -1359,10 +2988,7 @@ static inline int picolDoCommand(pickle_t *i, int argc, char *argv[]) {
 		i->inside_unknown = 0;
 		return r;
 	}
-	picolAssertCommandPreConditions(i, argc, argv, c->privdata);
-	const int r = c->func(i, argc, argv, c->privdata);
-	picolAssertCommandPostConditions(i, r);
-	return r;
+	return picolCallCommand(i, c, argc, argv, argl);
 }
 
 static int picolEvalAndSubst(pickle_t *i, pickle_parser_opts_t *o, const char *eval) {
@@ -1371,7 +2997,7 @@ static int picolEvalAndSubst(pickle_t *i, pickle_parser_opts_t *o, const char *e
 	/* NB: assert(o || !o); */
 	assert(eval);
 	pickle_parser_t p = { .p = NULL };
-	int retcode = PICKLE_OK, argc = 0;
+	int retcode = PICKLE_OK, argc = 0, argmax = 0;
 	char **argv = NULL;
 	if (picolSetResultEmpty(i) != PICKLE_OK)
 		return PICKLE_ERROR;
@@ -1379,6 +3005,7 @@ static int picolEvalAndSubst(pickle_t *i, pickle_parser_opts_t *o, const char *e
 		i->evals--;
 		return error(i, "Invalid recursion: %d", PICKLE_MAX_RECURSION);
 	}
+	const pickle_mark_t mark = picolScratchMark(i);
 	picolParserInitialize(&p, o, eval);
 	for (int prevtype = p.type;;) {
 		if (picolGetToken(&p) != PICKLE_OK) {
@@ -1387,202 +3014,1248 @@ static int picolEvalAndSubst(pickle_t *i, pickle_parser_opts_t *o, const char *e
 		}
 		if (p.type == PT_EOF)
 			break;
+		if (p.type == PT_SEP) {
+			prevtype = p.type;
+			continue;
+		}
+
+		if (p.type == PT_EOL) { /* We have a complete command + args. Call it! */
+			prevtype = p.type;
+			if (p.o.noeval) {
+				char *result = concatenate(i, " ", argc, argv, 0, -1, 0);
+				if (!result) {
+					retcode = PICKLE_ERROR;
+					goto err;
+				}
+				if ((retcode = picolForceResult(i, result, 0)) != PICKLE_OK)
+					goto err;
+			} else {
+				if (argc) {
+					if ((retcode = picolDoCommand(i, argc, argv, NULL)) != PICKLE_OK) {
+						if (retcode == PICKLE_YIELD) /* only compiled scripts can be suspended */
+							retcode = error(i, "Invalid yield");
+						goto err;
+					}
+				}
+			}
+			/* Prepare for the next command */
+			if (picolScratchRelease(i, &mark) != PICKLE_OK) {
+				retcode = PICKLE_ERROR;
+				goto err;
+			}
+			argv = NULL;
+			argc = 0;
+			argmax = 0;
+			continue;
+		}
+
 		int tlen = p.end - p.start + 1;
 		if (tlen < 0)
 			tlen = 0;
-		char *t = picolMalloc(i, tlen + 1); /* Using 'picolStackOrHeapAlloc' may complicate things. */
+		char *t = picolScratchDup(i, p.start, tlen);
 		if (!t) {
 			retcode = PICKLE_ERROR;
 			goto err;
 		}
-		move(t, p.start, tlen);
-		t[tlen] = '\0';
 		if (p.type == PT_VAR) {
 			pickle_var_t * const v = picolGetVar(i, t, 1);
 			if (!v) {
 				retcode = error(i, "Invalid variable %s", t);
-				(void)picolFree(i, t);
 				goto err;
 			}
-			if (picolFree(i, t) != PICKLE_OK)
-				goto err;
-			if (!(t = picolStrdup(i, picolGetVarVal(v)))) {
+			char buffy[PRINT_NUMBER_BUF_SZ];
+			const char *val = picolGetVarVal(v, buffy);
+			if (!(t = picolScratchDup(i, val, picolStrlen(val)))) {
 				retcode = PICKLE_ERROR;
 				goto err;
 			}
 		} else if (p.type == PT_CMD) {
-			retcode = picolEvalAndSubst(i, NULL, t); // NB!
-			if (picolFree(i, t) != PICKLE_OK)
-				goto err;
-			if (retcode != PICKLE_OK)
+			if ((retcode = picolEvalAndSubst(i, NULL, t)) != PICKLE_OK) // NB!
 				goto err;
-			if (!(t = picolStrdup(i, i->result))) {
+			const char *result = picolGetResult(i);
+			char *own = picolResultTake(i); /* taken rather than copied, if it can be */
+			if (!(t = own ? picolScratchAdopt(i, own) : picolScratchDup(i, result, picolStrlen(result)))) {
 				retcode = PICKLE_ERROR;
 				goto err;
 			}
-		} else if (p.type == PT_ESC) {
+		} else if (p.type == PT_ESC && p.escaped) { /* most words have nothing to unescape */
 			if (picolUnEscape(t, tlen + 1/*NUL terminator*/) < 0) {
 				retcode = error(i, "Invalid parse %s", t); /* BUG: %s is probably mangled by now */
-				(void)picolFree(i, t);
-				goto err;
-			}
-		} else if (p.type == PT_SEP) {
-			prevtype = p.type;
-			if (picolFree(i, t) != PICKLE_OK)
 				goto err;
-			continue;
-		}
-
-		if (p.type == PT_EOL) { /* We have a complete command + args. Call it! */
-			if (picolFree(i, t) != PICKLE_OK)
-				goto err;
-			t = NULL;
-			prevtype = p.type;
-			if (p.o.noeval) {
-				char *result = concatenate(i, " ", argc, argv, 0, -1, 0);
-				if (!result) {
-					retcode = PICKLE_ERROR;
-					goto err;
-				}
-				if ((retcode = picolForceResult(i, result, 0)) != PICKLE_OK)
-					goto err;
-			} else {
-				if (argc) {
-					if ((retcode = picolDoCommand(i, argc, argv)) != PICKLE_OK)
-						goto err;
-				}
 			}
-			/* Prepare for the next command */
-			if (picolFreeArgList(i, argc, argv) != PICKLE_OK)
-				return PICKLE_ERROR;
-			argv = NULL;
-			argc = 0;
-			continue;
 		}
 
 		if (prevtype == PT_SEP || prevtype == PT_EOL) { /* New token, append to the previous or as new arg? */
-			char **old = argv;
-			if (!(argv = picolRealloc(i, argv, sizeof(char*)*(argc + 1)))) {
-				argv = old;
+			if (!(argv = picolScratchArgs(i, argv, argc, &argmax))) {
 				retcode = PICKLE_ERROR;
 				goto err;
 			}
-			argv[argc] = t;
-			t = NULL;
-			argc++;
+			argv[argc++] = t;
 		} else { /* Interpolation */
 			assert(argv);
-			const int oldlen = picolStrlen(argv[argc - 1]), ilen = picolStrlen(t);
-			char *arg = picolRealloc(i, argv[argc - 1], oldlen + ilen + 1);
-			if (!arg) {
+			if (!(argv[argc - 1] = picolScratchAppend(i, argv[argc - 1], argv[argc - 1], picolStrlen(argv[argc - 1]), t, picolStrlen(t)))) {
 				retcode = PICKLE_ERROR;
-				(void)picolFree(i, t);
 				goto err;
 			}
-			argv[argc - 1] = arg;
-			move(argv[argc - 1] + oldlen, t, ilen);
-			argv[argc - 1][oldlen + ilen] = '\0';
 		}
-		if (picolFree(i, t) != PICKLE_OK)
-			goto err;
 		prevtype = p.type;
 	}
 err:
 	i->evals--;
-	if (picolFreeArgList(i, argc, argv) != PICKLE_OK)
+	if (picolScratchRelease(i, &mark) != PICKLE_OK)
 		return PICKLE_ERROR;
 	return retcode;
 }
 
-static int picolEval(pickle_t *i, const char *t) {
-	assert(i);
-	assert(t);
-	return picolEvalAndSubst(i, NULL, t);
-}
+enum { UNOT, UINV, UABS, UBOOL, UNEGATE };
+enum {
+	BADD,  BSUB,    BMUL,    BDIV, BMOD,
+	BMORE, BMEQ,    BLESS,   BLEQ, BEQ,
+	BNEQ,  BLSHIFT, BRSHIFT, BAND, BOR,
+	BXOR,  BMIN,    BMAX,    BPOW, BLOG
+};
 
-/*Based on: <http://c-faq.com/lib/regex.html>, also see:
- <https://www.cs.princeton.edu/courses/archive/spr09/cos333/beautiful.html> */
-static inline int match(const char *pat, const char *str, const int nocase, const size_t depth) {
-	assert(pat);
-	assert(str);
-	if (!depth) return -1; /* error: depth exceeded */
- again:
-	switch (*pat) {
-	case '\0': return !*str;
-	case '*': { /* match any number of characters: normally '.*' */
-		const int r = match(pat + 1, str, nocase, depth - 1);
-		if (r)         return r;
-		if (!*(str++)) return 0;
-		goto again;
-	}
-	case '?':  /* match any single characters: normally '.' */
-		if (!*str) return 0;
-		pat++, str++;
-		goto again;
-	case '\\': /* escape character */
-		if (!*(++pat)) return -2; /* error: missing escaped character */
-		if (!*str)     return 0;
-		/* fall through */
-	default:
-		if (nocase) {
-			if (tolower(*pat) != tolower(*str)) return 0;
-		} else {
-			if (*pat != *str) return 0;
-		}
-		pat++, str++;
-		goto again;
+static inline int picolMathUnary(const unsigned op, number_t *a) { /* apply unary operator 'op' to 'a' */
+	assert(a);
+	switch (op) {
+	case UNOT:    *a = !*a; break;
+	case UINV:    *a = ~*a; break;
+	case UABS:    *a = *a < 0 ? -*a : *a; break;
+	case UBOOL:   *a = !!*a; break;
+	case UNEGATE: *a = -*a; break;
+	default: return PICKLE_ERROR;
 	}
-	return -3; /* not reached */
+	return PICKLE_OK;
 }
 
-static inline int isFalse(const char *s) {
-	assert(s);
-	static const char *negatory[] = { "0", "false", "off", "no", };
-	for (size_t i = 0; i < (sizeof(negatory) / sizeof(negatory[0])); i++)
-		if (!picolCompareCaseInsensitive(negatory[i], s))
-			return 1;
-	return 0;
+/* apply binary operator 'op' to 'a' and 'b', for comparisons the result is
+ * accumulated in 'c' (which should start at one) instead of updating 'a' */
+static inline int picolMath(const unsigned op, number_t *a, const number_t b, number_t *c) {
+	assert(a);
+	assert(c);
+	switch (op) {
+	case BADD:    *c = *a + b; *a = *c; break;
+	case BSUB:    *c = *a - b; *a = *c; break;
+	case BMUL:    *c = *a * b; *a = *c; break;
+	case BDIV:    if (!b) return PICKLE_ERROR; *c = *a / b; *a = *c; break;
+	case BMOD:    if (!b) return PICKLE_ERROR; *c = *a % b; *a = *c; break;
+	case BMORE:   *c &= *a > b; break;
+	case BMEQ:    *c &= *a >= b; break;
+	case BLESS:   *c &= *a < b; break;
+	case BLEQ:    *c &= *a <= b; break;
+	case BEQ:     *c &= *a == b; break;
+	case BNEQ:    *c &= *a != b; break;
+	case BLSHIFT: *c = ((unumber_t)*a) << b; *a = *c; break;
+	case BRSHIFT: *c = ((unumber_t)*a) >> b; *a = *c; break;
+	case BAND:    *c = *a & b; *a = *c; break;
+	case BOR:     *c = *a | b; *a = *c; break;
+	case BXOR:    *c = *a ^ b; *a = *c; break;
+	case BMIN:    *c = MIN(*a, b); *a = *c; break;
+	case BMAX:    *c = MAX(*a, b); *a = *c; break;
+	case BPOW:    if (picolPower(*a, b, c)     != PICKLE_OK) return PICKLE_ERROR; *a = *c; break;
+	case BLOG:    if (picolLogarithm(*a, b, c) != PICKLE_OK) return PICKLE_ERROR; *a = *c; break;
+	default: return PICKLE_ERROR;
+	}
+	return PICKLE_OK;
 }
 
-static inline int isTrue(const char *s) {
-	assert(s);
-	static const char *affirmative[] = { "1", "true", "on", "yes", };
-	for (size_t i = 0; i < (sizeof(affirmative) / sizeof(affirmative[0])); i++)
-		if (!picolCompareCaseInsensitive(affirmative[i], s))
-			return 1;
-	return 0;
-}
+static int picolCommandIf(pickle_t *i, const int argc, char **argv, void *pd);
+static int picolCommandWhile(pickle_t *i, const int argc, char **argv, void *pd);
+static int picolCommandFor(pickle_t *i, const int argc, char **argv, void *pd);
+static inline int picolCommandMath(pickle_t *i, const int argc, char **argv, void *pd);
+static inline int picolCommandLLength(pickle_t *i, const int argc, char **argv, void *pd);
+static inline int picolCommandLIndex(pickle_t *i, const int argc, pickle_slice_t *argv, void *pd);
+static inline int picolCommandDict(pickle_t *i, const int argc, char **argv, void *pd);
+static int picolCommandSet(pickle_t *i, const int argc, char **argv, void *pd);
+static inline int picolCommandExpr(pickle_t *i, const int argc, char **argv, void *pd);
+static pickle_expr_t *picolExprGet(pickle_t *i, const char *text);
+static int picolExprEval(pickle_t *i, const pickle_expr_t *e, number_t *out);
+static int picolExprRelease(pickle_t *i, pickle_expr_t *e);
+
+/* Scripts are parsed ahead of time into a token stream that mirrors the
+ * tokens 'picolEvalAndSubst' would see, with separators removed, escapes
+ * already processed and each token marked as either starting a new argument
+ * or being appended to the last one. Parse errors are recorded as a PT_ERROR
+ * token at the position they occur, so that the commands before them are still
+ * executed, as they are when evaluating the string directly.
+ *
+ * The token stream is then compiled; calls to 'if', 'while' and 'for' whose
+ * arguments are all literals have their clauses compiled in line with jumps
+ * between them, and the mathematical operators, 'lindex', 'llength', and
+ * 'dict get' and 'dict exists' of a variable are evaluated directly when
+ * their operands are simple. A 'set' of a variable to its own value
+ * followed by literals and variables appends to it in place. As any command
+ * can be redefined at run time each of these is guarded and falls back to
+ * calling the command normally if the name no longer refers to the built in
+ * the code was compiled for.
+ *
+ * Commands named by a literal remember the command they were resolved to,
+ * along with the interpreters 'epoch', which changes whenever a command is
+ * added or removed; while it stays the same the name does not need looking
+ * up again. */
 
-#define TRCC (256)
+enum { INL_IF, INL_WHILE, INL_FOR, INL_MATH, INL_LIST, INL_SET, INL_EXPR, INL_DICT, };
 
-typedef struct { short set[TRCC]; /* x < 0 == delete, x | 0x100 == squeeze, x < 0x100 == translate */ } tr_t;
+typedef struct {
+	const char *name;   /**< name of the built in command */
+	pickle_func_t func; /**< function that implements it */
+	void *data;         /**< and its private data */
+	int kind;           /**< INL_... */
+	pickle_func_ex_t ex; /**< function that implements it, if it is given slices */
+} pickle_inline_t;          /**< a built in command the compiler knows about */
+
+static const pickle_inline_t inlines[] = {
+	{ "if",     picolCommandIf,    NULL,        INL_IF    , NULL },
+	{ "while",  picolCommandWhile, NULL,        INL_WHILE , NULL },
+	{ "for",    picolCommandFor,   NULL,        INL_FOR   , NULL },
+#if DEFINE_MATHS
+	{ "+",      picolCommandMath,  (char*)BADD,  INL_MATH , NULL },
+	{ "-",      picolCommandMath,  (char*)BSUB,  INL_MATH , NULL },
+	{ "*",      picolCommandMath,  (char*)BMUL,  INL_MATH , NULL },
+	{ "/",      picolCommandMath,  (char*)BDIV,  INL_MATH , NULL },
+	{ "mod",    picolCommandMath,  (char*)BMOD,  INL_MATH , NULL },
+	{ ">",      picolCommandMath,  (char*)BMORE, INL_MATH , NULL },
+	{ ">=",     picolCommandMath,  (char*)BMEQ,  INL_MATH , NULL },
+	{ "<",      picolCommandMath,  (char*)BLESS, INL_MATH , NULL },
+	{ "<=",     picolCommandMath,  (char*)BLEQ,  INL_MATH , NULL },
+	{ "==",     picolCommandMath,  (char*)BEQ,   INL_MATH , NULL },
+	{ "!=",     picolCommandMath,  (char*)BNEQ,  INL_MATH , NULL },
+	{ "expr",   picolCommandExpr,  NULL,         INL_EXPR , NULL },
+#endif
+#if DEFINE_LIST
+	{ "llength", picolCommandLLength, NULL,      INL_LIST,  NULL },
+	{ "lindex", NULL,                 NULL,      INL_LIST,  picolCommandLIndex },
+	{ "dict",   picolCommandDict,     NULL,      INL_DICT,  NULL },
+#endif
+	{ "set",    picolCommandSet,   NULL,        INL_SET   , NULL },
+};
 
-static inline int trInit(tr_t *t, int translate, int compliment, const char *set1, const char *set2) {
-	assert(t);
-	assert(set1);
-	assert(set2);
-	char schoen[TRCC+1] = { 0 };
+typedef struct {
+	pickle_script_t *s; /**< script being assembled */
+	size_t max;         /**< number of ops allocated */
+	size_t used;        /**< bytes of pool used */
+	size_t poolsz;      /**< bytes of pool allocated */
+} pickle_compiler_t;        /**< state used whilst building a script */
 
-	if (compliment) {
-		char haesslich[TRCC] = { 0 };
-		for (unsigned char ch = 0; (ch = *set1); set1++)
-			haesslich[ch] = 1;
-		for (size_t i = 0, j = 0; i < sizeof haesslich; i++)
-			if (haesslich[i] == 0)
-				schoen[j++] = i;
-		set1 = &schoen[1]; /* cannot deal with NUL */
+static pickle_script_t *picolScriptCompile(pickle_t *i, const char *text, const size_t length, const int depth);
+
+static int picolScriptRelease(pickle_t *i, pickle_script_t *s) {
+	assert(i);
+	if (!s)
+		return PICKLE_OK;
+	assert(s->refs > 0);
+	if (--s->refs > 0)
+		return PICKLE_OK;
+	int r = PICKLE_OK;
+	for (int j = 0; j < s->count; j++) {
+		if (picolScriptRelease(i, s->ops[j].child) != PICKLE_OK)
+			r = PICKLE_ERROR;
+		if (picolAtomRelease(i, s->ops[j].atom) != PICKLE_OK)
+			r = PICKLE_ERROR;
+		if (DEFINE_MATHS && picolExprRelease(i, s->ops[j].expr) != PICKLE_OK)
+			r = PICKLE_ERROR;
 	}
+	if (picolFree(i, s->ops) != PICKLE_OK)
+		r = PICKLE_ERROR;
+	if (picolFree(i, s->pool) != PICKLE_OK)
+		r = PICKLE_ERROR;
+	if (picolFree(i, s->source) != PICKLE_OK)
+		r = PICKLE_ERROR;
+	if (picolFree(i, s) != PICKLE_OK)
+		r = PICKLE_ERROR;
+	return r;
+}
 
-	for (size_t i = 0; i < TRCC; i++)
-		t->set[i] = i;
+static inline int picolScriptFits(const size_t size) { /* will an allocation of 'size' succeed */
+	return !USE_MAX_STRING || size <= PICKLE_MAX_STRING;
+}
 
-	for (unsigned char from = 0; (from = *set1); set1++)
-		if (translate) {
-			const unsigned char to = *set2;
-			t->set[to]   |= 0x100;
-			t->set[from] = (t->set[from] & 0x100) | to;
-			if (to && set2[1])
-				set2++;
+static int picolCompilerNew(pickle_t *i, pickle_compiler_t *c) {
+	assert(i);
+	assert(c);
+	zero(c, sizeof *c);
+	if (!(c->s = picolMalloc(i, sizeof *c->s)))
+		return PICKLE_ERROR;
+	zero(c->s, sizeof *c->s);
+	c->s->refs = 1;
+	return PICKLE_OK;
+}
+
+/* Returns PICKLE_OK, PICKLE_ERROR on allocation failure, or PICKLE_BREAK if
+ * the script would be too big, the text is copied, the index of the new
+ * op is 'c->s->count - 1'. */
+static int picolEmit(pickle_t *i, pickle_compiler_t *c, const int op, const int newword, const char *text, const size_t length) {
+	assert(i);
+	assert(c);
+	assert(c->s);
+	assert(text);
+	pickle_script_t *s = c->s;
+	if (c->used + length + 1 > c->poolsz) {
+		const size_t nsz = MAX(c->poolsz * 2, c->used + length + 1);
+		if (!picolScriptFits(nsz))
+			return PICKLE_BREAK;
+		char *n = picolRealloc(i, s->pool, nsz);
+		if (!n)
+			return PICKLE_ERROR;
+		s->pool = n;
+		c->poolsz = nsz;
+	}
+	if ((size_t)s->count >= c->max) {
+		const size_t nmax = MAX(c->max * 2, 8);
+		if (!picolScriptFits(nmax * sizeof *s->ops))
+			return PICKLE_BREAK;
+		pickle_op_t *n = picolRealloc(i, s->ops, nmax * sizeof *s->ops);
+		if (!n)
+			return PICKLE_ERROR;
+		s->ops = n;
+		c->max = nmax;
+	}
+	pickle_op_t *t = &s->ops[s->count++];
+	zero(t, sizeof *t);
+	move(s->pool + c->used, text, length);
+	s->pool[c->used + length] = '\0';
+	t->text    = (char*)(intptr_t)c->used; /* converted to a pointer once the pool stops moving */
+	t->op      = op;
+	t->newword = newword;
+	t->length  = length;
+	c->used += length + 1;
+	return PICKLE_OK;
+}
+
+static int picolEmitOp(pickle_t *i, pickle_compiler_t *c, const int op, int *index) {
+	assert(c);
+	const int r = picolEmit(i, c, op, 0, string_empty, 0);
+	if (index)
+		*index = c->s->count - 1;
+	return r;
+}
+
+/* convert pool offsets to pointers, and optionally compile command substitutions */
+static int picolCompilerFinish(pickle_t *i, pickle_compiler_t *c, const int depth, const int children) {
+	assert(i);
+	assert(c);
+	pickle_script_t *s = c->s;
+	for (int j = 0; j < s->count; j++) {
+		pickle_op_t *t = &s->ops[j];
+		t->text = s->pool + (intptr_t)t->text;
+		if (children && t->op == PT_CMD) {
+			t->child = picolScriptCompile(i, t->text, t->length, depth + 1);
+			if (!(t->child) && i->fatal)
+				return PICKLE_ERROR;
+		}
+	}
+	return PICKLE_OK;
+}
+
+static int picolScriptParse(pickle_t *i, pickle_compiler_t *c, const char *text, const size_t length, const int depth) {
+	assert(i);
+	assert(c);
+	assert(text);
+	pickle_parser_t p = { .p = NULL };
+	int r = PICKLE_OK;
+	picolParserInitialize(&p, NULL, text);
+	for (int prevtype = p.type;;) {
+		if (picolGetToken(&p) != PICKLE_OK) {
+			r = picolEmit(i, c, PT_ERROR, 0, text, length);
+			break;
+		}
+		if (p.type == PT_EOF)
+			break;
+		if (p.type == PT_SEP) {
+			prevtype = p.type;
+			continue;
+		}
+		const int newword = prevtype == PT_SEP || prevtype == PT_EOL;
+		int tlen = p.end - p.start + 1;
+		if (tlen < 0 || p.type == PT_EOL)
+			tlen = 0;
+		if ((r = picolEmit(i, c, p.type, newword, p.start, tlen)) != PICKLE_OK)
+			break;
+		if (p.type == PT_ESC && p.escaped) {
+			pickle_op_t *t = &c->s->ops[c->s->count - 1];
+			const int u = picolUnEscape(c->s->pool + (intptr_t)t->text, tlen + 1);
+			if (u < 0) {
+				t->op = PT_ERROR;
+				break;
+			}
+			t->length = u;
+		}
+		prevtype = p.type;
+	}
+	if (r != PICKLE_OK)
+		return r;
+	return picolCompilerFinish(i, c, depth, 1);
+}
+
+static int picolEmitCopy(pickle_t *i, pickle_compiler_t *c, pickle_op_t *o) {
+	assert(o);
+	const int r = picolEmit(i, c, o->op, o->newword, o->text, o->length);
+	if (r == PICKLE_OK) { /* ownership of any command substitution moves to the new script */
+		c->s->ops[c->s->count - 1].child  = o->child;
+		c->s->ops[c->s->count - 1].cached = o->cached;
+		o->child = NULL;
+	}
+	return r;
+}
+
+static int picolEmitCommand(pickle_t *i, pickle_compiler_t *c, pickle_script_t *t, const int start, const int end) {
+	assert(t);
+	for (int j = start; j <= end && j < t->count; j++) {
+		const int r = picolEmitCopy(i, c, &t->ops[j]);
+		if (r != PICKLE_OK)
+			return r;
+	}
+	return PICKLE_OK;
+}
+
+static int picolCompileBlock(pickle_t *i, pickle_compiler_t *c, const char *text, const size_t length, const int depth, const int nest);
+
+static int picolCompileClause(pickle_t *i, pickle_compiler_t *c, const pickle_op_t *o, const int depth, const int nest) {
+	assert(o);
+	const int r = picolEmitOp(i, c, OP_EMPTY, NULL); /* as 'picolEvalScript' does */
+	if (r != PICKLE_OK)
+		return r;
+	return picolCompileBlock(i, c, o->text, o->length, depth, nest + 1);
+}
+
+static inline void picolPatch(pickle_compiler_t *c, const int op, const int target) {
+	assert(c);
+	assert(op >= 0 && op < c->s->count);
+	c->s->ops[op].target = target;
+}
+
+/* Layout of the code for the in lined control structures, 'F' marks the
+ * fall back code which calls the command normally and 'X' the exit:
+ *
+ *	if:    GUARD F; EMPTY; cond; JUMP_FALSE L; EMPTY; body; JUMP X; L: [EMPTY; else; JUMP X]; F: ...; X:
+ *	while: GUARD F; L: EMPTY; cond; JUMP_FALSE X; LOOP X L; EMPTY; body; UNLOOP; JUMP L; F: ...; X:
+ *	for:   GUARD F; EMPTY; setup; L: EMPTY; cond; JUMP_FALSE X; LOOP X N; EMPTY; body; UNLOOP;
+ *	       N: EMPTY; next; JUMP L; F: ...; X:
+ *
+ * Only the body of a loop is inside LOOP/UNLOOP, a 'break' or 'continue'
+ * anywhere else is passed on as the built in commands would. */
+static int picolCompileControl(pickle_t *i, pickle_compiler_t *c, pickle_script_t *t, const int start, const int end, const int index, const int depth, const int nest) {
+	assert(t);
+	const int kind = inlines[index].kind, words = end - start;
+	const pickle_op_t *w = &t->ops[start];
+	int r = PICKLE_OK, guard = 0, head = 0, test = 0, loop = 0, next = 0, skip = 0, other = -1;
+	if ((r = picolEmit(i, c, OP_GUARD, 0, w[0].text, w[0].length)) != PICKLE_OK)
+		return r;
+	guard = c->s->count - 1;
+	c->s->ops[guard].inl = index;
+	if (kind == INL_FOR)
+		if ((r = picolCompileClause(i, c, &w[1], depth, nest)) != PICKLE_OK)
+			return r;
+	head = c->s->count;
+	if ((r = picolCompileClause(i, c, &w[kind == INL_FOR ? 2 : 1], depth, nest)) != PICKLE_OK)
+		return r;
+	if ((r = picolEmitOp(i, c, OP_JUMP_FALSE, &test)) != PICKLE_OK)
+		return r;
+	if (kind != INL_IF)
+		if ((r = picolEmitOp(i, c, OP_LOOP, &loop)) != PICKLE_OK)
+			return r;
+	if ((r = picolCompileClause(i, c, &w[kind == INL_FOR ? 4 : 2], depth, nest)) != PICKLE_OK)
+		return r;
+	if (kind != INL_IF)
+		if ((r = picolEmitOp(i, c, OP_UNLOOP, NULL)) != PICKLE_OK)
+			return r;
+	next = c->s->count;
+	if (kind == INL_FOR)
+		if ((r = picolCompileClause(i, c, &w[3], depth, nest)) != PICKLE_OK)
+			return r;
+	if ((r = picolEmitOp(i, c, OP_JUMP, &skip)) != PICKLE_OK)
+		return r;
+	if (kind == INL_IF && words == 5) {
+		picolPatch(c, test, c->s->count);
+		if ((r = picolCompileClause(i, c, &w[4], depth, nest)) != PICKLE_OK)
+			return r;
+		if ((r = picolEmitOp(i, c, OP_JUMP, &other)) != PICKLE_OK)
+			return r;
+	}
+	picolPatch(c, guard, c->s->count);
+	if ((r = picolEmitCommand(i, c, t, start, end)) != PICKLE_OK)
+		return r;
+	const int exit = c->s->count;
+	if (kind == INL_IF) {
+		picolPatch(c, skip, exit);
+		picolPatch(c, other >= 0 ? other : test, exit);
+		return PICKLE_OK;
+	}
+	picolPatch(c, skip, head);
+	picolPatch(c, test, exit);
+	picolPatch(c, loop, exit);
+	c->s->ops[loop].length = next;
+	return PICKLE_OK;
+}
+
+static int picolInlineFind(const pickle_op_t *o) {
+	assert(o);
+	if (!DEFINE_COMPILER || (o->op != PT_STR && o->op != PT_ESC))
+		return -1;
+	for (size_t j = 0; j < sizeof (inlines) / sizeof (inlines[0]); j++)
+		if (!compare(inlines[j].name, o->text))
+			return j;
+	return -1;
+}
+
+/* Only decimal literals that cannot overflow are converted ahead of time,
+ * anything else is left to the command to deal with (or report). */
+static int picolLiteralNumber(const char *s, number_t *n) {
+	assert(s);
+	assert(n);
+	const int negate = s[0] == '-', prefix = negate || s[0] == '+';
+	number_t result = 0;
+	size_t j = prefix;
+	for (; s[j] && j < (size_t)(18 + prefix); j++) {
+		if (!isdigit(s[j]))
+			return 0;
+		result = (result * 10) + (s[j] - '0');
+	}
+	if (s[j] || j == (size_t)prefix)
+		return 0;
+	*n = negate ? -result : result;
+	return 1;
+}
+
+static int picolIsOperand(const pickle_op_t *o, const pickle_op_t *next) { /* a single token that is a variable or number */
+	assert(o);
+	assert(next);
+	if (!(o->newword) || !(next->newword || next->op == PT_EOL))
+		return 0;
+	return o->op == PT_VAR || ((o->op == PT_STR || o->op == PT_ESC) && picolLiteralNumber(o->text, &(number_t){ 0 }));
+}
+
+/* 'set name $name...', with only literals and variables after '$name', a
+ * quoted word can start with an empty literal. */
+static int picolIsSelfAppend(const pickle_op_t *w, const int words) {
+	assert(w);
+	if (words < 4 || !(w[1].newword) || (w[1].op != PT_STR && w[1].op != PT_ESC) || !(w[2].newword))
+		return 0;
+	int j = 2;
+	if ((w[j].op == PT_STR || w[j].op == PT_ESC) && !(w[j].length))
+		j++;
+	if (j >= words - 1 || w[j].op != PT_VAR || compare(w[1].text, w[j].text))
+		return 0;
+	for (j++; j < words; j++)
+		if (w[j].newword || (w[j].op != PT_STR && w[j].op != PT_ESC && w[j].op != PT_VAR))
+			return 0;
+	return 1;
+}
+
+/* 'dict get $name key' or 'dict exists $name key', where the key is made of
+ * literals and variables. */
+static int picolIsDictLookup(const pickle_op_t *w, const int words) {
+	assert(w);
+	if (words < 4 || (w[1].op != PT_STR && w[1].op != PT_ESC) || w[2].op != PT_VAR || !(w[3].newword))
+		return 0;
+	if (!(w[1].newword) || !(w[2].newword) || (compare(w[1].text, "get") && compare(w[1].text, "exists")))
+		return 0;
+	for (int j = 3; j < words; j++)
+		if ((j > 3 && w[j].newword) || (w[j].op != PT_STR && w[j].op != PT_ESC && w[j].op != PT_VAR))
+			return 0;
+	return 1;
+}
+
+/* OP_MATH, OP_LIST, OP_APPEND, OP_EXPR and OP_DICT are followed by their operands, then by
+ * the code to call the command normally, which they skip on success:
+ *
+ *	MATH X; a; b; F: ...; X:
+ *	LIST X; list; [index]; F: ...; X:
+ *	APPEND X; name; [""]; $name; tokens...; F: ...; X:
+ *	EXPR X; expression; F: ...; X:
+ *	DICT X; get|exists; $dictionary; key tokens...; F: ...; X: */
+static int picolCompileOperands(pickle_t *i, pickle_compiler_t *c, pickle_script_t *t, const int start, const int end, const int index, const int op) {
+	assert(t);
+	pickle_op_t *w = &t->ops[start];
+	int r = picolEmit(i, c, op, 0, w[0].text, w[0].length);
+	if (r != PICKLE_OK)
+		return r;
+	const int math = c->s->count - 1;
+	c->s->ops[math].inl = index;
+	for (int j = 1; j < end - start; j++) {
+		if ((r = picolEmitCopy(i, c, &w[j])) != PICKLE_OK)
+			return r;
+		pickle_op_t *o = &c->s->ops[c->s->count - 1];
+		if (o->op != PT_VAR)
+			(void)picolLiteralNumber(w[j].text, &o->number);
+	}
+	if ((r = picolEmitCommand(i, c, t, start, end)) != PICKLE_OK)
+		return r;
+	picolPatch(c, math, c->s->count);
+	return PICKLE_OK;
+}
+
+static int picolCompileCommand(pickle_t *i, pickle_compiler_t *c, pickle_script_t *t, const int start, const int end, const int depth, const int nest) {
+	assert(t);
+	assert(start <= end);
+	if (end >= t->count || t->ops[end].op != PT_EOL || start == end)
+		return picolEmitCommand(i, c, t, start, end);
+	const pickle_op_t *w = &t->ops[start];
+	const int words = end - start, index = picolInlineFind(&w[0]);
+	if (index < 0 || (words > 1 && !(w[1].newword)))
+		return picolEmitCommand(i, c, t, start, end);
+	const int kind = inlines[index].kind;
+	if (kind == INL_IF || kind == INL_WHILE || kind == INL_FOR) {
+		int literal = nest < PICKLE_MAX_INLINE;
+		for (int j = 0; j < words && literal; j++) /* each argument must be a single literal token */
+			literal = w[j].newword && (w[j].op == PT_STR || w[j].op == PT_ESC);
+		if (literal && kind == INL_IF && (words == 3 || (words == 5 && !compare(w[3].text, "else"))))
+			return picolCompileControl(i, c, t, start, end, index, depth, nest);
+		if (literal && ((kind == INL_WHILE && words == 3) || (kind == INL_FOR && words == 5)))
+			return picolCompileControl(i, c, t, start, end, index, depth, nest);
+		return picolEmitCommand(i, c, t, start, end);
+	}
+	if (kind == INL_MATH && words == 3 && picolIsOperand(&w[1], &w[2]) && picolIsOperand(&w[2], &w[3]))
+		return picolCompileOperands(i, c, t, start, end, index, OP_MATH);
+	if (kind == INL_LIST && words == 2 + !!inlines[index].ex && w[1].op == PT_VAR && picolIsOperand(&w[1], &w[2]))
+		if (words == 2 || picolIsOperand(&w[2], &w[3]))
+			return picolCompileOperands(i, c, t, start, end, index, OP_LIST);
+	if (kind == INL_SET && picolIsSelfAppend(w, words))
+		return picolCompileOperands(i, c, t, start, end, index, OP_APPEND);
+	if (kind == INL_EXPR && words == 2 && (w[1].op == PT_STR || w[1].op == PT_ESC))
+		return picolCompileOperands(i, c, t, start, end, index, OP_EXPR);
+	if (kind == INL_DICT && picolIsDictLookup(w, words))
+		return picolCompileOperands(i, c, t, start, end, index, OP_DICT);
+	return picolEmitCommand(i, c, t, start, end);
+}
+
+static int picolCompileBlock(pickle_t *i, pickle_compiler_t *c, const char *text, const size_t length, const int depth, const int nest) {
+	assert(i);
+	assert(c);
+	assert(text);
+	pickle_compiler_t t = { .s = NULL };
+	int r = picolCompilerNew(i, &t);
+	if (r != PICKLE_OK)
+		return r;
+	if ((r = picolScriptParse(i, &t, text, length, depth)) != PICKLE_OK)
+		goto done;
+	for (int start = 0, end = 0; start < t.s->count; start = end + 1) {
+		for (end = start; end < t.s->count; end++)
+			if (t.s->ops[end].op == PT_EOL || t.s->ops[end].op == PT_ERROR)
+				break;
+		if (end < t.s->count && end > start && t.s->ops[end].op == PT_EOL) {
+			const pickle_op_t *w = &t.s->ops[start];
+			t.s->ops[end].cached = (w[0].op == PT_STR || w[0].op == PT_ESC) && (end - start == 1 || w[1].newword);
+		}
+		if ((r = picolCompileCommand(i, c, t.s, start, end, depth, nest)) != PICKLE_OK)
+			break;
+	}
+done:
+	if (picolScriptRelease(i, t.s) != PICKLE_OK)
+		r = PICKLE_ERROR;
+	return r;
+}
+
+/* Returns a script with a reference count of one or NULL, if NULL is returned
+ * and the interpreter is not in an erroneous state the script is too
+ * big to compile (only when USE_MAX_STRING is in effect), or too deeply
+ * nested, and should be evaluated directly instead. */
+static pickle_script_t *picolScriptCompile(pickle_t *i, const char *text, const size_t length, const int depth) {
+	assert(i);
+	assert(text);
+	if (depth > PICKLE_MAX_RECURSION || !picolScriptFits(length + 1))
+		return NULL;
+	pickle_compiler_t c = { .s = NULL };
+	if (picolCompilerNew(i, &c) != PICKLE_OK)
+		return NULL;
+	pickle_script_t *s = c.s;
+	s->length = length;
+	if (!(s->source = picolMalloc(i, length + 1)))
+		goto fail;
+	move(s->source, text, length + 1);
+	s->hash = picolHashString(s->source);
+	if (picolCompileBlock(i, &c, s->source, length, depth, 0) != PICKLE_OK)
+		goto fail;
+	if (picolCompilerFinish(i, &c, depth, 0) != PICKLE_OK)
+		goto fail;
+	for (int j = 0; j < s->count; j++) { /* intern the names of variables used */
+		pickle_op_t *o = &s->ops[j];
+		if (o->op == PT_VAR || (j && o[-1].op == OP_APPEND))
+			if (!(o->atom = picolAtom(i, o->text)))
+				goto fail;
+	}
+	return s;
+fail:
+	(void)picolScriptRelease(i, s);
+	return NULL;
+}
+
+/* Look up a script in the cache, compiling and adding it if it is not
+ * present. The returned script has had its reference count incremented. */
+static pickle_script_t *picolScriptGet(pickle_t *i, const char *text) {
+	assert(i);
+	assert(text);
+	const size_t length = picolStrlen(text);
+	if (!PICKLE_CACHE_SIZE || length > PICKLE_CACHE_STRING || !picolScriptFits(length + 1))
+		return picolScriptCompile(i, text, length, 0);
+	if (!(i->cache)) {
+		const size_t bytes = MAX(PICKLE_CACHE_SIZE, 1) * sizeof (*i->cache);
+		if (!(i->cache = picolMalloc(i, bytes)))
+			return NULL;
+		zero(i->cache, bytes);
+	}
+	const unsigned long hash = picolHashString(text);
+	pickle_script_t **slot = &i->cache[hash % MAX(PICKLE_CACHE_SIZE, 1)];
+	pickle_script_t *s = *slot;
+	if (s && s->hash == hash && s->length == length && !memcmp(s->source, text, length)) {
+		s->refs++;
+		return s;
+	}
+	if (!(s = picolScriptCompile(i, text, length, 0)))
+		return NULL;
+	if (picolScriptRelease(i, *slot) != PICKLE_OK) {
+		*slot = NULL;
+		(void)picolScriptRelease(i, s);
+		return NULL;
+	}
+	*slot = s;
+	s->refs++;
+	return s;
+}
+
+static inline const pickle_command_t *picolCachedCommand(pickle_t *i, pickle_op_t *k, const char *name) {
+	assert(i);
+	assert(k);
+	assert(name);
+	if (k->epoch != i->epoch) {
+		k->command = picolGetCommand(i, name);
+		k->epoch   = i->epoch;
+	}
+	return k->command;
+}
+
+/* Returns the built in an OP_GUARD or OP_MATH was compiled for, if its name
+ * still refers to it and it can be called directly, or NULL. */
+static inline const pickle_inline_t *picolInlineGuard(pickle_t *i, pickle_op_t *k) {
+	assert(i);
+	assert(k);
+	assert(k->inl < (sizeof (inlines) / sizeof (inlines[0])));
+	if (i->trace || i->profile)
+		return NULL;
+	const pickle_inline_t *inl = &inlines[k->inl];
+	const pickle_command_t *c = picolCachedCommand(i, k, k->text);
+	return c && c->func == inl->func && c->ex == inl->ex && c->privdata == inl->data ? inl : NULL;
+}
+
+static inline int picolOperand(pickle_t *i, const pickle_op_t *o, number_t *n) {
+	assert(i);
+	assert(o);
+	assert(n);
+	if (o->op != PT_VAR) {
+		*n = o->number;
+		return PICKLE_OK;
+	}
+	pickle_var_t *v = picolGetVarAtom(i, o->atom, 1);
+	return v ? picolGetVarNumber(i, v, n) : PICKLE_ERROR;
+}
+
+/* The operands of OP_APPEND, a variable name, the variable again (perhaps
+ * after an empty literal) and what is to be appended to it, 'set' is called
+ * normally instead (PICKLE_BREAK is returned) if any variable does not
+ * exist, or is appended to itself. */
+static int picolSelfAppend(pickle_t *i, const pickle_op_t *o, const int operands) {
+	assert(i);
+	assert(o);
+	pickle_var_t *v = picolGetVarAtom(i, o[0].atom, 1);
+	if (!v)
+		return PICKLE_BREAK;
+	char buffy[PRINT_NUMBER_BUF_SZ];
+	size_t more = 0, length = 0;
+	const int first = 2 + (o[1].op != PT_VAR);
+	for (int j = first; j < operands; j++) {
+		if (o[j].op != PT_VAR) {
+			more += o[j].length;
+			continue;
+		}
+		pickle_var_t *a = picolGetVarAtom(i, o[j].atom, 1);
+		if (!a || a == v)
+			return PICKLE_BREAK;
+		const char *t = picolGetVarVal(a, buffy);
+		if (!t)
+			return PICKLE_ERROR;
+		more += picolStrlen(t);
+	}
+	const char *old = picolGetVarVal(v, buffy);
+	if (!old)
+		return PICKLE_ERROR;
+	if (USE_MAX_STRING && (picolStrlen(old) + more + 1) >= PICKLE_MAX_STRING)
+		return PICKLE_BREAK;
+	char *s = picolVarReserve(i, v, more, &length);
+	if (!s)
+		return PICKLE_ERROR;
+	for (int j = first; j < operands; j++) {
+		const char *t = o[j].op == PT_VAR ? picolGetVarVal(picolGetVarAtom(i, o[j].atom, 1), buffy) : o[j].text;
+		const size_t tl = o[j].op == PT_VAR ? picolStrlen(t) : (size_t)o[j].length;
+		move(s + length, t, tl);
+		length += tl;
+	}
+	s[length] = '\0';
+	picolVarCapacity(v)->length = length;
+	return picolForceResult(i, s, 1); /* as 'append' does */
+}
+
+/* The operands of OP_DICT, 'get' or 'exists', the dictionary and the tokens
+ * of the key, PICKLE_BREAK is returned if the command should be called
+ * instead, as it should for a key that is missing from 'get'. */
+static int picolDictInline(pickle_t *i, const pickle_op_t *o, const int operands) {
+	assert(i);
+	assert(o);
+	pickle_var_t *v = picolGetVarAtom(i, o[1].atom, 1);
+	pickle_list_t *l = NULL;
+	int r = v ? picolVarList(i, v, &l) : PICKLE_BREAK;
+	if (r == PICKLE_OK)
+		r = picolDictIndex(i, l);
+	if (r != PICKLE_OK)
+		return r;
+	char buffy[PRINT_NUMBER_BUF_SZ]; /* keys are found after 'v' is made a list, they could use it */
+	size_t length = 0;
+	for (int j = 2; j < operands; j++) {
+		pickle_var_t *a = o[j].op == PT_VAR ? picolGetVarAtom(i, o[j].atom, 1) : NULL;
+		const char *t = o[j].op == PT_VAR ? (a ? picolGetVarVal(a, buffy) : NULL) : o[j].text;
+		if (!t)
+			return PICKLE_BREAK;
+		length += o[j].op == PT_VAR ? picolStrlen(t) : (size_t)o[j].length;
+	}
+	const pickle_mark_t mark = picolScratchMark(i);
+	char *key = operands == 3 ? NULL : picolScratch(i, length + 1);
+	if (operands > 3 && !key)
+		return PICKLE_ERROR;
+	for (size_t at = 0, j = 2; key && j < (size_t)operands; j++) {
+		const char *t = o[j].op == PT_VAR ? picolGetVarVal(picolGetVarAtom(i, o[j].atom, 1), buffy) : o[j].text;
+		const size_t tl = o[j].op == PT_VAR ? picolStrlen(t) : (size_t)o[j].length;
+		move(key + at, t, tl);
+		key[at += tl] = '\0';
+	}
+	if (!key)
+		key = o[2].op == PT_VAR ? (char*)picolGetVarVal(picolGetVarAtom(i, o[2].atom, 1), buffy) : o[2].text;
+	const int exists = o[0].text[0] == 'e', item = picolDictFind(l, key);
+	if (picolScratchRelease(i, &mark) != PICKLE_OK)
+		return PICKLE_ERROR;
+	if (exists)
+		return picolSetResultNumber(i, item >= 0);
+	return item >= 0 ? picolListIndex(i, l, item + 1) : PICKLE_BREAK;
+}
+
+static int picolResumeFree(pickle_t *i, pickle_resume_t *r);
+
+/* A command returning PICKLE_YIELD suspends the evaluation of every script
+ * between it and whatever is able to resume them, which is 'coroutine', a
+ * coroutine being called, or 'pickle_eval_start' and 'pickle_resume'. Each
+ * compiled script, as it returns, records where it was in a
+ * 'pickle_resume_t' added to 'i->yielded', so those are in the order they
+ * need resuming, innermost first, by 'picolResume'. Only scripts evaluated
+ * directly by something that knows how to resume them can be suspended;
+ * the body of a procedure called from such a script, a substitution in
+ * one, or the clauses of in lined 'if', 'while' and 'for', but not a script
+ * evaluated by another command written in C ('catch', 'eval', 'foreach',
+ * ...), as the C stack cannot be unwound and rebuilt. A yield from any
+ * other script is an error. */
+static int picolSuspend(pickle_t *i, pickle_script_t *s, const int pc, const int loops, const int *loop, const int argc, const pickle_slice_t *argl, const int resumable) {
+	assert(i);
+	assert(s);
+	assert(loop);
+	implies(argc, argl);
+	if (!resumable)
+		return error(i, "Invalid yield");
+	pickle_resume_t *r = picolMalloc(i, sizeof *r);
+	if (!r)
+		return PICKLE_ERROR;
+	zero(r, sizeof *r);
+	if (argc && !(r->words = picolMalloc(i, argc * sizeof (*r->words)))) {
+		(void)picolFree(i, r);
+		return PICKLE_ERROR;
+	}
+	for (; r->argc < argc; r->argc++) {
+		char *w = picolMalloc(i, argl[r->argc].len + 1);
+		if (!w) {
+			(void)picolResumeFree(i, r);
+			return PICKLE_ERROR;
+		}
+		move(w, argl[r->argc].ptr, argl[r->argc].len + 1);
+		r->words[r->argc] = (pickle_slice_t) { .ptr = w, .len = argl[r->argc].len };
+	}
+	s->refs++;
+	r->script = s;
+	r->frame  = i->callframe;
+	r->level  = i->level;
+	r->pc     = pc;
+	r->loops  = loops;
+	move(r->loop, loop, loops * sizeof (*loop));
+	if (i->yield_last)
+		i->yield_last->next = r;
+	else
+		i->yielded = r;
+	i->yield_last = r;
+	return PICKLE_YIELD;
+}
+
+/* Evaluate a compiled script, from the start or from where it was suspended
+ * in 'at', the result then being that of the command that yielded. */
+static int picolEvalScript(pickle_t *i, pickle_script_t *s, const int resumable, const pickle_resume_t *at) {
+	assert(i);
+	assert(i->initialized);
+	assert(s);
+	assert(s->refs > 0);
+	implies(at, at->script == s);
+	int retcode = PICKLE_OK, argc = 0, argmax = 0, loops = 0, j = 0, resume = 0;
+	int loop[PICKLE_MAX_INLINE]; /* OP_LOOP instructions of the loops we are in the body of */
+	char **argv = NULL; /* copies of the words in 'argl', NULL if a word is still a view of the script */
+	pickle_slice_t *argl = NULL;
+	if (!at && picolSetResultEmpty(i) != PICKLE_OK)
+		return PICKLE_ERROR;
+	if (i->evals++ >= PICKLE_MAX_RECURSION) {
+		i->evals--;
+		return error(i, "Invalid recursion: %d", PICKLE_MAX_RECURSION);
+	}
+	const pickle_mark_t mark = picolScratchMark(i);
+	if (at) { /* carry on from the instruction that suspended us, with the arguments built so far */
+		for (; argc < at->argc; argc++) {
+			char *arg = NULL;
+			if (picolScratchWords(i, &argv, &argl, argc, &argmax) != PICKLE_OK || !(arg = picolScratchDup(i, at->words[argc].ptr, at->words[argc].len))) {
+				retcode = PICKLE_ERROR;
+				goto err;
+			}
+			argv[argc] = arg;
+			argl[argc] = (pickle_slice_t){ .ptr = arg, .len = at->words[argc].len };
+		}
+		loops = at->loops;
+		move(loop, at->loop, loops * sizeof (*loop));
+		j = at->pc;
+		resume = 1;
+	}
+	for (; j < s->count; j++) {
+		pickle_op_t *k = &s->ops[j];
+		char buffy[PRINT_NUMBER_BUF_SZ];
+		const char *t = NULL;
+		char *own = NULL; /* an allocated result, given to the argument instead of copied */
+		size_t tl = 0;
+		int copy = 1;
+		switch (k->op) {
+		case PT_ERROR:
+			retcode = error(i, "Invalid parse %s", k->text);
+			goto err;
+		case OP_JUMP:
+			if (k->target <= j && i->budgeted && (retcode = picolBudgetCheck(i)) != PICKLE_OK)
+				goto err;
+			j = k->target - 1;
+			continue;
+		case OP_JUMP_FALSE:
+			if (picolResultIsFalse(i))
+				j = k->target - 1;
+			continue;
+		case OP_EMPTY:
+			if ((retcode = picolSetResultEmpty(i)) != PICKLE_OK)
+				goto err;
+			continue;
+		case OP_GUARD:
+			if (!picolInlineGuard(i, k))
+				j = k->target - 1;
+			else if ((retcode = picolCounted(i)) != PICKLE_OK) /* as if the command had been called */
+				goto err;
+			continue;
+		case OP_LOOP:
+			assert(loops < PICKLE_MAX_INLINE);
+			loop[loops++] = j;
+			continue;
+		case OP_UNLOOP:
+			assert(loops > 0);
+			loops--;
+			continue;
+		case OP_MATH: {
+			number_t a = 0, b = 0, c = 1;
+			const pickle_inline_t *inl = picolInlineGuard(i, k);
+			if (inl
+				&& picolOperand(i, &s->ops[j + 1], &a) == PICKLE_OK
+				&& picolOperand(i, &s->ops[j + 2], &b) == PICKLE_OK
+				&& picolMath((intptr_t)(char*)inl->data, &a, b, &c) == PICKLE_OK) {
+				if ((retcode = picolCounted(i)) != PICKLE_OK || (retcode = picolSetResultNumber(i, c)) != PICKLE_OK)
+					goto err;
+				j = k->target - 1;
+				continue;
+			}
+			j += 2; /* skip operands, call the command normally so it can deal with any errors */
+			continue;
+		}
+		case OP_LIST: { /* 'llength $v' or 'lindex $v index', with the items of 'v' found once */
+			const pickle_inline_t *inl = picolInlineGuard(i, k);
+			const int lindex = inlines[k->inl].ex != NULL;
+			pickle_var_t *v = inl ? picolGetVarAtom(i, s->ops[j + 1].atom, 1) : NULL;
+			pickle_list_t *l = NULL;
+			number_t n = 0;
+			const int r = v ? picolVarList(i, v, &l) : PICKLE_BREAK;
+			if (r == PICKLE_ERROR) {
+				retcode = PICKLE_ERROR;
+				goto err;
+			}
+			if (r == PICKLE_OK && (!lindex || picolOperand(i, &s->ops[j + 2], &n) == PICKLE_OK)) {
+				if ((retcode = picolCounted(i)) != PICKLE_OK)
+					goto err;
+				if ((retcode = lindex ? picolListIndex(i, l, n) : picolSetResultNumber(i, l->count)) != PICKLE_OK)
+					goto err;
+				j = k->target - 1;
+				continue;
+			}
+			j += 1 + lindex;
+			continue;
+		}
+		case OP_APPEND: { /* 'set name $name...', the tokens after '$name' are appended to it */
+			int operands = 2;
+			while (!(s->ops[j + 1 + operands].newword))
+				operands++;
+			const int r = picolInlineGuard(i, k) ? picolSelfAppend(i, &s->ops[j + 1], operands) : PICKLE_BREAK;
+			if (r == PICKLE_ERROR) {
+				retcode = PICKLE_ERROR;
+				goto err;
+			}
+			if (r == PICKLE_OK) {
+				if ((retcode = picolCounted(i)) != PICKLE_OK)
+					goto err;
+				j = k->target - 1;
+				continue;
+			}
+			j += operands;
+			continue;
+		}
+		case OP_EXPR: { /* 'expr {...}', compiled once and evaluated without calling the command */
+			if (!picolInlineGuard(i, k)) {
+				j++;
+				continue;
+			}
+			number_t n = 0;
+			if ((retcode = picolCounted(i)) != PICKLE_OK)
+				goto err;
+			if (!(k->expr) && !(k->expr = picolExprGet(i, s->ops[j + 1].text))) {
+				retcode = PICKLE_ERROR;
+				goto err;
+			}
+			if ((retcode = picolExprEval(i, k->expr, &n)) != PICKLE_OK)
+				goto code; /* a command substitution may 'break' */
+			if ((retcode = picolSetResultNumber(i, n)) != PICKLE_OK)
+				goto err;
+			j = k->target - 1;
+			continue;
+		}
+		case OP_DICT: { /* 'dict get $v key' or 'dict exists $v key', with the keys of 'v' indexed once */
+			int operands = 3;
+			while (!(s->ops[j + 1 + operands].newword))
+				operands++;
+			const int r = picolInlineGuard(i, k) ? picolDictInline(i, &s->ops[j + 1], operands) : PICKLE_BREAK;
+			if (r == PICKLE_ERROR) {
+				retcode = PICKLE_ERROR;
+				goto err;
+			}
+			if (r == PICKLE_OK) {
+				if ((retcode = picolCounted(i)) != PICKLE_OK)
+					goto err;
+				j = k->target - 1;
+				continue;
+			}
+			j += operands; /* a missing key is an error */
+			continue;
+		}
+		case PT_EOL: { /* We have a complete command + args. Call it! */
+			const pickle_command_t *c = NULL;
+			if (resume) {
+				retcode = at->code;
+				resume = 0;
+			} else if (argc && k->cached && !i->trace && (c = picolCachedCommand(i, k, argl[0].ptr))) {
+				i->cmdcount++;
+				if ((retcode = picolSetResultEmpty(i)) == PICKLE_OK)
+					if (c->ex || (retcode = picolSliceOwn(i, argc, argv, argl)) == PICKLE_OK) {
+						if (resumable)
+							i->callsite = argv;
+						retcode = picolCallCommand(i, c, argc, argv, argl);
+						i->callsite = NULL;
+					}
+			} else if (argc) {
+				if ((retcode = picolSliceOwn(i, argc, argv, argl)) == PICKLE_OK) {
+					if (resumable)
+						i->callsite = argv;
+					retcode = picolDoCommand(i, argc, argv, argl);
+					i->callsite = NULL;
+				}
+			}
+			const int r = picolScratchRelease(i, &mark);
+			argv = NULL;
+			argl = NULL;
+			argc = 0;
+			argmax = 0;
+			if (r != PICKLE_OK) {
+				retcode = PICKLE_ERROR;
+				goto err;
+			}
+			if (retcode != PICKLE_OK)
+				goto code;
+			continue;
+		}
+		case PT_VAR: {
+			pickle_var_t * const v = picolGetVarAtom(i, k->atom, 1);
+			if (!v) {
+				retcode = error(i, "Invalid variable %s", k->text);
+				goto err;
+			}
+			t  = picolGetVarVal(v, buffy); /* 'v' may be changed by the command, so it is copied */
+			tl = picolStrlen(t);
+			break;
+		}
+		case PT_CMD:
+			if (resume) {
+				retcode = at->code;
+				resume = 0;
+			} else {
+				retcode = k->child ? picolEvalScript(i, k->child, resumable, NULL) : picolEvalAndSubst(i, NULL, k->text);
+			}
+			if (retcode != PICKLE_OK)
+				goto code;
+			t  = picolGetResult(i);
+			tl = picolStrlen(t);
+			if (k->newword && (own = picolResultTake(i)))
+				copy = 0;
+			break;
+		default: /* literals are passed as views into the script, and only copied for commands that need it */
+			assert(k->op == PT_STR || k->op == PT_ESC);
+			t    = k->text;
+			tl   = k->length;
+			copy = 0;
+			break;
+		}
+		if (k->newword) { /* New token, append to the previous or as new arg? */
+			char *arg = NULL;
+			if (picolScratchWords(i, &argv, &argl, argc, &argmax) != PICKLE_OK) {
+				(void)picolFree(i, own);
+				retcode = PICKLE_ERROR;
+				goto err;
+			}
+			if ((own && !(arg = picolScratchAdopt(i, own))) || (copy && !(arg = picolScratchDup(i, t, tl)))) {
+				retcode = PICKLE_ERROR;
+				goto err;
+			}
+			argv[argc]   = arg;
+			argl[argc++] = (pickle_slice_t){ .ptr = arg ? arg : t, .len = tl };
+			continue;
+		}
+		assert(argl); /* Interpolation */
+		pickle_slice_t *w = &argl[argc - 1];
+		if (!(argv[argc - 1] = picolScratchAppend(i, argv[argc - 1], w->ptr, w->len, t, tl))) {
+			retcode = PICKLE_ERROR;
+			goto err;
+		}
+		w->ptr  = argv[argc - 1];
+		w->len += tl;
+		continue;
+code: /* A command returned something other than PICKLE_OK, 'break' and 'continue' apply to an in lined loop */
+		if (retcode == PICKLE_YIELD) {
+			retcode = picolSuspend(i, s, j, loops, loop, argc, argl, resumable);
+			goto err;
+		}
+		if ((retcode != PICKLE_BREAK && retcode != PICKLE_CONTINUE) || !loops)
+			goto err;
+		if (picolScratchRelease(i, &mark) != PICKLE_OK) {
+			retcode = PICKLE_ERROR;
+			goto err;
+		}
+		argv = NULL;
+		argl = NULL;
+		argc = 0;
+		argmax = 0;
+		k = &s->ops[loop[--loops]];
+		j = (retcode == PICKLE_BREAK ? k->target : k->length) - 1;
+		retcode = PICKLE_OK;
+	}
+err:
+	i->evals--;
+	if (picolScratchRelease(i, &mark) != PICKLE_OK)
+		return PICKLE_ERROR;
+	return retcode;
+}
+
+static int picolEval(pickle_t *i, const char *t) {
+	assert(i);
+	assert(t);
+	pickle_script_t *s = picolScriptGet(i, t);
+	if (!s)
+		return i->fatal ? PICKLE_ERROR : picolEvalAndSubst(i, NULL, t);
+	const int r = picolEvalScript(i, s, 0, NULL);
+	return picolScriptRelease(i, s) == PICKLE_OK ? r : PICKLE_ERROR;
+}
+
+/* Match a glob pattern, returning 1 if it matches, 0 if it does not and -2
+ * if the pattern ends in an escape. Rather than recursing on each '*' the
+ * position of the last one seen is remembered, and when matching fails after
+ * it the '*' is made to take one more character and matching resumes from
+ * there. Earlier stars never need to be revisited, so this takes at most
+ * time proportional to the length of the pattern times that of the string. */
+static inline int match(const char *pat, const char *str, const int nocase) {
+	assert(pat);
+	assert(str);
+	const char *star = NULL, *resume = NULL;
+	for (;;) {
+		switch (*pat) {
+		case '\0':
+			if (!*str)
+				return 1;
+			goto backtrack;
+		case '*': /* match any number of characters: normally '.*' */
+			star = ++pat;
+			resume = str;
+			continue;
+		case '?': /* match any single characters: normally '.' */
+			if (!*str)
+				return 0;
+			pat++, str++;
+			continue;
+		case '\\': /* escape character */
+			if (!*(++pat))
+				return -2; /* error: missing escaped character */
+			/* fall through */
+		default:
+			if (!*str)
+				return 0;
+			if (nocase ? tolower(*pat) == tolower(*str) : *pat == *str) {
+				pat++, str++;
+				continue;
+			}
+			goto backtrack;
+		}
+	backtrack:
+		if (!star || !*resume)
+			return 0;
+		pat = star;
+		str = ++resume;
+	}
+	return -3; /* not reached */
+}
+
+#define TRCC (256)
+
+typedef struct { short set[TRCC]; /* x < 0 == delete, x | 0x100 == squeeze, x < 0x100 == translate */ } tr_t;
+
+static inline int trInit(tr_t *t, int translate, int compliment, const char *set1, const char *set2) {
+	assert(t);
+	assert(set1);
+	assert(set2);
+	char schoen[TRCC+1] = { 0 };
+
+	if (compliment) {
+		char haesslich[TRCC] = { 0 };
+		for (unsigned char ch = 0; (ch = *set1); set1++)
+			haesslich[ch] = 1;
+		for (size_t i = 0, j = 0; i < sizeof haesslich; i++)
+			if (haesslich[i] == 0)
+				schoen[j++] = i;
+		set1 = &schoen[1]; /* cannot deal with NUL */
+	}
+
+	for (size_t i = 0; i < TRCC; i++)
+		t->set[i] = i;
+
+	for (unsigned char from = 0; (from = *set1); set1++)
+		if (translate) {
+			const unsigned char to = *set2;
+			t->set[to]   |= 0x100;
+			t->set[from] = (t->set[from] & 0x100) | to;
+			if (to && set2[1])
+				set2++;
 		} else { /* delete */
 			t->set[from] = -1;
 		}
@@ -1667,7 +4340,7 @@ static inline int trimOps(pickle_t *i, pickle_stack_or_heap_t *h, int op, const
 	return r;
 }
 
-static inline int picolCommandString(pickle_t *i, const int argc, char **argv, void *pd) { /* Big! */
+static inline int picolCommandStringArgs(pickle_t *i, const int argc, char **argv, void *pd) { /* Big! */
 	UNUSED(pd);
 	assert(!pd);
 	ARITY(argc < 3, "subcommand opts...: perform string operations depending on subcommand");
@@ -1685,12 +4358,16 @@ static inline int picolCommandString(pickle_t *i, const int argc, char **argv, v
 			return picolSetResultNumber(i, picolStrlen(arg1));
 		if (!compare(rq, "toupper") || !compare(rq, "tolower")) {
 			const int lower = rq[2] == 'l';
-			if (picolStackOrHeapAlloc(i, &h, picolStrlen(arg1) + 1) != PICKLE_OK)
+			const size_t l = picolStrlen(arg1);
+			if (picolStackOrHeapAlloc(i, &h, l + 1) != PICKLE_OK)
 				return PICKLE_ERROR;
-			size_t j = 0;
-			for (j = 0; arg1[j]; j++)
-				h.p[j] = lower ? tolower(arg1[j]) : toupper(arg1[j]);
-			h.p[j] = 0;
+			for (size_t j = 0; j < l; j++) { /* runs left as they are are copied at once, ASCII as in the C locale */
+				const size_t run = picolSpan(&arg1[j], l - j, lower ? SC_UPPER : SC_LOWER);
+				move(&h.p[j], &arg1[j], run);
+				if ((j += run) < l)
+					h.p[j] = arg1[j] ^ 0x20;
+			}
+			h.p[l] = 0;
 			if (picolOnHeap(i, &h))
 				return picolForceResult(i, h.p, 0);
 			const int r = picolSetResultString(i, h.p);
@@ -1743,9 +4420,9 @@ static inline int picolCommandString(pickle_t *i, const int argc, char **argv, v
 		if (!compare(rq, "trim"))
 			return trimOps(i, &h, TRIM, arg1, arg2);
 		if (!compare(rq, "match"))  {
-			const int r = match(arg1, arg2, 0, PICKLE_MAX_RECURSION - i->level);
+			const int r = match(arg1, arg2, 0);
 			if (r < 0)
-				return error(i, "Invalid recursion %d", r);
+				return error(i, "Invalid pattern %s", arg1);
 			return picolSetResultNumber(i, r);
 		}
 		if (!compare(rq, "equal"))
@@ -1878,9 +4555,9 @@ static inline int picolCommandString(pickle_t *i, const int argc, char **argv, v
 		if (!compare(rq, "match"))  {
 			if (compare(arg1, "-nocase"))
 				return error(i, "Invalid option %s", arg1);
-			const int r = match(arg2, arg3, 1, PICKLE_MAX_RECURSION - i->level);
+			const int r = match(arg2, arg3, 1);
 			if (r < 0)
-				return error(i, "Invalid recursion %d", r);
+				return error(i, "Invalid pattern %s", arg2);
 			return picolSetResultNumber(i, r);
 		}
 		if (!compare(rq, "tr"))
@@ -1925,6 +4602,39 @@ static inline int picolCommandString(pickle_t *i, const int argc, char **argv, v
 	return error(i, "Invalid option %s", argv[0]);
 }
 
+static inline int picolCommandString(pickle_t *i, const int argc, pickle_slice_t *argv, void *pd) {
+	UNUSED(pd);
+	assert(!pd);
+	ARITY_SLICE(argc < 3, "subcommand opts...: perform string operations depending on subcommand");
+	const char *rq = argv[1].ptr; /* the common subcommands use the length of their arguments, others get a copy */
+	if (argc == 3 && !compare(rq, "length"))
+		return picolSetResultNumber(i, argv[2].len);
+	if (argc == 4) {
+		const pickle_slice_t *arg1 = &argv[2], *arg2 = &argv[3];
+		if (!compare(rq, "equal") || !compare(rq, "unequal")) {
+			const int equal = arg1->len == arg2->len && !compareBytes(arg1->ptr, arg2->ptr, arg1->len);
+			return picolSetResultNumber(i, rq[0] == 'e' ? equal : !equal);
+		}
+		if (!compare(rq, "index"))   {
+			number_t index = 0;
+			if (picolStringToNumber(i, arg2->ptr, &index) != PICKLE_OK)
+				return PICKLE_ERROR;
+			const number_t length = arg1->len;
+			if (index < 0)
+				index = length + index;
+			if (index > length)
+				index = length - 1;
+			if (index < 0)
+				index = 0;
+			return picolSetResultBuffer(i, &arg1->ptr[index], index < length);
+		}
+	}
+	const pickle_mark_t mark = picolScratchMark(i);
+	char **args = picolSliceArgs(i, argc, argv);
+	const int r = args ? picolCommandStringArgs(i, argc, args, pd) : PICKLE_ERROR;
+	return picolScratchRelease(i, &mark) == PICKLE_OK ? r : PICKLE_ERROR;
+}
+
 static inline int picolCommandEqual(pickle_t *i, const int argc, char **argv, void *pd) {
 	UNUSED(pd);
 	assert(!pd);
@@ -1950,36 +4660,465 @@ static int picolCommandIncr(pickle_t *i, const int argc, char **argv, void *pd)
 	pickle_var_t *v = picolGetVar(i, argv[1], 1);
 	if (!v)
 		return error(i, "Invalid variable %s", argv[1]);
-	const char *ns = picolGetVarVal(v);
-	if (picolStringToNumber(i, ns, &n) != PICKLE_OK)
+	if (picolGetVarNumber(i, v, &n) != PICKLE_OK)
 		return PICKLE_ERROR;
 	n += incr;
-	if (picolSetVarInteger(i, argv[1], n) != PICKLE_OK)
+	if (picolSetVarNumber(i, v, n) != PICKLE_OK)
 		return PICKLE_ERROR;
 	return picolSetResultNumber(i, n);
 }
 
-enum { UNOT, UINV, UABS, UBOOL, UNEGATE };
-enum {
-	BADD,  BSUB,    BMUL,    BDIV, BMOD,
-	BMORE, BMEQ,    BLESS,   BLEQ, BEQ,
-	BNEQ,  BLSHIFT, BRSHIFT, BAND, BOR,
-	BXOR,  BMIN,    BMAX,    BPOW, BLOG
+/* Expressions, as given to 'expr', are compiled into reverse Polish order
+ * instructions working on a small stack of numbers, the operators have the
+ * same precedence as in C (and TCL), with '**' for powers binding tighter
+ * than multiplication, and '&&', '||' and '?:' only evaluating the operands
+ * they need. Variables are interned and commands substitutions kept as text
+ * to be evaluated when needed; each use of the expression then only has to
+ * run the instructions. Compiled expressions are kept in a small cache keyed
+ * by their text, as scripts are. */
+
+enum { EX_NUMBER, EX_VAR, EX_CMD, EX_UNARY, EX_BINARY, EX_AND, EX_OR, EX_JUMP, EX_JUMP_FALSE, };
+enum { EXPR_TERNARY = 1, EXPR_OR, EXPR_AND, }; /* lowest precedence levels, which are not a single instruction */
+
+typedef struct {
+	pickle_expr_t *e;   /**< expression being assembled */
+	const char *p;      /**< current position in its source */
+	int max;            /**< number of instructions allocated */
+	int depth, deepest; /**< operands on the stack at this point, and the most there ever are */
+	int nest;           /**< depth of recursion */
+} pickle_expr_parser_t;
+
+static const struct {
+	const char *name;
+	unsigned char op, precedence, right;
+} operators[] = { /* two character operators are matched first */
+	{ "**", BPOW,    13, 1 }, { "<<", BLSHIFT, 10, 0 }, { ">>", BRSHIFT, 10, 0 },
+	{ "<=", BLEQ,     9, 0 }, { ">=", BMEQ,     9, 0 }, { "==", BEQ,      8, 0 },
+	{ "!=", BNEQ,     8, 0 }, { "&&", 0, EXPR_AND, 0 }, { "||", 0,  EXPR_OR, 0 },
+	{ "*",  BMUL,    12, 0 }, { "/",  BDIV,    12, 0 }, { "%",  BMOD,    12, 0 },
+	{ "+",  BADD,    11, 0 }, { "-",  BSUB,    11, 0 }, { "<",  BLESS,    9, 0 },
+	{ ">",  BMORE,    9, 0 }, { "&",  BAND,     7, 0 }, { "^",  BXOR,     6, 0 },
+	{ "|",  BOR,      5, 0 }, { "?",  0, EXPR_TERNARY, 1 },
+};
+
+static const struct {
+	const char *name;
+	unsigned char op, binary;
+} functions[] = {
+	{ "abs", UABS, 0 }, { "bool", UBOOL, 0 }, { "log", BLOG, 1 },
+	{ "max", BMAX, 1 }, { "min",  BMIN,  1 }, { "pow", BPOW, 1 },
 };
 
+static int picolExprRelease(pickle_t *i, pickle_expr_t *e) {
+	assert(i);
+	if (!e)
+		return PICKLE_OK;
+	assert(e->refs > 0);
+	if (--e->refs > 0)
+		return PICKLE_OK;
+	int r = PICKLE_OK;
+	for (int j = 0; j < e->count; j++) {
+		const pickle_expr_op_t *o = &e->ops[j];
+		if (o->code == EX_VAR && picolAtomRelease(i, o->data.atom) != PICKLE_OK)
+			r = PICKLE_ERROR;
+		if (o->code == EX_CMD && picolFree(i, o->data.text) != PICKLE_OK)
+			r = PICKLE_ERROR;
+	}
+	if (picolFree(i, e->ops) != PICKLE_OK)
+		r = PICKLE_ERROR;
+	if (picolFree(i, e->source) != PICKLE_OK)
+		r = PICKLE_ERROR;
+	if (picolFree(i, e) != PICKLE_OK)
+		r = PICKLE_ERROR;
+	return r;
+}
+
+static int picolExprInvalid(pickle_t *i, pickle_expr_parser_t *x) {
+	assert(i);
+	assert(x);
+	return error(i, "Invalid expression %s", x->e->source);
+}
+
+static inline void picolExprSpace(pickle_expr_parser_t *x) {
+	assert(x);
+	while (isspace(*x->p))
+		x->p++;
+}
+
+static inline int picolExprExpect(pickle_expr_parser_t *x, const int ch) { /* skip 'ch', which must be next */
+	assert(x);
+	if (*x->p != ch)
+		return 0;
+	x->p++;
+	return 1;
+}
+
+/* Add an instruction, returning where it is or -1, which operands are taken
+ * from the stack and which put on it is tracked to size the stack. */
+static int picolExprEmit(pickle_t *i, pickle_expr_parser_t *x, const int code, const int op) {
+	assert(i);
+	assert(x);
+	pickle_expr_t *e = x->e;
+	if (e->count >= x->max) {
+		const int max = x->max ? x->max * 2 : 8;
+		if (!picolScriptFits(max * sizeof (*e->ops)))
+			return picolExprInvalid(i, x), -1;
+		pickle_expr_op_t *ops = picolRealloc(i, e->ops, max * sizeof (*ops));
+		if (!ops)
+			return -1;
+		e->ops = ops;
+		x->max = max;
+	}
+	pickle_expr_op_t *o = &e->ops[e->count];
+	zero(o, sizeof *o);
+	o->code = code;
+	o->op   = op;
+	switch (code) {
+	case EX_NUMBER: case EX_VAR: case EX_CMD:
+		x->deepest = MAX(x->deepest, x->depth + 1);
+		x->depth++;
+		break;
+	case EX_BINARY: case EX_AND: case EX_OR: case EX_JUMP_FALSE:
+		x->depth--;
+		break;
+	}
+	return e->count++;
+}
+
+static int picolExprBinary(pickle_t *i, pickle_expr_parser_t *x, const int precedence);
+
+static int picolExprName(pickle_t *i, pickle_expr_parser_t *x, const int code, const char *name, const size_t length) {
+	assert(i);
+	assert(x);
+	assert(name);
+	char *s = picolMalloc(i, length + 1);
+	if (!s)
+		return PICKLE_ERROR;
+	move(s, name, length);
+	s[length] = '\0';
+	const int j = picolExprEmit(i, x, code, 0);
+	if (j < 0) {
+		(void)picolFree(i, s);
+		return PICKLE_ERROR;
+	}
+	if (code == EX_CMD) {
+		x->e->ops[j].data.text = s;
+		return PICKLE_OK;
+	}
+	x->e->ops[j].data.atom = picolAtom(i, s);
+	if (picolFree(i, s) != PICKLE_OK || !(x->e->ops[j].data.atom)) {
+		x->e->ops[j].code = EX_NUMBER; /* so it is not released */
+		return PICKLE_ERROR;
+	}
+	return PICKLE_OK;
+}
+
+static int picolExprFunction(pickle_t *i, pickle_expr_parser_t *x) {
+	assert(i);
+	assert(x);
+	const char *name = x->p;
+	while (isalpha(*x->p))
+		x->p++;
+	const size_t length = x->p - name;
+	for (size_t j = 0; j < sizeof (functions) / sizeof (functions[0]); j++) {
+		if (picolStrlen(functions[j].name) != length || memcmp(functions[j].name, name, length))
+			continue;
+		picolExprSpace(x);
+		if (!picolExprExpect(x, '(') || picolExprBinary(i, x, 0) != PICKLE_OK)
+			return picolExprInvalid(i, x);
+		if (functions[j].binary && (!picolExprExpect(x, ',') || picolExprBinary(i, x, 0) != PICKLE_OK))
+			return picolExprInvalid(i, x);
+		if (!picolExprExpect(x, ')'))
+			return picolExprInvalid(i, x);
+		return picolExprEmit(i, x, functions[j].binary ? EX_BINARY : EX_UNARY, functions[j].op) < 0 ? PICKLE_ERROR : PICKLE_OK;
+	}
+	return picolExprInvalid(i, x);
+}
+
+/* an operand; a number, variable, command, function call, parenthesized
+ * expression, or one of these after a unary operator */
+static int picolExprUnary(pickle_t *i, pickle_expr_parser_t *x) {
+	assert(i);
+	assert(x);
+	if (++(x->nest) > PICKLE_MAX_RECURSION)
+		return picolExprInvalid(i, x);
+	picolExprSpace(x);
+	const int ch = *x->p;
+	int r = PICKLE_OK;
+	if (ch == '-' || ch == '+' || ch == '!' || ch == '~') {
+		x->p++;
+		if ((r = picolExprUnary(i, x)) == PICKLE_OK && ch != '+')
+			if (picolExprEmit(i, x, EX_UNARY, ch == '-' ? UNEGATE : ch == '!' ? UNOT : UINV) < 0)
+				r = PICKLE_ERROR;
+	} else if (ch == '(') {
+		x->p++;
+		if ((r = picolExprBinary(i, x, 0)) == PICKLE_OK && !picolExprExpect(x, ')'))
+			r = picolExprInvalid(i, x);
+	} else if (isdigit(ch)) {
+		number_t n = 0;
+		for (; isdigit(*x->p); x->p++)
+			n = (n * 10) + (*x->p - '0');
+		const int j = picolExprEmit(i, x, EX_NUMBER, 0);
+		if (j < 0)
+			r = PICKLE_ERROR;
+		else if (isalpha(*x->p) || *x->p == '_')
+			r = picolExprInvalid(i, x);
+		else
+			x->e->ops[j].data.number = n;
+	} else if (ch == '$') {
+		const char *name = ++(x->p);
+		if (*name == '{') {
+			const char *end = locateChar(++name, '}');
+			if (!end)
+				return picolExprInvalid(i, x);
+			x->p = end + 1;
+			r = picolExprName(i, x, EX_VAR, name, end - name);
+		} else {
+			while (isalnum(*x->p) || *x->p == '_')
+				x->p++;
+			r = x->p == name ? picolExprInvalid(i, x) : picolExprName(i, x, EX_VAR, name, x->p - name);
+		}
+	} else if (ch == '[') {
+		const char *script = ++(x->p);
+		for (int level = 1; level; x->p++) {
+			if (!*x->p)
+				return picolExprInvalid(i, x);
+			if (*x->p == '\\' && x->p[1])
+				x->p++;
+			else if (*x->p == '[')
+				level++;
+			else if (*x->p == ']')
+				level--;
+		}
+		r = picolExprName(i, x, EX_CMD, script, x->p - script - 1);
+	} else if (isalpha(ch)) {
+		r = picolExprFunction(i, x);
+	} else {
+		r = picolExprInvalid(i, x);
+	}
+	x->nest--;
+	picolExprSpace(x);
+	return r;
+}
+
+static void picolExprPatch(pickle_expr_parser_t *x, const int j) {
+	assert(x);
+	x->e->ops[j].target = x->e->count;
+}
+
+/* operands joined by binary operators of at least 'precedence', by precedence
+ * climbing, the operator with the highest precedence binds first */
+static int picolExprBinary(pickle_t *i, pickle_expr_parser_t *x, const int precedence) {
+	assert(i);
+	assert(x);
+	if (picolExprUnary(i, x) != PICKLE_OK)
+		return PICKLE_ERROR;
+	for (;;) {
+		size_t j = 0;
+		for (; j < sizeof (operators) / sizeof (operators[0]); j++) {
+			const char *name = operators[j].name;
+			if (name[0] == x->p[0] && (!name[1] || name[1] == x->p[1]))
+				break;
+		}
+		if (j == sizeof (operators) / sizeof (operators[0]) || operators[j].precedence < precedence)
+			return PICKLE_OK;
+		x->p += picolStrlen(operators[j].name);
+		const int level = operators[j].precedence;
+		if (level == EXPR_TERNARY) { /* c ? a : b becomes c; JUMP_FALSE B; a; JUMP E; B: b; E: */
+			const int b = picolExprEmit(i, x, EX_JUMP_FALSE, 0);
+			if (b < 0 || picolExprBinary(i, x, 0) != PICKLE_OK)
+				return PICKLE_ERROR;
+			if (!picolExprExpect(x, ':'))
+				return picolExprInvalid(i, x);
+			const int e = picolExprEmit(i, x, EX_JUMP, 0);
+			if (e < 0)
+				return PICKLE_ERROR;
+			x->depth--; /* either 'a' or 'b' is left on the stack, not both */
+			picolExprPatch(x, b);
+			if (picolExprBinary(i, x, level) != PICKLE_OK)
+				return PICKLE_ERROR;
+			picolExprPatch(x, e);
+			continue;
+		}
+		if (level == EXPR_AND || level == EXPR_OR) { /* a && b becomes a; AND E; b; BOOL; E: */
+			const int e = picolExprEmit(i, x, level == EXPR_AND ? EX_AND : EX_OR, 0);
+			if (e < 0 || picolExprBinary(i, x, level + 1) != PICKLE_OK)
+				return PICKLE_ERROR;
+			if (picolExprEmit(i, x, EX_UNARY, UBOOL) < 0)
+				return PICKLE_ERROR;
+			picolExprPatch(x, e);
+			continue;
+		}
+		if (picolExprBinary(i, x, level + !(operators[j].right)) != PICKLE_OK)
+			return PICKLE_ERROR;
+		if (picolExprEmit(i, x, EX_BINARY, operators[j].op) < 0)
+			return PICKLE_ERROR;
+	}
+}
+
+/* Returns an expression with a reference count of one, or NULL with an
+ * error set if it is invalid or memory runs out. */
+static pickle_expr_t *picolExprCompile(pickle_t *i, const char *text, const size_t length) {
+	assert(i);
+	assert(text);
+	if (!picolScriptFits(length + 1)) {
+		(void)error(i, "Invalid expression %s", text);
+		return NULL;
+	}
+	pickle_expr_parser_t x = { .e = picolMalloc(i, sizeof (*x.e)) };
+	if (!(x.e))
+		return NULL;
+	zero(x.e, sizeof (*x.e));
+	x.e->refs   = 1;
+	x.e->length = length;
+	if (!(x.e->source = picolMalloc(i, length + 1)))
+		goto fail;
+	move(x.e->source, text, length + 1);
+	x.e->hash = picolHashString(x.e->source);
+	x.p = x.e->source;
+	if (picolExprBinary(i, &x, 0) != PICKLE_OK)
+		goto fail;
+	if (*x.p || x.deepest > PICKLE_EXPR_STACK) {
+		(void)picolExprInvalid(i, &x);
+		goto fail;
+	}
+	assert(x.depth == 1);
+	return x.e;
+fail:
+	(void)picolExprRelease(i, x.e);
+	return NULL;
+}
+
+/* Look up an expression in the cache, compiling and adding it if it is not
+ * present, as 'picolScriptGet' does for scripts. */
+static pickle_expr_t *picolExprGet(pickle_t *i, const char *text) {
+	assert(i);
+	assert(text);
+	const size_t length = picolStrlen(text);
+	if (!PICKLE_EXPR_CACHE || length > PICKLE_CACHE_STRING)
+		return picolExprCompile(i, text, length);
+	if (!(i->exprs)) {
+		const size_t bytes = MAX(PICKLE_EXPR_CACHE, 1) * sizeof (*i->exprs);
+		if (!(i->exprs = picolMalloc(i, bytes)))
+			return NULL;
+		zero(i->exprs, bytes);
+	}
+	const unsigned long hash = picolHashString(text);
+	pickle_expr_t **slot = &i->exprs[hash % MAX(PICKLE_EXPR_CACHE, 1)];
+	pickle_expr_t *e = *slot;
+	if (e && e->hash == hash && e->length == length && !memcmp(e->source, text, length)) {
+		e->refs++;
+		return e;
+	}
+	if (!(e = picolExprCompile(i, text, length)))
+		return NULL;
+	if (picolExprRelease(i, *slot) != PICKLE_OK) {
+		*slot = NULL;
+		(void)picolExprRelease(i, e);
+		return NULL;
+	}
+	*slot = e;
+	e->refs++;
+	return e;
+}
+
+/* The caller must hold a reference to 'e', a command substitution in it
+ * could otherwise replace it in the cache whilst it is running. */
+static int picolExprEval(pickle_t *i, const pickle_expr_t *e, number_t *out) {
+	assert(i);
+	assert(e);
+	assert(out);
+	number_t stack[PICKLE_EXPR_STACK];
+	int sp = 0;
+	*out = 0;
+	for (int j = 0; j < e->count; j++) {
+		const pickle_expr_op_t *o = &e->ops[j];
+		switch (o->code) {
+		case EX_NUMBER:
+			stack[sp++] = o->data.number;
+			break;
+		case EX_VAR: {
+			pickle_var_t *v = picolGetVarAtom(i, o->data.atom, 1);
+			if (!v)
+				return error(i, "Invalid variable %s", o->data.atom->name);
+			if (picolGetVarNumber(i, v, &stack[sp++]) != PICKLE_OK)
+				return PICKLE_ERROR;
+			break;
+		}
+		case EX_CMD: {
+			const int r = picolEval(i, o->data.text);
+			if (r != PICKLE_OK)
+				return r;
+			if (picolStringToNumber(i, picolGetResult(i), &stack[sp++]) != PICKLE_OK)
+				return PICKLE_ERROR;
+			break;
+		}
+		case EX_UNARY:
+			if (picolMathUnary(o->op, &stack[sp - 1]) != PICKLE_OK)
+				return error(i, "Invalid expression %s", e->source);
+			break;
+		case EX_BINARY: {
+			number_t c = 1;
+			sp--;
+			if (picolMath(o->op, &stack[sp - 1], stack[sp], &c) != PICKLE_OK)
+				return error(i, "Invalid expression %s", e->source);
+			stack[sp - 1] = c;
+			break;
+		}
+		case EX_AND: /* the operand is left as the result if it decides it */
+			if (stack[sp - 1])
+				sp--;
+			else
+				j = o->target - 1;
+			break;
+		case EX_OR:
+			if (stack[sp - 1]) {
+				stack[sp - 1] = 1;
+				j = o->target - 1;
+			} else {
+				sp--;
+			}
+			break;
+		case EX_JUMP_FALSE:
+			if (!stack[--sp])
+				j = o->target - 1;
+			break;
+		case EX_JUMP:
+			j = o->target - 1;
+			break;
+		default:
+			return error(i, "Invalid expression %s", e->source);
+		}
+		assert(sp >= 0 && sp <= PICKLE_EXPR_STACK);
+	}
+	assert(sp == 1);
+	*out = stack[0];
+	return PICKLE_OK;
+}
+
+static inline int picolCommandExpr(pickle_t *i, const int argc, char **argv, void *pd) {
+	UNUSED(pd);
+	ARITY(argc < 2, "expression...: evaluate an infix expression");
+	char *cat = argc == 2 ? argv[1] : concatenate(i, " ", argc - 1, argv + 1, 0, -1, 0);
+	if (!cat)
+		return PICKLE_ERROR;
+	pickle_expr_t *e = picolExprGet(i, cat);
+	number_t n = 0;
+	int r = e ? picolExprEval(i, e, &n) : PICKLE_ERROR;
+	if (picolExprRelease(i, e) != PICKLE_OK)
+		r = PICKLE_ERROR;
+	if (cat != argv[1] && picolFree(i, cat) != PICKLE_OK)
+		r = PICKLE_ERROR;
+	return r == PICKLE_OK ? picolSetResultNumber(i, n) : r;
+}
+
 static inline int picolCommandMathUnary(pickle_t *i, const int argc, char **argv, void *pd) {
 	ARITY(argc != 2, "number: unary operator");
 	number_t a = 0;
 	if (picolStringToNumber(i, argv[1], &a) != PICKLE_OK)
 		return PICKLE_ERROR;
-	switch ((intptr_t)(char*)pd) {
-	case UNOT:    a = !a; break;
-	case UINV:    a = ~a; break;
-	case UABS:    a = a < 0 ? -a : a; break;
-	case UBOOL:   a = !!a; break;
-	case UNEGATE: a = -a; break;
-	default: return error(i, "Invalid operation %s", argv[0]);
-	}
+	if (picolMathUnary((intptr_t)(char*)pd, &a) != PICKLE_OK)
+		return error(i, "Invalid operation %s", argv[0]);
 	return picolSetResultNumber(i, a);
 }
 
@@ -1994,28 +5133,10 @@ static inline int picolCommandMath(pickle_t *i, const int argc, char **argv, voi
 	for (int j = 2; j < argc; j++) {
 		if (picolStringToNumber(i, argv[j], &b) != PICKLE_OK)
 			return PICKLE_ERROR;
-		switch (op) {
-		case BADD:    c = a + b; a = c; break;
-		case BSUB:    c = a - b; a = c; break;
-		case BMUL:    c = a * b; a = c; break;
-		case BDIV:    if (b) { c = a / b; a = c; } else { return error(i, "Invalid %s %s", argv[0], argv[j]); } break;
-		case BMOD:    if (b) { c = a % b; a = c; } else { return error(i, "Invalid %s %s", argv[0], argv[j]); } break;
-		case BMORE:   c &= a > b; break;
-		case BMEQ:    c &= a >= b; break;
-		case BLESS:   c &= a < b; break;
-		case BLEQ:    c &= a <= b; break;
-		case BEQ:     c &= a == b; break;
-		case BNEQ:    c &= a != b; break;
-		case BLSHIFT: c = ((unumber_t)a) << b; a = c; break;
-		case BRSHIFT: c = ((unumber_t)a) >> b; a = c; break;
-		case BAND:    c = a & b; a = c; break;
-		case BOR:     c = a | b; a = c; break;
-		case BXOR:    c = a ^ b; a = c; break;
-		case BMIN:    c = MIN(a, b); a = c; break;
-		case BMAX:    c = MAX(a, b); a = c; break;
-		case BPOW:    if (picolPower(a, b, &c)     != PICKLE_OK) return error(i, "Invalid operation %s", argv[0]); a = c; break;
-		case BLOG:    if (picolLogarithm(a, b, &c) != PICKLE_OK) return error(i, "Invalid operation %s", argv[0]); a = c; break;
-		default: return error(i, "Invalid operation %s", argv[0]);
+		if (picolMath(op, &a, b, &c) != PICKLE_OK) {
+			if (op == BDIV || op == BMOD)
+				return error(i, "Invalid %s %s", argv[0], argv[j]);
+			return error(i, "Invalid operation %s", argv[0]);
 		}
 	}
 	return picolSetResultNumber(i, c);
@@ -2025,27 +5146,32 @@ static int picolCommandSet(pickle_t *i, const int argc, char **argv, void *pd) {
 	UNUSED(pd);
 	ARITY(argc != 3 && argc != 2, "name string?: set a variable and return it");
 	if (argc == 2) {
-		const char *r = NULL;
-		const int retcode = pickle_var_get(i, argv[1], &r);
-		if (retcode != PICKLE_OK || !r)
+		pickle_var_t *v = picolGetVar(i, argv[1], 1);
+		if (!v)
 			return error(i, "Invalid variable %s", argv[1]);
-		return picolSetResultString(i, r);
+		if (v->type == PV_NUMBER)
+			return picolSetResultNumber(i, v->data.number);
+		if (v->type == PV_LIST)
+			return picolSetResultList(i, v->data.list);
+		char buffy[PRINT_NUMBER_BUF_SZ];
+		return picolSetResultString(i, picolGetVarVal(v, buffy));
 	}
-	if (pickle_var_set(i, argv[1], argv[2]) != PICKLE_OK)
+	pickle_var_t *v = NULL; /* a large value is moved into the variable from the arguments */
+	if (picolSetVar(i, argv[1], argv[2], picolScratchTake(i, argv[2]), &v) != PICKLE_OK)
 		return PICKLE_ERROR;
-	return picolSetResultString(i, argv[2]);
+	char buffy[PRINT_NUMBER_BUF_SZ];
+	return picolSetResultString(i, picolGetVarVal(v, buffy));
 }
 
 static int picolCommandCatch(pickle_t *i, const int argc, char **argv, void *pd) {
 	UNUSED(pd);
 	ARITY(argc != 2 && argc != 3, "expression variable: evaluate expression and catch return code");
 	const int r = picolEval(i, argv[1]);
-	const char *s = NULL;
-	if (pickle_result_get(i, &s) != PICKLE_OK)
-		return PICKLE_ERROR;
-	if (argc == 3)
-		if (pickle_var_set(i, argv[2], s) != PICKLE_OK)
+	if (argc == 3) {
+		const char *s = picolGetResult(i);
+		if (picolSetVar(i, argv[2], s, picolResultTake(i), NULL) != PICKLE_OK)
 			return PICKLE_ERROR;
+	}
 	return picolSetResultNumber(i, r);
 }
 
@@ -2058,7 +5184,7 @@ static int picolCommandIf(pickle_t *i, const int argc, char **argv, void *pd) {
 			return error(i, "Invalid operation %s", argv[0]);
 	if ((r= picolEval(i, argv[1])) != PICKLE_OK)
 		return r;
-	if (!isFalse(i->result))
+	if (!picolResultIsFalse(i))
 		return picolEval(i, argv[2]);
 	else if (argc == 5)
 		return picolEval(i, argv[4]);
@@ -2073,7 +5199,7 @@ static int picolCommandWhile(pickle_t *i, const int argc, char **argv, void *pd)
 		const int r1 = picolEval(i, argv[1]);
 		if (r1 != PICKLE_OK)
 			return r1;
-		if (isFalse(i->result))
+		if (picolResultIsFalse(i))
 			return PICKLE_OK;
 		const int r2 = picolEval(i, argv[2]);
 		switch (r2) {
@@ -2088,6 +5214,44 @@ static int picolCommandWhile(pickle_t *i, const int argc, char **argv, void *pd)
 	}
 }
 
+/* The argument list is split on spaces once, when a procedure is defined,
+ * rather than each time it is called. Returns the text with no references,
+ * in a single allocation. */
+static pickle_proc_text_t *picolProcText(pickle_t *i, const char *args, const char *body) {
+	assert(i);
+	assert(args);
+	assert(body);
+	const size_t al = picolStrlen(args), bl = picolStrlen(body);
+	int count = 0;
+	for (size_t j = 0; j < al; j++)
+		count += args[j] != ' ' && (j == 0 || args[j - 1] == ' ');
+	pickle_proc_text_t *text = picolMalloc(i, sizeof (*text) + (count * sizeof (char*)) + (2 * al) + bl + 3);
+	if (!text)
+		return NULL;
+	zero(text, sizeof *text);
+	text->params = (char**)(text + 1);
+	text->args   = (char*)(text->params + count);
+	text->body   = text->args + al + 1;
+	move(text->args, args, al + 1);
+	move(text->body, body, bl + 1);
+	char *names = text->body + bl + 1;
+	move(names, args, al + 1);
+	for (size_t j = 0; j < al; j++) {
+		if (names[j] == ' ')
+			names[j] = '\0';
+		else if (j == 0 || names[j - 1] == '\0')
+			text->params[text->count++] = &names[j];
+	}
+	assert(text->count == count);
+	text->variadic = count && !compare(text->params[count - 1], "args");
+	text->unique   = 1;
+	for (int j = 0; j < count; j++)
+		for (int k = j + 1; k < count; k++)
+			if (!compare(text->params[j], text->params[k]))
+				text->unique = 0;
+	return text;
+}
+
 static int picolCommandApply(pickle_t *i, const int argc, char **argv, void *pd) {
 	UNUSED(pd);
 	assert(!pd);
@@ -2099,39 +5263,186 @@ static int picolCommandApply(pickle_t *i, const int argc, char **argv, void *pd)
 		(void)picolFreeArgList(i, a.argc, a.argv);
 		return error(i, "Invalid option %s", argv[1]);
 	}
-	const int r = picolCommandCallProc(i, argc - 1, argv + 1, a.argv);
-	if (picolFreeArgList(i, a.argc, a.argv) != PICKLE_OK)
+	pickle_proc_t proc = { .text = picolProcText(i, a.argv[0], a.argv[1]), .script = NULL, .params = NULL };
+	if (picolFreeArgList(i, a.argc, a.argv) != PICKLE_OK || !(proc.text)) {
+		(void)picolFree(i, proc.text);
+		return PICKLE_ERROR;
+	}
+	int r = picolCommandCallProc(i, argc - 1, argv + 1, &proc);
+	if (picolScriptRelease(i, proc.script) != PICKLE_OK)
+		r = PICKLE_ERROR;
+	if (picolProcParamsFree(i, &proc) != PICKLE_OK)
+		r = PICKLE_ERROR;
+	if (picolFree(i, proc.text) != PICKLE_OK)
+		return PICKLE_ERROR;
+	return r;
+}
+
+static int picolCommandFor(pickle_t *i, const int argc, char **argv, void *pd) {
+	UNUSED(pd);
+	assert(!pd);
+	ARITY(argc != 5, "setup condition after clause: evaluate clause whilst condition is true");
+	const int r1 = picolEval(i, argv[1]);
+	if (r1 != PICKLE_OK)
+		return r1;
+	for (;;) {
+		const int r2 = picolEval(i, argv[2]);
+		if (r2 != PICKLE_OK)
+			return r2;
+		if (picolResultIsFalse(i))
+			return PICKLE_OK;
+		const int r3 = picolEval(i, argv[4]);
+		switch (r3) {
+		case PICKLE_OK:
+		case PICKLE_CONTINUE:
+			break;
+		case PICKLE_BREAK:
+			return PICKLE_OK;
+		default:
+			return r3;
+		}
+		const int r4 = picolEval(i, argv[3]);
+		if (r4 != PICKLE_OK)
+			return r4;
+	}
+}
+
+/* A list is split once into a copy of it, with each item terminated in place,
+ * so its items can be used as strings without being looked up again. The
+ * list should be freed with 'picolListSplitFree' even if this fails. */
+static int picolListSplit(pickle_t *i, pickle_list_t *l, const char *s) {
+	assert(i);
+	assert(l);
+	assert(s);
+	zero(l, sizeof *l);
+	l->length = picolStrlen(s);
+	l->size   = l->length + 1;
+	if (!(l->string = picolStrdup(i, s)))
+		return PICKLE_ERROR;
+	const int r = picolListParse(i, l, 0);
+	if (r != PICKLE_OK)
+		return r == PICKLE_BREAK ? error(i, "Invalid list %s", s) : PICKLE_ERROR;
+	for (int j = 0; j < l->count; j++)
+		l->string[l->items[j].start + l->items[j].length] = '\0';
+	return PICKLE_OK;
+}
+
+static inline const char *picolListItem(const pickle_list_t *l, const int j) {
+	assert(l);
+	assert(j >= 0 && j < l->count);
+	return l->string + l->items[j].start;
+}
+
+static int picolListSplitFree(pickle_t *i, pickle_list_t *l) {
+	assert(i);
+	assert(l);
+	const int r1 = picolFree(i, l->string);
+	const int r2 = picolFree(i, l->items);
+	const int r3 = picolFree(i, l->index);
+	return r1 == PICKLE_OK && r2 == PICKLE_OK && r3 == PICKLE_OK ? PICKLE_OK : PICKLE_ERROR;
+}
+
+static inline int picolCommandForeach(pickle_t *i, const int argc, char **argv, void *pd) {
+	UNUSED(pd);
+	assert(!pd);
+	ARITY(argc < 4 || (argc % 2), "{variables} list... clause: evaluate clause for each item in the lists");
+	const int pairs = (argc - 2) / 2;
+	pickle_list_t small[8], *l = small; /* variable names then items of each pair */
+	if ((pairs * 2) > (int)(sizeof (small) / sizeof (small[0])) && !(l = picolMalloc(i, pairs * 2 * sizeof *l)))
 		return PICKLE_ERROR;
+	zero(l, pairs * 2 * sizeof *l);
+	int r = PICKLE_OK, loops = 0;
+	for (int j = 0; j < pairs && r == PICKLE_OK; j++) {
+		pickle_list_t *names = &l[j * 2], *items = &l[(j * 2) + 1];
+		if ((r = picolListSplit(i, names, argv[(j * 2) + 1])) != PICKLE_OK)
+			break;
+		if (!(names->count)) {
+			r = error(i, "Invalid variable list %s", argv[(j * 2) + 1]);
+			break;
+		}
+		if ((r = picolListSplit(i, items, argv[(j * 2) + 2])) == PICKLE_OK)
+			loops = MAX(loops, (items->count + names->count - 1) / names->count);
+	}
+	for (int n = 0; n < loops && r == PICKLE_OK; n++) {
+		for (int j = 0; j < pairs && r == PICKLE_OK; j++) {
+			const pickle_list_t *names = &l[j * 2], *items = &l[(j * 2) + 1];
+			for (int k = 0; k < names->count && r == PICKLE_OK; k++) {
+				const int item = (n * names->count) + k; /* there are empty items after the end of a list */
+				r = picolSetVar(i, picolListItem(names, k), item < items->count ? picolListItem(items, item) : "", NULL, NULL);
+			}
+		}
+		if (r == PICKLE_OK && (r = picolEval(i, argv[argc - 1])) == PICKLE_CONTINUE)
+			r = PICKLE_OK;
+	}
+	if (r == PICKLE_BREAK)
+		r = PICKLE_OK;
+	if (r == PICKLE_OK)
+		r = picolSetResultEmpty(i);
+	for (int j = 0; j < (pairs * 2); j++)
+		if (picolListSplitFree(i, &l[j]) != PICKLE_OK)
+			r = PICKLE_ERROR;
+	if (l != small && picolFree(i, l) != PICKLE_OK)
+		r = PICKLE_ERROR;
 	return r;
 }
 
-static int picolCommandFor(pickle_t *i, const int argc, char **argv, void *pd) {
+static inline int picolSwitchMatch(pickle_t *i, const char *pattern, const char *string, const int glob, const int nocase) {
+	assert(i);
+	assert(pattern);
+	assert(string);
+	if (!glob)
+		return nocase ? !picolCompareCaseInsensitive(pattern, string) : !compare(pattern, string);
+	const int m = match(pattern, string, nocase);
+	return m < 0 ? error(i, "Invalid pattern %s", pattern) : m;
+}
+
+static inline int picolCommandSwitch(pickle_t *i, const int argc, char **argv, void *pd) {
 	UNUSED(pd);
 	assert(!pd);
-	ARITY(argc != 5, "setup condition after clause: evaluate clause whilst condition is true");
-	const int r1 = picolEval(i, argv[1]);
-	if (r1 != PICKLE_OK)
-		return r1;
-	for (;;) {
-		const int r2 = picolEval(i, argv[2]);
-		if (r2 != PICKLE_OK)
-			return r2;
-		if (isFalse(i->result))
-			return PICKLE_OK;
-		const int r3 = picolEval(i, argv[4]);
-		switch (r3) {
-		case PICKLE_OK:
-		case PICKLE_CONTINUE:
+	ARITY(argc < 3, "opts... string {pattern clause...}: evaluate the clause of the first pattern matching string");
+	int j = 1, glob = 0, nocase = 0;
+	for (; (argc - j) > 2 && argv[j][0] == '-'; j++) { /* the string itself may start with '-' */
+		if (!compare(argv[j], "--")) {
+			j++;
 			break;
-		case PICKLE_BREAK:
-			return PICKLE_OK;
-		default:
-			return r3;
 		}
-		const int r4 = picolEval(i, argv[3]);
-		if (r4 != PICKLE_OK)
-			return r4;
+		if (!compare(argv[j], "-exact"))
+			glob = 0;
+		else if (!compare(argv[j], "-glob"))
+			glob = 1;
+		else if (!compare(argv[j], "-nocase"))
+			nocase = 1;
+		else
+			return error(i, "Invalid option %s", argv[j]);
+	}
+	if ((argc - j) < 2)
+		return error(i, "Invalid %s arity: %d", argv[0], argc);
+	const char *string = argv[j++];
+	pickle_list_t l = { .string = NULL }; /* patterns and clauses given as one list */
+	const int inline_arms = (argc - j) > 1;
+	int r = inline_arms ? PICKLE_OK : picolListSplit(i, &l, argv[j]);
+	const int arms = inline_arms ? (argc - j) : l.count;
+#define ARM(K) (inline_arms ? argv[j + (K)] : picolListItem(&l, (K)))
+	if (r == PICKLE_OK && (arms % 2))
+		r = error(i, "Invalid pattern %s: no clause", ARM(arms - 1));
+	int found = -1;
+	for (int k = 0; r == PICKLE_OK && found < 0 && k < arms; k += 2) {
+		const char *pattern = ARM(k);
+		const int m = (k == (arms - 2)) && !compare(pattern, "default") ? 1 : picolSwitchMatch(i, pattern, string, glob, nocase);
+		if (m < 0)
+			r = PICKLE_ERROR;
+		else if (m)
+			found = k + 1;
 	}
+	while (r == PICKLE_OK && found >= 0 && !compare(ARM(found), "-")) /* fall through to the next clause */
+		if ((found += 2) >= arms)
+			r = error(i, "Invalid clause -");
+	if (r == PICKLE_OK)
+		r = found < 0 ? picolSetResultEmpty(i) : picolEval(i, ARM(found));
+#undef ARM
+	if (!inline_arms && picolListSplitFree(i, &l) != PICKLE_OK)
+		r = PICKLE_ERROR;
+	return r;
 }
 
 static inline int picolCommandLRepeat(pickle_t *i, const int argc, char **argv, void *pd) {
@@ -2205,28 +5516,30 @@ static inline int picolCommandLReverse(pickle_t *i, const int argc, char **argv,
 	return picolForceResult(i, s, 0);
 }
 
-static inline int picolCommandLIndex(pickle_t *i, const int argc, char **argv, void *pd) {
+static inline int picolCommandLIndex(pickle_t *i, const int argc, pickle_slice_t *argv, void *pd) {
 	UNUSED(pd);
 	assert(!pd);
 	if (argc == 2)
-		return picolSetResultString(i, argv[1]);
-	ARITY(argc != 3, "list index?: index into a list");
-	number_t index = 0;
-	if (picolStringToNumber(i, argv[2], &index) != PICKLE_OK)
+		return picolSetResultBuffer(i, argv[1].ptr, argv[1].len);
+	ARITY_SLICE(argc != 3, "list index?: index into a list");
+	number_t index = 0, j = 0;
+	if (picolStringToNumber(i, argv[2].ptr, &index) != PICKLE_OK)
 		return PICKLE_ERROR;
-	const args_t a = picolArgs(i, &(pickle_parser_opts_t){ 1, 1, 1, 1 }, argv[1]);
-	if (a.argc < 0)
-		return PICKLE_ERROR;
-	if (!a.argc || index >= a.argc || index < 0) {
-		if (picolFreeArgList(i, a.argc, a.argv) != PICKLE_OK)
+	pickle_parser_t p = { .p = NULL };
+	pickle_slice_t found = { .ptr = NULL };
+	picolParserInitialize(&p, &(pickle_parser_opts_t){ 1, 1, 1, 1 }, argv[1].ptr);
+	for (;;) { /* the whole list is parsed so badly formed lists are still an error */
+		if (picolGetToken(&p) != PICKLE_OK)
 			return PICKLE_ERROR;
-		return picolSetResultEmpty(i);
+		if (p.type == PT_EOF)
+			break;
+		if (p.type == PT_STR || p.type == PT_VAR || p.type == PT_CMD || p.type == PT_ESC)
+			if (j++ == index)
+				found = (pickle_slice_t){ .ptr = p.start, .len = (p.end - p.start) + 1 };
 	}
-	index = MAX(0, MIN(index, a.argc - 1));
-	const int r1 = picolForceResult(i, a.argv[index], 0);
-	a.argv[index] = NULL;
-	const int r2 = picolFreeArgList(i, a.argc, a.argv);
-	return r1 == PICKLE_OK && r2 == PICKLE_OK ? PICKLE_OK : PICKLE_ERROR;
+	if (!found.ptr)
+		return picolSetResultEmpty(i);
+	return picolSetResultBuffer(i, found.ptr, found.len);
 }
 
 enum { INSERT, DELETE, SET }; /* picolListOperation, and the list functions, are far too complex... */
@@ -2324,95 +5637,242 @@ static inline int picolCommandLSet(pickle_t *i, const int argc, char **argv, voi
 	pickle_var_t *v = picolGetVar(i, argv[1], 1);
 	if (!v)
 		return error(i, "Invalid variable %s", argv[1]);
-	if (picolListOperation(i, picolGetVarVal(v), argv[2], 1, argv[3], argv[3][0] ? SET : DELETE, 1) != PICKLE_OK)
+	char buffy[PRINT_NUMBER_BUF_SZ];
+	if (picolListOperation(i, picolGetVarVal(v, buffy), argv[2], 1, argv[3], argv[3][0] ? SET : DELETE, 1) != PICKLE_OK)
 		return PICKLE_ERROR;
 	if (picolFreeVarVal(i, v) != PICKLE_OK)
 		return PICKLE_ERROR;
-	return picolSetVarString(i, v,  i->result);
+	return picolSetVarString(i, v,  picolGetResult(i));
 }
 
-enum { INTEGER, STRING };
+enum { INTEGER, STRING, COMMAND };
 
-static inline int order(pickle_t *i, int op, int rev, const char *a, const char *b) {
+typedef struct {
+	int op, rev;       /**< INTEGER, STRING or COMMAND, and whether to reverse the order */
+	char **keys;       /**< what each item is sorted by, the item itself or its '-index' element */
+	number_t *numbers; /**< 'keys' decoded once up front, for INTEGER */
+	int argc;          /**< words in the '-command' prefix plus the two keys being compared */
+	char **argv;       /**< '-command' prefix, and space for the two keys */
+} pickle_sorter_t; /**< how 'lsort' compares items, by their index in the list */
+
+static int order(pickle_t *i, pickle_sorter_t *s, const int a, const int b, int *r) {
 	assert(i);
-	assert(a);
-	assert(b);
-	int r = 0;
-	switch (op) {
-	case INTEGER: {
-		number_t an = 0, bn = 0;
-		const int ra = picolStringToNumber(i, a, &an);
-		const int rb = picolStringToNumber(i, b, &bn);
-		if (ra != PICKLE_OK || rb != PICKLE_OK)
-			return -1;
-		r = an < bn;
+	assert(s);
+	assert(r);
+	switch (s->op) {
+	case INTEGER:
+		*r = (s->numbers[a] > s->numbers[b]) - (s->numbers[a] < s->numbers[b]);
 		break;
-	}
-	case STRING: {
-		r = compare(b, a) > 0;
+	case STRING:
+		*r = compare(s->keys[a], s->keys[b]);
+		break;
+	case COMMAND: {
+		number_t n = 0;
+		s->argv[s->argc - 2] = s->keys[a];
+		s->argv[s->argc - 1] = s->keys[b];
+		if (picolDoCommand(i, s->argc, s->argv, NULL) != PICKLE_OK)
+			return PICKLE_ERROR;
+		if (picolStringToNumber(i, picolGetResult(i), &n) != PICKLE_OK)
+			return PICKLE_ERROR;
+		*r = (n > 0) - (n < 0);
 		break;
 	}
+	default:
+		return error(i, "Invalid sort %d", s->op);
 	}
-	return rev ? !r : r;
+	if (s->rev)
+		*r = -*r;
+	return PICKLE_OK;
 }
 
-static inline int sortArgs(pickle_t *i, int op, int rev, const int argc, char **argv) {
+/* A stable merge sort of the item indices in 'p', using 't' as temporary
+ * storage. Already ordered halves (common with sorted or nearly sorted
+ * input) are not merged. The recursion depth is only log2 of the length. */
+static int sortMerge(pickle_t *i, pickle_sorter_t *s, int *p, int *t, const int n) {
 	assert(i);
-	assert(argc >= 0);
-	for (int j = 1, k = 0; j < argc; j++) { /* insertion sort */
-		char *key = argv[j];
-		k = j - 1;
-		while (k >= 0) {
-			const int od = order(i, op, rev, key, argv[k]);
-			if (od < 0)
+	assert(s);
+	assert(p);
+	assert(t);
+	int r = 0;
+	if (n < 2)
+		return PICKLE_OK;
+	const int h = n / 2;
+	if (sortMerge(i, s, p, t, h) != PICKLE_OK || sortMerge(i, s, p + h, t, n - h) != PICKLE_OK)
+		return PICKLE_ERROR;
+	if (order(i, s, p[h - 1], p[h], &r) != PICKLE_OK)
+		return PICKLE_ERROR;
+	if (r <= 0)
+		return PICKLE_OK;
+	int j = 0, k = h, l = 0;
+	while (j < h && k < n) {
+		if (order(i, s, p[k], p[j], &r) != PICKLE_OK)
+			return PICKLE_ERROR;
+		t[l++] = r < 0 ? p[k++] : p[j++]; /* ties go to the left half, keeping it stable */
+	}
+	while (j < h)
+		t[l++] = p[j++];
+	move(p, t, sizeof (*p) * l);
+	return PICKLE_OK;
+}
+
+static int sortKeys(pickle_t *i, pickle_sorter_t *s, const int index, const int argc, char **argv) {
+	assert(i);
+	assert(s);
+	assert(argc > 0);
+	if (!(s->keys = picolMalloc(i, sizeof (*s->keys) * argc)))
+		return PICKLE_ERROR;
+	if (index < 0) {
+		move(s->keys, argv, sizeof (*s->keys) * argc);
+	} else {
+		zero(s->keys, sizeof (*s->keys) * argc);
+		for (int j = 0; j < argc; j++) {
+			args_t a = picolArgs(i, &(pickle_parser_opts_t){ 1, 1, 1, 1 }, argv[j]);
+			if (a.argc < 0)
+				return PICKLE_ERROR;
+			if (index >= a.argc) {
+				(void)picolFreeArgList(i, a.argc, a.argv);
+				return error(i, "Invalid index %d", index);
+			}
+			s->keys[j] = a.argv[index];
+			a.argv[index] = NULL;
+			if (picolFreeArgList(i, a.argc, a.argv) != PICKLE_OK)
 				return PICKLE_ERROR;
-			if (!od)
-				break;
-			assert((k + 1) < argc && k < argc);
-			argv[k + 1] = argv[k];
-			k--;
 		}
-		assert((k + 1) < argc);
-		argv[k + 1] = key;
 	}
+	if (s->op != INTEGER)
+		return PICKLE_OK;
+	if (!(s->numbers = picolMalloc(i, sizeof (*s->numbers) * argc)))
+		return PICKLE_ERROR;
+	for (int j = 0; j < argc; j++)
+		if (picolStringToNumber(i, s->keys[j], &s->numbers[j]) != PICKLE_OK)
+			return PICKLE_ERROR;
 	return PICKLE_OK;
 }
 
+static int sortFree(pickle_t *i, pickle_sorter_t *s, const int index, const int argc) {
+	assert(i);
+	assert(s);
+	int r = PICKLE_OK;
+	if (index >= 0 && s->keys)
+		for (int j = 0; j < argc; j++)
+			if (picolFree(i, s->keys[j]) != PICKLE_OK)
+				r = PICKLE_ERROR;
+	if (picolFree(i, s->keys) != PICKLE_OK || picolFree(i, s->numbers) != PICKLE_OK)
+		r = PICKLE_ERROR;
+	s->keys = NULL;
+	s->numbers = NULL;
+	return r;
+}
+
+/* Sorts 'argv' in place, returning the number of items left in 'count', any
+ * that were dropped by 'unique' are freed and the end of 'argv' is NULL'd */
+static inline int sortArgs(pickle_t *i, pickle_sorter_t *s, const int index, const int unique, const int argc, char **argv, int *count) {
+	assert(i);
+	assert(s);
+	assert(argv);
+	assert(count);
+	int *p = NULL, *t = NULL, n = 0, r = PICKLE_ERROR;
+	char **sorted = NULL;
+	if (sortKeys(i, s, index, argc, argv) != PICKLE_OK)
+		goto done;
+	if (!(p = picolMalloc(i, sizeof (*p) * argc)) || !(t = picolMalloc(i, sizeof (*t) * argc)))
+		goto done;
+	for (int j = 0; j < argc; j++)
+		p[j] = j;
+	if (sortMerge(i, s, p, t, argc) != PICKLE_OK)
+		goto done;
+	for (int j = 0; j < argc; j++) {
+		int od = 1;
+		if (unique && (j + 1) < argc && order(i, s, p[j], p[j + 1], &od) != PICKLE_OK)
+			goto done;
+		if (od) {
+			t[n++] = p[j];
+			continue;
+		}
+		if (picolFree(i, argv[p[j]]) != PICKLE_OK) /* the last of a run of equal items is kept */
+			goto done;
+		argv[p[j]] = NULL;
+	}
+	if (sortFree(i, s, index, argc) != PICKLE_OK)
+		goto done;
+	if (!(sorted = picolMalloc(i, sizeof (*sorted) * argc)))
+		goto done;
+	for (int j = 0; j < n; j++)
+		sorted[j] = argv[t[j]];
+	zero(argv, sizeof (*argv) * argc);
+	move(argv, sorted, sizeof (*argv) * n);
+	*count = n;
+	r = PICKLE_OK;
+done:
+	if (sortFree(i, s, index, argc) != PICKLE_OK)
+		r = PICKLE_ERROR;
+	if (picolFree(i, p) != PICKLE_OK || picolFree(i, t) != PICKLE_OK || picolFree(i, sorted) != PICKLE_OK)
+		r = PICKLE_ERROR;
+	return r;
+}
+
 static inline int picolCommandLSort(pickle_t *i, int argc, char **argv, void *pd) {
 	UNUSED(pd);
 	assert(!pd);
-	ARITY(argc < 2, "-increasing? -decreasing? -ascii? -integer? list: sort a list, increasing/ascii are default");
-	int op = STRING, rev = 0, j = 1;
+	ARITY(argc < 2, "-increasing? -decreasing? -ascii? -integer? -unique? [-index number]? [-command command]? list: sort a list, increasing/ascii are default");
+	pickle_sorter_t s = { .op = STRING, .rev = 0 };
+	number_t index = -1;
+	int j = 1, unique = 0, count = 0;
+	const char *command = NULL;
 	for (j = 1; j < (argc - 1); j++) {
-		if (!compare(argv[j], "-increasing"))
-			rev = 0;
-		else if (!compare(argv[j], "-decreasing"))
-			rev = 1;
-		else if (!compare(argv[j], "-ascii"))
-			op = STRING;
-		else if (!compare(argv[j], "-integer"))
-			op = INTEGER;
-		else
+		if (!compare(argv[j], "-increasing")) {
+			s.rev = 0;
+		} else if (!compare(argv[j], "-decreasing")) {
+			s.rev = 1;
+		} else if (!compare(argv[j], "-ascii")) {
+			s.op = STRING;
+		} else if (!compare(argv[j], "-integer")) {
+			s.op = INTEGER;
+		} else if (!compare(argv[j], "-unique")) {
+			unique = 1;
+		} else if (!compare(argv[j], "-index") && (j + 2) < argc) {
+			if (picolStringToNumber(i, argv[++j], &index) != PICKLE_OK)
+				return PICKLE_ERROR;
+			if (index < 0 || index > INT_MAX)
+				return error(i, "Invalid index %s", argv[j]);
+		} else if (!compare(argv[j], "-command") && (j + 2) < argc) {
+			command = argv[++j];
+		} else {
 			return error(i, "Invalid option %s", argv[j]);
+		}
 	}
-	char *r = NULL;
+	args_t c = { .argc = 0, .argv = NULL };
 	args_t a = picolArgs(i, &(pickle_parser_opts_t){ 1, 1, 1, 1 }, argv[j]);
 	if (a.argc < 0)
 		return PICKLE_ERROR;
-	if (sortArgs(i, op, rev, a.argc, a.argv) != PICKLE_OK)
-		goto fail;
-	r = concatenate(i, " ", a.argc, a.argv, 1, -1, 0);
-	if (picolFreeArgList(i, a.argc, a.argv) != PICKLE_OK) {
+	if (command) {
+		c = picolArgs(i, &(pickle_parser_opts_t){ 1, 1, 1, 1 }, command);
+		if (c.argc <= 0) {
+			(void)picolFreeArgList(i, a.argc, a.argv);
+			return c.argc < 0 ? PICKLE_ERROR : error(i, "Invalid command %s", command);
+		}
+		if (!(s.argv = picolArgsCopy(i, c.argc, c.argv, 2))) {
+			(void)picolFreeArgList(i, c.argc, c.argv);
+			(void)picolFreeArgList(i, a.argc, a.argv);
+			return PICKLE_ERROR;
+		}
+		s.argc = c.argc + 2;
+		s.op = COMMAND;
+	}
+	const int sr = a.argc ? sortArgs(i, &s, index, unique, a.argc, a.argv, &count) : PICKLE_OK;
+	char *r = sr == PICKLE_OK ? concatenate(i, " ", count, a.argv, 1, -1, 0) : NULL;
+	int rc = r ? PICKLE_OK : PICKLE_ERROR;
+	if (picolFree(i, s.argv) != PICKLE_OK)
+		rc = PICKLE_ERROR;
+	if (picolFreeArgList(i, c.argc, c.argv) != PICKLE_OK)
+		rc = PICKLE_ERROR;
+	if (picolFreeArgList(i, a.argc, a.argv) != PICKLE_OK)
+		rc = PICKLE_ERROR;
+	if (rc != PICKLE_OK) {
 		(void)picolFree(i, r);
 		return PICKLE_ERROR;
 	}
-	if (!r)
-		return PICKLE_ERROR;
 	return picolForceResult(i, r, 0);
-fail:
-	(void)picolFree(i, r);
-	(void)picolFreeArgList(i, a.argc, a.argv);
-	return PICKLE_ERROR;
 }
 
 static inline int picolCommandLReplace(pickle_t *i, const int argc, char **argv, void *pd) {
@@ -2472,14 +5932,41 @@ err:
 	return PICKLE_ERROR;
 }
 
-/* implementing the '-all' option would be useful */
+enum { oGLOB, oEXACT, oINTEGER, /*oREGEXP*/ };
+
+static int picolSearchOrder(pickle_t *i, const int op, const int nocase, const char *pattern, const number_t value, const char *item, int *r) {
+	assert(i);
+	assert(pattern);
+	assert(item);
+	assert(r);
+	switch (op) {
+	case oGLOB: {
+		const int m = match(pattern, item, nocase);
+		if (m < 0)
+			return error(i, "Invalid pattern %s", pattern);
+		*r = m == 0;
+		return PICKLE_OK;
+	}
+	case oEXACT:
+		*r = nocase ? picolCompareCaseInsensitive(item, pattern) : compare(item, pattern);
+		return PICKLE_OK;
+	case oINTEGER: {
+		number_t n = 0;
+		if (picolStringToNumber(i, item, &n) != PICKLE_OK)
+			return PICKLE_ERROR;
+		*r = (n > value) - (n < value);
+		return PICKLE_OK;
+	}
+	}
+	return error(i, "Invalid search %d", op);
+}
+
 static inline int picolCommandLSearch(pickle_t *i, const int argc, char **argv, void *pd) {
 	UNUSED(pd);
 	assert(!pd);
-	ARITY(argc < 3, "-integer? -exact? -inline? -not? -glob? -nocase? [-start number]? list pattern: search a list for a pattern");
-	enum { oGLOB, oEXACT, oINTEGER, /*oREGEXP*/ };
+	ARITY(argc < 3, "-integer? -exact? -inline? -not? -glob? -nocase? -sorted? -all? [-start number]? list pattern: search a list for a pattern");
 	number_t start = 0, value = 0;
-	int op = oGLOB, last = argc - 2, index = -1, not = 0, inl = 0, nocase = 0;
+	int op = oGLOB, last = argc - 2, index = -1, not = 0, inl = 0, nocase = 0, sorted = 0, all = 0, found = 0, r = PICKLE_ERROR;
 	char *list = argv[argc - 2], *pattern = argv[argc - 1];
 	for (int j = 1; j < last; j++) {
 		     if (!compare(argv[j], "-integer")) { op = oINTEGER; }
@@ -2488,6 +5975,8 @@ static inline int picolCommandLSearch(pickle_t *i, const int argc, char **argv,
 		else if (!compare(argv[j], "-nocase"))  { nocase = 1; }
 		else if (!compare(argv[j], "-not"))     { not = 1; }
 		else if (!compare(argv[j], "-glob"))    { op = oGLOB; }
+		else if (!compare(argv[j], "-sorted"))  { sorted = 1; }
+		else if (!compare(argv[j], "-all"))     { all = 1; }
 		else if (!compare(argv[j], "-start")) {
 			if (!((j + 1) < last))
 				return error(i, "Invalid option %s", argv[j]);
@@ -2498,58 +5987,74 @@ static inline int picolCommandLSearch(pickle_t *i, const int argc, char **argv,
 			return error(i, "Invalid option %s", argv[j]);
 		}
 	}
+	if (sorted && op == oGLOB) /* a pattern cannot be searched for by bisection */
+		op = oEXACT;
 	if (op == oINTEGER)
 		if (picolStringToNumber(i, pattern, &value) != PICKLE_OK)
 			return PICKLE_ERROR;
-	const args_t a = picolArgs(i, &(pickle_parser_opts_t){ 1, 1, 1, 1 }, list);
+	args_t a = picolArgs(i, &(pickle_parser_opts_t){ 1, 1, 1, 1 }, list);
 	if (a.argc < 0)
 		return PICKLE_ERROR;
-	for (size_t j = start; j < (size_t)a.argc; j++) {
-		switch (op) {
-		case oGLOB: {
-			const int m = match(pattern, a.argv[j], nocase, PICKLE_MAX_RECURSION - i->level);
-			if (m < 0) {
-				(void)picolFreeArgList(i, a.argc, a.argv);
-				return error(i, "Invalid recursion %d", m);
-			}
-			if (not ^ (m > 0)) {
-				index = j;
+	size_t j = MAX(0, start);
+	if (sorted && !not) { /* find the first item not less than 'pattern', any matches follow it */
+		size_t h = a.argc;
+		while (j < h) {
+			const size_t m = j + ((h - j) / 2);
+			int od = 0;
+			if (picolSearchOrder(i, op, nocase, pattern, value, a.argv[m], &od) != PICKLE_OK)
 				goto done;
-			}
-			break;
+			if (od < 0)
+				j = m + 1;
+			else
+				h = m;
 		}
-		case oEXACT:
-			if (not ^ (nocase ? !picolCompareCaseInsensitive(pattern, a.argv[j]) : !compare(pattern, a.argv[j]))) {
-				index = j;
-				goto done;
-			}
+	}
+	for (; j < (size_t)a.argc; j++) {
+		int od = 0;
+		if (picolSearchOrder(i, op, nocase, pattern, value, a.argv[j], &od) != PICKLE_OK)
+			goto done;
+		if (!(not ^ (od == 0))) {
+			if (sorted && !not)
+				break;
+			continue;
+		}
+		if (index < 0)
+			index = j;
+		if (!all)
 			break;
-		case oINTEGER: {
-			number_t n = 0;
-			if (picolStringToNumber(i, a.argv[j], &n) != PICKLE_OK) {
-				(void)picolFreeArgList(i, a.argc, a.argv);
-				return PICKLE_ERROR;
-			}
-			if (not ^ (n == value)) {
-				index = j;
+		/* items before 'j' are no longer needed, so the matches are gathered at the start of 'a' */
+		char buffy[PRINT_NUMBER_BUF_SZ];
+		char *n = a.argv[j];
+		if (!inl) {
+			if (picolNumberToString(buffy, j, 10) != PICKLE_OK)
 				goto done;
-			}
-			break;
+			if (!(n = picolStrdup(i, buffy)))
+				goto done;
+		} else if ((size_t)found == j) {
+			found++;
+			continue;
 		}
-		default:
-			assert(op <= INTEGER);
+		if (picolFree(i, a.argv[found]) != PICKLE_OK) {
+			if (!inl)
+				(void)picolFree(i, n);
+			goto done;
 		}
+		a.argv[j] = inl ? NULL : a.argv[j];
+		a.argv[found++] = n;
 	}
-done:
-	if (inl && index > 0) {
-		assert(index < a.argc);
-		const int r = picolForceResult(i, a.argv[index], 0);
+	if (all) {
+		char *s = concatenate(i, " ", found, a.argv, inl, -1, 0);
+		r = s ? picolForceResult(i, s, 0) : PICKLE_ERROR;
+	} else if (inl && index >= 0) {
+		r = picolForceResult(i, a.argv[index], 0);
 		a.argv[index] = NULL;
-		(void)picolFreeArgList(i, a.argc, a.argv);
-		return r;
+	} else {
+		r = picolSetResultNumber(i, index);
 	}
-	(void)picolFreeArgList(i, a.argc, a.argv);
-	return picolSetResultNumber(i, index);
+done:
+	if (picolFreeArgList(i, a.argc, a.argv) != PICKLE_OK)
+		r = PICKLE_ERROR;
+	return r;
 }
 
 static inline int picolCommandLRange(pickle_t *i, const int argc, char **argv, void *pd) {
@@ -2574,36 +6079,449 @@ static inline int picolCommandLRange(pickle_t *i, const int argc, char **argv, v
 			return PICKLE_ERROR;
 		return picolSetResultEmpty(i);
 	}
-	char *range = concatenate(i, " ", 1 + last - first, a.argv + first, 1, -1, 0);
-	if (!range) {
-		(void)picolFreeArgList(i, a.argc, a.argv);
-		return PICKLE_ERROR;
+	char *range = concatenate(i, " ", 1 + last - first, a.argv + first, 1, -1, 0);
+	if (!range) {
+		(void)picolFreeArgList(i, a.argc, a.argv);
+		return PICKLE_ERROR;
+	}
+	const int rs = picolForceResult(i, range, 0);
+	return picolFreeArgList(i, a.argc, a.argv) == PICKLE_OK ? rs : PICKLE_ERROR;
+}
+
+static inline int picolCommandLAppend(pickle_t *i, const int argc, char **argv, void *pd) {
+	UNUSED(pd);
+	assert(!pd);
+	ARITY(argc < 2, "variable values...: append values to a list in a variable");
+	pickle_var_t *v = picolGetVar(i, argv[1], 1);
+	pickle_list_t *l = NULL;
+	const int lr = v ? picolVarList(i, v, &l) : PICKLE_BREAK;
+	if (lr == PICKLE_ERROR)
+		return PICKLE_ERROR;
+	if (lr == PICKLE_OK && l->refs == 1) { /* append in place */
+		char *args = concatenate(i, " ", argc - 2, argv + 2, 1, -1, 0);
+		if (!args)
+			return PICKLE_ERROR;
+		const size_t length = l->length;
+		const int r = picolListAppend(i, l, args);
+		if (picolFree(i, args) != PICKLE_OK || r == PICKLE_ERROR)
+			return PICKLE_ERROR;
+		if (r == PICKLE_OK)
+			return picolSetResultList(i, l);
+		if (picolVarString(i, v) != PICKLE_OK) /* the items no longer fit, the string may have */
+			return PICKLE_ERROR;
+		if (length != picolStrlen(v->data.val.ptr))
+			return picolSetResultString(i, v->data.val.ptr);
+	}
+	char *args = concatenate(i, " ", argc - 2, argv + 2, 1, -1, 0);
+	if (!args)
+		return PICKLE_ERROR;
+	if (!v) {
+		if (pickle_var_set(i, argv[1], args) != PICKLE_OK) {
+			(void)picolFree(i, args);
+			return PICKLE_ERROR;
+		}
+		return picolForceResult(i, args, 0);
+	}
+	char buffy[PRINT_NUMBER_BUF_SZ]; /* appended to the string, leaving room to grow */
+	const char *ovar = picolGetVarVal(v, buffy);
+	const size_t al = picolStrlen(args);
+	size_t length = 0;
+	char *s = NULL;
+	if (!ovar || (USE_MAX_STRING && (picolStrlen(ovar) + al + 2) >= PICKLE_MAX_STRING) || !(s = picolVarReserve(i, v, al + 1, &length))) {
+		(void)picolFree(i, args);
+		return PICKLE_ERROR;
+	}
+	s[length] = ' ';
+	move(s + length + 1, args, al + 1);
+	picolVarCapacity(v)->length = length + 1 + al;
+	if (picolFree(i, args) != PICKLE_OK)
+		return PICKLE_ERROR;
+	return picolForceResult(i, s, 1);
+}
+
+/* A dictionary held in a variable is kept as a list with its keys indexed,
+ * see 'picolDictIndex', so changing it does not parse it again. Another
+ * reference to it, from the result, is dropped first as that would
+ * otherwise force a copy. */
+static int picolVarDict(pickle_t *i, pickle_var_t *v, pickle_list_t **dict) {
+	assert(i);
+	assert(v);
+	assert(dict);
+	pickle_list_t *l = NULL;
+	*dict = NULL;
+	int r = picolVarList(i, v, &l);
+	if (r == PICKLE_OK && l->refs > 1 && i->list_result && i->list == l)
+		r = picolSetResultEmpty(i);
+	if (r == PICKLE_OK && l->refs > 1 && (r = picolVarString(i, v)) == PICKLE_OK)
+		r = picolVarList(i, v, &l);
+	if (r == PICKLE_OK)
+		r = picolDictIndex(i, l);
+	if (r == PICKLE_BREAK) {
+		char buffy[PRINT_NUMBER_BUF_SZ];
+		return error(i, "Invalid dictionary %s", picolGetVarVal(v, buffy));
+	}
+	*dict = l;
+	return r;
+}
+
+static int picolDictSplit(pickle_t *i, pickle_list_t *l, const char *s) { /* free with 'picolListSplitFree' */
+	assert(i);
+	assert(l);
+	assert(s);
+	int r = picolListSplit(i, l, s);
+	if (r == PICKLE_OK && (r = picolDictIndex(i, l)) == PICKLE_BREAK)
+		return error(i, "Invalid dictionary %s", s);
+	return r;
+}
+
+/* 'dict get' and 'dict exists' of a value, a key at a time, each value found
+ * is split in turn so it stays in one of 'l' until the next has been found. */
+static int picolDictLookup(pickle_t *i, const char *d, const int argc, char **keys, const int exists) {
+	assert(i);
+	assert(d);
+	assert(keys);
+	pickle_list_t l[2];
+	zero(l, sizeof l);
+	const char *s = d;
+	int r = PICKLE_OK, found = 1, n = 0;
+	for (; n < argc && r == PICKLE_OK && found; n++) {
+		pickle_list_t *c = &l[n % 2];
+		if (n >= 2 && (r = picolListSplitFree(i, c)) != PICKLE_OK)
+			break;
+		if ((r = picolDictSplit(i, c, s)) != PICKLE_OK) {
+			if (exists && r == PICKLE_ERROR && c->string) { /* not a dictionary, rather than out of memory */
+				r = PICKLE_OK;
+				found = 0;
+			}
+			break;
+		}
+		const int item = picolDictFind(c, keys[n]);
+		if ((found = item >= 0))
+			s = picolListItem(c, item + 1);
+	}
+	if (r == PICKLE_OK)
+		r = exists ? picolSetResultNumber(i, found) : found ? picolSetResultString(i, s) : error(i, "Invalid key %s", keys[n - 1]);
+	const int r1 = picolListSplitFree(i, &l[0]);
+	const int r2 = picolListSplitFree(i, &l[1]);
+	return r1 == PICKLE_OK && r2 == PICKLE_OK ? r : PICKLE_ERROR;
+}
+
+static int picolDictKeys(pickle_t *i, const char *d, const char *pat) {
+	assert(i);
+	assert(d);
+	assert(pat);
+	pickle_list_t l;
+	args_t a = { 0, NULL };
+	int r = picolDictSplit(i, &l, d);
+	for (int j = 0; r == PICKLE_OK && j < l.count; j += 2) {
+		const char *key = picolListItem(&l, j);
+		if (picolDictFind(&l, key) != j || match(pat, key, 0) <= 0) /* given again later, or not wanted */
+			continue;
+		if (!(a.argv = picolArgsGrow(i, &a.argc, a.argv)))
+			r = PICKLE_ERROR;
+		else
+			a.argv[a.argc - 1] = (char*)key;
+	}
+	if (r == PICKLE_OK)
+		r = picolForceResult(i, concatenate(i, " ", a.argc, a.argv, 1, -1, 0), 0);
+	const int r1 = picolFree(i, a.argv); /* NB. Not picolFreeArgList! */
+	const int r2 = picolListSplitFree(i, &l);
+	return r1 == PICKLE_OK && r2 == PICKLE_OK ? r : PICKLE_ERROR;
+}
+
+static int picolDictFor(pickle_t *i, const char *vars, const char *d, const char *body) {
+	assert(i);
+	assert(vars);
+	assert(d);
+	assert(body);
+	pickle_list_t names, items;
+	zero(&items, sizeof items);
+	int r = picolListSplit(i, &names, vars);
+	if (r == PICKLE_OK && names.count != 2)
+		r = error(i, "Invalid variable list %s", vars);
+	if (r == PICKLE_OK)
+		r = picolDictSplit(i, &items, d);
+	for (int j = 0; r == PICKLE_OK && j < items.count; j += 2) {
+		if (picolDictFind(&items, picolListItem(&items, j)) != j)
+			continue;
+		if ((r = picolSetVar(i, picolListItem(&names, 0), picolListItem(&items, j), NULL, NULL)) != PICKLE_OK)
+			break;
+		if ((r = picolSetVar(i, picolListItem(&names, 1), picolListItem(&items, j + 1), NULL, NULL)) != PICKLE_OK)
+			break;
+		if ((r = picolEval(i, body)) == PICKLE_CONTINUE)
+			r = PICKLE_OK;
+	}
+	if (r == PICKLE_BREAK)
+		r = PICKLE_OK;
+	if (r == PICKLE_OK)
+		r = picolSetResultEmpty(i);
+	const int r1 = picolListSplitFree(i, &names);
+	const int r2 = picolListSplitFree(i, &items);
+	return r1 == PICKLE_OK && r2 == PICKLE_OK ? r : PICKLE_ERROR;
+}
+
+/* Set, or with no 'value' remove, a key in a dictionary within 'l' found by
+ * following 'keys' before it, missing ones are created when setting. */
+static int picolDictUpdate(pickle_t *i, pickle_list_t *l, const int depth, char **keys, const char *value) {
+	assert(i);
+	assert(l);
+	assert(keys);
+	assert(depth > 0);
+	if (depth == 1)
+		return value ? picolDictPut(i, l, keys[0], value) : picolDictRemove(i, l, keys[0]);
+	const int item = picolDictFind(l, keys[0]);
+	if (item < 0 && !value)
+		return error(i, "Invalid key %s", keys[0]);
+	pickle_list_t n;
+	zero(&n, sizeof n);
+	n.refs = 1;
+	if (!(n.string = picolListCopy(i, l, item < 0 ? -1 : item + 1)))
+		return PICKLE_ERROR;
+	n.length = picolStrlen(n.string);
+	n.size   = n.length + 1;
+	int r = picolListParse(i, &n, 0);
+	if (r == PICKLE_OK)
+		r = picolDictIndex(i, &n);
+	if (r == PICKLE_BREAK)
+		r = error(i, "Invalid dictionary %s", n.string);
+	if (r == PICKLE_OK && (r = picolDictUpdate(i, &n, depth - 1, keys + 1, value)) == PICKLE_OK)
+		r = picolDictPut(i, l, keys[0], n.string);
+	return picolListSplitFree(i, &n) == PICKLE_OK ? r : PICKLE_ERROR;
+}
+
+static int picolDictIncr(pickle_t *i, pickle_list_t *l, const char *key, const char *by) {
+	assert(i);
+	assert(l);
+	assert(key);
+	number_t n = 0, incr = 1;
+	if (by && picolStringToNumber(i, by, &incr) != PICKLE_OK)
+		return PICKLE_ERROR;
+	const int item = picolDictFind(l, key);
+	if (item >= 0) {
+		char *value = picolListCopy(i, l, item + 1);
+		if (!value)
+			return PICKLE_ERROR;
+		const int r = picolStringToNumber(i, value, &n);
+		if (picolFree(i, value) != PICKLE_OK || r != PICKLE_OK)
+			return PICKLE_ERROR;
+	}
+	char buffy[PRINT_NUMBER_BUF_SZ];
+	if (picolNumberToString(buffy, n + incr, 10) != PICKLE_OK)
+		return PICKLE_ERROR;
+	return picolDictPut(i, l, key, buffy);
+}
+
+static int picolDictLAppend(pickle_t *i, pickle_list_t *l, const char *key, const int argc, char **argv) {
+	assert(i);
+	assert(l);
+	assert(key);
+	const int item = picolDictFind(l, key);
+	char *old = picolListCopy(i, l, item < 0 ? -1 : item + 1);
+	char *args = old ? concatenate(i, " ", argc, argv, 1, -1, 0) : NULL;
+	char *value = args ? concatenate(i, " ", 1 + !!old[0], (char*[2]) { old[0] ? old : args, args }, 0, -1, 0) : NULL;
+	const int r = value ? picolDictPut(i, l, key, value) : PICKLE_ERROR;
+	const int r1 = picolFree(i, old);
+	const int r2 = picolFree(i, args);
+	const int r3 = picolFree(i, value);
+	return r1 == PICKLE_OK && r2 == PICKLE_OK && r3 == PICKLE_OK ? r : PICKLE_ERROR;
+}
+
+static inline int picolCommandDict(pickle_t *i, const int argc, char **argv, void *pd) {
+	UNUSED(pd);
+	assert(!pd);
+	ARITY(argc < 3, "get|exists|keys|for|set|unset|incr|lappend dictionary ...: use a list of keys and values as a dictionary");
+	const char *rq = argv[1];
+	if (!compare(rq, "get"))
+		return picolDictLookup(i, argv[2], argc - 3, argv + 3, 0);
+	if (!compare(rq, "exists")) {
+		ARITY(argc < 4, "exists dictionary key...: does a key exist in a dictionary");
+		return picolDictLookup(i, argv[2], argc - 3, argv + 3, 1);
+	}
+	if (!compare(rq, "keys")) {
+		ARITY(argc > 4, "keys dictionary pattern?: list the keys of a dictionary");
+		return picolDictKeys(i, argv[2], argc == 4 ? argv[3] : "*");
 	}
-	const int rs = picolForceResult(i, range, 0);
-	return picolFreeArgList(i, a.argc, a.argv) == PICKLE_OK ? rs : PICKLE_ERROR;
+	if (!compare(rq, "for")) {
+		ARITY(argc != 5, "for {key value} dictionary clause: evaluate clause for each key in a dictionary");
+		return picolDictFor(i, argv[2], argv[3], argv[4]);
+	}
+	const int set = !compare(rq, "set"), unset = !compare(rq, "unset"), incr = !compare(rq, "incr"), lappend = !compare(rq, "lappend");
+	if (!set && !unset && !incr && !lappend)
+		return error(i, "Invalid subcommand %s", rq);
+	ARITY(argc < 4 || (set && argc < 5) || (incr && argc > 5), "set|unset|incr|lappend variable key...: change a dictionary in a variable");
+	pickle_var_t *v = picolGetVar(i, argv[2], 1);
+	pickle_list_t *l = NULL;
+	if (!v && unset)
+		return error(i, "Invalid variable %s", argv[2]);
+	if (!v && picolSetVar(i, argv[2], "", NULL, &v) != PICKLE_OK)
+		return PICKLE_ERROR;
+	if (picolVarDict(i, v, &l) != PICKLE_OK)
+		return PICKLE_ERROR;
+	int r = PICKLE_OK;
+	if (set)
+		r = picolDictUpdate(i, l, argc - 4, argv + 3, argv[argc - 1]);
+	else if (unset)
+		r = picolDictUpdate(i, l, argc - 3, argv + 3, NULL);
+	else if (incr)
+		r = picolDictIncr(i, l, argv[3], argc == 5 ? argv[4] : NULL);
+	else
+		r = picolDictLAppend(i, l, argv[3], argc - 4, argv + 4);
+	if (r == PICKLE_BREAK)
+		return error(i, "Invalid dictionary %s", argv[2]);
+	return r == PICKLE_OK ? picolSetResultList(i, l) : r;
 }
 
-static inline int picolCommandLAppend(pickle_t *i, const int argc, char **argv, void *pd) {
+static inline int picolCommandAppend(pickle_t *i, const int argc, char **argv, void *pd) {
 	UNUSED(pd);
 	assert(!pd);
-	ARITY(argc < 2, "variable values...: append values to a list in a variable");
+	ARITY(argc < 2, "variable strings...: append strings to a variable and return it");
 	pickle_var_t *v = picolGetVar(i, argv[1], 1);
-	const char *ovar = v ? picolGetVarVal(v) : NULL;
-	char *nvar = NULL, *args = concatenate(i, " ", argc - 2, argv + 2, 1, -1, 0);
-	if (!args)
+	if (!v && picolSetVar(i, argv[1], "", NULL, &v) != PICKLE_OK)
 		return PICKLE_ERROR;
-	char *list[2] = { (char*)ovar, args };
-	nvar = concatenate(i, " ", 2 - (ovar == NULL), list + (ovar == NULL), 0, -1, 0);
-	const int r1 = picolFree(i, args);
-	if (!nvar)
-		return PICKLE_ERROR;
-	const int r2 = pickle_var_set(i, argv[1], nvar);
-	const int r3 = picolForceResult(i, nvar, 0);
-	if (r1 != PICKLE_OK && r2 != PICKLE_OK && r3 != PICKLE_OK)
+	size_t length = 0, more = 0;
+	for (int j = 2; j < argc; j++)
+		more += picolStrlen(argv[j]);
+	char *s = picolVarReserve(i, v, more, &length);
+	if (!s)
 		return PICKLE_ERROR;
+	for (int j = 2; j < argc; j++) {
+		const size_t l = picolStrlen(argv[j]);
+		move(s + length, argv[j], l);
+		length += l;
+	}
+	s[length] = '\0';
+	picolVarCapacity(v)->length = length;
+	return picolForceResult(i, s, 1); /* shared with the variable, see 'picolResultDetach' */
+}
+
+static inline int picolFormatReserve(pickle_t *i, pickle_stack_or_heap_t *h, const size_t used, const size_t more) {
+	assert(i);
+	assert(h);
+	const size_t need = used + more + 1;
+	if (need <= h->length)
+		return PICKLE_OK;
+	const size_t size = MAX(need, h->length * 2);
+	return picolStackOrHeapAlloc(i, h, USE_MAX_STRING ? MIN(size, MAX(need, PICKLE_MAX_STRING)) : size);
+}
+
+static inline int picolFormatNumber(pickle_t *i, const char **fmt, const int argc, char **argv, int *arg, long *n) {
+	assert(i);
+	assert(fmt && *fmt);
+	assert(n);
+	if (**fmt == '*') { /* taken from the arguments instead */
+		(*fmt)++;
+		if (*arg >= argc)
+			return PICKLE_BREAK;
+		number_t a = 0;
+		if (picolStringToNumber(i, argv[(*arg)++], &a) != PICKLE_OK)
+			return PICKLE_ERROR;
+		if (a > INT_MAX || a < -INT_MAX)
+			return PICKLE_BREAK;
+		*n = a;
+		return PICKLE_OK;
+	}
+	for (*n = NUMBER_MIN; isdigit((unsigned char)**fmt); (*fmt)++) { /* NUMBER_MIN if there is no number */
+		*n = ((*n == NUMBER_MIN ? 0 : *n) * 10) + (**fmt - '0');
+		if (*n > INT_MAX)
+			return PICKLE_BREAK;
+	}
 	return PICKLE_OK;
 }
 
+/* Each conversion is checked and rebuilt here, then given to 'snprintf' with
+ * an argument of the type it expects, numbers are 'long'. There are no
+ * floating point conversions, nor positional arguments. */
+static inline int picolCommandFormat(pickle_t *i, const int argc, char **argv, void *pd) {
+	UNUSED(pd);
+	assert(!pd);
+	ARITY(argc < 2, "format args...: format a string like 'printf'");
+	pickle_stack_or_heap_t h = { .p = NULL };
+	if (picolStackOrHeapAlloc(i, &h, 1) != PICKLE_OK)
+		return PICKLE_ERROR;
+	size_t used = 0;
+	int arg = 2, r = PICKLE_OK;
+	for (const char *f = argv[1]; *f && r == PICKLE_OK;) {
+		if (*f != '%' || f[1] == '%') {
+			if ((r = picolFormatReserve(i, &h, used, 1)) == PICKLE_OK)
+				h.p[used++] = *f;
+			f += 1 + (*f == '%');
+			continue;
+		}
+		char spec[32] = { '%' }, *sp = spec + 1;
+		for (f++; *f && locateChar("-+ #0", *f) && (sp - spec) < 6; f++)
+			*sp++ = *f;
+		long width = NUMBER_MIN, precision = NUMBER_MIN;
+		if ((r = picolFormatNumber(i, &f, argc, argv, &arg, &width)) != PICKLE_OK)
+			break;
+		if (*f == '.') {
+			f++;
+			if ((r = picolFormatNumber(i, &f, argc, argv, &arg, &precision)) != PICKLE_OK)
+				break;
+			precision = precision == NUMBER_MIN ? 0 : precision; /* a negative '*' is as if there was none */
+		}
+		while (*f == 'l' || *f == 'h')
+			f++;
+		const char conv = *f ? *f++ : '\0';
+		if (!conv || !locateChar("diuoxXcs", conv) || arg >= argc) {
+			r = PICKLE_BREAK;
+			break;
+		}
+		if (width != NUMBER_MIN && width < 0) {
+			*sp++ = '-';
+			width = -width;
+		}
+		if (width != NUMBER_MIN) {
+			char buf[PRINT_NUMBER_BUF_SZ];
+			(void)picolNumberToString(buf, width, 10);
+			for (const char *b = buf; *b;)
+				*sp++ = *b++;
+		}
+		if (precision != NUMBER_MIN && precision >= 0) {
+			char buf[PRINT_NUMBER_BUF_SZ];
+			(void)picolNumberToString(buf, precision, 10);
+			*sp++ = '.';
+			for (const char *b = buf; *b;)
+				*sp++ = *b++;
+		}
+		if (conv != 'c' && conv != 's')
+			*sp++ = 'l';
+		*sp++ = conv == 'i' ? 'd' : conv;
+		*sp = '\0';
+		const char *a = argv[arg++];
+		number_t n = 0;
+		if (conv != 's' && picolStringToNumber(i, a, &n) != PICKLE_OK) {
+			r = PICKLE_ERROR;
+			break;
+		}
+		int length = 0;
+		for (int pass = 0; pass < 2 && r == PICKLE_OK; pass++) { /* measure, then print */
+			char *to = pass ? h.p + used : NULL;
+			const size_t room = pass ? h.length - used : 0;
+			switch (conv) {
+			case 's':                     length = snprintf(to, room, spec, a);                break;
+			case 'c':                     length = snprintf(to, room, spec, (int)n);           break;
+			case 'd': case 'i':           length = snprintf(to, room, spec, (long)n);          break;
+			default:                      length = snprintf(to, room, spec, (unsigned long)n); break;
+			}
+			if (length < 0)
+				r = PICKLE_BREAK;
+			else if (!pass)
+				r = picolFormatReserve(i, &h, used, length);
+		}
+		used += length;
+	}
+	if (r == PICKLE_BREAK)
+		r = error(i, "Invalid format %s", argv[1]);
+	if (r != PICKLE_OK) {
+		(void)picolStackOrHeapFree(i, &h);
+		return r;
+	}
+	h.p[used] = '\0';
+	if (!picolOnHeap(i, &h))
+		return picolSetResultString(i, h.buf);
+	return picolForceResult(i, h.p, 0);
+}
+
 static inline int picolCommandSplit(pickle_t *i, const int argc, char **argv, void *pd) {
 	UNUSED(pd);
 	assert(!pd);
@@ -2665,6 +6583,12 @@ static int picolVarFree(pickle_t *i, pickle_var_t *v) {
 		return PICKLE_OK;
 	const int r1 = picolFreeVarName(i, v);
 	const int r2 = picolFreeVarVal(i, v);
+	if (i->spare_vars < PICKLE_VAR_POOL) {
+		v->next = i->vars;
+		i->vars = v;
+		i->spare_vars++;
+		return r1 == PICKLE_OK && r2 == PICKLE_OK ? PICKLE_OK : PICKLE_ERROR;
+	}
 	const int r3 = picolFree(i, v);
 	return r1 == PICKLE_OK && r2 == PICKLE_OK && r3 == PICKLE_OK ? PICKLE_OK : PICKLE_ERROR;
 }
@@ -2685,10 +6609,19 @@ static int picolDropCallFrame(pickle_t *i) {
 			r = PICKLE_ERROR;
 		v = t;
 	}
+	if (cf->index != cf->small)
+		if (picolFree(i, cf->index) != PICKLE_OK)
+			r = PICKLE_ERROR;
 	i->callframe = cf->parent;
-	if (picolFree(i, cf) != PICKLE_OK)
-		r = PICKLE_ERROR;
-	return r;
+	if (cf == &i->top) /* part of the interpreter */
+		return r;
+	if (i->spare_frames < PICKLE_VAR_POOL) { /* kept for the next call */
+		cf->parent = i->frames;
+		i->frames = cf;
+		i->spare_frames++;
+		return r;
+	}
+	return picolFree(i, cf) == PICKLE_OK ? r : PICKLE_ERROR;
 }
 
 static int picolDropAllCallFrames(pickle_t *i) {
@@ -2700,69 +6633,176 @@ static int picolDropAllCallFrames(pickle_t *i) {
 	return r;
 }
 
+/* Free suspended evaluations, along with the call frames of any procedures
+ * they were in. */
+static int picolResumeFree(pickle_t *i, pickle_resume_t *r) {
+	assert(i);
+	int rc = PICKLE_OK;
+	for (pickle_resume_t *next = NULL; r; r = next) {
+		next = r->next;
+		if (r->proc) {
+			pickle_call_frame_t *cf = i->callframe;
+			const int level = i->level;
+			i->callframe = r->frame;
+			if (picolDropCallFrame(i) != PICKLE_OK)
+				rc = PICKLE_ERROR;
+			i->callframe = cf;
+			i->level = level;
+		}
+		if (picolScriptRelease(i, r->script) != PICKLE_OK)
+			rc = PICKLE_ERROR;
+		for (int j = 0; j < r->argc; j++)
+			if (picolFree(i, (char*)r->words[j].ptr) != PICKLE_OK)
+				rc = PICKLE_ERROR;
+		if (picolFree(i, r->words) != PICKLE_OK)
+			rc = PICKLE_ERROR;
+		if (picolFree(i, r) != PICKLE_OK)
+			rc = PICKLE_ERROR;
+	}
+	return rc;
+}
+
+/* Resume evaluations suspended by a yield, innermost first, giving each the
+ * return code of the one before it, and 'code' to the first, which is the
+ * code of the command that yielded. The call frame and level are left as
+ * the outermost evaluation left them, so the caller should restore its
+ * own. If any of them yields again, PICKLE_YIELD is returned and the
+ * evaluations left to resume are in 'i->yielded'. */
+static int picolResume(pickle_t *i, pickle_resume_t *r, int code) {
+	assert(i);
+	i->yielded = NULL;
+	i->yield_last = NULL;
+	while (r) {
+		pickle_resume_t *next = r->next;
+		r->next = NULL;
+		r->code = code;
+		i->callframe = r->frame;
+		i->level = r->level;
+		code = picolEvalScript(i, r->script, 1, r);
+		if (code == PICKLE_YIELD) {
+			if (r->proc) { /* the frame moves to the new record, it is still in use */
+				assert(i->yield_last);
+				i->yield_last->proc = 1;
+				r->proc = 0;
+				i->callframe = r->frame->parent;
+				i->level--;
+			}
+			assert(i->yield_last);
+			i->yield_last->next = next;
+			if (picolResumeFree(i, r) != PICKLE_OK)
+				code = PICKLE_ERROR;
+			return code;
+		}
+		if (r->proc) {
+			r->proc = 0;
+			if (code == PICKLE_RETURN)
+				code = PICKLE_OK;
+			if (picolDropCallFrame(i) != PICKLE_OK)
+				code = PICKLE_ERROR;
+		}
+		if (picolResumeFree(i, r) != PICKLE_OK)
+			code = PICKLE_ERROR;
+		r = next;
+	}
+	return code;
+}
+
+static int picolProcParamsFree(pickle_t *i, pickle_proc_t *proc) {
+	assert(i);
+	assert(proc);
+	if (!(proc->params))
+		return PICKLE_OK;
+	int r = PICKLE_OK;
+	for (int j = 0; j < proc->text->count; j++)
+		if (picolAtomRelease(i, proc->params[j]) != PICKLE_OK)
+			r = PICKLE_ERROR;
+	if (picolFree(i, proc->params) != PICKLE_OK)
+		r = PICKLE_ERROR;
+	proc->params = NULL;
+	return r;
+}
+
+static int picolProcParams(pickle_t *i, pickle_proc_t *proc) { /* intern the parameter names of 'proc' */
+	assert(i);
+	assert(proc);
+	const int count = proc->text->count;
+	if (proc->params || !count)
+		return PICKLE_OK;
+	if (!(proc->params = picolMalloc(i, count * sizeof (*proc->params))))
+		return PICKLE_ERROR;
+	zero(proc->params, count * sizeof (*proc->params));
+	for (int j = 0; j < count; j++)
+		if (!(proc->params[j] = picolAtom(i, proc->text->params[j]))) {
+			(void)picolProcParamsFree(i, proc);
+			return PICKLE_ERROR;
+		}
+	return PICKLE_OK;
+}
+
 static int picolCommandCallProc(pickle_t *i, const int argc, char **argv, void *pd) {
 	assert(pd);
 	if (i->level > (int)PICKLE_MAX_RECURSION)
 		return error(i, "Invalid recursion %d", PICKLE_MAX_RECURSION);
-	char **x = pd, *alist = x[0], *body = x[1], *tofree = NULL;
-	char *p = picolStrdup(i, alist);
-	int arity = 0, variadic = 0;
-	pickle_call_frame_t *cf = picolMalloc(i, sizeof(*cf));
-	if (!cf || !p) {
-		(void)picolFree(i, p);
-		(void)picolFree(i, cf);
+	const int resumable = argv == i->callsite; /* called from a script that can be suspended */
+	pickle_proc_t *proc = pd;
+	pickle_proc_text_t *text = proc->text;
+	if (picolProcParams(i, proc) != PICKLE_OK)
 		return PICKLE_ERROR;
-	}
-	cf->vars     = NULL;
-	cf->parent   = i->callframe;
+	pickle_call_frame_t *cf = i->frames;
+	if (cf) {
+		i->frames = cf->parent;
+		i->spare_frames--;
+	} else if (!(cf = picolMalloc(i, sizeof(*cf))))
+		return PICKLE_ERROR;
+	picolFrameInitialize(cf, i->callframe);
 	i->callframe = cf;
 	i->level++;
-	tofree = p;
-	for (int done = 0;!done;) {
-		const char *start = p;
-		while (*p != ' ' && *p != '\0')
-			p++;
-		if (*p != '\0' && p == start) {
-			p++;
-			continue;
-		}
-		if (p == start)
-			break;
-		if (*p == '\0')
-			done = 1;
-		else
-			*p = '\0';
+	int arity = 0, variadic = 0;
+	/* a new frame has no variables, so each can be created without looking
+	 * for it first, unless a parameter name is given more than once */
+	int (*bind)(pickle_t *i, pickle_atom_t *name, const char *val, char *owned, pickle_var_t **set) = text->unique ? picolNewVarAtom : picolSetVarAtom;
+	for (int j = 0; j < text->count; j++) {
+		pickle_atom_t *name = proc->params[j];
 		if (++arity > (argc - 1)) {
-			if (!compare(start, "args")) {
-				if (pickle_var_set(i, start, "") != PICKLE_OK)
+			if (!compare(text->params[j], "args")) {
+				if (bind(i, name, "", NULL, NULL) != PICKLE_OK)
 					goto error;
 				variadic = 1;
 				break;
 			}
 			goto arityerr;
 		}
-		if (done && !compare(start, "args")) {  /* special case: args as last argument */
+		if (j == (text->count - 1) && text->variadic) {  /* special case: args as last argument */
 			variadic = 1;
 			char *cat = concatenate(i, " ", argc - arity, &argv[arity], 1, -1, 0);
-			if (!cat)
-				goto error;
-			int r = pickle_var_set(i, start, cat);
-			if (picolFree(i, cat) != PICKLE_OK)
-				r = PICKLE_ERROR;
-			if (r != PICKLE_OK)
+			if (!cat || bind(i, name, cat, cat, NULL) != PICKLE_OK)
 				goto error;
 		} else {
-			if (pickle_var_set(i, start, argv[arity]) != PICKLE_OK)
+			if (bind(i, name, argv[arity], NULL, NULL) != PICKLE_OK)
 				goto error;
 		}
-		p++;
 	}
-	if (picolFree(i, tofree) != PICKLE_OK)
-		goto error;
-	tofree = NULL;
 	if (!variadic && arity != (argc - 1))
 		goto arityerr;
-	int errcode = picolEval(i, body);
+	if (!(proc->script) && !(proc->script = picolScriptGet(i, proc->text->body)) && i->fatal)
+		goto error;
+	pickle_script_t *script = proc->script;
+	int errcode = PICKLE_OK;
+	if (script) { /* hold a reference, the procedure may be redefined whilst running */
+		script->refs++;
+		errcode = picolEvalScript(i, script, resumable, NULL);
+		if (picolScriptRelease(i, script) != PICKLE_OK)
+			errcode = PICKLE_ERROR;
+	} else {
+		errcode = picolEvalAndSubst(i, NULL, proc->text->body);
+	}
+	if (errcode == PICKLE_YIELD) { /* the frame is kept with the suspended body, see 'picolResume' */
+		assert(i->yield_last);
+		i->yield_last->proc = 1;
+		i->callframe = cf->parent;
+		i->level--;
+		return errcode;
+	}
 	if (errcode == PICKLE_RETURN)
 		errcode = PICKLE_OK;
 	if (picolDropCallFrame(i) != PICKLE_OK)
@@ -2771,28 +6811,71 @@ static int picolCommandCallProc(pickle_t *i, const int argc, char **argv, void *
 arityerr:
 	(void)error(i, "Invalid %s arity: %d (wanted %d)", argv[0], argc, arity + 1);
 error:
-	(void)picolFree(i, tofree);
 	(void)picolDropCallFrame(i);
 	return PICKLE_ERROR;
 }
 
+/* Defines 'name' as a procedure sharing 'text' and, if given, the already
+ * parsed 'script', which must belong to 'i'. */
+static inline long picolTextRefs(pickle_proc_text_t *text, const long add) { /* returns new count */
+	assert(text);
+#if PICKLE_ATOMIC
+	return __atomic_add_fetch(&text->refs, add, __ATOMIC_ACQ_REL);
+#else
+	return text->refs += add;
+#endif
+}
+
+static int picolProcShare(pickle_t *i, const char *name, pickle_proc_text_t *text, pickle_script_t *script) {
+	assert(i);
+	assert(name);
+	assert(text);
+	if (picolGetCommand(i, name))
+		return error(i, "Invalid operation %s", name);
+	pickle_proc_t *proc = picolMalloc(i, sizeof *proc);
+	if (!proc)
+		return PICKLE_ERROR;
+	proc->text   = text;
+	proc->script = script;
+	proc->params = NULL;
+	(void)picolTextRefs(text, 1);
+	if (script)
+		script->refs++;
+	if (picolRegisterCommand(i, name, picolCommandCallProc, NULL, proc) != PICKLE_OK) {
+		(void)picolProcFree(i, proc);
+		return PICKLE_ERROR;
+	}
+	return PICKLE_OK;
+}
+
 static int picolCommandAddProc(pickle_t *i, const char *name, const char *args, const char *body) {
 	assert(i);
 	assert(name);
 	assert(args);
 	assert(body);
-	char **procdata = picolMalloc(i, sizeof(char*)*2);
-	if (!procdata)
+	pickle_proc_text_t *text = picolProcText(i, args, body);
+	if (!text)
 		return PICKLE_ERROR;
-	procdata[0] = picolStrdup(i, args); /* arguments list */
-	procdata[1] = picolStrdup(i, body); /* procedure body */
-	if (!(procdata[0]) || !(procdata[1])) {
-		(void)picolFree(i, procdata[0]);
-		(void)picolFree(i, procdata[1]);
-		(void)picolFree(i, procdata);
+	text->refs = 1; /* held until it is shared with the new procedure */
+	const int r = picolProcShare(i, name, text, NULL);
+	if (picolTextRefs(text, -1) == 0 && picolFree(i, text) != PICKLE_OK)
 		return PICKLE_ERROR;
-	}
-	return pickle_command_register(i, name, picolCommandCallProc, procdata);
+	return r;
+}
+
+static int picolProcFree(pickle_t *i, pickle_proc_t *proc) {
+	assert(i);
+	if (!proc)
+		return PICKLE_OK;
+	int r = picolScriptRelease(i, proc->script);
+	if (picolProcParamsFree(i, proc) != PICKLE_OK)
+		r = PICKLE_ERROR;
+	if (picolTextRefs(proc->text, -1) == 0)
+		if (picolFree(i, proc->text) != PICKLE_OK)
+			r = PICKLE_ERROR;
+	if (picolFree(i, proc) != PICKLE_OK)
+		r = PICKLE_ERROR;
+	return r;
 }
 
 static int picolCommandProc(pickle_t *i, const int argc, char **argv, void *pd) {
@@ -2826,6 +6909,106 @@ static int picolCommandReturn(pickle_t *i, const int argc, char **argv, void *pd
 	return r;
 }
 
+static inline int picolCommandYield(pickle_t *i, const int argc, char **argv, void *pd) {
+	UNUSED(pd);
+	ARITY(argc != 1 && argc != 2, "value?: suspend the coroutine, 'value' is returned to whatever resumed it");
+	if (picolSetResultString(i, argc == 2 ? argv[1] : string_empty) != PICKLE_OK)
+		return PICKLE_ERROR;
+	return PICKLE_YIELD;
+}
+
+static int picolCommandResume(pickle_t *i, const int argc, char **argv, void *pd);
+
+static int picolIsCoroutine(pickle_func_t func) {
+	return func == picolCommandResume;
+}
+
+static int picolCoroutineFree(pickle_t *i, pickle_coroutine_t *co) {
+	assert(i);
+	if (!co)
+		return PICKLE_OK;
+	if (co->running) { /* freed when it stops running, see 'picolCoroutineStop' */
+		co->deleted = 1;
+		return PICKLE_OK;
+	}
+	const int r = picolResumeFree(i, co->resume);
+	return picolFree(i, co) == PICKLE_OK ? r : PICKLE_ERROR;
+}
+
+/* A coroutine has stopped running, with return code 'r', either because it
+ * yielded, in which case the yielded value is returned, or as it finished,
+ * in which case its command, hopefully still called 'name', is deleted. */
+static int picolCoroutineStop(pickle_t *i, pickle_coroutine_t *co, const char *name, const int r) {
+	assert(i);
+	assert(co);
+	assert(name);
+	assert(co->running);
+	co->running = 0;
+	if (r == PICKLE_YIELD) {
+		co->resume = i->yielded;
+		i->yielded = NULL;
+		i->yield_last = NULL;
+		if (co->deleted)
+			return picolCoroutineFree(i, co);
+		return PICKLE_OK;
+	}
+	if (co->deleted)
+		return picolCoroutineFree(i, co) == PICKLE_OK ? r : PICKLE_ERROR;
+	const pickle_command_t *c = picolGetCommand(i, name);
+	for (long j = 0; j < i->length && !(c && c->privdata == co); j++) /* it has been renamed, look for it */
+		for (c = i->table[j]; c && c->privdata != co; c = c->next)
+			;
+	assert(c && c->privdata == co);
+	return picolUnsetCommand(i, c->name) == PICKLE_OK ? r : PICKLE_ERROR;
+}
+
+/* Coroutines run at the top level, like 'uplevel #0', as they can be
+ * resumed from anywhere. */
+static inline int picolCommandCoroutine(pickle_t *i, const int argc, char **argv, void *pd) {
+	UNUSED(pd);
+	ARITY(argc < 3, "name command args...: call a command that can yield, 'name' resumes it");
+	pickle_coroutine_t *co = picolMalloc(i, sizeof *co);
+	if (!co)
+		return PICKLE_ERROR;
+	zero(co, sizeof *co);
+	if (picolRegisterCommand(i, argv[1], picolCommandResume, NULL, co) != PICKLE_OK) {
+		(void)picolFree(i, co);
+		return PICKLE_ERROR;
+	}
+	pickle_call_frame_t *cf = i->callframe;
+	const int level = i->level;
+	co->running   = 1;
+	i->callframe  = &i->top;
+	i->level      = 0;
+	i->yielded    = NULL;
+	i->yield_last = NULL;
+	i->callsite   = &argv[2];
+	const int r = picolDoCommand(i, argc - 2, &argv[2], NULL);
+	i->callsite   = NULL;
+	i->callframe  = cf;
+	i->level      = level;
+	return picolCoroutineStop(i, co, argv[1], r);
+}
+
+static int picolCommandResume(pickle_t *i, const int argc, char **argv, void *pd) {
+	pickle_coroutine_t *co = pd;
+	assert(co);
+	ARITY(argc != 1 && argc != 2, "value?: resume a coroutine, 'value' is returned by the yield it is suspended in");
+	if (co->running)
+		return error(i, "Invalid coroutine %s: running", argv[0]);
+	if (picolSetResultString(i, argc == 2 ? argv[1] : string_empty) != PICKLE_OK)
+		return PICKLE_ERROR;
+	pickle_call_frame_t *cf = i->callframe;
+	const int level = i->level;
+	pickle_resume_t *r = co->resume;
+	co->resume  = NULL;
+	co->running = 1;
+	const int code = picolResume(i, r, PICKLE_OK);
+	i->callframe = cf;
+	i->level     = level;
+	return picolCoroutineStop(i, co, argv[0], code);
+}
+
 static int doJoin(pickle_t *i, const char *join, const int argc, char **argv, int list, int trim) {
 	char *e = concatenate(i, join, argc, argv, list, -1, trim);
 	if (!e)
@@ -2861,8 +7044,8 @@ static int picolCommandEval(pickle_t *i, const int argc, char **argv, void *pd)
 	UNUSED(pd);
 	int r = doJoin(i, " ", argc - 1, argv + 1, 0, 0);
 	if (r == PICKLE_OK) {
-		char *e = picolStrdup(i, i->result);
-		if (!e)
+		char *e = picolResultTake(i);
+		if (!e && !(e = picolStrdup(i, picolGetResult(i))))
 			return PICKLE_ERROR;
 		r = picolEval(i, e);
 		if (picolFree(i, e) != PICKLE_OK)
@@ -2923,21 +7106,25 @@ static int picolCommandUpVar(pickle_t *i, const int argc, char **argv, void *pd)
 		goto end;
 	}
 	assert(cf);
-	m = cf->vars;
+	m = picolGetVar(i, argv[3], 0);
+	assert(m);
 
 	if ((r = picolSetLevelByString(i, argv[1])) != PICKLE_OK)
 		goto end;
 	if (!(o = picolGetVar(i, argv[2], 1))) {
 		if ((r = pickle_var_set(i, argv[2], "")) != PICKLE_OK)
 			goto end;
-		o = i->callframe->vars;
+		o = picolGetVar(i, argv[2], 1);
 	}
+	assert(o && o->type != PV_LINK); /* link is resolved now, not on each use */
 
 	if (m == o) { /* more advance cycle detection should be done here */
 		r = error(i, "Invalid operation %s", argv[0]);
 		goto end;
 	}
 
+	if ((r = picolFreeVarVal(i, m)) != PICKLE_OK)
+		goto end;
 	m->type = PV_LINK;
 	m->data.link = o;
 end:
@@ -2980,7 +7167,7 @@ static inline int picolUnsetVar(pickle_t *i, const char *name) {
 	pickle_var_t *p = NULL, *deleteMe = picolGetVar(i, name, 0/*NB!*/);
 	if (!deleteMe)
 		return error(i, "Invalid variable %s", name);
-
+	picolFrameRemove(cf, deleteMe);
 	if (cf->vars == deleteMe) {
 		cf->vars = deleteMe->next;
 		return picolVarFree(i, deleteMe);
@@ -3007,7 +7194,7 @@ enum { ARGS, BODY, PRIVATE };
 static int picolInfoFunction(pickle_t *i, const int type, const char *cmd) {
 	assert(i);
 	assert(cmd);
-	pickle_command_t *c = picolGetCommand(i, cmd);
+	const pickle_command_t *c = picolGetCommand(i, cmd);
 	if (!c)
 		return error(i, "Invalid command %s", cmd);
 	if (type == PRIVATE)
@@ -3015,12 +7202,14 @@ static int picolInfoFunction(pickle_t *i, const int type, const char *cmd) {
 	assert((type == BODY || type == ARGS) && ARGS == 0 && BODY == 1);
 	const int defined = picolIsDefinedProc(c->func);
 	if (!defined) {
+		if (type && c->ex)
+			return ok(i, "%p", c->ex);
 		if (type)
 			return ok(i, "%p", c->func);
 		return ok(i, "built-in");
 	}
-	char **procdata = c->privdata;
-	return picolSetResultString(i, procdata[!!type]);
+	pickle_proc_t *proc = c->privdata;
+	return picolSetResultString(i, type ? proc->text->body : proc->text->args);
 }
 
 enum { COMMANDS, PROCS, FUNCTIONS, };
@@ -3032,22 +7221,20 @@ static int picolInfoCommands(pickle_t *i, const int type, const char *pat) {
 	args_t a = { 0, NULL };
 	if (!DEFINE_MATHS && type == FUNCTIONS)
 		return picolSetResultEmpty(i);
-	for (long j = 0; j < i->length; j++) {
-		pickle_command_t *c = i->table[j];
-		for (; c; c = c->next) {
-			assert(c != c->next);
-			if (type == PROCS && !picolIsDefinedProc(c->func))
-				continue;
-			if (type == FUNCTIONS) {
-				if (DEFINE_MATHS)
-					if (c->func != picolCommandMath && c->func != picolCommandMathUnary)
-						continue;
-			}
-			if (match(pat, c->name, 0, PICKLE_MAX_RECURSION)) {
-				if (!(a.argv = picolArgsGrow(i, &a.argc, a.argv)))
-					return PICKLE_ERROR;
-				a.argv[a.argc - 1] = c->name;
-			}
+	long j = -1;
+	for (const pickle_command_t *c = picolNextCommand(i, &j, NULL); c; c = picolNextCommand(i, &j, c)) {
+		assert(c != c->next);
+		if (type == PROCS && !picolIsDefinedProc(c->func))
+			continue;
+		if (type == FUNCTIONS) {
+			if (DEFINE_MATHS)
+				if (c->func != picolCommandMath && c->func != picolCommandMathUnary)
+					continue;
+		}
+		if (match(pat, c->name, 0) > 0) {
+			if (!(a.argv = picolArgsGrow(i, &a.argc, a.argv)))
+				return PICKLE_ERROR;
+			a.argv[a.argc - 1] = c->name;
 		}
 	}
 	char *l = concatenate(i, " ", a.argc, a.argv, 1, -1, 0);
@@ -3056,15 +7243,128 @@ static int picolInfoCommands(pickle_t *i, const int type, const char *pat) {
 	return r1 == PICKLE_OK && r2 == PICKLE_OK ? PICKLE_OK : PICKLE_ERROR;
 }
 
+#if DEFINE_PROFILE
+static void picolProfileReset(pickle_t *i) {
+	assert(i);
+	long j = -1;
+	for (const pickle_command_t *c = picolNextCommand(i, &j, NULL); c; c = picolNextCommand(i, &j, c)) {
+		pickle_profile_t *p = picolProfileOf(i, c);
+		if (p)
+			zero(p, sizeof (*p));
+	}
+	i->child = 0;
+	i->child_allocations = 0;
+	i->child_bytes = 0;
+}
+
+/* Each entry is a list of the command name, calls, total time, self time,
+ * and the allocations and bytes allocated by the command itself */
+static int picolInfoProfile(pickle_t *i, const char *pat) {
+	assert(i);
+	assert(pat);
+	args_t a = { 0, NULL };
+	long j = -1;
+	for (const pickle_command_t *c = picolNextCommand(i, &j, NULL); c; c = picolNextCommand(i, &j, c)) {
+		const pickle_profile_t *p = picolProfileOf(i, c);
+		if (!p || !p->calls || match(pat, c->name, 0) <= 0)
+			continue;
+		char n[5][PRINT_NUMBER_BUF_SZ] = { { 0 } };
+		char *e[6] = { c->name, n[0], n[1], n[2], n[3], n[4] };
+		(void)picolNumberToString(n[0], p->calls, 10);
+		(void)picolNumberToString(n[1], p->total, 10);
+		(void)picolNumberToString(n[2], p->self, 10);
+		(void)picolNumberToString(n[3], p->allocations, 10);
+		(void)picolNumberToString(n[4], p->bytes, 10);
+		if (!(a.argv = picolArgsGrow(i, &a.argc, a.argv)))
+			return PICKLE_ERROR;
+		if (!(a.argv[a.argc - 1] = concatenate(i, " ", 6, e, 1, -1, 0))) {
+			(void)picolFreeArgList(i, a.argc, a.argv);
+			return PICKLE_ERROR;
+		}
+	}
+	char *l = concatenate(i, " ", a.argc, a.argv, 1, -1, 0);
+	const int r1 = picolFreeArgList(i, a.argc, a.argv);
+	const int r2 = picolForceResult(i, l, 0);
+	return r1 == PICKLE_OK && r2 == PICKLE_OK ? PICKLE_OK : PICKLE_ERROR;
+}
+
+static int picolCommandInfoProfile(pickle_t *i, const char *rq) {
+	assert(i);
+	assert(rq);
+	if (!compare(rq, "on"))
+		return picolProfileStart(i);
+	if (!compare(rq, "off")) {
+		i->profile = 0;
+		return PICKLE_OK;
+	}
+	if (!compare(rq, "reset")) {
+		picolProfileReset(i);
+		return PICKLE_OK;
+	}
+	if (!compare(rq, "status"))
+		return picolForceResult(i, i->profile ? "1" : "0", 1);
+	return picolInfoProfile(i, rq);
+}
+#endif
+
+#if DEFINE_MEMORY
+/* A list of names and counts, so 'dict get' can read it, ending with the
+ * list of allocations in each size class */
+static int picolInfoMemory(pickle_t *i) {
+	assert(i);
+	static const pickle_memory_t none = { 0 };
+	const pickle_memory_t *m = i->tracker ? &i->tracker->counts : &none;
+	const unsigned long v[] = { m->allocations, m->reallocations, m->frees, m->bytes, m->live, m->peak };
+	char n[6 + PICKLE_MEMORY_CLASSES][PRINT_NUMBER_BUF_SZ] = { { 0 } };
+	char *e[14] = { "allocations", n[0], "reallocations", n[1], "frees", n[2], "bytes", n[3], "live", n[4], "peak", n[5], "classes", NULL, };
+	char *c[PICKLE_MEMORY_CLASSES] = { NULL };
+	for (size_t j = 0; j < (sizeof (v) / sizeof (v[0])); j++)
+		(void)picolNumberToString(n[j], v[j], 10);
+	for (int j = 0; j < PICKLE_MEMORY_CLASSES; j++)
+		(void)picolNumberToString(c[j] = n[6 + j], m->classes[j], 10);
+	if (!(e[13] = concatenate(i, " ", PICKLE_MEMORY_CLASSES, c, 0, -1, 0)))
+		return PICKLE_ERROR;
+	char *l = concatenate(i, " ", 14, e, 1, -1, 0);
+	const int r1 = picolFree(i, e[13]);
+	const int r2 = picolForceResult(i, l, 0);
+	return r1 == PICKLE_OK && r2 == PICKLE_OK ? PICKLE_OK : PICKLE_ERROR;
+}
+
+static int picolCommandInfoMemory(pickle_t *i, const char *rq) {
+	assert(i);
+	if (!rq)
+		return picolInfoMemory(i);
+	if (!compare(rq, "on"))
+		return picolMemoryStart(i);
+	if (!compare(rq, "off")) {
+		picolMemoryStop(i);
+		return PICKLE_OK;
+	}
+	if (!compare(rq, "reset")) { /* blocks still held stay counted, so freeing them later balances */
+		pickle_memory_t *m = i->tracker ? &i->tracker->counts : NULL;
+		if (m) {
+			const size_t live = m->live;
+			zero(m, sizeof (*m));
+			m->live = live;
+			m->peak = live;
+		}
+		return PICKLE_OK;
+	}
+	if (!compare(rq, "status"))
+		return picolForceResult(i, i->track ? "1" : "0", 1);
+	return error(i, "Invalid option %s", rq);
+}
+#endif
+
 static int picolInfoVars(pickle_t *i, const char *pat) {
 	assert(i);
 	assert(pat);
 	args_t a = { 0, NULL };
 	for (pickle_var_t *v = i->callframe->vars; v; v = v->next) {
-		char *name = v->smallname ? &v->name.small[0] : v->name.ptr;
+		char *name = v->name->name;
 		if (v->type == PV_LINK)
 			continue;
-		if (match(pat, name, 0, PICKLE_MAX_RECURSION)) {
+		if (match(pat, name, 0) > 0) {
 			if (!(a.argv = picolArgsGrow(i, &a.argc, a.argv)))
 				return PICKLE_ERROR;
 			a.argv[a.argc - 1] = name;
@@ -3103,6 +7403,14 @@ static int picolCommandInfo(pickle_t *i, const int argc, char **argv, void *pd)
 		return picolSetResultNumber(i, i->level);
 	if (!compare(rq, "cmdcount")) /* For (very rough) code profiling */
 		return picolSetResultNumber(i, i->cmdcount);
+#if DEFINE_PROFILE
+	if (!compare(rq, "profile"))
+		return picolCommandInfoProfile(i, argc == 2 ? "*" : argv[2]);
+#endif
+#if DEFINE_MEMORY
+	if (!compare(rq, "memory"))
+		return picolCommandInfoMemory(i, argc == 2 ? NULL : argv[2]);
+#endif
 	if (!compare(rq, "version"))
 		return ok(i, "%d %d %d", (int)((PICKLE_VERSION >> 16) & 255),
 			(int)((PICKLE_VERSION >> 8) & 255), (int)(PICKLE_VERSION & 255));
@@ -3142,6 +7450,11 @@ static int picolCommandInfo(pickle_t *i, const int argc, char **argv, void *pd)
 			{  "list",       DEFINE_LIST                          },
 			{  "regex",      DEFINE_REGEX                         },
 			{  "help",       DEFINE_HELP                          },
+			{  "compiler",   DEFINE_COMPILER                      },
+			{  "profile",    DEFINE_PROFILE                       },
+			{  "memory",     DEFINE_MEMORY                        },
+			{  "native",     DEFINE_NATIVE                        },
+			{  "coroutine",  DEFINE_COROUTINE                     },
 			{  "debugging",  DEBUGGING                            },
 			{  "strict",     STRICT_NUMERIC_CONVERSION            },
 		};
@@ -3169,9 +7482,17 @@ static int picolCommandTrace(pickle_t *i, const int argc, char **argv, void *pd)
 }
 
 /* Regular Expression Engine
- * Modified from:
+ * The syntax is that of the matcher from:
  * https://www.cs.princeton.edu/courses/archive/spr09/cos333/beautiful.html
  *
+ * Patterns are compiled to a small program for a Pike VM, described in
+ * <https://swtch.com/~rsc/regexp/regexp2.html>, which runs every possible
+ * match in step over the text, so matching takes time proportional to the
+ * length of the text times the length of the pattern and uses no recursion.
+ * Threads are kept in priority order, so lazy, greedy and possessive
+ * matches give the same results as a backtracking matcher would. Compiled
+ * patterns are kept in a small cache, most recently used first.
+ *
  * Supports: "^$.*+?", escaping, and classes "\w\W\s\S\d\D"
  * Nice to have: hex escape sequences, ability to work on binary data. */
 
@@ -3185,6 +7506,31 @@ enum { /* watch out for those negatives */
 
 enum { LAZY, GREEDY, POSSESSIVE };
 
+enum {
+	RX_CHAR,  /**< match a character or class 'c' and move on */
+	RX_NOT,   /**< continue only if the next character is not 'c', for possessive matches */
+	RX_SPLIT, /**< continue at both 'x' and 'y', preferring 'x' */
+	RX_JUMP,  /**< continue at 'x' */
+	RX_END,   /**< continue only at the end of the text */
+	RX_MATCH, /**< a match has been found */
+	RX_FAIL,  /**< the pattern is malformed, only an error if it is reached */
+};
+
+typedef PREPACK struct {
+	short op; /**< RX_... */
+	short c;  /**< character or class for RX_CHAR and RX_NOT */
+	int x, y; /**< targets for RX_SPLIT and RX_JUMP */
+} POSTPACK pickle_regex_op_t;
+
+struct pickle_regex {
+	char *pattern;            /**< pattern this was compiled from */
+	unsigned type     :2,     /**< lazy, greedy or possessive */
+		 nocase   :1,     /**< ignore case when matching */
+		 anchored :1;     /**< pattern began with '^' */
+	int length;               /**< number of instructions in 'ops' */
+	pickle_regex_op_t *ops;   /**< the compiled pattern, allocated after this structure */
+};
+
 /* escape a character, or return an operator */
 static int regexEscape(const unsigned ch, const int esc) {
 	switch (ch) {
@@ -3209,141 +7555,314 @@ static int regexEscape(const unsigned ch, const int esc) {
 	return ch;
 }
 
-static int regexChar(const pickle_regex_t *x, const int pattern, const int ch) {
+static int regexChar(const pickle_regex_program_t *x, const int pattern, const int ch) {
 	assert(x);
+	if (ch == EOI)
+		return 0;
 	switch (pattern) {
 	case ANY:   return 1;
 	case ALPHA: return isalpha(ch); case NALPHA: return !isalpha(ch);
 	case DIGIT: return isdigit(ch); case NDIGIT: return !isdigit(ch);
 	case SPACE: return isspace(ch); case NSPACE: return !isspace(ch);
 	}
+	if (pattern < 0) /* an operator in the place of an atom matches nothing */
+		return 0;
 	if (x->nocase)
 		return tolower(pattern) == tolower(ch);
 	return pattern == ch;
 }
 
-static int regexStar(pickle_regex_t *x, int depth, int c, const char *regexp, const char *text);
+static int regexEmit(pickle_regex_program_t *x, const int op, const int c, const int a, const int b) {
+	assert(x);
+	if (x->ops) {
+		pickle_regex_op_t *o = &x->ops[x->length];
+		o->op = op;
+		o->c  = c;
+		o->x  = a;
+		o->y  = b;
+	}
+	return x->length++;
+}
+
+/* Compile 'regexp' into 'x', or when 'x->ops' is NULL only count the
+ * instructions needed. Each atom takes one instruction, and up to three
+ * more for the operator after it:
+ *
+ *	c?  SPLIT L1 L2; L1: CHAR c; L2:            (L2, L1 if lazy)
+ *	c*  L0: SPLIT L1 L2; L1: CHAR c; JUMP L0; L2:
+ *	c+  L0: CHAR c; SPLIT L0 L1; L1:
+ *
+ * A possessive 'c?' or 'c*' is only allowed to skip 'c' with a NOT c at
+ * L2, and 'c+' is compiled as 'cc*'. */
+static void regexCompile(pickle_regex_program_t *x, const char *regexp) {
+	assert(x);
+	assert(regexp);
+	const int lazy = x->type == LAZY, possessive = x->type == POSSESSIVE;
+	x->length = 0;
+	for (;;) {
+		int r1 = regexEscape(regexp[0], 0), r2 = EOI;
+		if (r1 == EOI)
+			break;
+		if (r1 == START) {
+			(void)regexEmit(x, RX_FAIL, 0, 0, 0);
+			return;
+		}
+		if (r1 == ESC) {
+			r1 = regexEscape(regexp[1], 1);
+			if (r1 == EOI) {
+				(void)regexEmit(x, RX_FAIL, 0, 0, 0);
+				return;
+			}
+			regexp++;
+		}
+		r2 = regexEscape(regexp[1], 0);
+		if (r2 == MAYBE) {
+			const int at = x->length, l1 = at + 1, l2 = at + 2;
+			(void)regexEmit(x, RX_SPLIT, 0, lazy ? l2 : l1, lazy ? l1 : l2);
+			(void)regexEmit(x, RX_CHAR, r1, 0, 0);
+			if (possessive) {
+				(void)regexEmit(x, RX_JUMP, 0, at + 4, 0);
+				if (x->ops)
+					x->ops[at].y = at + 3;
+				(void)regexEmit(x, RX_NOT, r1, 0, 0);
+			}
+			regexp += 2;
+			continue;
+		}
+		if (r2 == MANY || r2 == ATLEAST) {
+			if (r2 == ATLEAST && !possessive) {
+				const int at = regexEmit(x, RX_CHAR, r1, 0, 0);
+				(void)regexEmit(x, RX_SPLIT, 0, lazy ? at + 2 : at, lazy ? at : at + 2);
+				regexp += 2;
+				continue;
+			}
+			if (r2 == ATLEAST)
+				(void)regexEmit(x, RX_CHAR, r1, 0, 0);
+			const int at = x->length, l1 = at + 1, l2 = at + 3;
+			(void)regexEmit(x, RX_SPLIT, 0, lazy ? l2 : l1, lazy ? l1 : l2);
+			(void)regexEmit(x, RX_CHAR, r1, 0, 0);
+			(void)regexEmit(x, RX_JUMP, 0, at, 0);
+			if (possessive)
+				(void)regexEmit(x, RX_NOT, r1, 0, 0);
+			regexp += 2;
+			continue;
+		}
+		if (r1 == END) {
+			(void)regexEmit(x, r2 == EOI ? RX_END : RX_FAIL, 0, 0, 0);
+			if (r2 != EOI)
+				return;
+			break;
+		}
+		(void)regexEmit(x, RX_CHAR, r1, 0, 0);
+		regexp++;
+	}
+	(void)regexEmit(x, RX_MATCH, 0, 0, 0);
+}
+
+static int regexFree(pickle_t *i, pickle_regex_program_t *x) {
+	assert(i);
+	if (!x)
+		return PICKLE_OK;
+	const int r = picolFree(i, x->pattern);
+	return picolFree(i, x) == PICKLE_OK ? r : PICKLE_ERROR;
+}
 
-/* search for regexp at beginning of text */
-static int regexHere(pickle_regex_t *x, const int depth, const char *regexp, const char *text) {
-	assert(x);
+static pickle_regex_program_t *regexNew(pickle_t *i, const char *regexp, const unsigned type, const unsigned nocase) {
+	assert(i);
 	assert(regexp);
-	assert(text);
-	if (x->max && depth > x->max)
-		return -1;
-	int r1 = EOI, r2 = EOI;
-again:
-	r1 = regexEscape(regexp[0], 0);
-	if (r1 == EOI) {
-		x->end = text;
-		return 1;
+	pickle_regex_program_t count = { .type = type, .nocase = nocase, };
+	const int anchored = regexp[0] == START;
+	regexCompile(&count, regexp + anchored);
+	const size_t bytes = sizeof (count) + (count.length * sizeof (*count.ops));
+	if (USE_MAX_STRING && bytes > PICKLE_MAX_STRING)
+		return NULL;
+	pickle_regex_program_t *x = picolMalloc(i, bytes);
+	if (!x)
+		return NULL;
+	zero(x, bytes);
+	x->type     = type;
+	x->nocase   = nocase;
+	x->anchored = anchored;
+	x->ops      = (pickle_regex_op_t*)(x + 1);
+	if (!(x->pattern = picolStrdup(i, regexp))) {
+		(void)picolFree(i, x);
+		return NULL;
 	}
-	if (r1 == START)
-		return -1;
-	if (r1 == ESC) {
-		r1 = regexEscape(regexp[1], 1);
-		if (r1 == EOI)
-			return -1;
-		regexp++;
+	regexCompile(x, regexp + anchored);
+	assert(x->length == count.length);
+	return x;
+}
+
+/* Look up a compiled pattern in the cache of 'PICKLE_REGEX_CACHE' entries,
+ * compiling it if it is not there and moving it to the front. The returned
+ * pattern belongs to the cache unless 'PICKLE_REGEX_CACHE' is zero. */
+static pickle_regex_program_t *picolRegexGet(pickle_t *i, const char *regexp, const unsigned type, const unsigned nocase) {
+	assert(i);
+	assert(regexp);
+	if (!PICKLE_REGEX_CACHE)
+		return regexNew(i, regexp, type, nocase);
+	const size_t cbytes = MAX(PICKLE_REGEX_CACHE, 1) * sizeof (*i->regexes);
+	if (!(i->regexes)) {
+		if (!(i->regexes = picolMalloc(i, cbytes)))
+			return NULL;
+		zero(i->regexes, cbytes);
 	}
-	r2 = regexEscape(regexp[1], 0);
-	if (r2 == MAYBE) {
-		const int is = regexChar(x, r1, *text);
-		if (x->type == GREEDY) {
-			if (is) {
-				const int m = regexHere(x, depth + 1, regexp + 2, text + 1);
-				if (m)
-					return m;
-			}
-			regexp += 2;
-			goto again;
-		} else if (x->type == LAZY) {
-			const int m = regexHere(x, depth + 1, regexp + 2, text);
-			if (m)
-				return m;
-			if (!is)
-				return 0;
-			regexp += 2, text++;
-			goto again;
-		} else {
-			assert(x->type == POSSESSIVE);
-			regexp += 2, text += is;
-			goto again;
+	pickle_regex_program_t **c = i->regexes, *x = NULL;
+	int j = 0;
+	for (j = 0; j < PICKLE_REGEX_CACHE && c[j]; j++)
+		if (c[j]->type == type && c[j]->nocase == nocase && !compare(c[j]->pattern, regexp))
+			break;
+	if (j < PICKLE_REGEX_CACHE && c[j]) {
+		x = c[j];
+	} else {
+		if (!(x = regexNew(i, regexp, type, nocase)))
+			return NULL;
+		j = MAX(PICKLE_REGEX_CACHE, 1) - 1;
+		if (regexFree(i, c[j]) != PICKLE_OK) {
+			c[j] = NULL;
+			(void)regexFree(i, x);
+			return NULL;
 		}
 	}
-	if (r2 == ATLEAST) {
-		if (!regexChar(x, r1, *text))
-			return 0;
-		return regexStar(x, depth + 1, r1, regexp + 2, text + 1);
-	}
-	if (r2 == MANY)
-		return regexStar(x, depth + 1, r1, regexp + 2, text);
-	if (r1 == END) {
-		if (r2 != EOI)
-			return -1;
-		const int m = *text == EOI;
-		x->end = m == 1 ? text : NULL;
-		return m;
-	}
-	if (*text != EOI && regexChar(x, r1, *text)) {
-		regexp++, text++;
-		goto again;
+	move(&c[1], &c[0], j * sizeof (*c));
+	c[0] = x;
+	return x;
+}
+
+static int regexDeinitialize(pickle_t *i) {
+	assert(i);
+	int r = PICKLE_OK;
+	if (!(i->regexes))
+		return r;
+	for (int j = 0; j < PICKLE_REGEX_CACHE; j++)
+		if (regexFree(i, i->regexes[j]) != PICKLE_OK)
+			r = PICKLE_ERROR;
+	if (picolFree(i, i->regexes) != PICKLE_OK)
+		r = PICKLE_ERROR;
+	i->regexes = NULL;
+	return r;
+}
+
+typedef struct {
+	int *pc;             /**< instructions the threads are at, highest priority first */
+	const char **start;  /**< where the match each thread is trying began */
+	int count;           /**< number of threads */
+} pickle_regex_threads_t;
+
+/* Add a thread at 'pc' to 'l' for the text at 't', following any jumps in
+ * priority order. 'seen' marks the instructions already visited for 't',
+ * and 'stack' has room for two entries per instruction. */
+static int regexAdd(const pickle_regex_program_t *x, pickle_regex_threads_t *l, unsigned *seen, const unsigned step, int *stack, int pc, const char *start, const char *t) {
+	assert(x);
+	assert(l);
+	assert(seen);
+	assert(stack);
+	assert(start);
+	assert(t);
+	int sp = 0;
+	stack[sp++] = pc;
+	while (sp) {
+		pc = stack[--sp];
+		assert(pc >= 0 && pc < x->length);
+		if (seen[pc] == step)
+			continue;
+		seen[pc] = step;
+		const pickle_regex_op_t *o = &x->ops[pc];
+		switch (o->op) {
+		case RX_SPLIT: stack[sp++] = o->y; stack[sp++] = o->x; break;
+		case RX_JUMP:  stack[sp++] = o->x; break;
+		case RX_NOT:   if (!regexChar(x, o->c, (unsigned char)*t)) stack[sp++] = pc + 1; break;
+		case RX_END:   if (*t == EOI) stack[sp++] = pc + 1; break;
+		case RX_FAIL:  return -1;
+		default:
+			l->pc[l->count]    = pc;
+			l->start[l->count] = start;
+			l->count++;
+		}
 	}
 	return 0;
 }
 
-/* search for c*regexp at beginning of text */
-static int regexStar(pickle_regex_t *x, const int depth, const int c, const char *regexp, const char *text) {
+/* search for the compiled pattern anywhere in text, see 'picolRegexExtract' */
+static int regexExecute(pickle_t *i, const pickle_regex_program_t *x, pickle_regex_t *m, const char *text) {
+	assert(i);
 	assert(x);
-	assert(regexp);
+	assert(m);
 	assert(text);
-	if (x->max && depth > x->max)
-		return -1;
-	if (x->type == GREEDY || x->type == POSSESSIVE) {
-		const char *t = NULL;
-		for (t = text; *t != EOI && regexChar(x, c, *t); t++)
-			;
-		if (x->type == POSSESSIVE)
-			return regexHere(x, depth + 1, regexp, t);
-		do {
-			const int m = regexHere(x, depth + 1, regexp, t);
-			if (m)
-				return m;
-		} while (t-- > text);
-		return 0;
+	const int n = x->length;
+	const pickle_mark_t mark = picolScratchMark(i);
+	pickle_regex_threads_t l[2] = {
+		{ .pc = picolScratch(i, n * sizeof (int)), .start = picolScratch(i, n * sizeof (char*)), },
+		{ .pc = picolScratch(i, n * sizeof (int)), .start = picolScratch(i, n * sizeof (char*)), },
+	};
+	unsigned *seen = picolScratch(i, n * sizeof (*seen)), step = 1;
+	int *stack = picolScratch(i, 2 * n * sizeof (*stack)), r = 0;
+	if (!l[0].pc || !l[0].start || !l[1].pc || !l[1].start || !seen || !stack) {
+		r = -1;
+		goto done;
 	}
-	assert(x->type == LAZY);
-	do {    /* a '*' matches zero or more instances */
-		const int m = regexHere(x, depth + 1, regexp, text);
-		if (m)
-			return m;
-	} while (*text != EOI && regexChar(x, c, *text++));
-	return 0;
+	zero(seen, n * sizeof (*seen));
+	pickle_regex_threads_t *c = &l[0], *nl = &l[1];
+	const int first = x->ops[0].op == RX_CHAR && x->ops[0].c > 0 && !x->nocase ? x->ops[0].c : 0;
+	for (const char *t = text; ; t++) { /* 'c' holds the threads for 't', added with the current 'step' */
+		if (first && !c->count && !r && !x->anchored) /* skip to where a match could start */
+			if (!(t = strchr(t, first)))
+				break;
+		if (!r && (!x->anchored || t == text)) /* no match yet, so try one starting here, after all others */
+			if (regexAdd(x, c, seen, step, stack, 0, t, t) < 0)
+				goto fail;
+		if (!c->count && (r || x->anchored)) /* nothing left running, or that could start later */
+			break;
+		step++;
+		nl->count = 0;
+		for (int j = 0; j < c->count; j++) {
+			const pickle_regex_op_t *o = &x->ops[c->pc[j]];
+			if (o->op == RX_MATCH) {
+				r = 1;
+				m->start = c->start[j];
+				m->end   = t;
+				break; /* threads after this one have a lower priority */
+			}
+			assert(o->op == RX_CHAR);
+			if (regexChar(x, o->c, (unsigned char)*t))
+				if (regexAdd(x, nl, seen, step, stack, c->pc[j] + 1, c->start[j], t + 1) < 0)
+					goto fail;
+		}
+		pickle_regex_threads_t *swap = c;
+		c = nl;
+		nl = swap;
+		if (*t == EOI)
+			break;
+	}
+	goto done;
+fail:
+	r = -1;
+done:
+	if (picolScratchRelease(i, &mark) != PICKLE_OK)
+		r = -1;
+	return r;
 }
 
-/* search for regexp anywhere in text */
-static int picolRegexExtract(pickle_regex_t *x, const char *regexp, const char *text) {
+/* search for regexp anywhere in text, returning 1 and setting the start and
+ * end of the match in 'x' if it is found, 0 if it is not, and -1 if the
+ * pattern is malformed (or memory runs out) */
+static int picolRegexExtract(pickle_t *i, pickle_regex_t *x, const char *regexp, const char *text) {
+	assert(i);
 	assert(x);
 	assert(regexp);
 	assert(text);
 	x->start = NULL;
 	x->end   = NULL;
-	int m = 0;
-	if (regexp[0] == START) {
-		m = regexHere(x, 0, regexp + 1, text);
-		goto done;
+	pickle_regex_program_t *p = picolRegexGet(i, regexp, x->type, x->nocase);
+	if (!p)
+		return -1;
+	const int m = regexExecute(i, p, x, text);
+	if (!PICKLE_REGEX_CACHE && regexFree(i, p) != PICKLE_OK)
+		return -1;
+	if (m <= 0) {
+		x->start = NULL;
+		x->end   = NULL;
 	}
-	do {    /* must look even if string is empty */
-		m = regexHere(x, 0, regexp, text);
-		if (m)
-		       goto done;
-	} while (*text++ != EOI);
-	x->start = NULL;
-	x->end   = NULL;
-	return 0;
-done:
-	if (m > 0)
-		x->start = text;
 	return m;
 }
 
@@ -3378,8 +7897,8 @@ static inline int picolCommandRegex(pickle_t *i, const int argc, char **argv, vo
 			index = l;
 		string += index;
 	}
-	pickle_regex_t x = { NULL, NULL, PICKLE_MAX_RECURSION, type, nocase };
-	const int r = picolRegexExtract(&x, pattern, string);
+	pickle_regex_t x = { NULL, NULL, type, nocase };
+	const int r = picolRegexExtract(i, &x, pattern, string);
 	mutual(x.start, x.end);
 	if (r < 0)
 		return error(i, "Invalid %s %s", argv[0], pattern);
@@ -3394,111 +7913,233 @@ static inline int picolCommandRegex(pickle_t *i, const int argc, char **argv, vo
 	return ok(i, "%ld %ld", (long)start, (long)end);
 }
 
-static int picolRegisterCoreCommands(pickle_t *i) {
-	assert(i);
-
-	typedef PREPACK struct {
-		const char *name;   /**< Name of function/TCL command */
-		pickle_func_t func; /**< Callback that actually does stuff */
-		void *data;         /**< Optional data for this function */
-	} POSTPACK pickle_command_register_t; /**< A single TCL command */
-
-	static const pickle_command_register_t commands[] = {
-		{ "apply",     picolCommandApply,     NULL },
-		{ "break",     picolCommandRetCodes,  (char*)PICKLE_BREAK },
-		{ "catch",     picolCommandCatch,     NULL },
-		{ "concat",    picolCommandConcat,    (char*)CONCAT },
-		{ "conjoin",   picolCommandConcat,    (char*)CONJOIN },
-		{ "continue",  picolCommandRetCodes,  (char*)PICKLE_CONTINUE },
-		{ "eq",        picolCommandEqual,     NULL },
-		{ "eval",      picolCommandEval,      NULL },
-		{ "for",       picolCommandFor,       NULL },
-		{ "if",        picolCommandIf,        NULL },
-		{ "incr",      picolCommandIncr,      NULL },
-		{ "info",      picolCommandInfo,      NULL },
-		{ "join",      picolCommandJoin,      NULL },
-		{ "list",      picolCommandConcat,    (char*)LIST },
-		{ "ne",        picolCommandNotEqual,  NULL },
-		{ "proc",      picolCommandProc,      NULL },
-		{ "rename",    picolCommandRename,    NULL },
-		{ "return",    picolCommandReturn,    NULL },
-		{ "set",       picolCommandSet,       NULL },
-		{ "subst",     picolCommandSubst,     NULL },
-		{ "trace",     picolCommandTrace,     NULL },
-		{ "unset",     picolCommandUnSet,     NULL },
-		{ "uplevel",   picolCommandUpLevel,   NULL },
-		{ "upvar",     picolCommandUpVar,     NULL },
-		{ "while",     picolCommandWhile,     NULL },
 #if DEFINE_LIST
-		{ "lappend",   picolCommandLAppend,   NULL },
-		{ "lindex",    picolCommandLIndex,    NULL },
-		{ "linsert",   picolCommandLInsert,   NULL },
-		{ "llength",   picolCommandLLength,   NULL },
-		{ "lrange",    picolCommandLRange,    NULL },
-		{ "lrepeat",   picolCommandLRepeat,   NULL },
-		{ "lreplace",  picolCommandLReplace,  NULL },
-		{ "lreverse",  picolCommandLReverse,  NULL },
-		{ "lsearch",   picolCommandLSearch,   NULL },
-		{ "lset",      picolCommandLSet,      NULL },
-		{ "lsort",     picolCommandLSort,     NULL },
-		{ "split",     picolCommandSplit,     NULL },
+#define IF_LIST(F)   (F)
+#else
+#define IF_LIST(F)   NULL
+#endif
+#if DEFINE_MATHS
+#define IF_MATHS(F)  (F)
+#else
+#define IF_MATHS(F)  NULL
 #endif
 #if DEFINE_REGEX
-		{ "reg",       picolCommandRegex,     NULL },
+#define IF_REGEX(F)  (F)
+#else
+#define IF_REGEX(F)  NULL
 #endif
 #if DEFINE_STRING
-		{ "string",    picolCommandString,    NULL },
+#define IF_STRING(F) (F)
+#else
+#define IF_STRING(F) NULL
 #endif
-#if DEFINE_MATHS
-		{ "abs",       picolCommandMathUnary, (char*)UABS      },
-		{ "bool",      picolCommandMathUnary, (char*)UBOOL     },
-		{ "invert",    picolCommandMathUnary, (char*)UINV      },
-		{ "negate",    picolCommandMathUnary, (char*)UNEGATE   },
-		{ "not",       picolCommandMathUnary, (char*)UNOT      },
-		{  "+",        picolCommandMath,      (char*)BADD,     },
-		{  "-",        picolCommandMath,      (char*)BSUB,     },
-		{  "*",        picolCommandMath,      (char*)BMUL,     },
-		{  "/",        picolCommandMath,      (char*)BDIV,     },
-		{  "mod",      picolCommandMath,      (char*)BMOD,     },
-		{  ">",        picolCommandMath,      (char*)BMORE,    },
-		{  ">=",       picolCommandMath,      (char*)BMEQ,     },
-		{  "<",        picolCommandMath,      (char*)BLESS,    },
-		{  "<=",       picolCommandMath,      (char*)BLEQ,     },
-		{  "==",       picolCommandMath,      (char*)BEQ,      },
-		{  "!=",       picolCommandMath,      (char*)BNEQ,     },
-		{  "lshift",   picolCommandMath,      (char*)BLSHIFT,  },
-		{  "rshift",   picolCommandMath,      (char*)BRSHIFT,  },
-		{  "and",      picolCommandMath,      (char*)BAND,     },
-		{  "or",       picolCommandMath,      (char*)BOR,      },
-		{  "xor",      picolCommandMath,      (char*)BXOR,     },
-		{  "min",      picolCommandMath,      (char*)BMIN,     },
-		{  "max",      picolCommandMath,      (char*)BMAX,     },
-		{  "pow",      picolCommandMath,      (char*)BPOW,     },
-		{  "log",      picolCommandMath,      (char*)BLOG,     },
+#if DEFINE_NATIVE
+#define IF_NATIVE(F) (F)
+#else
+#define IF_NATIVE(F) NULL
 #endif
-	};
-	for (size_t j = 0; j < sizeof(commands)/sizeof(commands[0]); j++)
-		if (picolRegisterCommand(i, commands[j].name, commands[j].func, commands[j].data) != PICKLE_OK)
+
+#if DEFINE_COROUTINE
+#define IF_COROUTINE(F) (F)
+#else
+#define IF_COROUTINE(F) NULL
+#endif
+
+#define BUILTIN(NAME, FUNC, DATA) { .name = (NAME), .func = (FUNC), .privdata = (DATA) }
+#define BUILTIN_EX(NAME, EX)      { .name = (NAME), .ex = (EX) }
+
+/* The built in commands are shared, read only, by every interpreter, so
+ * creating one does not allocate them. The table must be kept sorted by
+ * name as it is searched by bisection, before the hash table of commands
+ * added later. A built in can only be renamed or deleted by marking it as
+ * removed in 'i->removed', renaming it then adds a copy to the hash table.
+ * Entries with neither 'func' nor 'ex' are compiled out. */
+static const pickle_command_t builtins[] = {
+	BUILTIN("!=",        IF_MATHS(picolCommandMath),      (char*)BNEQ),
+	BUILTIN("*",         IF_MATHS(picolCommandMath),      (char*)BMUL),
+	BUILTIN("+",         IF_MATHS(picolCommandMath),      (char*)BADD),
+	BUILTIN("-",         IF_MATHS(picolCommandMath),      (char*)BSUB),
+	BUILTIN("/",         IF_MATHS(picolCommandMath),      (char*)BDIV),
+	BUILTIN("<",         IF_MATHS(picolCommandMath),      (char*)BLESS),
+	BUILTIN("<=",        IF_MATHS(picolCommandMath),      (char*)BLEQ),
+	BUILTIN("==",        IF_MATHS(picolCommandMath),      (char*)BEQ),
+	BUILTIN(">",         IF_MATHS(picolCommandMath),      (char*)BMORE),
+	BUILTIN(">=",        IF_MATHS(picolCommandMath),      (char*)BMEQ),
+	BUILTIN("abs",       IF_MATHS(picolCommandMathUnary), (char*)UABS),
+	BUILTIN("and",       IF_MATHS(picolCommandMath),      (char*)BAND),
+	BUILTIN("append",    IF_NATIVE(picolCommandAppend),   NULL),
+	BUILTIN("apply",     picolCommandApply,               NULL),
+	BUILTIN("bool",      IF_MATHS(picolCommandMathUnary), (char*)UBOOL),
+	BUILTIN("break",     picolCommandRetCodes,            (char*)PICKLE_BREAK),
+	BUILTIN("catch",     picolCommandCatch,               NULL),
+	BUILTIN("concat",    picolCommandConcat,              (char*)CONCAT),
+	BUILTIN("conjoin",   picolCommandConcat,              (char*)CONJOIN),
+	BUILTIN("continue",  picolCommandRetCodes,            (char*)PICKLE_CONTINUE),
+	BUILTIN("coroutine", IF_COROUTINE(picolCommandCoroutine), NULL),
+	BUILTIN("dict",      IF_LIST(picolCommandDict),       NULL),
+	BUILTIN("eq",        picolCommandEqual,               NULL),
+	BUILTIN("eval",      picolCommandEval,                NULL),
+	BUILTIN("expr",      IF_MATHS(picolCommandExpr),      NULL),
+	BUILTIN("for",       picolCommandFor,                 NULL),
+	BUILTIN("foreach",   IF_NATIVE(picolCommandForeach),  NULL),
+	BUILTIN("format",    IF_NATIVE(picolCommandFormat),   NULL),
+	BUILTIN("if",        picolCommandIf,                  NULL),
+	BUILTIN("incr",      picolCommandIncr,                NULL),
+	BUILTIN("info",      picolCommandInfo,                NULL),
+	BUILTIN("invert",    IF_MATHS(picolCommandMathUnary), (char*)UINV),
+	BUILTIN("join",      picolCommandJoin,                NULL),
+	BUILTIN("lappend",   IF_LIST(picolCommandLAppend),    NULL),
+	BUILTIN_EX("lindex",  IF_LIST(picolCommandLIndex)), /* takes the length of its arguments */
+	BUILTIN("linsert",   IF_LIST(picolCommandLInsert),    NULL),
+	BUILTIN("list",      picolCommandConcat,              (char*)LIST),
+	BUILTIN("llength",   IF_LIST(picolCommandLLength),    NULL),
+	BUILTIN("log",       IF_MATHS(picolCommandMath),      (char*)BLOG),
+	BUILTIN("lrange",    IF_LIST(picolCommandLRange),     NULL),
+	BUILTIN("lrepeat",   IF_LIST(picolCommandLRepeat),    NULL),
+	BUILTIN("lreplace",  IF_LIST(picolCommandLReplace),   NULL),
+	BUILTIN("lreverse",  IF_LIST(picolCommandLReverse),   NULL),
+	BUILTIN("lsearch",   IF_LIST(picolCommandLSearch),    NULL),
+	BUILTIN("lset",      IF_LIST(picolCommandLSet),       NULL),
+	BUILTIN("lshift",    IF_MATHS(picolCommandMath),      (char*)BLSHIFT),
+	BUILTIN("lsort",     IF_LIST(picolCommandLSort),      NULL),
+	BUILTIN("max",       IF_MATHS(picolCommandMath),      (char*)BMAX),
+	BUILTIN("min",       IF_MATHS(picolCommandMath),      (char*)BMIN),
+	BUILTIN("mod",       IF_MATHS(picolCommandMath),      (char*)BMOD),
+	BUILTIN("ne",        picolCommandNotEqual,            NULL),
+	BUILTIN("negate",    IF_MATHS(picolCommandMathUnary), (char*)UNEGATE),
+	BUILTIN("not",       IF_MATHS(picolCommandMathUnary), (char*)UNOT),
+	BUILTIN("or",        IF_MATHS(picolCommandMath),      (char*)BOR),
+	BUILTIN("pow",       IF_MATHS(picolCommandMath),      (char*)BPOW),
+	BUILTIN("proc",      picolCommandProc,                NULL),
+	BUILTIN("reg",       IF_REGEX(picolCommandRegex),     NULL),
+	BUILTIN("rename",    picolCommandRename,              NULL),
+	BUILTIN("return",    picolCommandReturn,              NULL),
+	BUILTIN("rshift",    IF_MATHS(picolCommandMath),      (char*)BRSHIFT),
+	BUILTIN("set",       picolCommandSet,                 NULL),
+	BUILTIN("split",     IF_LIST(picolCommandSplit),      NULL),
+	BUILTIN_EX("string",  IF_STRING(picolCommandString)), /* takes the length of its arguments */
+	BUILTIN("subst",     picolCommandSubst,               NULL),
+	BUILTIN("switch",    IF_NATIVE(picolCommandSwitch),   NULL),
+	BUILTIN("trace",     picolCommandTrace,               NULL),
+	BUILTIN("unset",     picolCommandUnSet,               NULL),
+	BUILTIN("uplevel",   picolCommandUpLevel,             NULL),
+	BUILTIN("upvar",     picolCommandUpVar,               NULL),
+	BUILTIN("while",     picolCommandWhile,               NULL),
+	BUILTIN("xor",       IF_MATHS(picolCommandMath),      (char*)BXOR),
+	BUILTIN("yield",     IF_COROUTINE(picolCommandYield), NULL),
+};
+
+#undef BUILTIN
+#undef BUILTIN_EX
+#undef IF_LIST
+#undef IF_MATHS
+#undef IF_REGEX
+#undef IF_STRING
+#undef IF_NATIVE
+#undef IF_COROUTINE
+
+#define BUILTINS ((long)(sizeof (builtins) / sizeof (builtins[0])))
+
+static inline int picolBuiltinVisible(const pickle_t *i, const long b) {
+	assert(i);
+	assert(b >= 0 && b < BUILTINS);
+	BUILD_BUG_ON(BUILTINS > BUILTIN_MAX);
+	const pickle_command_t *c = &builtins[b];
+	return (c->func || c->ex) && !(i->removed[b / CHAR_BIT] & (1u << (b % CHAR_BIT)));
+}
+
+static long picolBuiltinIndex(const char *name) { /* index into 'builtins' of 'name', or -1 */
+	assert(name);
+	long l = 0, h = BUILTINS - 1;
+	while (l <= h) {
+		const long m = l + ((h - l) / 2);
+		const int r = compare(name, builtins[m].name);
+		if (r == 0)
+			return m;
+		if (r < 0)
+			h = m - 1;
+		else
+			l = m + 1;
+	}
+	return -1;
+}
+
+/* Returns the index into 'builtins' of 'name', or -1 if it is not a built in
+ * or that built in has been removed. */
+static long picolBuiltin(const pickle_t *i, const char *name) {
+	assert(i);
+	const long b = picolBuiltinIndex(name);
+	return b >= 0 && picolBuiltinVisible(i, b) ? b : -1;
+}
+
+static inline const pickle_command_t *picolGetCommand(pickle_t *i, const char *s) {
+	assert(s);
+	assert(i);
+	const long b = picolBuiltin(i, s);
+	if (b >= 0)
+		return &builtins[b];
+	if (!i->table)
+		return NULL;
+	for (const pickle_command_t *np = i->table[picolHashString(s) % i->length]; np != NULL; np = np->next)
+		if (!compare(s, np->name))
+			return np; /* found */
+	return NULL; /* not found */
+}
+
+/* Iterate over all commands, built ins first; '*j' should start at -1 and 'c'
+ * should be NULL, or the previous command returned. */
+static const pickle_command_t *picolNextCommand(pickle_t *i, long *j, const pickle_command_t *c) {
+	assert(i);
+	assert(j);
+	if (c && c->next)
+		return c->next;
+	while (++*j < BUILTINS + i->length) {
+		if (*j < BUILTINS) {
+			if (picolBuiltinVisible(i, *j))
+				return &builtins[*j];
+		} else if (i->table[*j - BUILTINS]) {
+			return i->table[*j - BUILTINS];
+		}
+	}
+	return NULL;
+}
+
+#if DEFINE_PROFILE
+static pickle_profile_t *picolProfileOf(pickle_t *i, const pickle_command_t *c) {
+	assert(i);
+	assert(c);
+	if (c >= builtins && c < &builtins[BUILTINS])
+		return i->profiles ? &i->profiles[c - builtins] : NULL;
+	return &((pickle_command_t*)c)->profile; /* not built in, so not read only */
+}
+
+static int picolProfileStart(pickle_t *i) {
+	assert(i);
+	if (!(i->profiles)) { /* allocated directly, like the interpreter, as it may be larger than PICKLE_MAX_STRING */
+		if (i->fatal || !(i->profiles = i->allocator(i->arena, NULL, 0, BUILTINS * sizeof (*i->profiles)))) {
+			i->fatal = 1;
+			(void)picolForceResult(i, string_oom, 1);
 			return PICKLE_ERROR;
+		}
+		zero(i->profiles, BUILTINS * sizeof (*i->profiles));
+	}
+	picolProfileReset(i);
+	i->profile = 1;
 	return PICKLE_OK;
 }
+#endif
 
 static int picolFreeCmd(pickle_t *i, pickle_command_t *p) {
 	assert(i);
 	if (!p)
 		return PICKLE_OK;
 	int r = PICKLE_OK;
-	if (picolIsDefinedProc(p->func)) {
-		char **procdata = (char**) p->privdata;
-		if (procdata) {
-			if (picolFree(i, procdata[0]) != PICKLE_OK)
-				r = PICKLE_ERROR;
-			if (picolFree(i, procdata[1]) != PICKLE_OK)
-				r = PICKLE_ERROR;
-		}
-		if (picolFree(i, procdata) != PICKLE_OK)
+	if (picolIsDefinedProc(p->func))
+		if (picolProcFree(i, p->privdata) != PICKLE_OK)
+			r = PICKLE_ERROR;
+	if (picolIsCoroutine(p->func))
+		if (picolCoroutineFree(i, p->privdata) != PICKLE_OK)
 			r = PICKLE_ERROR;
-	}
 	if (picolFree(i, p->name) != PICKLE_OK)
 		r = PICKLE_ERROR;
 	if (picolFree(i, p) != PICKLE_OK)
@@ -3508,10 +8149,12 @@ static int picolFreeCmd(pickle_t *i, pickle_command_t *p) {
 
 static int picolDeinitialize(pickle_t *i) {
 	assert(i);
-	int r = picolDropAllCallFrames(i);
-	assert(!(i->callframe));
-	if (picolFreeResult(i) != PICKLE_OK)
-		r = PICKLE_ERROR;
+#if DEFINE_MEMORY
+	picolMemoryStop(i);
+	if (i->tracker)
+		(void)i->allocator(i->arena, i->tracker, 0, 0);
+#endif
+	int r = picolResumeFree(i, i->suspended); /* suspended evaluations and coroutines hold call frames */
 	for (long j = 0; j < i->length; j++) {
 		pickle_command_t *c = i->table[j], *p = NULL;
 		for (; c; p = c, c = c->next) {
@@ -3522,8 +8165,48 @@ static int picolDeinitialize(pickle_t *i) {
 		if (picolFreeCmd(i, p) != PICKLE_OK)
 			r = PICKLE_ERROR;
 	}
+	if (picolDropAllCallFrames(i) != PICKLE_OK)
+		r = PICKLE_ERROR;
+	assert(!(i->callframe));
+	for (pickle_call_frame_t *cf = i->frames, *n = NULL; cf; cf = n) {
+		n = cf->parent;
+		if (picolFree(i, cf) != PICKLE_OK)
+			r = PICKLE_ERROR;
+	}
+	for (pickle_var_t *v = i->vars, *n = NULL; v; v = n) {
+		n = v->next;
+		if (picolFree(i, v) != PICKLE_OK)
+			r = PICKLE_ERROR;
+	}
+	if (picolScratchDeinitialize(i) != PICKLE_OK)
+		r = PICKLE_ERROR;
+	if (picolFreeResult(i) != PICKLE_OK)
+		r = PICKLE_ERROR;
 	if (picolFree(i, i->table) != PICKLE_OK)
 		r = PICKLE_ERROR;
+	if (picolFree(i, i->profiles) != PICKLE_OK)
+		r = PICKLE_ERROR;
+	if (picolFree(i, i->feed) != PICKLE_OK)
+		r = PICKLE_ERROR;
+	if (i->cache) {
+		for (long j = 0; j < PICKLE_CACHE_SIZE; j++)
+			if (picolScriptRelease(i, i->cache[j]) != PICKLE_OK)
+				r = PICKLE_ERROR;
+		if (picolFree(i, i->cache) != PICKLE_OK)
+			r = PICKLE_ERROR;
+	}
+	if (regexDeinitialize(i) != PICKLE_OK)
+		r = PICKLE_ERROR;
+	if (i->exprs) {
+		for (long j = 0; j < PICKLE_EXPR_CACHE; j++)
+			if (picolExprRelease(i, i->exprs[j]) != PICKLE_OK)
+				r = PICKLE_ERROR;
+		if (picolFree(i, i->exprs) != PICKLE_OK)
+			r = PICKLE_ERROR;
+	}
+	assert(i->atom_count == 0); /* everything holding a name has been freed */
+	if (picolFree(i, i->atoms) != PICKLE_OK)
+		r = PICKLE_ERROR;
 	zero(i, sizeof *i);
 	i->fatal = 1;
 	return r;
@@ -3534,24 +8217,15 @@ static int picolInitialize(pickle_t *i, allocator_fn fn, void *arena) {
 	assert(i);
 	assert(fn);
 	/*'i' may contain junk, otherwise: assert(!(i->initialized));*/
-	const size_t hbytes = PICKLE_MAX_STRING;
-	const size_t helem  = hbytes / sizeof (*i->table);
 	zero(i, sizeof *i);
 	i->initialized   = 1;
 	i->allocator     = fn;
 	i->arena         = arena;
-	i->callframe     = i->allocator(i->arena, NULL, 0, sizeof(*i->callframe));
+	i->callframe     = &i->top; /* the command table and script cache are allocated on first use */
 	i->result        = string_empty;
 	i->static_result = 1;
-	i->table         = picolMalloc(i, hbytes); /* NB. We could make this configurable, for little gain. */
-
-	if (!(i->callframe) || !(i->result) || !(i->table))
-		goto fail;
-	zero(i->table,     hbytes);
-	zero(i->callframe, sizeof(*i->callframe));
-	i->length = helem;
-	if (picolRegisterCoreCommands(i) != PICKLE_OK)
-		goto fail;
+	i->epoch         = 1; /* compiled call sites start with an epoch of zero */
+	picolFrameInitialize(i->callframe, NULL);
 	if (pickle_var_set(i, "argv", "") != PICKLE_OK)
 		goto fail;
 	return PICKLE_OK;
@@ -3560,6 +8234,270 @@ fail:
 	return PICKLE_ERROR;
 }
 
+/* Global variables are copied in the order they were defined, links to
+ * other globals are made after all of the other variables exist. Numbers
+ * stay numbers, lists are copied as strings. */
+static int picolCloneVars(pickle_t *d, pickle_t *s) {
+	assert(d);
+	assert(s);
+	assert(d->callframe == &d->top && !(d->top.vars) && d->top.count == 0);
+	pickle_var_t **tail = &d->top.vars;
+	for (int links = 0; links < 2; links++) {
+		for (pickle_var_t *v = s->top.vars; v; v = v->next) {
+			if ((v->type == PV_LINK) != links)
+				continue;
+			pickle_var_t *o = links ? picolGetVar(d, picolGetVarName(v->data.link), 1) : NULL; /* names are interned again in 'd' */
+			if (links && !o)
+				continue;
+			pickle_var_t *n = picolVarNew(d);
+			if (!n)
+				return PICKLE_ERROR;
+			if (picolSetVarName(d, n, picolGetVarName(v)) != PICKLE_OK) {
+				(void)picolFree(d, n);
+				return PICKLE_ERROR;
+			}
+			*tail = n; /* the variable is freed along with the frame from here on */
+			tail = &n->next;
+			if (picolFrameAdd(d, &d->top, n) != PICKLE_OK)
+				return PICKLE_ERROR;
+			char buffy[PRINT_NUMBER_BUF_SZ];
+			if (links) {
+				n->type = PV_LINK;
+				n->data.link = o;
+			} else if (v->type == PV_NUMBER) {
+				n->type = PV_NUMBER;
+				n->data.number = v->data.number;
+			} else if (picolSetVarString(d, n, picolGetVarVal(v, buffy)) != PICKLE_OK) {
+				n->type = PV_SMALL_STRING;
+				return PICKLE_ERROR;
+			}
+		}
+	}
+	return PICKLE_OK;
+}
+
+/* 'd' must be newly made with the allocator of 's'. Procedures share their
+ * source with 's' but are parsed again when first used, as parsed scripts
+ * remember the commands of the interpreter using them. */
+static int picolClone(pickle_t *d, pickle_t *s) {
+	assert(d);
+	assert(s);
+	assert(d->allocator == s->allocator && d->arena == s->arena);
+	for (pickle_var_t *v = d->top.vars, *next = NULL; v; v = next) { /* remove the default 'argv' */
+		next = v->next;
+		picolFrameRemove(&d->top, v);
+		if (picolVarFree(d, v) != PICKLE_OK)
+			return PICKLE_ERROR;
+	}
+	d->top.vars  = NULL;
+	d->top.count = 0;
+	move(d->removed, s->removed, sizeof (d->removed));
+	for (long j = 0; j < s->length; j++) {
+		for (pickle_command_t *c = s->table[j]; c; c = c->next) {
+			int r = PICKLE_OK;
+			if (picolIsDefinedProc(c->func)) {
+				pickle_proc_t *proc = c->privdata;
+				r = picolProcShare(d, c->name, proc->text, NULL);
+			} else if (picolIsCoroutine(c->func)) {
+				continue; /* a suspended coroutine belongs to the interpreter it runs in */
+			} else {
+				r = picolRegisterCommand(d, c->name, c->func, c->ex, c->privdata);
+			}
+			if (r != PICKLE_OK)
+				return PICKLE_ERROR;
+		}
+	}
+	d->epoch++;
+	d->clock     = s->clock;
+	d->clockdata = s->clockdata;
+	return picolCloneVars(d, s);
+}
+
+/* An image holds what evaluating a script leaves behind in an interpreter,
+ * so another interpreter can be given it without evaluating the script again;
+ * built in commands that were removed or renamed, the procedures, and the
+ * global variables. It is a header followed by records, each a letter and a
+ * fixed number of NUL terminated strings:
+ *
+ *	"\0PKI1" ('a' new-name built-in | 'r' built-in | 'p' name args body |
+ *	          'v' name value | 'u' name target)... 'e'
+ *
+ * which are in that order, so built ins are removed before procedures of
+ * the same name are defined and links are made after the variables they
+ * refer to. Procedures keep their source, their bodies are compiled when
+ * first used as they would be otherwise. Commands registered from C are
+ * not saved, as only the program that registered them can do so again. */
+static const char image_magic[] = "\0PKI1";
+
+typedef struct {
+	char *p;           /**< image being written */
+	size_t used, size; /**< bytes of 'p' written, and allocated */
+} pickle_image_t;
+
+static int picolImageWrite(pickle_t *i, pickle_image_t *m, const char *s, const size_t length) {
+	assert(i);
+	assert(m);
+	assert(s);
+	if ((m->size - m->used) < length) {
+		size_t size = m->size ? m->size : 256;
+		while ((size - m->used) < length)
+			size *= 2;
+		char *n = picolRealloc(i, m->p, size);
+		if (!n)
+			return PICKLE_ERROR;
+		m->p    = n;
+		m->size = size;
+	}
+	move(m->p + m->used, s, length);
+	m->used += length;
+	return PICKLE_OK;
+}
+
+static int picolImageRecord(pickle_t *i, pickle_image_t *m, const char type, const int argc, const char **argv) {
+	assert(i);
+	assert(m);
+	if (picolImageWrite(i, m, &type, 1) != PICKLE_OK)
+		return PICKLE_ERROR;
+	for (int j = 0; j < argc; j++)
+		if (picolImageWrite(i, m, argv[j], picolStrlen(argv[j]) + 1) != PICKLE_OK)
+			return PICKLE_ERROR;
+	return PICKLE_OK;
+}
+
+static long picolBuiltinOf(const pickle_command_t *c) { /* the built in 'c' is a renamed copy of, or -1 */
+	assert(c);
+	for (long b = 0; b < BUILTINS; b++)
+		if (builtins[b].func == c->func && builtins[b].ex == c->ex && builtins[b].privdata == c->privdata)
+			return b;
+	return -1;
+}
+
+static int picolImageVars(pickle_t *i, pickle_image_t *m) { /* oldest first, so they are listed in the same order when loaded */
+	assert(i);
+	assert(m);
+	long count = 0, j = 0;
+	for (pickle_var_t *v = i->top.vars; v; v = v->next)
+		count++;
+	if (!count)
+		return PICKLE_OK;
+	pickle_var_t **vs = picolMalloc(i, count * sizeof *vs);
+	if (!vs)
+		return PICKLE_ERROR;
+	for (pickle_var_t *v = i->top.vars; v; v = v->next)
+		vs[j++] = v;
+	int r = PICKLE_OK;
+	for (int links = 0; links < 2 && r == PICKLE_OK; links++)
+		for (j = count - 1; j >= 0 && r == PICKLE_OK; j--) {
+			pickle_var_t *v = vs[j];
+			if ((v->type == PV_LINK) != links)
+				continue;
+			char buffy[PRINT_NUMBER_BUF_SZ];
+			const char *value = links ? picolGetVarName(v->data.link) : picolGetVarVal(v, buffy);
+			r = value ? picolImageRecord(i, m, links ? 'u' : 'v', 2, (const char*[]) { picolGetVarName(v), value }) : PICKLE_ERROR;
+		}
+	return picolFree(i, vs) == PICKLE_OK ? r : PICKLE_ERROR;
+}
+
+static int picolImageSave(pickle_t *i, pickle_image_t *m) {
+	assert(i);
+	assert(m);
+	if (picolImageWrite(i, m, image_magic, sizeof image_magic - 1) != PICKLE_OK)
+		return PICKLE_ERROR;
+	for (long j = 0; j < i->length; j++)
+		for (pickle_command_t *c = i->table[j]; c; c = c->next) {
+			const long b = picolIsDefinedProc(c->func) ? -1 : picolBuiltinOf(c);
+			if (b >= 0 && picolImageRecord(i, m, 'a', 2, (const char*[]) { c->name, builtins[b].name }) != PICKLE_OK)
+				return PICKLE_ERROR;
+		}
+	for (long b = 0; b < BUILTINS; b++)
+		if ((builtins[b].func || builtins[b].ex) && !picolBuiltinVisible(i, b))
+			if (picolImageRecord(i, m, 'r', 1, (const char*[]) { builtins[b].name }) != PICKLE_OK)
+				return PICKLE_ERROR;
+	for (long j = 0; j < i->length; j++)
+		for (pickle_command_t *c = i->table[j]; c; c = c->next) {
+			if (!picolIsDefinedProc(c->func))
+				continue;
+			const pickle_proc_t *proc = c->privdata;
+			if (picolImageRecord(i, m, 'p', 3, (const char*[]) { c->name, proc->text->args, proc->text->body }) != PICKLE_OK)
+				return PICKLE_ERROR;
+		}
+	if (picolImageVars(i, m) != PICKLE_OK)
+		return PICKLE_ERROR;
+	return picolImageRecord(i, m, 'e', 0, NULL);
+}
+
+static const char *picolImageString(const char *image, const size_t length, size_t *at) { /* next string, or NULL if there is none */
+	assert(image);
+	assert(at);
+	if (*at >= length)
+		return NULL;
+	const char *s = image + *at, *end = locateByte(s, 0, length - *at);
+	if (!end)
+		return NULL;
+	*at = (end - image) + 1;
+	return s;
+}
+
+static int picolImageLoad(pickle_t *i, const char *image, const size_t length) {
+	assert(i);
+	assert(image);
+	assert(i->callframe == &i->top);
+	const size_t header = sizeof image_magic - 1;
+	if (length < header || memcmp(image, image_magic, header))
+		return error(i, "Invalid image %s", "header");
+	for (size_t at = header; at < length;) {
+		const char type = image[at++];
+		const int argc = type == 'p' ? 3 : type == 'a' || type == 'v' || type == 'u' ? 2 : type == 'r';
+		const char *argv[3] = { NULL, NULL, NULL };
+		for (int j = 0; j < argc; j++)
+			if (!(argv[j] = picolImageString(image, length, &at)))
+				return error(i, "Invalid image %s", "record");
+		switch (type) {
+		case 'a': {
+			const long b = picolBuiltinIndex(argv[1]); /* it may have been removed by an earlier load */
+			if (b < 0 || !(builtins[b].func || builtins[b].ex))
+				return error(i, "Invalid image %s", argv[0]);
+			if (picolGetCommand(i, argv[0]) && picolUnsetCommand(i, argv[0]) != PICKLE_OK)
+				return PICKLE_ERROR;
+			if (picolRegisterCommand(i, argv[0], builtins[b].func, builtins[b].ex, builtins[b].privdata) != PICKLE_OK)
+				return error(i, "Invalid image %s", argv[0]);
+			break;
+		}
+		case 'r':
+			if (picolBuiltin(i, argv[0]) >= 0 && picolUnsetCommand(i, argv[0]) != PICKLE_OK)
+				return PICKLE_ERROR;
+			break;
+		case 'p':
+			if (picolGetCommand(i, argv[0]) && picolUnsetCommand(i, argv[0]) != PICKLE_OK)
+				return PICKLE_ERROR;
+			if (picolCommandAddProc(i, argv[0], argv[1], argv[2]) != PICKLE_OK)
+				return PICKLE_ERROR;
+			break;
+		case 'v':
+			if (picolSetVar(i, argv[0], argv[1], NULL, NULL) != PICKLE_OK)
+				return PICKLE_ERROR;
+			break;
+		case 'u': {
+			pickle_var_t *o = picolGetVar(i, argv[1], 1), *n = NULL;
+			if (!o || !compare(argv[0], argv[1]))
+				return error(i, "Invalid image %s", argv[0]);
+			if (!(n = picolGetVar(i, argv[0], 0)) && picolNewVar(i, argv[0], "", NULL, &n) != PICKLE_OK)
+				return PICKLE_ERROR;
+			if (picolFreeVarVal(i, n) != PICKLE_OK)
+				return PICKLE_ERROR;
+			n->type = PV_LINK;
+			n->data.link = o;
+			break;
+		}
+		case 'e':
+			return at == length ? PICKLE_OK : error(i, "Invalid image %s", "length");
+		default:
+			return error(i, "Invalid image %s", "record");
+		}
+	}
+	return error(i, "Invalid image %s", "length");
+}
+
 static inline int test(allocator_fn fn, void *arena, const char *eval, const char *result, int retcode) {
 	assert(fn);
 	assert(eval);
@@ -3570,8 +8508,8 @@ static inline int test(allocator_fn fn, void *arena, const char *eval, const cha
 	if (rc != PICKLE_OK || !p)
 		return -1;
 	if ((actual = picolEval(p, eval)) != retcode) { r = -2; goto end; }
-	if (!(p->result))                             { r = -3; goto end; }
-	if (compare(p->result, result))               { r = -4; goto end; }
+	if (!picolGetResult(p))                       { r = -3; goto end; }
+	if (compare(picolGetResult(p), result))       { r = -4; goto end; }
 end:
 	if (pickle_delete(p) != PICKLE_OK)
 		return -1;
@@ -3669,6 +8607,15 @@ static inline int picolTestEval(allocator_fn fn, void *arena) {
 		{ PICKLE_OK,     "* -2 9",          "-18"   },
 		{ PICKLE_OK,     "join {a b c} ,",  "a,b,c" },
 		{ PICKLE_ERROR,  "return fail -1",  "fail"  },
+		{ PICKLE_OK,     "set a 0; while {< $a 4} {incr a}; set a", "4" },
+		{ PICKLE_OK,     "proc f {x} {+ $x 1}; f [f 1]", "3" },
+		{ PICKLE_OK,     "set a 0; while {< $a 9} {incr a; if {== $a 3} break}; set a", "3" },
+		{ PICKLE_OK,     "set n 0; for {set j 0} {< $j 4} {incr j} {if {== $j 1} continue; incr n}; set n", "3" },
+		{ PICKLE_OK,     "set a 9; incr a; string length $a", "2" },
+		{ PICKLE_OK,     "set a 1; set b 2; set c 3; set d 4; set e 5; unset b; unset c; set f 6; + $a $d $e $f", "16" },
+		{ PICKLE_OK,     "proc a {} {return 1}; proc b {} {a}; set x [b]; proc a {} {return 2}; + $x [b]", "3" },
+		{ PICKLE_OK,     "set l {}; lappend l a {b c}; set m $l; lappend m d; list [lindex $l 1] [llength $m] $l", "{b c} 3 { a {b c}}" },
+		{ PICKLE_ERROR,  "set a 0; while {< $a 3} {/ 1 $a; incr a}", "Invalid / 0" },
 	};
 
 	int r = 0;
@@ -3728,12 +8675,342 @@ static inline int picolTestGetSetVar(allocator_fn fn, void *arena) {
 	r += (pickle_eval(p, "set a 54; set b 3; set c -4x") != PICKLE_OK);
 	r += (pickle_var_get(p, "a", &val) != PICKLE_OK || compare(val, "54"));
 	r += (pickle_var_get(p, "c", &val) != PICKLE_OK || compare(val, "-4x"));
+	r += (pickle_eval(p, "incr a; incr a 2") != PICKLE_OK);
+	r += (pickle_var_get(p, "a", &val) != PICKLE_OK || compare(val, "57"));
 	r += (pickle_var_set(p, "d", "123") != PICKLE_OK);
 	r += (pickle_var_get(p, "d", &val) != PICKLE_OK || compare(val, "123"));
 	r += (pickle_delete(p) != PICKLE_OK);
 	return -r;
 }
 
+static int picolTestCommandSlices(pickle_t *i, const int argc, pickle_slice_t *argv, void *pd) {
+	UNUSED(pd);
+	long total = 0;
+	for (int j = 1; j < argc; j++)
+		total += argv[j].len;
+	return ok(i, "%d %ld", argc, total);
+}
+
+static inline int picolTestSlices(allocator_fn fn, void *arena) {
+	assert(fn);
+	const char *val = 0;
+	int r = 0;
+	pickle_t *p = NULL;
+	if (pickle_new(&p, fn, arena) != PICKLE_OK || !p)
+		return -1;
+	r += (pickle_command_register_ex(p, "sum", picolTestCommandSlices, NULL) != PICKLE_OK);
+	r += (pickle_eval(p, "sum abc \"d\\x00e\" {f g}") != PICKLE_OK);
+	r += (pickle_result_get(p, &val) != PICKLE_OK || compare(val, "4 9"));
+	r += (pickle_eval(p, "set x yz; sum a$x [set x]") != PICKLE_OK);
+	r += (pickle_result_get(p, &val) != PICKLE_OK || compare(val, "3 5"));
+	r += (pickle_eval(p, "rename sum s2; s2 q") != PICKLE_OK);
+	r += (pickle_result_get(p, &val) != PICKLE_OK || compare(val, "2 1"));
+	r += (pickle_delete(p) != PICKLE_OK);
+	return -r;
+}
+
+static inline int picolTestBuiltins(allocator_fn fn, void *arena) {
+	assert(fn);
+	int r = 0;
+	pickle_t *p = NULL;
+	if (pickle_new(&p, fn, arena) != PICKLE_OK || !p)
+		return -1;
+	for (long j = 0; j < BUILTINS; j++) {
+		r += j && compare(builtins[j - 1].name, builtins[j].name) >= 0; /* must be sorted for 'picolBuiltin' */
+		r += (builtins[j].func || builtins[j].ex) && picolGetCommand(p, builtins[j].name) != &builtins[j];
+	}
+	r += (pickle_eval(p, "rename if when; when {== 1 1} { set x 2 }") != PICKLE_OK);
+	r += picolGetCommand(p, "if") != NULL;
+	r += (pickle_command_rename(p, "when", "if") != PICKLE_OK);
+	r += (pickle_eval(p, "if {== 1 1} { set x 3 }") != PICKLE_OK);
+	r += (pickle_delete(p) != PICKLE_OK);
+	return -r;
+}
+
+static int picolTestRepeat(pickle_t *i, const int argc, char **argv, void *pd) { /* 'repeat n' gives a string of 'n' "x"s */
+	UNUSED(pd);
+	allocator_fn fn = NULL;
+	void *arena = NULL;
+	number_t n = 0;
+	if (argc != 2 || pickle_allocator_get(i, &fn, &arena) != PICKLE_OK || picolStringToNumber(i, argv[1], &n) != PICKLE_OK || n < 0)
+		return PICKLE_ERROR;
+	char *s = fn(arena, NULL, 0, n + 1);
+	if (!s)
+		return PICKLE_ERROR;
+	memset(s, 'x', n);
+	s[n] = '\0';
+	return pickle_result_set_owned(i, PICKLE_OK, s);
+}
+
+static inline int picolTestOwned(allocator_fn fn, void *arena) {
+	assert(fn);
+	int r = 0;
+	const char *val = NULL;
+	pickle_t *p = NULL;
+	if (pickle_new(&p, fn, arena) != PICKLE_OK || !p)
+		return -1;
+	r += (pickle_command_register(p, "repeat", picolTestRepeat, NULL) != PICKLE_OK);
+	r += (pickle_eval(p, "set a [repeat 300]; set b [repeat 3]; catch {repeat 400} c; string length $a$b$c") != PICKLE_OK);
+	r += (pickle_result_get(p, &val) != PICKLE_OK) || compare(val, "703");
+	r += (pickle_eval(p, "proc f {} { repeat 500 }; set d [f]; set e $d; string length $e") != PICKLE_OK);
+	r += (pickle_result_get(p, &val) != PICKLE_OK) || compare(val, "500");
+	r += (pickle_delete(p) != PICKLE_OK);
+	return -r;
+}
+
+static inline int picolTestProcFrames(allocator_fn fn, void *arena) {
+	assert(fn);
+	int r = 0;
+	const char *val = NULL;
+	pickle_t *p = NULL;
+	if (pickle_new(&p, fn, arena) != PICKLE_OK || !p)
+		return -1;
+	r += (pickle_eval(p, "proc d {a  a } { set a }; proc v {a args} { list $a $args }; proc n {n} { if {< $n 1} { return 0 }; + 1 [n [- $n 1]] }") != PICKLE_OK);
+	r += (pickle_eval(p, "d 1 2") != PICKLE_OK);
+	r += (pickle_result_get(p, &val) != PICKLE_OK) || compare(val, "2");
+	r += (pickle_eval(p, "v 1 2 3") != PICKLE_OK);
+	r += (pickle_result_get(p, &val) != PICKLE_OK) || compare(val, "1 {2 3}");
+	r += (pickle_eval(p, "v") == PICKLE_OK);
+	r += (pickle_eval(p, "n 50") != PICKLE_OK);
+	r += (pickle_result_get(p, &val) != PICKLE_OK) || compare(val, "50");
+	pickle_call_frame_t *cf = p->frames;
+	r += PICKLE_VAR_POOL && (!cf || p->spare_vars <= 0);
+	r += (pickle_eval(p, "n 50") != PICKLE_OK); /* the same frames are used again */
+	r += PICKLE_VAR_POOL >= 50 && p->frames != cf; /* if there is room to keep them all */
+	long frames = 0;
+	for (cf = p->frames; cf; cf = cf->parent)
+		frames++;
+	r += frames != p->spare_frames || frames > PICKLE_VAR_POOL || p->spare_vars > PICKLE_VAR_POOL; /* any more are freed */
+	r += (pickle_delete(p) != PICKLE_OK);
+	return -r;
+}
+
+static unsigned long picolTestClock(void *clockdata) {
+	assert(clockdata);
+	return ++*(unsigned long*)clockdata;
+}
+
+static inline int picolTestBudget(allocator_fn fn, void *arena) {
+	assert(fn);
+	int r = 0;
+	const char *val = NULL;
+	unsigned long ticks = 0;
+	pickle_t *p = NULL;
+	if (pickle_new(&p, fn, arena) != PICKLE_OK || !p)
+		return -1;
+	r += (pickle_budget_set(p, &(pickle_budget_t){ .commands = 100 }) != PICKLE_OK);
+	r += (pickle_eval(p, "set a 0; while {== 1 1} { incr a }") != PICKLE_LIMIT);
+	r += (pickle_result_get(p, &val) != PICKLE_OK) || compare(val, "Invalid budget: commands");
+	r += (pickle_eval(p, "set a") != PICKLE_LIMIT); /* stays spent */
+	r += (pickle_budget_set(p, &(pickle_budget_t){ .commands = 1000 }) != PICKLE_OK);
+	r += (pickle_eval(p, "while {== 1 1} { catch { while {== 1 1} {} } }") != PICKLE_LIMIT);
+	r += (pickle_budget_set(p, &(pickle_budget_t){ .clock = picolTestClock, .clockdata = &ticks, .deadline = 20, .interval = 1 }) != PICKLE_OK);
+	r += (pickle_eval(p, "for {set j 0} {< $j 100} {incr j} {}") != PICKLE_LIMIT);
+	r += (pickle_result_get(p, &val) != PICKLE_OK) || compare(val, "Invalid budget: time");
+	r += ticks != 20;
+	r += (pickle_budget_set(p, &(pickle_budget_t){ .bytes = 600 }) != PICKLE_OK);
+	r += (pickle_eval(p, "set a x; while {== 1 1} { set a $a$a }") != PICKLE_LIMIT);
+	r += (pickle_result_get(p, &val) != PICKLE_OK) || compare(val, "Invalid budget: memory");
+	r += (pickle_budget_set(p, NULL) != PICKLE_OK);
+	r += (pickle_eval(p, "set a 3; incr a") != PICKLE_OK);
+	r += (pickle_result_get(p, &val) != PICKLE_OK) || compare(val, "4");
+	r += (pickle_budget_set(p, &(pickle_budget_t){ .commands = -1 }) == PICKLE_OK);
+	r += (pickle_delete(p) != PICKLE_OK);
+	return -r;
+}
+
+static int picolTestWait(pickle_t *i, int argc, char **argv, void *pd) { /* stands in for a command waiting on I/O */
+	UNUSED(pd);
+	if (argc != 2)
+		return pickle_result_set(i, PICKLE_ERROR, "Invalid arity");
+	return pickle_result_set(i, PICKLE_YIELD, "%s", argv[1]);
+}
+
+static inline int picolTestCoroutine(allocator_fn fn, void *arena) {
+	assert(fn);
+	static const char *values[] = { "10", "20", "30" };
+	int r = 0;
+	const char *val = NULL;
+	pickle_t *p = NULL;
+	if (USE_MAX_STRING || !DEFINE_COMPILER) /* loops must be compiled in line to be suspended, and few scripts are small enough to be compiled */
+		return 0;
+	if (pickle_new(&p, fn, arena) != PICKLE_OK || !p)
+		return -1;
+	r += (pickle_command_register(p, "wait", picolTestWait, NULL) != PICKLE_OK);
+	r += (pickle_eval(p, "proc get {x} { return [wait $x] }; proc sum {n} { set t 0; for {set j 0} {< $j $n} {incr j} { set t [+ $t [get $j]] }; return $t }") != PICKLE_OK);
+	r += (pickle_eval_start(p, "set a [sum 3]") != PICKLE_YIELD);
+	for (size_t j = 0; j < (sizeof(values) / sizeof(values[0])); j++) {
+		char n[2] = { (char)('0' + j), '\0' };
+		r += (pickle_result_get(p, &val) != PICKLE_OK) || compare(val, n);
+		r += (pickle_eval(p, "set b [info level]") != PICKLE_OK); /* other evaluations can be made whilst suspended */
+		r += (pickle_eval_start(p, "set c 1") == PICKLE_OK); /* but not started */
+		r += (pickle_resume(p, values[j]) != (j == 2 ? PICKLE_OK : PICKLE_YIELD));
+	}
+	r += (pickle_result_get(p, &val) != PICKLE_OK) || compare(val, "60");
+	r += (pickle_var_get(p, "a", &val) != PICKLE_OK) || compare(val, "60");
+	r += (pickle_resume(p, "1") == PICKLE_OK); /* nothing to resume */
+	r += (pickle_eval(p, "wait 1") != PICKLE_ERROR);
+	r += (pickle_eval_start(p, "catch {wait 1} e; set e") != PICKLE_OK); /* C commands cannot be suspended part way through */
+	r += (pickle_result_get(p, &val) != PICKLE_OK) || compare(val, "Invalid yield");
+	r += (pickle_eval_start(p, "sum 2") != PICKLE_YIELD);
+	r += (pickle_resume(p, NULL) != PICKLE_OK); /* abandoned */
+	r += (pickle_eval_start(p, "sum 2") != PICKLE_YIELD); /* left suspended, freed with the interpreter */
+	r += (pickle_delete(p) != PICKLE_OK);
+	return -r;
+}
+
+static inline int picolTestFeed(allocator_fn fn, void *arena) {
+	assert(fn);
+	static const char *chunks[] = { "set a 1; set b {x", "\n}\nset c [list $b", "]\n", "set d \"e", "\"" };
+	int r = 0;
+	const char *val = NULL;
+	pickle_t *p = NULL;
+	if (pickle_new(&p, fn, arena) != PICKLE_OK || !p)
+		return -1;
+	for (size_t j = 0; j < (sizeof(chunks) / sizeof(chunks[0])); j++)
+		r += (pickle_eval_feed(p, chunks[j], picolStrlen(chunks[j])) != PICKLE_OK);
+	r += (pickle_var_get(p, "c", &val) != PICKLE_OK) || compare(val, "{x\n}");
+	r += (pickle_var_get(p, "d", &val) == PICKLE_OK); /* not run until it is known to be complete */
+	r += (pickle_eval_feed(p, NULL, 0) != PICKLE_OK);
+	r += (pickle_var_get(p, "d", &val) != PICKLE_OK) || compare(val, "e");
+	r += (pickle_eval_feed(p, "set e {", 7) != PICKLE_OK);
+	r += (pickle_eval_feed(p, NULL, 0) == PICKLE_OK); /* incomplete at the end */
+	r += (pickle_eval_feed(p, "set f 2\n", 8) != PICKLE_OK);
+	r += (pickle_var_get(p, "f", &val) != PICKLE_OK) || compare(val, "2");
+	r += (pickle_delete(p) != PICKLE_OK);
+	return -r;
+}
+
+typedef struct {
+	allocator_fn fn; /**< allocator that does the work */
+	void *arena;     /**< its arena */
+	long left;       /**< allocations that may succeed before they all fail, negative for no limit */
+} pickle_test_heap_t;
+
+static void *picolTestAllocator(void *arena, void *ptr, const size_t oldsz, const size_t newsz) {
+	pickle_test_heap_t *h = arena;
+	assert(h);
+	if (newsz && h->left == 0)
+		return NULL;
+	if (newsz && h->left > 0)
+		h->left--;
+	return h->fn(h->arena, ptr, oldsz, newsz);
+}
+
+static inline int picolTestClone(allocator_fn fn, void *arena) {
+	assert(fn);
+	int r = 0;
+	const char *val = NULL;
+	pickle_t *p = NULL, *c = NULL;
+	pickle_test_heap_t h = { .fn = fn, .arena = arena, .left = -1 };
+	if (pickle_new(&p, picolTestAllocator, &h) != PICKLE_OK || !p)
+		return -1;
+	for (long j = 0; j < 8; j++) { /* a clone that runs out of memory fails cleanly, wherever that happens */
+		h.left = j;
+		const int e = pickle_clone(&c, p);
+		h.left = -1;
+		r += j < 2 && e != PICKLE_ERROR; /* the interpreter, then its first variable */
+		r += e == PICKLE_OK ? !c : !!c;
+		if (c)
+			r += (pickle_delete(c) != PICKLE_OK);
+		c = NULL;
+	}
+	r += (pickle_eval(p, "proc f {a} { upvar #0 n n; return [+ $a $n] }; set n 2; set l {a b}; upvar #0 n m; rename lreverse {}") != PICKLE_OK);
+	r += (pickle_eval(p, "f 1") != PICKLE_OK); /* the template has a parsed 'f', the clone does not */
+	if (pickle_clone(&c, p) != PICKLE_OK || !c) {
+		(void)pickle_delete(p);
+		return -1;
+	}
+	r += (pickle_delete(p) != PICKLE_OK); /* procedure text outlives the template */
+	r += (pickle_eval(c, "set m 3; f 1") != PICKLE_OK);
+	r += (pickle_result_get(c, &val) != PICKLE_OK) || compare(val, "4");
+	r += (pickle_eval(c, "join [info locals] ,") != PICKLE_OK);
+	r += (pickle_result_get(c, &val) != PICKLE_OK) || compare(val, "l,n,argv");
+	r += (pickle_eval(c, "lreverse {a b}") == PICKLE_OK);
+	r += (pickle_delete(c) != PICKLE_OK);
+	return -r;
+}
+
+static inline int picolTestImage(allocator_fn fn, void *arena) {
+	assert(fn);
+	int r = 0;
+	const char *val = NULL;
+	char *m = NULL;
+	size_t length = 0;
+	pickle_t *p = NULL, *c = NULL;
+	if (pickle_new(&p, fn, arena) != PICKLE_OK || !p)
+		return -1;
+	r += (pickle_eval(p, "proc f {a} { return [+ $a 2] }; set n 2; set s {a b}; upvar #0 n m; rename subst sub; rename unset {}") != PICKLE_OK);
+	r += (pickle_image_save(p, &m, &length) != PICKLE_OK) || !m;
+	r += (pickle_delete(p) != PICKLE_OK);
+	if (r || pickle_new(&c, fn, arena) != PICKLE_OK || !c) {
+		(void)picolFree(c, m);
+		return -1;
+	}
+	r += (pickle_image_load(c, m, length - 1) == PICKLE_OK); /* no end record */
+	r += (pickle_image_load(c, m, length) != PICKLE_OK);
+	r += (pickle_eval(c, "set m 3; sub {[f $n] $s}") != PICKLE_OK);
+	r += (pickle_result_get(c, &val) != PICKLE_OK) || compare(val, "5 a b");
+	r += (pickle_eval(c, "unset n") == PICKLE_OK);
+	r += (pickle_eval(c, "subst x") == PICKLE_OK);
+	r += (pickle_image_load(c, "#!", 2) == PICKLE_OK);
+	r += (picolFree(c, m) != PICKLE_OK);
+	r += (pickle_delete(c) != PICKLE_OK);
+	return -r;
+}
+
+static inline int picolTestProfile(allocator_fn fn, void *arena) {
+	assert(fn);
+	if (!DEFINE_PROFILE)
+		return 0;
+	int r = 0;
+	unsigned long ticks = 0;
+	pickle_profile_t f = { 0 }, g = { 0 };
+	pickle_t *p = NULL;
+	if (pickle_new(&p, fn, arena) != PICKLE_OK || !p)
+		return -1;
+	r += (pickle_eval(p, "proc f {} { g }; proc g {} { return }") != PICKLE_OK);
+	r += (pickle_profile_set(p, picolTestClock, &ticks, 1) != PICKLE_OK);
+	r += (pickle_eval(p, "f") != PICKLE_OK);
+	r += (pickle_profile_set(p, picolTestClock, &ticks, 0) != PICKLE_OK);
+	r += (pickle_profile_get(p, "f", &f) != PICKLE_OK);
+	r += (pickle_profile_get(p, "g", &g) != PICKLE_OK);
+	r += (f.calls != 1 || f.total != 5 || f.self != 2); /* each call reads the clock twice */
+	r += (g.calls != 1 || g.total != 3 || g.self != 2);
+	r += (pickle_profile_get(p, "no-such-command", &f) == PICKLE_OK);
+	r += (pickle_delete(p) != PICKLE_OK);
+	return -r;
+}
+
+static inline int picolTestMemory(allocator_fn fn, void *arena) {
+	assert(fn);
+	if (!DEFINE_MEMORY)
+		return 0;
+	int r = 0;
+	pickle_memory_t m = { 0 };
+	pickle_profile_t s = { 0 };
+	pickle_t *p = NULL;
+	if (pickle_new(&p, fn, arena) != PICKLE_OK || !p)
+		return -1;
+	r += (pickle_eval(p, "proc f {} { string repeat x 500 }") != PICKLE_OK);
+	r += (pickle_memory_set(p, 1) != PICKLE_OK);
+	r += (pickle_eval(p, "set a [string repeat x 100]; unset a") != PICKLE_OK);
+	r += (pickle_memory_get(p, &m) != PICKLE_OK);
+	unsigned long classes = 0;
+	for (int j = 0; j < PICKLE_MEMORY_CLASSES; j++)
+		classes += m.classes[j];
+	r += (!m.allocations || !m.frees || m.peak < 101 || m.live > m.peak || classes != m.allocations + m.reallocations);
+	if (DEFINE_PROFILE) {
+		r += (pickle_profile_set(p, NULL, NULL, 1) != PICKLE_OK);
+		r += (pickle_eval(p, "f") != PICKLE_OK);
+		r += (pickle_profile_get(p, "string", &s) != PICKLE_OK);
+		r += (s.calls != 1 || !s.allocations || s.bytes < 501);
+	}
+	r += (pickle_memory_set(p, 0) != PICKLE_OK);
+	r += (pickle_delete(p) != PICKLE_OK);
+	return -r;
+}
+
 static inline int picolTestParser(allocator_fn fn, void *arena) {
 	UNUSED(fn);
 	UNUSED(arena);
@@ -3761,9 +9038,11 @@ static inline int picolTestParser(allocator_fn fn, void *arena) {
 }
 
 static int picolTestRegex(allocator_fn fn, void *arena) {
-	UNUSED(fn);
-	UNUSED(arena);
+	assert(fn);
 	int r = 0;
+	pickle_t *p = NULL;
+	if (pickle_new(&p, fn, arena) != PICKLE_OK || !p)
+		return -1;
 	struct tests { int match; char *reg, *str; } ts[] = {
 		{ 1,  "a",      "bba",      }, { 1,  ".",      "x",        },
 		{ 1,  "\\.",    ".",        }, { 0,  "\\.",    "x",        },
@@ -3780,10 +9059,12 @@ static int picolTestRegex(allocator_fn fn, void *arena) {
 		{ 1,  "\\sz",   " \t\r\nz", }, { 0,  "\\s",    "x",        },
 	};
 	for (size_t j = 0; j < (sizeof (ts) / sizeof (ts[0])); j++) {
-		pickle_regex_t x = { NULL, NULL, PICKLE_MAX_RECURSION, LAZY, 0 };
-		if (ts[j].match != picolRegexExtract(&x, ts[j].reg, ts[j].str))
+		pickle_regex_t x = { NULL, NULL, LAZY, 0 };
+		if (ts[j].match != picolRegexExtract(p, &x, ts[j].reg, ts[j].str))
 			r--;
 	}
+	if (pickle_delete(p) != PICKLE_OK)
+		r--;
 	return -r;
 }
 
@@ -3805,10 +9086,19 @@ static int picolSetResultArgError(pickle_t *i, const unsigned line, const char *
 	return post(i, PICKLE_ERROR);
 }
 
+static int picolSetResultSliceArgError(pickle_t *i, const unsigned line, const char *comp, const char *help, const int argc, pickle_slice_t *argv) {
+	assert(i);
+	const pickle_mark_t mark = picolScratchMark(i);
+	char **args = picolSliceArgs(i, argc, argv);
+	const int r = args ? picolSetResultArgError(i, line, comp, help, argc, args) : PICKLE_ERROR;
+	(void)picolScratchRelease(i, &mark);
+	return r;
+}
+
 int pickle_result_get(pickle_t *i, const char **s) {
 	pre(i);
 	assert(s);
-	*s = i->result;
+	*s = picolGetResult(i);
 	return post(i, PICKLE_OK);
 }
 
@@ -3816,35 +9106,21 @@ int pickle_command_register(pickle_t *i, const char *name, pickle_func_t func, v
 	pre(i);
 	assert(name);
 	assert(func);
-	return post(i, picolRegisterCommand(i, name, func, privdata));
+	return post(i, picolRegisterCommand(i, name, func, NULL, privdata));
+}
+
+int pickle_command_register_ex(pickle_t *i, const char *name, pickle_func_ex_t func, void *privdata) {
+	pre(i);
+	assert(name);
+	assert(func);
+	return post(i, picolRegisterCommand(i, name, NULL, func, privdata));
 }
 
 int pickle_var_set(pickle_t *i, const char *name, const char *val) {
 	pre(i);
 	assert(name);
 	assert(val);
-	int r = PICKLE_OK;
-	pickle_var_t *v = picolGetVar(i, name, 1);
-	if (v) {
-		r = picolFreeVarVal(i, v);
-		if (picolSetVarString(i, v, val) != PICKLE_OK)
-			return post(i, PICKLE_ERROR);
-	} else {
-		if (!(v = picolMalloc(i, sizeof(*v))))
-			return post(i, PICKLE_ERROR);
-		zero(v, sizeof *v);
-		const int r1 = picolSetVarName(i, v, name);
-		const int r2 = picolSetVarString(i, v, val);
-		if (r1 != PICKLE_OK || r2 != PICKLE_OK) {
-			(void)picolFreeVarName(i, v);
-			(void)picolFreeVarVal(i, v);
-			(void)picolFree(i, v);
-			return post(i, PICKLE_ERROR);
-		}
-		v->next = i->callframe->vars;
-		i->callframe->vars = v;
-	}
-	return post(i, r);
+	return post(i, picolSetVar(i, name, val, NULL, NULL));
 }
 
 int pickle_var_get(pickle_t *i, const char *name, const char **val) {
@@ -3855,7 +9131,11 @@ int pickle_var_get(pickle_t *i, const char *name, const char **val) {
 	pickle_var_t *v = picolGetVar(i, name, 1);
 	if (!v)
 		return post(i, PICKLE_ERROR);
-	*val = picolGetVarVal(v);
+	char buffy[PRINT_NUMBER_BUF_SZ];
+	if (v->type == PV_NUMBER) /* the string must live as long as the variable does */
+		if (picolSetVarString(i, v, picolGetVarVal(v, buffy)) != PICKLE_OK)
+			return post(i, PICKLE_ERROR);
+	*val = picolGetVarVal(v, buffy);
 	return post(i, *val ? PICKLE_OK : PICKLE_ERROR);
 }
 
@@ -3876,12 +9156,12 @@ int pickle_result_set(pickle_t *i, const int ret, const char *fmt, ...) {
 	assert(fmt);
 	va_list ap;
 	if (fmt[0] == '\0')
-		return post(i, picolSetResultEmpty(i));
+		return post(i, picolSetResultEmpty(i) != PICKLE_OK ? PICKLE_ERROR : ret);
 	if (fmt[0] == '%' && fmt[1] == 's' && fmt[2] == '\0') {
 		va_start(ap, fmt);
 		const int r = picolSetResultString(i, va_arg(ap, char*));
 		va_end(ap);
-		return post(i, r);
+		return post(i, r != PICKLE_OK ? PICKLE_ERROR : ret);
 	}
 	va_start(ap, fmt);
 	char *r = picolVsprintf(i, fmt, ap);
@@ -3895,12 +9175,171 @@ int pickle_result_set(pickle_t *i, const int ret, const char *fmt, ...) {
 	return post(i, ret);
 }
 
+int pickle_result_set_owned(pickle_t *i, const int ret, char *s) {
+	pre(i);
+	assert(s);
+	if (picolForceResult(i, s, 0) != PICKLE_OK)
+		return post(i, PICKLE_ERROR);
+	return post(i, ret);
+}
+
 int pickle_eval(pickle_t *i, const char *t) {
 	pre(i);
 	assert(t);
 	if (i->fatal)
 		return PICKLE_ERROR;
-	return picolEval(i, t); /* may return any int */
+	return picolBudgetCode(i, picolEval(i, t)); /* may return any int */
+}
+
+static int picolStarted(pickle_t *i, pickle_call_frame_t *cf, const int level, const int r) {
+	assert(i);
+	assert(cf);
+	i->callframe = cf;
+	i->level     = level;
+	if (r != PICKLE_YIELD) {
+		i->started = 0;
+		return picolBudgetCode(i, r);
+	}
+	i->suspended  = i->yielded;
+	i->yielded    = NULL;
+	i->yield_last = NULL;
+	return r;
+}
+
+/* Like 'pickle_eval', but evaluated at the top level, and a command that
+ * yields suspends the evaluation and returns PICKLE_YIELD (with the value
+ * yielded as the result), so it can be carried on with 'pickle_resume'. */
+int pickle_eval_start(pickle_t *i, const char *t) {
+	pre(i);
+	assert(t);
+	if (i->fatal)
+		return PICKLE_ERROR;
+	if (i->started)
+		return error(i, "Invalid operation: suspended");
+	pickle_script_t *s = picolScriptGet(i, t);
+	if (!s) /* too big to compile, so it cannot be suspended */
+		return i->fatal ? PICKLE_ERROR : pickle_eval(i, t);
+	pickle_call_frame_t *cf = i->callframe;
+	const int level = i->level;
+	i->callframe  = &i->top;
+	i->level      = 0;
+	i->started    = 1;
+	i->yielded    = NULL;
+	i->yield_last = NULL;
+	int r = picolEvalScript(i, s, 1, NULL);
+	if (picolScriptRelease(i, s) != PICKLE_OK)
+		r = PICKLE_ERROR;
+	return picolStarted(i, cf, level, r);
+}
+
+/* Carry on with an evaluation suspended under 'pickle_eval_start', with
+ * 'value' as the result of the command that yielded, or abandon it if
+ * 'value' is NULL. */
+int pickle_resume(pickle_t *i, const char *value) {
+	pre(i);
+	if (i->fatal)
+		return PICKLE_ERROR;
+	if (!(i->suspended))
+		return error(i, "Invalid operation: not suspended");
+	pickle_resume_t *r = i->suspended;
+	i->suspended = NULL;
+	if (!value) {
+		i->started = 0;
+		return picolResumeFree(i, r);
+	}
+	if (picolSetResultString(i, value) != PICKLE_OK) {
+		i->suspended = r;
+		return PICKLE_ERROR;
+	}
+	pickle_call_frame_t *cf = i->callframe;
+	const int level = i->level;
+	return picolStarted(i, cf, level, picolResume(i, r, PICKLE_OK));
+}
+
+/* Returns the length of the longest run of complete commands at the start
+ * of 'text', each ending with a newline or semicolon, so more text could
+ * not change how they are parsed. A parse error before the end of 'text'
+ * cannot be fixed by more text either, so all of it is returned for the
+ * error to be reported when it is evaluated. */
+static size_t picolFeedComplete(const char *text) {
+	assert(text);
+	pickle_parser_t p = { .p = NULL };
+	picolParserInitialize(&p, NULL, text);
+	size_t complete = 0;
+	for (;;) {
+		const int remaining = p.len;
+		if (picolGetToken(&p) != PICKLE_OK)
+			return p.len ? picolStrlen(text) : complete;
+		if (p.type == PT_EOF)
+			return complete;
+		if (p.type == PT_EOL && remaining) /* not the end of the text */
+			complete = p.p - text;
+	}
+}
+
+/* The text waiting to be evaluated is taken out of the interpreter while
+ * it is evaluated, so a command it runs can feed a script of its own. */
+static int picolFeedEval(pickle_t *i, const size_t length) {
+	assert(i);
+	char *t = i->feed;
+	const size_t fed = i->fed, size = i->feed_size;
+	assert(t && length <= fed);
+	i->feed = NULL;
+	i->fed  = 0;
+	i->feed_size = 0;
+	const char c = t[length];
+	t[length] = '\0';
+	const int r = picolEvalAndSubst(i, NULL, t);
+	t[length] = c;
+	if (picolFree(i, i->feed) != PICKLE_OK) /* left unfinished by a nested feed */
+		return PICKLE_ERROR;
+	if (r != PICKLE_OK || length == fed) {
+		i->feed = NULL;
+		return picolFree(i, t) == PICKLE_OK ? r : PICKLE_ERROR;
+	}
+	move(t, t + length, fed - length + 1);
+	i->feed = t;
+	i->fed  = fed - length;
+	i->feed_size = size;
+	return r;
+}
+
+int pickle_eval_feed(pickle_t *i, const char *text, size_t length) {
+	pre(i);
+	if (i->fatal)
+		return PICKLE_ERROR;
+	if (!text)
+		return post(i, i->feed ? picolBudgetCode(i, picolFeedEval(i, i->fed)) : PICKLE_OK);
+	if (!length)
+		return post(i, PICKLE_OK);
+	if (memchr(text, 0, length)) { /* the text waiting is discarded, as for any other error */
+		const int r = picolFree(i, i->feed);
+		i->feed = NULL;
+		i->fed  = 0;
+		i->feed_size = 0;
+		return post(i, r == PICKLE_OK ? error(i, "Invalid NUL") : PICKLE_ERROR);
+	}
+	if (i->fed + length + 1 > i->feed_size) { /* allocated directly as a single command may exceed PICKLE_MAX_STRING */
+		size_t size = i->feed_size ? i->feed_size : 64;
+		while (size < i->fed + length + 1)
+			size *= 2;
+		char *n = i->allocator(i->arena, i->feed, i->feed_size, size);
+		if (!n) {
+			i->fatal = 1;
+			(void)picolForceResult(i, string_oom, 1);
+			return post(i, PICKLE_ERROR);
+		}
+		i->feed = n;
+		i->feed_size = size;
+	}
+	move(i->feed + i->fed, text, length);
+	const size_t old = i->fed;
+	i->fed += length;
+	i->feed[i->fed] = '\0';
+	if (!strpbrk(i->feed + old, "\n\r;")) /* no command can end without one of these */
+		return post(i, PICKLE_OK);
+	const size_t complete = picolFeedComplete(i->feed);
+	return post(i, complete ? picolBudgetCode(i, picolFeedEval(i, complete)) : PICKLE_OK);
 }
 
 int pickle_command_rename(pickle_t *i, const char *src, const char *dst) {
@@ -3911,18 +9350,20 @@ int pickle_command_rename(pickle_t *i, const char *src, const char *dst) {
 		return post(i, error(i, "Invalid operation %s", dst));
 	if (!compare(dst, string_empty))
 		return post(i, picolUnsetCommand(i, src));
-	pickle_command_t *np = picolGetCommand(i, src);
+	const pickle_command_t *np = picolGetCommand(i, src);
 	if (!np)
 		return post(i, error(i, "Invalid command %s", src));
 	int r = PICKLE_ERROR;
 	if (picolIsDefinedProc(np->func)) {
-		char **procdata = (char**)np->privdata;
-		r = picolCommandAddProc(i, dst, procdata[0], procdata[1]);
+		pickle_proc_t *proc = np->privdata;
+		r = picolProcShare(i, dst, proc->text, proc->script);
 	} else {
-		r = pickle_command_register(i, dst, np->func, np->privdata);
+		r = picolRegisterCommand(i, dst, np->func, np->ex, np->privdata);
 	}
 	if (r != PICKLE_OK)
 		return post(i, r);
+	if (picolIsCoroutine(np->func)) /* now owned by 'dst' */
+		((pickle_command_t*)np)->privdata = NULL;
 	return post(i, picolUnsetCommand(i, src));
 }
 
@@ -3935,14 +9376,129 @@ int pickle_allocator_get(pickle_t *i, allocator_fn *fn, void **arena) {
 	return post(i, PICKLE_OK);
 }
 
+int pickle_profile_set(pickle_t *i, pickle_clock_t clock, void *clockdata, int on) {
+	pre(i);
+	UNUSED(on);
+	if (!DEFINE_PROFILE)
+		return post(i, error(i, "Invalid operation profile"));
+	i->clock     = clock;
+	i->clockdata = clockdata;
+	i->profile   = 0;
+#if DEFINE_PROFILE
+	if (on)
+		return post(i, picolProfileStart(i));
+#endif
+	return post(i, PICKLE_OK);
+}
+
+int pickle_profile_get(pickle_t *i, const char *name, pickle_profile_t *p) {
+	assert(name);
+	assert(p);
+	pre(i);
+	zero(p, sizeof (*p));
+	const pickle_command_t *c = picolGetCommand(i, name);
+	if (!c)
+		return post(i, error(i, "Invalid command %s", name));
+#if DEFINE_PROFILE
+	const pickle_profile_t *cp = picolProfileOf(i, c);
+	if (cp)
+		*p = *cp;
+#endif
+	return post(i, PICKLE_OK);
+}
+
+int pickle_memory_set(pickle_t *i, int on) {
+	pre(i);
+	UNUSED(on);
+	if (!DEFINE_MEMORY)
+		return post(i, error(i, "Invalid operation memory"));
+#if DEFINE_MEMORY
+	if (on)
+		return post(i, picolMemoryStart(i));
+	picolMemoryStop(i);
+#endif
+	return post(i, PICKLE_OK);
+}
+
+int pickle_memory_get(pickle_t *i, pickle_memory_t *m) {
+	assert(m);
+	pre(i);
+	zero(m, sizeof (*m));
+#if DEFINE_MEMORY
+	if (i->tracker)
+		*m = i->tracker->counts;
+#endif
+	return post(i, PICKLE_OK);
+}
+
+/* A budget applies from when it is set until it is replaced or removed, so
+ * one should be set before each evaluation that is to have its own. */
+int pickle_budget_set(pickle_t *i, const pickle_budget_t *b) {
+	pre(i);
+	i->budgeted = 0;
+	i->spent    = NULL;
+	if (!b)
+		return post(i, PICKLE_OK);
+	if (b->commands < 0 || b->interval < 0)
+		return post(i, error(i, "Invalid budget"));
+	i->budget       = *b;
+	i->budget_end   = i->cmdcount + b->commands;
+	i->budget_start = b->clock ? b->clock(b->clockdata) : 0;
+	i->allocated    = 0;
+	i->ticks        = 1; /* the clock is read at the first check */
+	i->budgeted     = b->commands || b->bytes || b->clock;
+	return post(i, PICKLE_OK);
+}
+
 int pickle_new(pickle_t **i, allocator_fn a, void *arena) {
 	assert(i);
 	assert(a);
 	*i = a(arena, NULL, 0, sizeof(**i));
 	if (!*i)
 		return PICKLE_ERROR;
-	const int r = picolInitialize(*i, a, arena);
-	return r == PICKLE_OK ? post(*i, r) : PICKLE_ERROR;
+	if (picolInitialize(*i, a, arena) != PICKLE_OK) { /* already deinitialized, which zeroes it */
+		(void)a(arena, *i, 0, 0);
+		*i = NULL;
+		return PICKLE_ERROR;
+	}
+	return post(*i, PICKLE_OK);
+}
+
+int pickle_clone(pickle_t **i, pickle_t *src) {
+	assert(i);
+	pre(src);
+	*i = NULL;
+	if (pickle_new(i, src->allocator, src->arena) != PICKLE_OK)
+		return PICKLE_ERROR;
+	if (picolClone(*i, src) != PICKLE_OK) {
+		(void)pickle_delete(*i);
+		*i = NULL;
+		return PICKLE_ERROR;
+	}
+	return post(*i, PICKLE_OK);
+}
+
+int pickle_image_save(pickle_t *i, char **image, size_t *length) {
+	assert(image);
+	assert(length);
+	pre(i);
+	pickle_image_t m = { .p = NULL };
+	*image  = NULL;
+	*length = 0;
+	if (picolImageSave(i, &m) != PICKLE_OK) {
+		(void)picolFree(i, m.p);
+		return post(i, PICKLE_ERROR);
+	}
+	*image  = m.p;
+	*length = m.used;
+	return post(i, PICKLE_OK);
+}
+
+int pickle_image_load(pickle_t *i, const char *image, size_t length) {
+	pre(i);
+	if (!image || i->callframe != &i->top)
+		return post(i, error(i, "Invalid image %s", "load"));
+	return post(i, picolImageLoad(i, image, length));
 }
 
 int pickle_delete(pickle_t *i) {
@@ -3968,6 +9524,17 @@ int pickle_tests(allocator_fn fn, void *arena) {
 		picolTestConcat,
 		picolTestEval,
 		picolTestGetSetVar,
+		picolTestSlices,
+		picolTestBuiltins,
+		picolTestClone,
+		picolTestImage,
+		picolTestFeed,
+		picolTestOwned,
+		picolTestProcFrames,
+		picolTestBudget,
+		picolTestCoroutine,
+		picolTestProfile,
+		picolTestMemory,
 		picolTestParser,
 		picolTestRegex,
 	};
@@ -24,20 +24,55 @@ typedef void *(*allocator_fn)(void *arena, void *ptr, size_t oldsz, size_t newsz
 struct pickle_interpreter;
 typedef struct pickle_interpreter pickle_t;
 typedef int (*pickle_func_t)(pickle_t *i, int argc, char **argv, void *privdata);
+typedef struct { const char *ptr; size_t len; } pickle_slice_t; /* 'ptr[len]' is always NUL, 'ptr' may contain NULs */
+typedef int (*pickle_func_ex_t)(pickle_t *i, int argc, pickle_slice_t *argv, void *privdata);
+typedef unsigned long (*pickle_clock_t)(void *clockdata); /* any monotonic unit, used by the profiler */
+typedef struct {
+	unsigned long calls, total, self; /* times exclude/include callees for self/total */
+	unsigned long allocations, bytes; /* made by the command itself, excluding callees, while memory is tracked */
+} pickle_profile_t;
+enum { PICKLE_MEMORY_CLASSES = 16 };
+typedef struct {
+	unsigned long allocations, reallocations, frees; /* calls made to the allocator */
+	size_t bytes;            /* asked for by allocations and reallocations, in total */
+	size_t live, peak;       /* held by blocks allocated since tracking started, and the most held at once */
+	unsigned long classes[PICKLE_MEMORY_CLASSES]; /* allocations of up to 16, 32, 64, ... bytes, the last counts any larger */
+} pickle_memory_t;
+typedef struct {
+	long commands;           /* commands that may be run, 0 for no limit */
+	size_t bytes;            /* bytes that may be allocated, 0 for no limit */
+	pickle_clock_t clock;    /* if not NULL, read every 'interval' commands and compared with 'deadline' */
+	void *clockdata;         /* passed to 'clock' */
+	unsigned long deadline;  /* value of 'clock' at which to stop */
+	long interval;           /* commands between reading 'clock', 0 for a default */
+} pickle_budget_t;
 
-enum { PICKLE_ERROR = -1, PICKLE_OK, PICKLE_RETURN, PICKLE_BREAK, PICKLE_CONTINUE };
+enum { PICKLE_YIELD = -3, PICKLE_LIMIT = -2, PICKLE_ERROR = -1, PICKLE_OK, PICKLE_RETURN, PICKLE_BREAK, PICKLE_CONTINUE };
 
 PICKLE_API int pickle_new(pickle_t **i, allocator_fn a, void *arena);
 PICKLE_API int pickle_delete(pickle_t *i);
+PICKLE_API int pickle_clone(pickle_t **i, pickle_t *src);
+PICKLE_API int pickle_image_save(pickle_t *i, char **image, size_t *length); /* '*image' is freed with the allocator of 'i' */
+PICKLE_API int pickle_image_load(pickle_t *i, const char *image, size_t length);
 PICKLE_API int pickle_eval(pickle_t *i, const char *t);
+PICKLE_API int pickle_eval_feed(pickle_t *i, const char *text, size_t length);
 PICKLE_API int pickle_eval_args(pickle_t *i, int argc, char **argv);
+PICKLE_API int pickle_eval_start(pickle_t *i, const char *t);
+PICKLE_API int pickle_resume(pickle_t *i, const char *value);
 PICKLE_API int pickle_command_register(pickle_t *i, const char *name, pickle_func_t f, void *privdata);
+PICKLE_API int pickle_command_register_ex(pickle_t *i, const char *name, pickle_func_ex_t f, void *privdata);
 PICKLE_API int pickle_command_rename(pickle_t *i, const char *src, const char *dst);
 PICKLE_API int pickle_allocator_get(pickle_t *i, allocator_fn *a, void **arena);
 PICKLE_API int pickle_result_set(pickle_t *i, int ret, const char *fmt, ...);
+PICKLE_API int pickle_result_set_owned(pickle_t *i, int ret, char *s);
 PICKLE_API int pickle_result_get(pickle_t *i, const char **s);
 PICKLE_API int pickle_var_set(pickle_t *i, const char *name, const char *val);
 PICKLE_API int pickle_var_get(pickle_t *i, const char *name, const char **val);
+PICKLE_API int pickle_profile_set(pickle_t *i, pickle_clock_t clock, void *clockdata, int on);
+PICKLE_API int pickle_profile_get(pickle_t *i, const char *name, pickle_profile_t *p);
+PICKLE_API int pickle_memory_set(pickle_t *i, int on); /* turning it on clears the counts */
+PICKLE_API int pickle_memory_get(pickle_t *i, pickle_memory_t *m);
+PICKLE_API int pickle_budget_set(pickle_t *i, const pickle_budget_t *b);
 PICKLE_API int pickle_tests(allocator_fn fn, void *arena);
 
 #ifdef __cplusplus
@@ -0,0 +1,218 @@
+/**@file pool.c
+ * @brief A pool of worker threads running pickle scripts, see 'pool.h'.
+ * BSD license: See <https://github.com/howerj/pickle/blob/master/LICENSE>
+ * Copyright (c) 2018-2020, Richard James Howe <howe.r.j.89@gmail.com>
+ *
+ * Each worker owns a clone of the template interpreter and nothing else is
+ * shared between workers apart from what 'pickle_clone' shares; the text of
+ * procedures, the allocator and the private data of commands registered from
+ * C, all of which must therefore be safe to use from several threads. Jobs
+ * are kept in a ring buffer that grows as needed, guarded by one lock, as a
+ * job (evaluating a script) takes far longer than taking one off the queue. */
+#define _POSIX_C_SOURCE 200809L
+#include "pool.h"
+#include <assert.h>
+#include <pthread.h>
+#include <string.h>
+
+#define POOL_QUEUE (16) /* initial number of jobs the queue can hold */
+
+typedef struct {
+	const char *script;      /* must stay valid until 'done' is called */
+	pickle_pool_done_t done; /* may be NULL */
+	void *data;              /* passed to 'done' */
+} job_t;
+
+typedef struct {
+	pthread_t thread;
+	pickle_t *i;             /* this workers clone of the template */
+	pickle_pool_t *pool;
+	int started;
+} worker_t;
+
+struct pickle_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t work, idle; /* signalled when a job is queued, and when all jobs are done */
+	allocator_fn allocator;
+	void *arena;
+	job_t *jobs;             /* ring buffer of 'size' jobs, 'count' of them queued starting at 'head' */
+	size_t size, head, count;
+	long pending;            /* jobs queued or running */
+	int stop, fresh;
+	int workers;
+	worker_t *worker;
+};
+
+static void *poolMalloc(pickle_pool_t *p, size_t size) {
+	assert(p);
+	return p->allocator(p->arena, NULL, 0, size);
+}
+
+static void poolFree(pickle_pool_t *p, void *ptr) {
+	assert(p);
+	(void)p->allocator(p->arena, ptr, 0, 0);
+}
+
+static void poolRun(worker_t *w, const job_t *job) {
+	assert(w);
+	assert(job);
+	pickle_t *i = w->i;
+	const char *result = "Invalid clone";
+	int r = PICKLE_ERROR;
+	if (w->pool->fresh && pickle_clone(&i, w->i) != PICKLE_OK)
+		i = NULL;
+	if (i) {
+		r = pickle_eval(i, job->script);
+		if (pickle_result_get(i, &result) != PICKLE_OK)
+			result = "";
+	}
+	if (job->done)
+		job->done(job->data, r, result);
+	if (i && i != w->i)
+		(void)pickle_delete(i);
+}
+
+static void *poolWorker(void *arg) {
+	worker_t *w = arg;
+	pickle_pool_t *p = w->pool;
+	for (;;) {
+		(void)pthread_mutex_lock(&p->lock);
+		while (!(p->count) && !(p->stop))
+			(void)pthread_cond_wait(&p->work, &p->lock);
+		if (!(p->count)) { /* stopped, and nothing left to do */
+			(void)pthread_mutex_unlock(&p->lock);
+			return NULL;
+		}
+		const job_t job = p->jobs[p->head];
+		p->head = (p->head + 1) % p->size;
+		p->count--;
+		(void)pthread_mutex_unlock(&p->lock);
+
+		poolRun(w, &job);
+
+		(void)pthread_mutex_lock(&p->lock);
+		if (--p->pending == 0)
+			(void)pthread_cond_broadcast(&p->idle);
+		(void)pthread_mutex_unlock(&p->lock);
+	}
+}
+
+static int poolGrow(pickle_pool_t *p) { /* call with lock held */
+	assert(p);
+	const size_t size = p->size ? p->size * 2 : POOL_QUEUE;
+	job_t *jobs = poolMalloc(p, size * sizeof *jobs);
+	if (!jobs)
+		return PICKLE_ERROR;
+	for (size_t j = 0; j < p->count; j++)
+		jobs[j] = p->jobs[(p->head + j) % p->size];
+	poolFree(p, p->jobs);
+	p->jobs = jobs;
+	p->size = size;
+	p->head = 0;
+	return PICKLE_OK;
+}
+
+int pickle_pool_submit(pickle_pool_t *p, const char *script, pickle_pool_done_t done, void *data) {
+	if (!p || !script)
+		return PICKLE_ERROR;
+	int r = PICKLE_OK;
+	(void)pthread_mutex_lock(&p->lock);
+	if (p->stop || (p->count == p->size && poolGrow(p) != PICKLE_OK)) {
+		r = PICKLE_ERROR;
+	} else {
+		p->jobs[(p->head + p->count) % p->size] = (job_t) { .script = script, .done = done, .data = data };
+		p->count++;
+		p->pending++;
+		(void)pthread_cond_signal(&p->work);
+	}
+	(void)pthread_mutex_unlock(&p->lock);
+	return r;
+}
+
+int pickle_pool_wait(pickle_pool_t *p) {
+	if (!p)
+		return PICKLE_ERROR;
+	(void)pthread_mutex_lock(&p->lock);
+	while (p->pending)
+		(void)pthread_cond_wait(&p->idle, &p->lock);
+	(void)pthread_mutex_unlock(&p->lock);
+	return PICKLE_OK;
+}
+
+int pickle_pool_delete(pickle_pool_t *p) {
+	if (!p)
+		return PICKLE_OK;
+	int r = PICKLE_OK;
+	(void)pthread_mutex_lock(&p->lock);
+	p->stop = 1; /* queued jobs are still run */
+	(void)pthread_cond_broadcast(&p->work);
+	(void)pthread_mutex_unlock(&p->lock);
+	for (int j = 0; j < p->workers; j++) {
+		worker_t *w = &p->worker[j];
+		if (w->started && pthread_join(w->thread, NULL) != 0)
+			r = PICKLE_ERROR;
+		if (w->i && pickle_delete(w->i) != PICKLE_OK)
+			r = PICKLE_ERROR;
+	}
+	(void)pthread_cond_destroy(&p->idle);
+	(void)pthread_cond_destroy(&p->work);
+	(void)pthread_mutex_destroy(&p->lock);
+	poolFree(p, p->worker);
+	poolFree(p, p->jobs);
+	poolFree(p, p);
+	return r;
+}
+
+/* 'src' must not be in use elsewhere until this returns, after that it can
+ * be used or deleted independently of the pool. */
+int pickle_pool_new(pickle_pool_t **p, pickle_t *src, int workers, int fresh) {
+	if (!p)
+		return PICKLE_ERROR;
+	*p = NULL;
+	allocator_fn allocator = NULL;
+	void *arena = NULL;
+	if (!src || workers <= 0 || pickle_allocator_get(src, &allocator, &arena) != PICKLE_OK)
+		return PICKLE_ERROR;
+	pickle_pool_t *n = allocator(arena, NULL, 0, sizeof *n);
+	if (!n)
+		return PICKLE_ERROR;
+	memset(n, 0, sizeof *n);
+	n->allocator = allocator;
+	n->arena     = arena;
+	n->fresh     = !!fresh;
+	if (pthread_mutex_init(&n->lock, NULL) != 0) {
+		poolFree(n, n);
+		return PICKLE_ERROR;
+	}
+	if (pthread_cond_init(&n->work, NULL) != 0) {
+		(void)pthread_mutex_destroy(&n->lock);
+		poolFree(n, n);
+		return PICKLE_ERROR;
+	}
+	if (pthread_cond_init(&n->idle, NULL) != 0) {
+		(void)pthread_cond_destroy(&n->work);
+		(void)pthread_mutex_destroy(&n->lock);
+		poolFree(n, n);
+		return PICKLE_ERROR;
+	}
+	if (!(n->worker = poolMalloc(n, workers * sizeof *n->worker)))
+		goto fail;
+	memset(n->worker, 0, workers * sizeof *n->worker);
+	for (; n->workers < workers; n->workers++) { /* all clones are made before any thread starts */
+		worker_t *w = &n->worker[n->workers];
+		w->pool = n;
+		if (pickle_clone(&w->i, src) != PICKLE_OK)
+			goto fail;
+	}
+	for (int j = 0; j < n->workers; j++) {
+		worker_t *w = &n->worker[j];
+		if (pthread_create(&w->thread, NULL, poolWorker, w) != 0)
+			goto fail;
+		w->started = 1;
+	}
+	*p = n;
+	return PICKLE_OK;
+fail:
+	(void)pickle_pool_delete(n);
+	return PICKLE_ERROR;
+}
@@ -0,0 +1,27 @@
+/**@file pool.h
+ * @brief A pool of worker threads, each running scripts in its own clone of
+ * a template pickle interpreter. Optional, it is not part of the library.
+ * BSD license: See <https://github.com/howerj/pickle/blob/master/LICENSE>
+ * Copyright (c) 2018-2020, Richard James Howe <howe.r.j.89@gmail.com> */
+
+#ifndef POOL_H
+#define POOL_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "pickle.h"
+
+struct pickle_pool;
+typedef struct pickle_pool pickle_pool_t;
+typedef void (*pickle_pool_done_t)(void *data, int retcode, const char *result); /* called from a worker thread */
+
+PICKLE_API int pickle_pool_new(pickle_pool_t **p, pickle_t *src, int workers, int fresh);
+PICKLE_API int pickle_pool_submit(pickle_pool_t *p, const char *script, pickle_pool_done_t done, void *data);
+PICKLE_API int pickle_pool_wait(pickle_pool_t *p);
+PICKLE_API int pickle_pool_delete(pickle_pool_t *p);
+
+#ifdef __cplusplus
+}
+#endif
+#endif